@@ -0,0 +1,42 @@
+#pragma once
+#include "globals.h"
+
+/*
+Output for the serial terminal that never blocks the lap processing.
+Renderers write a frame into a preallocated buffer: console_begin(), any number of console_printf(), console_end().
+console_end() appends the frame to the pending output and wakes console_task, which hands it to the UART driver in a single write.
+The driver sends from its own ring buffer of CONSOLE_UART_BUFFER_SIZE by interrupt. Only console_task ever waits for the UART, and it runs below every race task.
+A frame is never split, so other output (DEBUG, the PRINT_ diagnostics) ends up before or after it, never inside it.
+
+CONSOLE_FORMAT_SCREEN: the frames draw the terminal of tools/pi-conf (CONSOLE_COLUMNS x CONSOLE_ROWS) with ANSI cursor addressing instead of scrolling.
+Every line is addressed by its row and erased to its end. A new screen starts at the top and erases everything below its last line, appended frames continue below the last line.
+A new screen replaces output that was not sent yet, it would be overwritten anyway. Lines below CONSOLE_ROWS are dropped.
+Output that bypasses the console is overwritten by the next screen, console_drain() lets the screen go out first so it ends up below.
+
+CONSOLE_FORMAT_COMPACT: one tab-separated line per event for a program on the Raspberry Pi instead of the terminal. Nothing is replaced, console_line() text is left out.
+    RACE    laps in the race
+    LIGHT   light state 0...9, 1 is the ready state
+    CAR     car, position, laps, laps in the race, lap time in ms, improvement in ms, derailed 0/1     (every car of the standings after every lap)
+    WIN     car, mean lap time in ms, standard deviation in ms, derailments
+    NO_CU                                       (the control unit does not answer, restarting)
+*/
+
+#define CONSOLE_FRAME_SIZE          1536    /* in bytes, largest frame. The victory screen is about 700 with its escape sequences. */
+#define CONSOLE_PENDING_SIZE        2048    /* in bytes, output waiting for console_task. More than one frame, so lines appended to a screen still fit. */
+#define CONSOLE_UART_BUFFER_SIZE    2048    /* in bytes, transmit ring buffer of the UART driver */
+#define CONSOLE_COLUMNS             81      /* geometry of the serial terminal, see tools/pi-conf/config/lxterminal */
+#define CONSOLE_ROWS                22
+#define CONSOLE_PRIO                IDLE_PRIO+1
+#define CONSOLE_CORE                1
+#define CONSOLE_STACK               3072
+
+#define CONSOLE_SCREEN              (SERIAL_USERDATA_PRINT && (CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN))
+#define CONSOLE_COMPACT             (SERIAL_USERDATA_PRINT && (CONSOLE_FORMAT == CONSOLE_FORMAT_COMPACT))
+
+            void init_console();
+IRAM_ATTR   void console_begin(bool new_screen);
+IRAM_ATTR   void console_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+IRAM_ATTR   void console_end();
+IRAM_ATTR   void console_line(const char* text);
+            void console_drain();
+IRAM_ATTR   void console_task(void*);
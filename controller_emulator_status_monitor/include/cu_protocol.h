@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if __has_include(<esp_attr.h>)
+    #include <esp_attr.h>
+#else
+    #define IRAM_ATTR               /* host builds, see tools/cu-protocol */
+    #define DRAM_ATTR
+#endif
+
+/*
+Decoder for the responses of the Carrera Digital 132 control unit (CU) on its serial interface.
+Protocol from http://slotbaer.de/carrera-digital-124-132/10-cu-rundenzaehler-protokoll.html and own trial-and-error.
+
+A response is the echoed command character, payload characters, a checksum character and '$'.
+Values are sent one nibble per character as 0x30 + nibble. Values longer than a nibble are sent low nibble first, see cu_timestamp_t for the byte order of timestamps.
+The checksum is the sum of all characters between the echoed command and the checksum, modulo 16, also sent as 0x30 + nibble.
+
+The parser is fed byte by byte and keeps its state in between, so a response may be split over several reads of the serial interface.
+At every '$' the collected frame is matched against the layouts in cu_protocol.cpp by its leading characters and its length, and its fields are decoded in place from the parser buffer.
+A frame with an unknown layout, a character that is not a nibble, a bad checksum or a field out of range is dropped as a whole (CU_FRAME_INVALID).
+So is the frame completed by the first '$' after power-up, it may have begun before the parser saw it. cu_parser_reset() tells the parser that the next byte starts a frame.
+
+The checksum is only four bits: one corrupted character always shows, but of two or more, one in 16 keeps the checksum.
+Intact frames therefore also have to fit what the parser received before, or they are dropped as CU_FRAME_IMPLAUSIBLE:
+- timestamps come from the finish line, CU_SENSOR_GROUP_FINISH_LINE. The lap times of the controller emulator are measured there.
+- timestamps of a car only count up, by at least CU_LAP_TIME_MIN_MS
+- timestamps follow the CU clock, which the parser tracks against the receive time. A timestamp may be up to CU_TIMESTAMP_MAX_AGE_MS old, but not ahead by more than CU_CLOCK_TOLERANCE_MS.
+- a status is taken right away if only its light state changed, by a step of the CU sequence, so the start of a race is not delayed.
+  Any other change has to arrive twice in a row, which costs one poll.
+- the version is four digits and never changes, the first one counts. A different one has to arrive twice in a row.
+What is left is a corruption that keeps the checksum and happens to look like the next lap or the next step of the CU.
+tools/cu-protocol measures it, it fails on every such frame.
+*/
+
+#define CU_FRAME_MAX_LENGTH     20      /* longest response including '$'. Longer ones are dropped. */
+#define CU_FRAME_END            '$'
+
+#define CU_SENSOR_GROUP_FINISH_LINE 1   /* sensor group of the timestamps of the finish line */
+#define CU_LAP_TIME_MIN_MS      1000    /* no car makes a lap faster than this */
+#define CU_TIMESTAMP_MAX_AGE_MS 1000    /* a passing is reported at the next polls, even if several cars passed at once */
+#define CU_CLOCK_TOLERANCE_MS   250     /* a timestamp ahead of the tracked CU clock: poll interval and clock drift */
+#define CU_CLOCK_VALID_MS       600000  /* the tracked CU clock is learned again after this, before the drift of the two clocks adds up */
+
+/* frame kinds */
+#define CU_FRAME_NONE           0       /* no complete frame yet */
+#define CU_FRAME_STATUS         1       /* answer to REQUEST_LAST_PASSING_TIMESTAMP if no car passed the finish line since the last request */
+#define CU_FRAME_TIMESTAMP      2       /* answer to REQUEST_LAST_PASSING_TIMESTAMP if a car passed the finish line */
+#define CU_FRAME_VERSION        3       /* answer to ASK_VERSION_NUMBER */
+#define CU_FRAME_INVALID        4       /* complete, but dropped */
+#define CU_FRAME_IMPLAUSIBLE    5       /* complete and intact, but dropped by the plausibility checks */
+
+#define CU_NUMBER_CONTROLLERS   8       /* 6 cars, the autonomous car and the pace car */
+#define CU_LIGHT_STATE_MAX      9       /* 0 race going, 1 all lights on, 2...7 countdown, 8 and 9 early start */
+
+typedef struct
+{
+    uint8_t  fuel[CU_NUMBER_CONTROLLERS];   /* 0...15 per controller */
+    uint8_t  light_state;                   /* 0...CU_LIGHT_STATE_MAX */
+    uint8_t  mode;                          /* bit field of the CU, fuel mode and pit lane adapter */
+    uint8_t  pit_lane;                      /* bit n is set if car n is in the pit lane */
+    uint8_t  display;                       /* lap counter display mode */
+} cu_status_t;
+
+typedef struct
+{
+    uint8_t  car;                           /* 0...CU_NUMBER_CONTROLLERS-1, port 0 is the leftmost port of the CU */
+    uint32_t timestamp;                     /* in ms since the CU was powered up. The four bytes are sent high byte first, each of them low nibble first. */
+    uint8_t  sensor_group;                  /* finish line or checklane sensor */
+} cu_timestamp_t;
+
+typedef struct
+{
+    char     version[5];                    /* four characters and the terminator */
+} cu_version_t;
+
+typedef struct
+{
+    uint8_t kind;
+    union
+    {
+        cu_status_t    status;
+        cu_timestamp_t timestamp;
+        cu_version_t   version;
+    };
+} cu_frame_t;
+
+/* zero initialized, a parser is in the state of power-up */
+typedef struct
+{
+    uint8_t     buffer[CU_FRAME_MAX_LENGTH];
+    uint8_t     length;                         /* bytes of the current frame so far */
+    bool        overflow;                       /* the current frame is too long and is dropped at its '$' */
+    bool        synchronized;                   /* a '$' was received, the current frame started right after it */
+    uint32_t    frames_valid;
+    uint32_t    frames_invalid;
+    uint32_t    frames_implausible;
+
+    /* what the plausibility checks compare with */
+    cu_status_t status_accepted;
+    cu_status_t status_received;                /* last intact status, accepted or not */
+    bool        status_known;                   /* status_accepted is set */
+    bool        status_received_known;
+    cu_version_t version_accepted;              /* empty until the first version */
+    cu_version_t version_received;
+    uint32_t    car_timestamp[CU_NUMBER_CONTROLLERS];   /* last accepted timestamp per car */
+    uint8_t     car_timestamp_known;            /* bit n for car n, cleared when the CU shows all lights on for a new race */
+    int32_t     clock_offset;                   /* CU clock minus receive time, in ms. Newest passing reported so far. */
+    uint32_t    clock_learned_ms;               /* receive time the offset was learned at */
+    bool        clock_known;
+} cu_parser_t;
+
+IRAM_ATTR void    cu_parser_reset(cu_parser_t* parser);
+IRAM_ATTR uint8_t cu_parser_feed(cu_parser_t* parser, uint8_t received_byte, uint32_t received_ms, cu_frame_t* frame);
+IRAM_ATTR uint8_t cu_decode_frame(const uint8_t* data, uint8_t length, cu_frame_t* frame);
@@ -8,10 +8,20 @@
 
 #define DEBUG                       0       /* debug output in via serial port. Disable for final code. 0:disabled 1:enabled */
 #define SERIAL_USERDATA_PRINT       1       /* only outputs lap times via the serial terminal */
+    #define CONSOLE_FORMAT_SCREEN       0   /* screens for the serial terminal of tools/pi-conf, drawn with ANSI cursor addressing */
+    #define CONSOLE_FORMAT_COMPACT      1   /* one tab-separated line per event, for a program reading the serial port */
+#define CONSOLE_FORMAT              CONSOLE_FORMAT_SCREEN   /* set one of the formats above. See console_output.h */
+#define MEASURE_LATENCY             0       /* answer traced speed values of the sensorcar with receive and DAC write timestamps. Needs the same setting on the sensorcar. */
 #define DISPLAY_OUTPUT_ENABLE       1
 #define FAST_MODE_PLUS              3400000 /* I2C link speed */
 #define NUMBER_LAPS_IN_RACE_DEFAULT 10      /* the number of laps that have to be driven for a race to finish and declare a winner */
-#define WIRELESS_TRANSMISSION_TRIES 1       /* because it's not certain that the other uC has received the message, we send a couple times. */
+#define WIRELESS_TRANSMISSION_TRIES 1       /* because it's not certain that the other uC has received the message, we send race status messages a couple times. Speed values are acknowledged instead. */
+#define PRINT_HANDOFF_COUNTERS      0       /* output how many lap events, light states and speed values were handed over and how many got lost after every race */
+#define LINK_MONITOR                1       /* measure loss and RSSI of the ESP-NOW link and move both boards to the Wi-Fi channel with the least interference between races. Needs the same setting on the sensorcar. See link_quality.h */
+#define PRINT_LINK_STATS            0       /* output the link statistics after every race and the channel scores after every survey */
+#define EVENT_TRACE                 1       /* keep the last race states, light states, laps, hand-off losses and ESP-NOW messages in RTC memory and output them via the serial terminal after a reset. See event_trace.h */
+#define STATIC_ALLOCATION           1       /* stacks and control blocks of all tasks, semaphores and queues are reserved in DRAM at link time instead of being taken from the heap. See task_memory.h */
+#define PRINT_TASK_MEMORY           0       /* output the stack high-water mark of every task and the heap state after every race */
 
 /* states for race_status*/ 
 #define NO_RACE_GOING                   0
@@ -28,6 +38,7 @@
 #define BUTTON_HANDLE_PRIO      IDLE_PRIO+2
 #define LIGHT_STATE_PRIO        IDLE_PRIO+3
 #define PRINT_DATA_PRIO         IDLE_PRIO+2
+#define SETPOINT_PRIO           IDLE_PRIO+4 /* speed values go to the DAC before anything else */
 
 /* Task Cores
 main loop and setup run on core 1, wireless receive runs on core 0.
@@ -38,15 +49,29 @@ Tasks that share data should not be on different cores, since global variables a
 #define BUTTON_HANDLE_CORE      1   /* Draws on the display. Every Task that draws needs to run on the same core. */
 #define LIGHT_STATE_CORE        1
 #define PRINT_DATA_CORE         1   /* Draws on the display */
+#define SETPOINT_CORE           1   /* off the core of wireless receive, which only hands setpoints over */
+
+/* Task stack sizes
+In bytes, the ESP32 port of FreeRTOS counts stack depth in bytes, not in words. Check them with PRINT_TASK_MEMORY after changing a task.
+*/
+#define SERIAL2_COMMS_STACK     4096
+#define BUTTON_HANDLE_STACK     4096
+#define LIGHT_STATE_STACK       4096
+#define PRINT_DATA_STACK        6144        /* display drawing and the victory screen */
+#define SETPOINT_STACK          3072
 
 #define DELAY_N_MS(n) (vTaskDelay(n/portTICK_PERIOD_MS))            /* macro for vTaskDelay + math */
 
+#define HANDOFF_MAX_COUNT       255 /* maximum number of pending events on a hand-off semaphore. Hand-off semaphores count, so lost events can be accounted for. See handoff_accounting.h */
+
 extern DRAM_ATTR SemaphoreHandle_t button_pressed_semaphore;        /* is set when any button is pressed and the debounce timer has overflown */
 extern DRAM_ATTR SemaphoreHandle_t dac_access_semaphore;            /* for the shared resource digital to analog converter (DAC) */
 extern DRAM_ATTR SemaphoreHandle_t serial2_access_semaphore;        /* for the shared resource of the second serial interface, which is used to communicate to the Control Unit */
 extern DRAM_ATTR SemaphoreHandle_t print_data_semaphore;            /* used for telling the print_car_data_task that new data is available for print */
 extern DRAM_ATTR SemaphoreHandle_t process_light_state_semaphore;   /* used for telling the process_light_state_task that the light state has changed and has to be processed */
 extern DRAM_ATTR uint8_t           number_laps_in_race;
+extern DRAM_ATTR uint8_t           car_derailed[4];                 /* reported by the sensorcar via ESP-NOW, shown by print_car_data */
+extern DRAM_ATTR uint8_t           car_derailments[4];
 extern DRAM_ATTR U8G2_SSD1306_128X64_NONAME_F_HW_I2C display_128x64; /* display class used for user interface via I2C display */
 
 void init_dac();
@@ -0,0 +1,34 @@
+#pragma once
+#include "globals.h"
+
+/*
+Accounting for the producer/consumer hand-offs.
+Producers give a counting semaphore, consumers take it and drain everything that piled up in the meantime.
+Events that piled up were coalesced (the consumer only sees the most recent global data), events that could not be given or used at all were rejected.
+Each counter has exactly one writer, so no locking is needed.
+*/
+
+/* hand-off channels */
+#define HANDOFF_PRINT_DATA      0   /* parse_data_received -> print_car_data_task */
+#define HANDOFF_LIGHT_STATE     1   /* parse_data_received -> process_light_state_task. Coalesced light states were never processed. */
+#define HANDOFF_DAC_WRITE       2   /* setpoint_task -> DAC. A speed value is rejected while the DAC is locked. */
+#define HANDOFF_SETPOINT_RECEIVE 3  /* on_data_receive -> setpoint_task. Coalesced when a newer setpoint arrived before the task ran, rejected for retransmissions and late packets. */
+#define HANDOFF_DERAILMENT      4   /* on_data_receive -> print_car_data_task. Derailment reports of the sensorcar refresh the screen. */
+#define HANDOFF_LINK            5   /* wireless receive and the race state machine -> link_task. Rejected when link_mailbox is full. See link_quality.h */
+#define HANDOFF_CONSOLE         6   /* renderers -> console_task. Frames that piled up are coalesced into one write, rejected when they did not fit into the pending output. See console_output.h */
+#define HANDOFF_COUNT           7
+
+typedef struct
+{
+    uint32_t delivered;     /* events the consumer processed */
+    uint32_t coalesced;     /* events that arrived while the consumer was busy and were merged into the next one */
+    uint32_t rejected;      /* events that could not be handed over at all */
+} handoff_counter_t;
+
+extern DRAM_ATTR handoff_counter_t handoff_counters[HANDOFF_COUNT];
+
+IRAM_ATTR void  handoff_give(uint8_t channel, SemaphoreHandle_t semaphore);
+IRAM_ATTR bool  handoff_take(uint8_t channel, SemaphoreHandle_t semaphore, TickType_t ticks_to_wait);
+IRAM_ATTR void  handoff_count_delivered(uint8_t channel);
+IRAM_ATTR void  handoff_count_rejected(uint8_t channel);
+          void  print_handoff_counters();
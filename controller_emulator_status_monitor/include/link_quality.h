@@ -0,0 +1,33 @@
+#pragma once
+#include "globals.h"
+#include "link_monitor.h"
+#include "channel_hop.h"
+
+/*
+Link quality of the ESP-NOW connection and the channel hops, controller emulator side. See link_monitor.h and channel_hop.h.
+link_race_stats covers the current race: every packet of the sensorcar counts as received with the RSSI of its frame, gaps in the setpoint sequence numbers count as missed.
+The receive callback of ESP-NOW in this framework version has no RSSI, so the Wi-Fi driver also runs in promiscuous mode, filtered to management and data frames.
+Frames of the sensorcar give the RSSI, all other frames on the channel are counted as foreign frames for the channel survey.
+link_task runs the coordinator of channel_hop.h and is the only one that changes the channel. Link packets, survey requests and aborts reach it through link_mailbox.
+A survey starts LINK_SURVEY_DELAY_MS after the end of a race if the control unit is still idle by then. A countdown aborts it right away, the countdown messages reach the sensorcar on the home channel.
+*/
+
+#define LINK_SURVEY_DELAY_MS            3000    /* after the end of a race, the sensorcar slows down and the results are shown first */
+#define LINK_MAILBOX_LENGTH             8
+#define LINK_FRAME_SENDER_OFFSET        10      /* of addr2 in the 802.11 header of a received frame */
+#define LINK_PRIO                       IDLE_PRIO+3
+#define LINK_CORE                       0       /* next to wireless receive, which feeds it */
+#define LINK_STACK                      3072
+
+extern DRAM_ATTR channel_survey_t link_survey;
+
+void            init_link_quality();
+IRAM_ATTR void  link_packet_received(const uint8_t* data);
+IRAM_ATTR void  link_setpoint_received(uint16_t session, uint8_t sequence);
+IRAM_ATTR void  link_peer_heard();
+IRAM_ATTR void  link_survey_request();
+IRAM_ATTR void  link_survey_abort();
+          void  link_race_stats_reset();
+IRAM_ATTR void  link_task(void*);
+          void  print_link_stats();
+          void  print_link_survey();
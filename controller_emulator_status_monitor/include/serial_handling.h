@@ -3,6 +3,8 @@
 #include "Ticker.h"
 #include "globals.h"
 #include "wireless_transmission.h"  /* libraries and functions for esp_now transmission. Also writes received speed values to DAC */
+#include "cu_protocol.h"            /* decoder for the responses of the control unit */
+#include "console_output.h"         /* non-blocking output for the serial terminal */
 
 #define TIMEOUT_SECONDS                 300  /* after this much time has passed, the controller emulator will generate some activity to keep the CU awake. CU shuts down after 20min of inactivity. */
 /* Carrera D132 protocol from http://slotbaer.de/carrera-digital-124-132/10-cu-rundenzaehler-protokoll.html and own trial-and-error */
@@ -12,16 +14,15 @@
 #define REQUEST_LAST_PASSING_TIMESTAMP  "\"?"
 #define ASK_VERSION_NUMBER              "\"0"
 
-#define RECEIVE_BUFFER_LENGTH           20
-#define TEXT_PUSH_DOWN_STRING           "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n" /* used to "clear" modern autoscrolling terminals since they are not clearable with escape sequences */
-
 extern DRAM_ATTR uint8_t light_state;
 extern DRAM_ATTR uint8_t race_status;
 
             void init_serial2();
 inline      void print_eva_logo();            
 IRAM_ATTR   void get_data_from_control_unit();
-inline      void parse_data_received();
+inline      bool feed_cu_parser();
+inline      void handle_no_response();
+inline      void parse_data_received(const cu_frame_t* frame);
 IRAM_ATTR   void press_start_button();
 IRAM_ATTR   void keep_cu_awake();
 IRAM_ATTR   void print_car_data();
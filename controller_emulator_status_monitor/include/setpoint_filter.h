@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if __has_include(<esp_attr.h>)
+    #include <esp_attr.h>
+#else
+    #define IRAM_ATTR               /* host builds, see tools/setpoint-delivery */
+    #define DRAM_ATTR
+#endif
+
+/*
+Duplicate suppression of the setpoints, used by setpoint_task. It doesn't depend on the framework, so tools/setpoint-delivery tests it on the host.
+
+Sequence numbers only count within a session of the sensorcar. The sensorcar draws a random session number at every boot and restarts its sequence numbers,
+so the first setpoint of a new session is always applied, whatever its sequence number. Within a session:
+- the last applied sequence number again is a retransmission whose ack got lost, it is only acknowledged again
+- up to SETPOINT_REORDER_WINDOW behind the last one is a late packet, it is dropped without an ack
+- everything else is applied and acknowledged
+*/
+#define SETPOINT_REORDER_WINDOW     8   /* a sequence number up to this much behind the last one is a late packet */
+
+#define SETPOINT_APPLY              0
+#define SETPOINT_ACK_AGAIN          1
+#define SETPOINT_DROP               2
+
+typedef struct
+{
+    bool     any_applied;           /* false until the first setpoint, nothing to compare with */
+    uint16_t session;               /* of the last applied setpoint */
+    uint8_t  sequence;              /* of the last applied setpoint */
+} setpoint_filter_t;
+
+/* what to do with a received setpoint, SETPOINT_APPLY makes it the last applied one */
+IRAM_ATTR uint8_t setpoint_filter(setpoint_filter_t* filter, uint16_t session, uint8_t sequence);
@@ -4,9 +4,54 @@
 #include <WiFi.h>
 #include "globals.h"
 
+/*
+Setpoint delivery, see wireless_transmission.h of the sensorcar.
+Wireless receive only puts a setpoint into a single slot mailbox, so a newer setpoint replaces one that was not processed yet (latest value wins).
+setpoint_task writes the DAC and answers with the ack. Retransmissions and late packets are told apart by setpoint_filter, see setpoint_filter.h.
+*/
+
+typedef struct __attribute__((packed))
+{
+    uint16_t session;           /* drawn at every boot of the sensorcar, sequence numbers start over with it */
+    uint8_t  sequence;
+    uint8_t  speed_digital;
+    #if MEASURE_LATENCY
+        uint16_t trace_id;      /* correlation id of the latency trace the speed value belongs to */
+    #endif
+} setpoint_packet_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t  message;           /* RECEIVED_VALUE_WIRELESSLY */
+    uint8_t  sequence;
+} setpoint_ack_packet_t;
+
+/* sensorcar -> controller emulator, sent when the car derailed and when it is racing again */
+typedef struct __attribute__((packed))
+{
+    uint8_t  derailed;              /* 1 when derailed, 0 when the position was synced again */
+    uint8_t  track_position_index;
+    uint8_t  derailment_count;      /* derailments since boot of the sensorcar */
+} derailment_report_packet_t;
+
+#if MEASURE_LATENCY
+    /* answer of the controller emulator to a traced setpoint. Timestamps in us of the controller emulator clock. */
+    typedef struct __attribute__((packed))
+    {
+        uint16_t trace_id;
+        uint32_t receive_timestamp;
+        uint32_t dac_write_timestamp;
+        uint32_t report_send_timestamp;
+    } trace_report_packet_t;
+#endif
+
 const uint8_t newMACAddress[]       = {0x32, 0xAE, 0xA4, 0x07, 0x0D, 0x65}; /* MAC this uC */
 const uint8_t broadcastAddress[]    = {0x32, 0xAE, 0xA4, 0x07, 0x0D, 0x66}; /* MAC receiver */
 
 void init_wifi();
 IRAM_ATTR void send_data_wirelessly(uint8_t data_to_transmit);
-IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data, int len);
\ No newline at end of file
+#if MEASURE_LATENCY
+  IRAM_ATTR void send_trace_report(uint16_t trace_id, uint32_t receive_timestamp, uint32_t dac_write_timestamp);
+#endif
+IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data, int len);
+IRAM_ATTR void setpoint_task(void*);
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include <stdarg.h>
+#include "console_output.h"
+#include "handoff_accounting.h"
+
+#define CONSOLE_PRINTF_SIZE         512     /* in bytes, longest output of a single console_printf() */
+
+DRAM_ATTR SemaphoreHandle_t console_frame_mutex = NULL;    /* one renderer at a time, held from console_begin() to console_end() */
+DRAM_ATTR SemaphoreHandle_t console_semaphore   = NULL;    /* frames for console_task */
+#if STATIC_ALLOCATION
+    DRAM_ATTR StaticSemaphore_t console_frame_mutex_buffer;
+    DRAM_ATTR StaticSemaphore_t console_semaphore_buffer;
+#endif
+
+/* frame being rendered, only touched while holding console_frame_mutex */
+DRAM_ATTR char      console_frame[CONSOLE_FRAME_SIZE];
+DRAM_ATTR char      console_formatted[CONSOLE_PRINTF_SIZE];
+DRAM_ATTR uint16_t  console_frame_length    = 0;
+DRAM_ATTR bool      console_new_screen      = false;
+DRAM_ATTR uint8_t   console_row             = 1;        /* of the cursor on the terminal, 1 is the top */
+
+/* output for console_task */
+DRAM_ATTR portMUX_TYPE  console_pending_mutex   = portMUX_INITIALIZER_UNLOCKED;
+DRAM_ATTR char          console_pending[CONSOLE_PENDING_SIZE];
+DRAM_ATTR uint16_t      console_pending_length  = 0;
+DRAM_ATTR bool          console_sending         = false;    /* console_task is writing to the UART driver */
+DRAM_ATTR char          console_transmit[CONSOLE_PENDING_SIZE];
+
+/* call before any output, after Serial.begin() */
+void init_console()
+{
+    #if STATIC_ALLOCATION
+        console_frame_mutex = xSemaphoreCreateMutexStatic(&console_frame_mutex_buffer);
+        console_semaphore   = xSemaphoreCreateCountingStatic(HANDOFF_MAX_COUNT, 0, &console_semaphore_buffer);
+    #else
+        console_frame_mutex = xSemaphoreCreateMutex();
+        console_semaphore   = xSemaphoreCreateCounting(HANDOFF_MAX_COUNT, 0);
+    #endif
+}
+
+inline void frame_append(const char* text, uint16_t length)
+{
+    length = min(length, uint16_t(CONSOLE_FRAME_SIZE - console_frame_length)); /* a frame that does not fit is cut off */
+    memcpy(&console_frame[console_frame_length], text, length);
+    console_frame_length += length;
+}
+
+inline void frame_append_cursor()
+{
+    char cursor[12];
+    frame_append(cursor, snprintf(cursor, sizeof(cursor), "\x1b[%u;1H", console_row));
+}
+
+/* new_screen starts at the top of the terminal, otherwise the frame continues below the last line */
+IRAM_ATTR void console_begin(bool new_screen)
+{
+    xSemaphoreTake(console_frame_mutex, portMAX_DELAY);
+    console_frame_length = 0;
+    console_new_screen   = new_screen;
+    #if CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN
+        if (new_screen) { console_row = 1; }
+        if (console_row <= CONSOLE_ROWS) { frame_append_cursor(); }
+    #endif
+}
+
+IRAM_ATTR void console_printf(const char* format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(console_formatted, sizeof(console_formatted), format, arguments);
+    va_end(arguments);
+    length = constrain(length, 0, int(sizeof(console_formatted)) - 1);
+
+    #if CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN
+        /* every line break becomes erase to the end of the line and the address of the next row */
+        for (int ii = 0; ii < length; ii++)
+        {
+            char character = console_formatted[ii];
+            if (character == '\r') { continue; }
+            if (character == '\n')
+            {
+                if (console_row <= CONSOLE_ROWS) { frame_append("\x1b[K", 3); }
+                console_row++;
+                if (console_row <= CONSOLE_ROWS) { frame_append_cursor(); }
+                continue;
+            }
+            if (console_row <= CONSOLE_ROWS) { frame_append(&character, 1); }
+        }
+    #else
+        frame_append(console_formatted, length);
+    #endif
+}
+
+/* hands the frame to console_task, never waits for the UART */
+IRAM_ATTR void console_end()
+{
+    #if CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN
+        if (console_new_screen)                 { frame_append("\x1b[J", 3); } /* erase the rest of the previous screen */
+        else if (console_row <= CONSOLE_ROWS)   { frame_append("\x1b[K", 3); }
+    #endif
+
+    bool handed_over = false;
+    portENTER_CRITICAL(&console_pending_mutex);
+    #if CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN
+        if (console_new_screen) { console_pending_length = 0; } /* what was not sent yet would be overwritten anyway */
+    #endif
+    if (console_pending_length + console_frame_length <= CONSOLE_PENDING_SIZE)
+    {
+        memcpy(&console_pending[console_pending_length], console_frame, console_frame_length);
+        console_pending_length += console_frame_length;
+        handed_over = true;
+    }
+    portEXIT_CRITICAL(&console_pending_mutex);
+    xSemaphoreGive(console_frame_mutex);
+
+    if (handed_over)    { handoff_give(HANDOFF_CONSOLE, console_semaphore); }
+    else                { handoff_count_rejected(HANDOFF_CONSOLE); }
+}
+
+/* a frame of a single line below the last one. Text for people, the compact format leaves it out. */
+IRAM_ATTR void console_line(const char* text)
+{
+    #if CONSOLE_FORMAT == CONSOLE_FORMAT_SCREEN
+        console_begin(false);
+        console_printf("%s\n", text);
+        console_end();
+    #endif
+}
+
+/* waits until console_task handed everything to the UART driver, for output that bypasses the console */
+void console_drain()
+{
+    for(;;)
+    {
+        portENTER_CRITICAL(&console_pending_mutex);
+        bool idle = (console_pending_length == 0) && !console_sending;
+        portEXIT_CRITICAL(&console_pending_mutex);
+        if (idle) { return; }
+        DELAY_N_MS(10);
+    }
+}
+
+/* the only task that waits for the UART. Frames that piled up while it was writing go out in one write. */
+IRAM_ATTR void console_task(void*)
+{
+    for(;;)
+    {
+        if (handoff_take(HANDOFF_CONSOLE, console_semaphore, portMAX_DELAY))
+        {
+            portENTER_CRITICAL(&console_pending_mutex);
+            uint16_t length = console_pending_length;
+            memcpy(console_transmit, console_pending, length);
+            console_pending_length = 0;
+            console_sending        = true;
+            portEXIT_CRITICAL(&console_pending_mutex);
+
+            if (length > 0) { Serial.write((const uint8_t*)console_transmit, length); } /* blocks only while the driver's ring buffer is full */
+            console_sending = false;
+        }
+    }
+}
@@ -0,0 +1,229 @@
+#include "cu_protocol.h"
+#include <string.h>
+
+typedef bool (*cu_decode_function_t)(const uint8_t* data, cu_frame_t* frame);
+
+typedef struct
+{
+    uint8_t              kind;
+    uint8_t              command;       /* echoed command character */
+    uint8_t              marker;        /* second character, 0 if it is part of the payload */
+    uint8_t              length;        /* including checksum and '$' */
+    cu_decode_function_t decode;        /* returns false if a field is out of range */
+} cu_frame_layout_t;
+
+inline uint8_t nibble(uint8_t character)
+{
+    return character & 0x0F;
+}
+
+/* byte sent as two characters, low nibble first */
+inline uint8_t nibble_byte(const uint8_t* data)
+{
+    return (nibble(data[1]) << 4) | nibble(data[0]);
+}
+
+/* "?:" fuel[8] light_state mode pit_lane[2] display (two unknown characters of newer CUs) checksum '$' */
+IRAM_ATTR bool decode_status(const uint8_t* data, cu_frame_t* frame)
+{
+    for (uint8_t car = 0; car < CU_NUMBER_CONTROLLERS; car++) { frame->status.fuel[car] = nibble(data[2 + car]); }
+    frame->status.light_state = nibble(data[10]);
+    frame->status.mode        = nibble(data[11]);
+    frame->status.pit_lane    = nibble_byte(&data[12]);
+    frame->status.display     = nibble(data[14]);
+    return frame->status.light_state <= CU_LIGHT_STATE_MAX;
+}
+
+/* "?" car timestamp[8] sensor_group checksum '$' */
+IRAM_ATTR bool decode_timestamp(const uint8_t* data, cu_frame_t* frame)
+{
+    frame->timestamp.car          = nibble(data[1]) - 1;    /* sent as 1...8 */
+    frame->timestamp.timestamp    = ((uint32_t)nibble_byte(&data[2]) << 24) |
+                                    ((uint32_t)nibble_byte(&data[4]) << 16) |
+                                    ((uint32_t)nibble_byte(&data[6]) << 8)  |
+                                     (uint32_t)nibble_byte(&data[8]);
+    frame->timestamp.sensor_group = nibble(data[10]);
+    return frame->timestamp.car < CU_NUMBER_CONTROLLERS;
+}
+
+/* "0" version[4] checksum '$' */
+IRAM_ATTR bool decode_version(const uint8_t* data, cu_frame_t* frame)
+{
+    for (uint8_t ii = 0; ii < 4; ii++) { frame->version.version[ii] = data[1 + ii]; }
+    frame->version.version[4] = 0;
+    return true;
+}
+
+/* checked in this order, so the layouts with a marker character come before the ones that start with the same command without it */
+const cu_frame_layout_t CU_FRAME_LAYOUTS[] =
+{
+    { CU_FRAME_STATUS,      '?', ':', 17, decode_status    },
+    { CU_FRAME_STATUS,      '?', ':', 19, decode_status    },
+    { CU_FRAME_TIMESTAMP,   '?',  0,  13, decode_timestamp },
+    { CU_FRAME_VERSION,     '0',  0,   7, decode_version   },
+};
+#define CU_NUMBER_LAYOUTS   (sizeof(CU_FRAME_LAYOUTS) / sizeof(CU_FRAME_LAYOUTS[0]))
+
+/*
+Light state steps of the CU, bit n is set if state n may follow.
+1 all lights on, 2...7 countdown, then 0 with the race going. An early start (8 and 9 blinking) ends the countdown,
+the start button brings the CU from 0 to all lights on and from there into the countdown.
+*/
+const uint16_t CU_LIGHT_STATE_STEPS[CU_LIGHT_STATE_MAX + 1] =
+{
+    1 << 1,                         /* 0 */
+    (1 << 0) | (1 << 2),            /* 1 */
+    (1 << 3) | (1 << 8),            /* 2 */
+    (1 << 4) | (1 << 8),            /* 3 */
+    (1 << 5) | (1 << 8),            /* 4 */
+    (1 << 6) | (1 << 8),            /* 5 */
+    (1 << 7) | (1 << 8),            /* 6 */
+    (1 << 0) | (1 << 8),            /* 7 */
+    (1 << 9) | (1 << 0) | (1 << 1), /* 8 */
+    (1 << 8) | (1 << 0) | (1 << 1), /* 9 */
+};
+
+inline bool same_status(const cu_status_t* a, const cu_status_t* b)
+{
+    for (uint8_t car = 0; car < CU_NUMBER_CONTROLLERS; car++) { if (a->fuel[car] != b->fuel[car]) { return false; } }
+    return (a->light_state == b->light_state) && (a->mode == b->mode) && (a->pit_lane == b->pit_lane) && (a->display == b->display);
+}
+
+/* true if status follows from the last one by a step of the light state and nothing else */
+inline bool status_continues(const cu_status_t* last, const cu_status_t* status)
+{
+    cu_status_t stepped = *last;
+    stepped.light_state = status->light_state;
+    if (!same_status(&stepped, status)) { return false; }
+    return (status->light_state == last->light_state) || (CU_LIGHT_STATE_STEPS[last->light_state] & (1 << status->light_state));
+}
+
+IRAM_ATTR bool status_plausible(cu_parser_t* parser, const cu_status_t* status)
+{
+    bool repeated = parser->status_received_known && same_status(&parser->status_received, status);
+    parser->status_received       = *status;
+    parser->status_received_known = true;
+    if (!repeated && !(parser->status_known && status_continues(&parser->status_accepted, status))) { return false; }
+
+    if ((status->light_state == 1) && (!parser->status_known || (parser->status_accepted.light_state != 1)))
+    {
+        parser->car_timestamp_known = 0;    /* a new race, its first laps don't depend on what came before */
+    }
+    parser->status_accepted = *status;
+    parser->status_known    = true;
+    return true;
+}
+
+IRAM_ATTR bool timestamp_plausible(cu_parser_t* parser, const cu_timestamp_t* timestamp, uint32_t received_ms)
+{
+    if (timestamp->sensor_group != CU_SENSOR_GROUP_FINISH_LINE) { return false; }
+
+    int32_t clock_reading = int32_t(timestamp->timestamp - received_ms);   /* CU clock minus receive time, if the passing was right now */
+    bool    clock_valid   = parser->clock_known && ((received_ms - parser->clock_learned_ms) < CU_CLOCK_VALID_MS);
+    if (clock_valid)
+    {
+        int32_t ahead = clock_reading - parser->clock_offset;
+        if ((ahead > CU_CLOCK_TOLERANCE_MS) || (ahead < -CU_TIMESTAMP_MAX_AGE_MS)) { return false; }
+    }
+    uint8_t car_bit = 1 << timestamp->car;
+    if ((parser->car_timestamp_known & car_bit) && (int32_t(timestamp->timestamp - parser->car_timestamp[timestamp->car]) < CU_LAP_TIME_MIN_MS)) { return false; }
+
+    parser->car_timestamp[timestamp->car] = timestamp->timestamp;
+    parser->car_timestamp_known          |= car_bit;
+    if (!clock_valid)
+    {
+        parser->clock_offset     = clock_reading;
+        parser->clock_learned_ms = received_ms;
+        parser->clock_known      = true;
+    }
+    else if (clock_reading > parser->clock_offset) { parser->clock_offset = clock_reading; }  /* the freshest passing comes closest to the CU clock */
+    return true;
+}
+
+IRAM_ATTR bool version_plausible(cu_parser_t* parser, const cu_version_t* version)
+{
+    for (uint8_t ii = 0; ii < 4; ii++) { if (version->version[ii] > '9') { return false; } }
+    bool repeated = !strcmp(parser->version_received.version, version->version);
+    parser->version_received = *version;
+    if ((parser->version_accepted.version[0] != 0) && strcmp(parser->version_accepted.version, version->version) && !repeated) { return false; }
+    parser->version_accepted = *version;
+    return true;
+}
+
+/* checks an intact frame against what the parser received before, see cu_protocol.h */
+IRAM_ATTR bool frame_plausible(cu_parser_t* parser, const cu_frame_t* frame, uint32_t received_ms)
+{
+    switch (frame->kind)
+    {
+        case CU_FRAME_STATUS:       return status_plausible(parser, &frame->status);
+        case CU_FRAME_TIMESTAMP:    return timestamp_plausible(parser, &frame->timestamp, received_ms);
+        case CU_FRAME_VERSION:      return version_plausible(parser, &frame->version);
+    }
+    return true;
+}
+
+/* after discarded bytes, the next one starts a frame. What the plausibility checks learned stays. */
+IRAM_ATTR void cu_parser_reset(cu_parser_t* parser)
+{
+    parser->length       = 0;
+    parser->overflow     = false;
+    parser->synchronized = true;
+}
+
+/*
+Decodes one complete frame, data[length-1] is the '$'.
+Returns the kind of the frame and fills frame, or CU_FRAME_INVALID.
+*/
+IRAM_ATTR uint8_t cu_decode_frame(const uint8_t* data, uint8_t length, cu_frame_t* frame)
+{
+    frame->kind = CU_FRAME_INVALID;
+
+    const cu_frame_layout_t* layout = NULL;
+    for (uint8_t ii = 0; ii < CU_NUMBER_LAYOUTS; ii++)
+    {
+        const cu_frame_layout_t* candidate = &CU_FRAME_LAYOUTS[ii];
+        if ((data[0] != candidate->command) || (length != candidate->length)) { continue; }
+        if (candidate->marker && (data[1] != candidate->marker))             { continue; }
+        layout = candidate;
+        break;
+    }
+    if (layout == NULL) { return CU_FRAME_INVALID; }
+
+    /* every character between the command and the '$' is a nibble, including the checksum */
+    uint8_t checksum = 0;
+    for (uint8_t ii = 1; ii < length - 1; ii++)
+    {
+        if ((data[ii] & 0xF0) != 0x30) { return CU_FRAME_INVALID; }
+        if (ii < length - 2) { checksum += data[ii]; }
+    }
+    if (nibble(checksum) != nibble(data[length - 2])) { return CU_FRAME_INVALID; }
+
+    if (!layout->decode(data, frame)) { return CU_FRAME_INVALID; }
+    frame->kind = layout->kind;
+    return frame->kind;
+}
+
+/*
+Adds one received byte, received_ms is the time it was received at.
+Returns CU_FRAME_NONE until a '$' completes the frame, then the kind of the decoded frame, which is in frame, or CU_FRAME_INVALID or CU_FRAME_IMPLAUSIBLE.
+*/
+IRAM_ATTR uint8_t cu_parser_feed(cu_parser_t* parser, uint8_t received_byte, uint32_t received_ms, cu_frame_t* frame)
+{
+    if (received_byte != CU_FRAME_END)
+    {
+        if (parser->length < CU_FRAME_MAX_LENGTH - 1) { parser->buffer[parser->length++] = received_byte; }
+        else                                          { parser->overflow = true; }
+        return CU_FRAME_NONE;
+    }
+
+    parser->buffer[parser->length++] = received_byte;
+    uint8_t kind = (parser->overflow || !parser->synchronized) ? CU_FRAME_INVALID : cu_decode_frame(parser->buffer, parser->length, frame);
+    if ((kind != CU_FRAME_INVALID) && !frame_plausible(parser, frame, received_ms)) { kind = CU_FRAME_IMPLAUSIBLE; }
+    frame->kind  = kind;
+    cu_parser_reset(parser);
+
+    if      (kind == CU_FRAME_INVALID)      { parser->frames_invalid     += 1; }
+    else if (kind == CU_FRAME_IMPLAUSIBLE)  { parser->frames_implausible += 1; }
+    else                                    { parser->frames_valid       += 1; }
+    return kind;
+}
@@ -0,0 +1,107 @@
+#include "event_trace.h"
+#if EVENT_TRACE
+#include <esp_system.h>
+
+typedef struct
+{
+    uint32_t            magic;
+    uint32_t            boot_number;
+    uint32_t            written;        /* entries written since the power cycle, the ring index is the lower bits */
+    uint32_t            dumped;         /* value of written at the last dump */
+    event_trace_entry_t entries[EVENT_TRACE_LENGTH];
+} event_trace_ring_t;
+
+RTC_NOINIT_ATTR event_trace_ring_t event_trace_ring;
+DRAM_ATTR portMUX_TYPE event_trace_mutex  = portMUX_INITIALIZER_UNLOCKED;
+DRAM_ATTR bool         event_trace_ready  = false;      /* nothing is written before the ring of the last boot was dumped */
+DRAM_ATTR uint8_t      event_trace_last_state = NO_RACE_GOING;
+
+const char* const EVENT_NAMES[EVENT_COUNT] = { "boot", "restart", "state", "handoff_coalesced", "handoff_rejected", "espnow_send", "espnow_receive", "light_state", "lap", "cu_frame_invalid", "dac_write", "channel" };
+const char* const RESET_REASON_NAMES[]     = { "unknown", "power on", "external", "software", "panic", "interrupt watchdog", "task watchdog", "other watchdog", "deep sleep", "brownout", "sdio" };
+
+/*
+Outputs what the previous boots wrote since the last dump, then starts tracing this boot.
+Call first thing in setup(), right after Serial.begin().
+*/
+void dump_event_trace()
+{
+    esp_reset_reason_t reset_reason = esp_reset_reason();
+    uint8_t reason_index = (uint8_t(reset_reason) < sizeof(RESET_REASON_NAMES) / sizeof(RESET_REASON_NAMES[0])) ? uint8_t(reset_reason) : 0;
+
+    bool valid = (event_trace_ring.magic == EVENT_TRACE_MAGIC) && (event_trace_ring.dumped <= event_trace_ring.written);
+    if (!valid)
+    {
+        /* power cycle, the RTC memory holds noise */
+        memset(&event_trace_ring, 0, sizeof(event_trace_ring));
+        event_trace_ring.magic = EVENT_TRACE_MAGIC;
+    }
+    else if (event_trace_ring.written != event_trace_ring.dumped)
+    {
+        uint32_t first = event_trace_ring.dumped;
+        if (event_trace_ring.written - first > EVENT_TRACE_LENGTH) { first = event_trace_ring.written - EVENT_TRACE_LENGTH; }
+        Serial.printf("Event trace before this reset (%s), %u events, %u of them overwritten:\n",
+            RESET_REASON_NAMES[reason_index],
+            (unsigned int)(event_trace_ring.written - event_trace_ring.dumped),
+            (unsigned int)(first - event_trace_ring.dumped));
+
+        /* boot numbers are only stored in the boot entries, count them up while going through the ring */
+        uint32_t boot_number = event_trace_ring.boot_number;
+        for (uint32_t ii = first; ii != event_trace_ring.written; ii++)
+        {
+            if (event_trace_ring.entries[ii % EVENT_TRACE_LENGTH].event == EVENT_BOOT) { boot_number--; }
+        }
+        for (uint32_t ii = first; ii != event_trace_ring.written; ii++)
+        {
+            event_trace_entry_t entry = event_trace_ring.entries[ii % EVENT_TRACE_LENGTH];
+            if (entry.event == EVENT_BOOT) { boot_number++; }
+            Serial.printf("EVENT %u %u %s %u %u\n",
+                (unsigned int)boot_number,
+                (unsigned int)entry.timestamp,
+                (entry.event < EVENT_COUNT) ? EVENT_NAMES[entry.event] : "invalid",
+                (unsigned int)entry.value8,
+                (unsigned int)entry.value16);
+        }
+    }
+
+    event_trace_ring.boot_number += 1;
+    event_trace_ring.dumped       = event_trace_ring.written;
+    event_trace_ready             = true;
+    event_trace(EVENT_BOOT, uint8_t(reset_reason), uint16_t(event_trace_ring.boot_number));
+}
+
+/* writes one entry, event_trace_mutex has to be held */
+static IRAM_ATTR void event_trace_write(uint32_t timestamp, uint8_t event, uint8_t value8, uint16_t value16)
+{
+    event_trace_entry_t* entry = &event_trace_ring.entries[event_trace_ring.written % EVENT_TRACE_LENGTH];
+    entry->timestamp = timestamp;
+    entry->event     = event;
+    entry->value8    = value8;
+    entry->value16   = value16;
+    event_trace_ring.written += 1;
+}
+
+IRAM_ATTR void event_trace(uint8_t event, uint8_t value8, uint16_t value16)
+{
+    if (!event_trace_ready) { return; }
+    uint32_t timestamp = micros();
+    portENTER_CRITICAL(&event_trace_mutex);
+    event_trace_write(timestamp, event, value8, value16);
+    portEXIT_CRITICAL(&event_trace_mutex);
+}
+
+/*
+Traces a state transition. Call it periodically with the current state.
+process_light_state_task and serial_communication_with_control_unit_task (end of a race) both call it, so the comparison with the last state and the entry are taken under the same lock as the ring.
+*/
+IRAM_ATTR void event_trace_state(uint8_t state)
+{
+    uint32_t timestamp = micros();
+    portENTER_CRITICAL(&event_trace_mutex);
+    if (state != event_trace_last_state)
+    {
+        if (event_trace_ready) { event_trace_write(timestamp, EVENT_STATE, state, event_trace_last_state); }
+        event_trace_last_state = state;
+    }
+    portEXIT_CRITICAL(&event_trace_mutex);
+}
+#endif
@@ -1,10 +1,23 @@
 #include "globals.h"
 
-DRAM_ATTR SemaphoreHandle_t button_pressed_semaphore        = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t dac_access_semaphore            = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t serial2_access_semaphore        = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t print_data_semaphore            = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t process_light_state_semaphore   = xSemaphoreCreateBinary();
+#if STATIC_ALLOCATION
+  DRAM_ATTR StaticSemaphore_t button_pressed_semaphore_buffer;
+  DRAM_ATTR StaticSemaphore_t dac_access_semaphore_buffer;
+  DRAM_ATTR StaticSemaphore_t serial2_access_semaphore_buffer;
+  DRAM_ATTR StaticSemaphore_t print_data_semaphore_buffer;
+  DRAM_ATTR StaticSemaphore_t process_light_state_semaphore_buffer;
+  DRAM_ATTR SemaphoreHandle_t button_pressed_semaphore        = xSemaphoreCreateBinaryStatic(&button_pressed_semaphore_buffer);
+  DRAM_ATTR SemaphoreHandle_t dac_access_semaphore            = xSemaphoreCreateBinaryStatic(&dac_access_semaphore_buffer);
+  DRAM_ATTR SemaphoreHandle_t serial2_access_semaphore        = xSemaphoreCreateBinaryStatic(&serial2_access_semaphore_buffer);
+  DRAM_ATTR SemaphoreHandle_t print_data_semaphore            = xSemaphoreCreateCountingStatic(HANDOFF_MAX_COUNT, 0, &print_data_semaphore_buffer);
+  DRAM_ATTR SemaphoreHandle_t process_light_state_semaphore   = xSemaphoreCreateCountingStatic(HANDOFF_MAX_COUNT, 0, &process_light_state_semaphore_buffer);
+#else
+  DRAM_ATTR SemaphoreHandle_t button_pressed_semaphore        = xSemaphoreCreateBinary();
+  DRAM_ATTR SemaphoreHandle_t dac_access_semaphore            = xSemaphoreCreateBinary();
+  DRAM_ATTR SemaphoreHandle_t serial2_access_semaphore        = xSemaphoreCreateBinary();
+  DRAM_ATTR SemaphoreHandle_t print_data_semaphore            = xSemaphoreCreateCounting(HANDOFF_MAX_COUNT, 0);
+  DRAM_ATTR SemaphoreHandle_t process_light_state_semaphore   = xSemaphoreCreateCounting(HANDOFF_MAX_COUNT, 0);
+#endif
 DRAM_ATTR uint8_t           number_laps_in_race             = NUMBER_LAPS_IN_RACE_DEFAULT;
 DRAM_ATTR U8G2_SSD1306_128X64_NONAME_F_HW_I2C display_128x64(U8G2_R0, U8X8_PIN_NONE);
 
@@ -0,0 +1,53 @@
+#include "handoff_accounting.h"
+#include "event_trace.h"
+
+DRAM_ATTR handoff_counter_t handoff_counters[HANDOFF_COUNT] = { 0 };
+
+const char* const HANDOFF_NAMES[HANDOFF_COUNT] = { "print_data", "light_state", "dac_write", "setpoint_receive", "derailment", "link", "console" };
+
+IRAM_ATTR void handoff_give(uint8_t channel, SemaphoreHandle_t semaphore)
+{
+    if (xSemaphoreGive(semaphore) != pdTRUE) /* HANDOFF_MAX_COUNT events are pending already */
+    {
+        handoff_counters[channel].rejected += 1;
+        event_trace(EVENT_HANDOFF_REJECTED, channel, 0);
+    }
+}
+
+/* blocks like xSemaphoreTake, then drains the events that piled up while the consumer was busy. Returns true if there is an event to process. */
+IRAM_ATTR bool handoff_take(uint8_t channel, SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    if (xSemaphoreTake(semaphore, ticks_to_wait) != pdTRUE) { return false; }
+
+    uint16_t coalesced = 0;
+    while (xSemaphoreTake(semaphore, 0) == pdTRUE) { coalesced += 1; }
+    handoff_counters[channel].coalesced += coalesced;
+    handoff_counters[channel].delivered += 1;
+    if (coalesced > 0) { event_trace(EVENT_HANDOFF_COALESCED, channel, coalesced); }
+    return true;
+}
+
+IRAM_ATTR void handoff_count_delivered(uint8_t channel)
+{
+    handoff_counters[channel].delivered += 1;
+}
+
+IRAM_ATTR void handoff_count_rejected(uint8_t channel)
+{
+    handoff_counters[channel].rejected += 1;
+    event_trace(EVENT_HANDOFF_REJECTED, channel, 0);
+}
+
+void print_handoff_counters()
+{
+    Serial.printf("Hand-offs (delivered/coalesced/rejected):");
+    for (uint8_t ii = 0; ii < HANDOFF_COUNT; ii++)
+    {
+        Serial.printf(" %s=%u/%u/%u",
+            HANDOFF_NAMES[ii],
+            (unsigned int)handoff_counters[ii].delivered,
+            (unsigned int)handoff_counters[ii].coalesced,
+            (unsigned int)handoff_counters[ii].rejected);
+    }
+    Serial.printf("\r\n");
+}
@@ -0,0 +1,224 @@
+#include <esp_wifi.h>
+#include "link_quality.h"
+#include "serial_handling.h"   /* race_status, light_state, and through wireless_transmission.h the peer address */
+#include "handoff_accounting.h"
+#include "event_trace.h"
+#include "setpoint_filter.h"
+
+/* what wireless receive and the race state machine hand to link_task */
+#define LINK_EVENT_PACKET           0   /* link packet of the sensorcar */
+#define LINK_EVENT_SURVEY           1   /* a race ended, survey after LINK_SURVEY_DELAY_MS */
+#define LINK_EVENT_ABORT            2   /* a countdown started */
+
+typedef struct
+{
+    uint8_t       kind;
+    int8_t        rssi;
+    link_packet_t packet;
+    uint32_t      receive_us;
+} link_event_t;
+
+DRAM_ATTR QueueHandle_t link_mailbox = NULL;
+#if STATIC_ALLOCATION
+    DRAM_ATTR uint8_t       link_mailbox_storage[LINK_MAILBOX_LENGTH * sizeof(link_event_t)];
+    DRAM_ATTR StaticQueue_t link_mailbox_buffer;
+#endif
+
+DRAM_ATTR channel_survey_t link_survey;                                     /* only used by link_task */
+DRAM_ATTR link_stats_t  link_race_stats;                                    /* since light state '1' */
+DRAM_ATTR portMUX_TYPE  link_stats_mutex        = portMUX_INITIALIZER_UNLOCKED; /* written by wireless receive on core 0, reset and printed on core 1 */
+DRAM_ATTR bool          link_any_setpoint       = false;                    /* since the reset of link_race_stats */
+DRAM_ATTR uint16_t      link_last_session       = 0;
+DRAM_ATTR uint8_t       link_last_sequence      = 0;
+DRAM_ATTR int8_t        link_last_rssi          = 0;                        /* of the last frame of the sensorcar, 0 until the first one */
+DRAM_ATTR uint32_t      link_foreign_frames     = 0;                        /* since boot, only written by the Wi-Fi task */
+DRAM_ATTR bool          link_heard              = false;                    /* a packet of the sensorcar that was no link packet arrived */
+
+inline void link_radio_send(void* context, const link_packet_t* packet)
+{
+    esp_now_send(broadcastAddress, (uint8_t *) packet, sizeof(link_packet_t));
+    event_trace(EVENT_ESPNOW_SEND, ESPNOW_LINK, (packet->type << 8) | packet->channel);
+}
+
+inline void link_radio_set_channel(void* context, uint8_t channel)
+{
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    event_trace(EVENT_CHANNEL, channel, uint16_t(link_survey.commits));
+}
+
+DRAM_ATTR const link_radio_t link_radio = { NULL, link_radio_send, link_radio_set_channel };
+
+/* runs in the Wi-Fi task for every management and data frame on the channel, before the ESP-NOW callback gets the same frame */
+IRAM_ATTR void link_sniff(void* buffer, wifi_promiscuous_pkt_type_t type)
+{
+    const wifi_promiscuous_pkt_t* frame = (const wifi_promiscuous_pkt_t*)buffer;
+    if (frame->rx_ctrl.sig_len < LINK_FRAME_SENDER_OFFSET + 6) { return; }
+    if (memcmp(&frame->payload[LINK_FRAME_SENDER_OFFSET], broadcastAddress, 6) == 0) { link_last_rssi = frame->rx_ctrl.rssi; }
+    else { link_foreign_frames += 1; }
+}
+
+/* after init_wifi(), before any packet can arrive */
+void init_link_quality()
+{
+    #if STATIC_ALLOCATION
+        link_mailbox = xQueueCreateStatic(LINK_MAILBOX_LENGTH, sizeof(link_event_t), link_mailbox_storage, &link_mailbox_buffer);
+    #else
+        link_mailbox = xQueueCreate(LINK_MAILBOX_LENGTH, sizeof(link_event_t));
+    #endif
+    link_race_stats_reset();
+
+    wifi_promiscuous_filter_t filter = { WIFI_PROMIS_FILTER_MASK_MGMT | WIFI_PROMIS_FILTER_MASK_DATA };
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(link_sniff);
+    esp_wifi_set_promiscuous(true);
+}
+
+inline void link_post(const link_event_t* event)
+{
+    if (xQueueSend(link_mailbox, event, 0) != pdTRUE) { handoff_count_rejected(HANDOFF_LINK); }
+}
+
+/* wireless receive, for packets that passed link_packet_valid() */
+IRAM_ATTR void link_packet_received(const uint8_t* data)
+{
+    link_event_t event;
+    event.kind       = LINK_EVENT_PACKET;
+    event.rssi       = link_last_rssi;
+    event.receive_us = micros();
+    memcpy(&event.packet, data, sizeof(link_packet_t)); /* incoming data is not necessarily aligned */
+    event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_LINK, (event.packet.type << 8) | event.packet.channel);
+    link_post(&event);
+}
+
+/* wireless receive, for every setpoint including retransmissions. Sequence numbers that were skipped are setpoints that never arrived. */
+IRAM_ATTR void link_setpoint_received(uint16_t session, uint8_t sequence)
+{
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_received(&link_race_stats, link_last_rssi);
+    bool   same_session        = link_any_setpoint && (session == link_last_session);  /* a rebooted sensorcar starts over, nothing was missed */
+    int8_t sequence_difference = int8_t(sequence - link_last_sequence);
+    if (same_session && (sequence_difference > 1)) { link_stats_missed(&link_race_stats, sequence_difference - 1); }
+    if (!same_session || (sequence_difference > 0) || (sequence_difference < -SETPOINT_REORDER_WINDOW)) { link_last_sequence = sequence; } /* same rules as setpoint_filter */
+    link_last_session = session;
+    link_any_setpoint = true;
+    portEXIT_CRITICAL(&link_stats_mutex);
+}
+
+/* wireless receive, for every packet of the sensorcar that is no link packet */
+IRAM_ATTR void link_peer_heard()
+{
+    link_heard = true;
+}
+
+/* the end of a race, the survey starts after LINK_SURVEY_DELAY_MS */
+IRAM_ATTR void link_survey_request()
+{
+    link_event_t event = { LINK_EVENT_SURVEY, 0, { 0 }, uint32_t(micros()) };
+    link_post(&event);
+}
+
+/* a countdown started, back to the home channel */
+IRAM_ATTR void link_survey_abort()
+{
+    link_event_t event = { LINK_EVENT_ABORT, 0, { 0 }, uint32_t(micros()) };
+    link_post(&event);
+}
+
+/* at the start of every race */
+void link_race_stats_reset()
+{
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_reset(&link_race_stats);
+    link_any_setpoint = false;
+    portEXIT_CRITICAL(&link_stats_mutex);
+}
+
+/* the coordinator of channel_hop.h. Sleeps until the next event or the time the coordinator or a pending survey asks for. */
+IRAM_ATTR void link_task(void*)
+{
+    channel_survey_init(&link_survey, &link_radio, micros());
+    bool     survey_pending = false;
+    uint32_t survey_due_us  = 0;
+    #if PRINT_LINK_STATS
+        uint32_t surveys    = 0;
+    #endif
+    uint32_t foreign_frames = link_foreign_frames;
+    uint32_t wait_us        = 0;
+    for(;;)
+    {
+        uint32_t now_us = micros();
+        if (survey_pending) { wait_us = min(wait_us, link_time_reached(now_us, survey_due_us) ? 0 : survey_due_us - now_us); }
+        TickType_t   wait_ticks = (wait_us == LINK_NO_DEADLINE) ? portMAX_DELAY : ((wait_us + 999) / 1000) / portTICK_PERIOD_MS;
+        link_event_t event;
+        bool         received   = (xQueueReceive(link_mailbox, &event, wait_ticks) == pdTRUE);
+
+        /* frames of other stations since the last loop were heard in the state before this event */
+        uint32_t frames = link_foreign_frames;
+        channel_survey_foreign(&link_survey, frames - foreign_frames);
+        foreign_frames = frames;
+        if (link_heard)
+        {
+            link_heard = false;
+            channel_survey_heard(&link_survey);
+        }
+
+        now_us = micros();
+        if (received)
+        {
+            handoff_count_delivered(HANDOFF_LINK);
+            switch (event.kind)
+            {
+                case LINK_EVENT_PACKET:
+                    channel_survey_packet(&link_survey, &event.packet, event.rssi, event.receive_us);
+                    break;
+                case LINK_EVENT_SURVEY:
+                    survey_pending = true;
+                    survey_due_us  = event.receive_us + LINK_SURVEY_DELAY_MS * 1000;
+                    break;
+                case LINK_EVENT_ABORT:
+                    survey_pending = false;
+                    channel_survey_abort(&link_survey, now_us);
+                    break;
+            }
+        }
+        if (survey_pending && link_time_reached(now_us, survey_due_us))
+        {
+            survey_pending = false;
+            if ((race_status == NO_RACE_GOING) && (light_state == '0')) { channel_survey_start(&link_survey, now_us); } /* not in the middle of a countdown */
+        }
+        wait_us = channel_survey_tick(&link_survey, now_us);
+
+        #if PRINT_LINK_STATS
+            if (link_survey.surveys != surveys) { print_link_survey(); }
+            surveys = link_survey.surveys;
+        #endif
+    }
+}
+
+/* link statistics of the current race */
+void print_link_stats()
+{
+    link_stats_t stats;
+    portENTER_CRITICAL(&link_stats_mutex);
+    stats = link_race_stats;
+    portEXIT_CRITICAL(&link_stats_mutex);
+    char print_buffer[300];
+    link_stats_format(print_buffer, sizeof(print_buffer), &stats);
+    Serial.printf("Link on channel %u: %s\n", link_survey.home_channel, print_buffer);
+}
+
+/* scores of the last channel survey */
+void print_link_survey()
+{
+    char print_buffer[300];
+    Serial.printf("Channel survey %u, home channel %u, %u moves, %u announces\n", (unsigned int)link_survey.surveys, link_survey.home_channel,
+        (unsigned int)link_survey.commits, (unsigned int)link_survey.announces);
+    for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++)
+    {
+        const link_stats_t* stats = &link_survey.channel_stats[channel];
+        link_stats_format(print_buffer, sizeof(print_buffer), stats);
+        uint32_t score = link_channel_score(stats);
+        if (score == LINK_SCORE_UNUSABLE) { Serial.printf("  channel %2u: unusable, %s\n", channel, print_buffer); }
+        else                              { Serial.printf("  channel %2u: score %u, %s\n", channel, (unsigned int)score, print_buffer); }
+    }
+}
@@ -5,7 +5,28 @@ It also communicates with the Carrera CU to obtain lap times and start races.
 
 #include "globals.h"          /* constants, functions and variables used by multiple files */
 #include "button_handling.h"
+#include "handoff_accounting.h" /* counts events handed between tasks and the ones that got lost */
 #include "serial_handling.h"  /* For communication with the control unit and wireless comms as well as processing the data. The bulk of the code lives here. */
+#include "task_memory.h"      /* static task stacks and the stack usage report */
+#include "event_trace.h"      /* crash-surviving trace of the last events */
+#if LINK_MONITOR
+  #include "link_quality.h"   /* ESP-NOW link statistics and channel hops */
+#endif
+
+/* ###################################################
+Variables
+################################################### */
+STATIC_TASK_MEMORY(button_handle_task,                          BUTTON_HANDLE_STACK)
+STATIC_TASK_MEMORY(serial_communication_with_control_unit_task, SERIAL2_COMMS_STACK)
+STATIC_TASK_MEMORY(print_car_data_task,                         PRINT_DATA_STACK)
+STATIC_TASK_MEMORY(process_light_state_task,                    LIGHT_STATE_STACK)
+STATIC_TASK_MEMORY(setpoint_task,                               SETPOINT_STACK)
+#if LINK_MONITOR
+  STATIC_TASK_MEMORY(link_task,                                 LINK_STACK)
+#endif
+#if SERIAL_USERDATA_PRINT
+  STATIC_TASK_MEMORY(console_task,                              CONSOLE_STACK)
+#endif
 
 /* ###################################################
 Functions
@@ -16,8 +37,13 @@ inline void display_race_lap_number()
     Serial.printf("Lap count for race to finish: %d\n", number_laps_in_race);
   #endif
   #if SERIAL_USERDATA_PRINT
-    Serial.print(TEXT_PUSH_DOWN_STRING);
-    Serial.printf("Ein Rennen um %d Runden.\n", number_laps_in_race);
+    console_begin(true);
+    #if CONSOLE_SCREEN
+      console_printf("Ein Rennen um %d Runden.\n", number_laps_in_race);
+    #else
+      console_printf("RACE\t%d\n", number_laps_in_race);
+    #endif
+    console_end();
   #endif
   #if DISPLAY_OUTPUT_ENABLE
     display_128x64.setFont(u8g2_font_ncenB12_tr);
@@ -110,7 +136,7 @@ IRAM_ATTR void print_car_data_task(void*)
     If new data has arrived, present it over serial or on the display, depending on the configuration in globals.h 
     After it has been presented, block the task until there is new data available
     */
-    if ( xSemaphoreTake(print_data_semaphore,portMAX_DELAY) == pdTRUE )
+    if ( handoff_take(HANDOFF_PRINT_DATA, print_data_semaphore, portMAX_DELAY) )
     {
       print_car_data();
     }
@@ -126,7 +152,7 @@ IRAM_ATTR void process_light_state_task(void*)
 {
   for(;;)
   {
-    if ( xSemaphoreTake(process_light_state_semaphore,portMAX_DELAY) == pdTRUE )
+    if ( handoff_take(HANDOFF_LIGHT_STATE, process_light_state_semaphore, portMAX_DELAY) )
     {
       process_light_state();
     }
@@ -139,7 +165,14 @@ Initilization
 void setup()
 {
   /* Serial interfaces */
+  #if SERIAL_USERDATA_PRINT
+    Serial.setTxBufferSize(CONSOLE_UART_BUFFER_SIZE); /* console_task hands its frames to this ring buffer, the driver sends them by interrupt */
+  #endif
   Serial.begin(115200); /* Debug interface */
+  #if SERIAL_USERDATA_PRINT
+    init_console();     /* frames queue up until console_task runs */
+  #endif
+  dump_event_trace();   /* what happened before the last reset */
   init_serial2();       /* Control Unit serial interface */
 
   /* DAC */
@@ -147,6 +180,9 @@ void setup()
   
   /* Wi-Fi */
   init_wifi();
+  #if LINK_MONITOR
+    init_link_quality();  /* needs the Wi-Fi driver running */
+  #endif
 
   /* Tasks
   main loop runs on core 1.
@@ -154,34 +190,17 @@ void setup()
   Sometimes there's problems if that is not the case.
   That's a bug with the multicore port of FreeRTOS on the ESP32.
   */
-  xTaskCreatePinnedToCore(button_handle_task, 
-                          "button_handle_task", 
-                          10000,
-                          NULL,
-                          BUTTON_HANDLE_PRIO, 
-                          NULL,
-                          BUTTON_HANDLE_CORE);
-  xTaskCreatePinnedToCore(serial_communication_with_control_unit_task,
-                          "serial_communication_with_control_unit_task",
-                          10000,
-                          NULL,
-                          SERIAL2_COMMS_PRIO,
-                          NULL,
-                          SERIAL2_COMMS_CORE);
-  xTaskCreatePinnedToCore(print_car_data_task, 
-                          "print_car_data_task", 
-                          10000,
-                          NULL,
-                          PRINT_DATA_PRIO, 
-                          NULL,
-                          PRINT_DATA_CORE);
-  xTaskCreatePinnedToCore(process_light_state_task, 
-                          "process_light_state_task", 
-                          10000,
-                          NULL,
-                          LIGHT_STATE_PRIO, 
-                          NULL,
-                          LIGHT_STATE_CORE);                       
+  CREATE_TASK(button_handle_task,                          BUTTON_HANDLE_STACK, BUTTON_HANDLE_PRIO, NULL, BUTTON_HANDLE_CORE);
+  CREATE_TASK(serial_communication_with_control_unit_task, SERIAL2_COMMS_STACK, SERIAL2_COMMS_PRIO, NULL, SERIAL2_COMMS_CORE);
+  CREATE_TASK(print_car_data_task,                         PRINT_DATA_STACK,    PRINT_DATA_PRIO,    NULL, PRINT_DATA_CORE);
+  CREATE_TASK(process_light_state_task,                    LIGHT_STATE_STACK,   LIGHT_STATE_PRIO,   NULL, LIGHT_STATE_CORE);
+  CREATE_TASK(setpoint_task,                               SETPOINT_STACK,      SETPOINT_PRIO,      NULL, SETPOINT_CORE);
+  #if LINK_MONITOR
+    CREATE_TASK(link_task,                                 LINK_STACK,          LINK_PRIO,          NULL, LINK_CORE);
+  #endif
+  #if SERIAL_USERDATA_PRINT
+    CREATE_TASK(console_task,                              CONSOLE_STACK,       CONSOLE_PRIO,       NULL, CONSOLE_CORE);
+  #endif
 }
 
 /* ###################################################
@@ -1,10 +1,17 @@
 #include "serial_handling.h"
+#include "handoff_accounting.h"
+#include "task_memory.h"
+#include "event_trace.h"
+#if LINK_MONITOR
+    #include "link_quality.h"
+#endif
 
 DRAM_ATTR Ticker no_activity_timer;                                 /* if no laps have been made for TIMEOUT_SECONDS, the CU is kept awake using the keep_cu_awake() function. */
 DRAM_ATTR bool no_activity_timer_running = false;
 HardwareSerial serial_interface_2(2);                               /* Serial interface with RX at pin 16 and TX at pin 17 */
 
-DRAM_ATTR uint8_t receive_buffer[RECEIVE_BUFFER_LENGTH] = { 0 };    /* maximum received data in use should be 18 characters */
+DRAM_ATTR cu_parser_t cu_parser = {};                               /* keeps partial frames of the control unit between reads and what the plausibility checks compare with */
+DRAM_ATTR uint8_t empty_response_counter = 0;                       /* requests in a row the control unit did not answer */
 DRAM_ATTR uint8_t light_state = '0';                                /* State of the state machine in the control unit. 8 and 9 means early start, 1 is all LEDS on and 2...7 are the countdown. 0 is idle. */
 
 DRAM_ATTR uint8_t race_status   = NO_RACE_GOING;                    /* for states, look in globals.h */
@@ -17,6 +24,8 @@ DRAM_ATTR uint32_t car_timestamp              [4] = { 0 };    /* save counter st
 DRAM_ATTR uint32_t car_timestamp_previous     [4] = { 0 };    /* required to calculate lap times */
 DRAM_ATTR uint32_t car_lap_time               [4] = { 0 };
 DRAM_ATTR uint32_t car_lap_time_previous      [4] = { 0 };
+DRAM_ATTR uint8_t  car_derailed               [4] = { 0 };    /* reported by the sensorcar, cleared when it is racing again */
+DRAM_ATTR uint8_t  car_derailments            [4] = { 0 };    /* in this race */
 
 /* Statistics */
 DRAM_ATTR  int64_t car_lap_time_improvement   [4] = { 0 };    /* to see how your lap times have improved */
@@ -29,7 +38,12 @@ void init_serial2()
 {
     serial_interface_2.begin(19200);
     serial_interface_2.setTimeout(10);
-    #if SERIAL_USERDATA_PRINT
+    while (serial_interface_2.available() > 0) { serial_interface_2.read(); }  /* line noise of the power-up, the CU only answers requests */
+    cu_parser_reset(&cu_parser);                                                /* so the next byte starts a frame */
+    #if DEBUG
+        serial_interface_2.print(ASK_VERSION_NUMBER);   /* the answer is processed with the first request for a timestamp */
+    #endif
+    #if CONSOLE_SCREEN
         print_eva_logo();
     #endif
     xSemaphoreGive(serial2_access_semaphore);
@@ -40,8 +54,9 @@ void init_serial2()
 
 inline void print_eva_logo()
 {
-    Serial.print(TEXT_PUSH_DOWN_STRING);
-    Serial.printf("\r\n\
+    #if CONSOLE_SCREEN
+    console_begin(true);
+    console_printf("\r\n\
                      (=)\r\n\
  ______  __      __ (=/@/=)\r\n\
 |  ____| \\ \\    / /  /\\(=)\r\n\
@@ -49,49 +64,104 @@ inline void print_eva_logo()
 |  __|     \\ \\/ /  / /\\ \\\r\n\
 | |____     \\  /  / ____ \\\r\n\
 |______|     \\/  /_/    \\_\\ \r\n");
+    console_end();
+    #endif
 }
 
 IRAM_ATTR void get_data_from_control_unit()
 {
     if ( xSemaphoreTake(serial2_access_semaphore,0) == pdTRUE )
     {    
-        uint8_t buffer_index = 0;
-        memset(receive_buffer, 0, RECEIVE_BUFFER_LENGTH); /* Clear receive buffer */
-        
-        while ( serial_interface_2.available() > 0 ) { serial_interface_2.read(); } /* Clear serial buffer */
+        /* late responses to the previous request still complete their frame, a timestamp can't be requested twice */
+        feed_cu_parser();
         serial_interface_2.print(REQUEST_LAST_PASSING_TIMESTAMP);                   /* printing to the serial interface is equivalent to transmitting data */
         DELAY_N_MS(20);                                                             /* wait for response from CU. If the CU is polled too fast, it will never respond*/         
 
-        while ( serial_interface_2.available() > 0 )
+        bool frame_received = feed_cu_parser();
+        xSemaphoreGive(serial2_access_semaphore);
+        if (!frame_received) { handle_no_response(); }
+    }
+}
+
+/* feeds everything the CU sent to the protocol parser and processes every frame it completes. Returns true if any frame was complete. */
+inline bool feed_cu_parser()
+{
+    bool       frame_received = false;
+    cu_frame_t frame;
+    uint32_t   received_ms    = millis();
+    while ( serial_interface_2.available() > 0 )
+    {
+        /* reading from the serial interface is equivalent to receiving data */
+        uint8_t kind = cu_parser_feed(&cu_parser, serial_interface_2.read(), received_ms, &frame);
+        if (kind == CU_FRAME_NONE) { continue; }
+
+        frame_received = true;
+        if (kind == CU_FRAME_INVALID)
         {
-            /* reading from the serial interface is equivalent to receiving data */
-            uint8_t received_byte = serial_interface_2.read();
-            receive_buffer[buffer_index] = received_byte;
-            
-            /* '$' is the terminating character of the messages the control unit sends. */
-            if ( ( received_byte == '$' ) | ( buffer_index >= ( RECEIVE_BUFFER_LENGTH - 1 ) ) ) { break; }
-            else                                                                                { buffer_index += 1; }
+            event_trace(EVENT_CU_FRAME_INVALID, 0, uint16_t(cu_parser.frames_invalid));
+            #if DEBUG
+                Serial.printf("Dropped corrupted frame of the control unit, %u so far.\n", cu_parser.frames_invalid);
+            #endif
+            continue;
         }
-        xSemaphoreGive(serial2_access_semaphore);
-        parse_data_received();
+        if (kind == CU_FRAME_IMPLAUSIBLE)
+        {
+            event_trace(EVENT_CU_FRAME_INVALID, 1, uint16_t(cu_parser.frames_implausible));
+            #if DEBUG
+                Serial.printf("Dropped implausible frame of the control unit, %u so far.\n", cu_parser.frames_implausible);
+            #endif
+            continue;
+        }
+        parse_data_received(&frame);
     }
+    return frame_received;
 }
 
-inline void parse_data_received()
+/* If no frame arrives for a number of requests, the microcontroller will reboot because the control unit is likely turned off */
+inline void handle_no_response()
 {
-    /* If a threshold is reached, the microcontroller will reboot because the control unit is likely turned off */
-    static uint8_t empty_buffer_counter; 
-    #if DEBUG
-        //Serial.printf("Read buffer contents: %s\n", receive_buffer);
-    #endif
-    /* check for ':' (0x3A) as second received character. If it exists in the message, it does not contain counter data, but some other stats. See http://slotbaer.de/carrera-digital-124-132/10-cu-rundenzaehler-protokoll.html */
-    if (receive_buffer[1] == ':')
+    empty_response_counter += 1;
+    if (empty_response_counter > 10)
+    {
+        #if DEBUG
+            Serial.println("Serial receive buffer is empty. Control unit is likely off. Rebooting...");
+            delay(1000);
+            event_trace(EVENT_RESTART, RESTART_CU_NOT_RESPONDING, 0);
+            ESP.restart();
+        #endif
+        #if SERIAL_USERDATA_PRINT
+            #if CONSOLE_SCREEN
+                console_begin(true);
+                console_printf("Kann die Carrera Control Unit nicht finden.\r\nBitte die Control Unit ausschalten, mindestens zwei Sekunden warten und dann wieder einschalten.\r\nEVA startet gleich neu.\r\n");
+                console_end();
+            #else
+                console_begin(false);
+                console_printf("NO_CU\n");
+                console_end();
+            #endif
+            delay(10000);                   /* console_task sends it in the meantime */
+            event_trace(EVENT_RESTART, RESTART_CU_NOT_RESPONDING, 0);
+            ESP.restart();
+        #endif
+    }
+}
+
+/* processes one validated frame of the control unit, see cu_protocol.h */
+inline void parse_data_received(const cu_frame_t* frame)
+{
+    empty_response_counter = 0;
+    if (frame->kind == CU_FRAME_VERSION)
+    {
+        #if DEBUG
+            Serial.printf("Control unit version %s\n", frame->version.version);
+        #endif
+    }
+    else if (frame->kind == CU_FRAME_STATUS)
     {
         /*
         No car passed the finish line recently.
         If the light state has changed since last time, we need to process that to synchronize the race state
         */        
-        empty_buffer_counter = 0;
         /* if the no activity timer is not running, run it. */
         if ( !no_activity_timer_running )
         {
@@ -100,29 +170,14 @@ inline void parse_data_received()
         } 
 
         /* only change light state variable and give semaphore when the light state changed*/
-        if (light_state != receive_buffer[10])
+        uint8_t received_light_state = '0' + frame->status.light_state;
+        if (light_state != received_light_state)
         {
-            light_state = receive_buffer[10];
-            xSemaphoreGive(process_light_state_semaphore);
+            light_state = received_light_state;
+            event_trace(EVENT_LIGHT_STATE, frame->status.light_state, 0);
+            handoff_give(HANDOFF_LIGHT_STATE, process_light_state_semaphore);
         }
     } 
-    else if (receive_buffer[1] == 0)
-    {
-        empty_buffer_counter += 1;
-        if (empty_buffer_counter > 10)
-        {
-            #if DEBUG
-                Serial.println("Serial receive buffer is empty. Control unit is likely off. Rebooting...");
-                delay(1000);
-                ESP.restart();
-            #endif
-            #if SERIAL_USERDATA_PRINT
-                Serial.println("Kann die Carrera Control Unit nicht finden.\r\nBitte die Control Unit ausschalten, mindestens zwei Sekunden warten und dann wieder einschalten.\r\nEVA startet gleich neu.");
-                delay(10000);
-                ESP.restart();
-            #endif
-        }
-    }
     else
     {
         /* A car has passed the finish line recently. */
@@ -135,22 +190,23 @@ inline void parse_data_received()
         } 
 
         /* DECODING OF THE TIMESTAMP
-        The first character of the buffer is a '?', acknowledgement that the carrera control unit (CU) received the command.
+        Done by cu_decode_frame() in cu_protocol.cpp.
+        The first character of the frame is a '?', acknowledgement that the carrera control unit (CU) received the command.
 
-        The second character is a number of 1...4, given in ASCII-Code. If 49 is substracted, the car number of 0...3 can be obtained as an integer.
+        The second character is a number of 1...8, given in ASCII-Code. If 49 is substracted, the car number of 0...7 can be obtained as an integer.
         Port 0 is the leftmost port of the CU, port 3 is the rightmost port.
 
-        The timestamp is containted in eight characters of the receive_buffer: receive_buffer[2 to 9], including.
+        The timestamp is containted in eight characters of the frame: 2 to 9, including.
         Carrera transmits one nibble of data per transmitted character, the lower one.
         The upper one is always 0x3 for the timestamp, this is likely to only get printable characters as output.
         The eight transmitted nibbles combine to make four bytes.
         In each of the four bytes, the lower nibble is transmitted first.
         However, the lowest byte is transmitted last.
 
-        The last three characters are the group character, the checksum, and a '$' character. Those are not relevant for the timestamp.
+        The last three characters are the group character, the checksum, and a '$' character. Frames with a wrong checksum are dropped by the decoder.
 
         An example message (all numbers in HEX, 'enquoted' are ASCII characters):
-        3F      31      30      30      30      30      33      3A      31      30      31      3D      24
+        3F      31      30      30      30      30      33      3A      31      30      31      30      24
         '?'     '1'      0       0       0       0       3       A       1       0      Group   CSum    '$'
         Ack     Car0        00              00              A3              01
 
@@ -159,17 +215,16 @@ inline void parse_data_received()
         Instead, every time a car passes, a new timestamp becomes available.
         The lap time is obtained by substracting the last time stamp for the car from the current one.
         */ 
-        uint8_t car_number = receive_buffer[1] - 49;
-        /* car numbers can only be 0...3. If they are not, the CU is likely powered off. */
+        uint8_t car_number = frame->timestamp.car;
+        /* only cars 0...3 are raced, the others are the autonomous car and the pace car */
         if (car_number > 3) { return; }
-        car_timestamp[car_number] = ((receive_buffer[3] - 0x30) << 28) +
-                                    ((receive_buffer[2] - 0x30) << 24) +
-                                    ((receive_buffer[5] - 0x30) << 20) +
-                                    ((receive_buffer[4] - 0x30) << 16) +
-                                    ((receive_buffer[7] - 0x30) << 12) +
-                                    ((receive_buffer[6] - 0x30) << 8 ) +
-                                    ((receive_buffer[9] - 0x30) << 4 ) +
-                                     (receive_buffer[8] - 0x30);
+        /* the CU timer only counts up. An older timestamp would make a negative lap time, it only becomes the reference for the next lap. */
+        if ((car_timestamp_previous[car_number] != 0) && (frame->timestamp.timestamp <= car_timestamp_previous[car_number]))
+        {
+            car_timestamp_previous[car_number] = frame->timestamp.timestamp;
+            return;
+        }
+        car_timestamp[car_number] = frame->timestamp.timestamp;
         
         /* only calculate lap time if there is a previous, non-zero timestamp */
         if ( car_timestamp_previous[car_number] != 0 ) { car_lap_time[car_number] = car_timestamp[car_number] - car_timestamp_previous[car_number]; }
@@ -183,11 +238,13 @@ inline void parse_data_received()
         car_lap_time_array[car_laps[car_number]][car_number] = car_lap_time[car_number];
 
         car_laps[car_number] += 1;
+        event_trace(EVENT_LAP, car_number, uint16_t(min(car_lap_time[car_number], uint32_t(UINT16_MAX))));
 
         /* sensorcar needs to be car 0 */
         if (car_number == 0)
         {
             send_data_wirelessly(CAR_NO_0_PASSED_FINISH_LINE); /* notify sensorcar that it passed the finish line */
+            car_derailed[0] = false;    /* in case the report that it is racing again got lost */
         }
 
         /* if race is going (race_status is RACE_GOING) and a car has completed the required amount of laps, stop the race. */
@@ -207,7 +264,11 @@ inline void parse_data_received()
             xSemaphoreTake(dac_access_semaphore,0); /* lock DAC access */
             dac_output_voltage(DAC_CHANNEL_1, 0);   /* stop car */
             race_status = NO_RACE_GOING;
+            event_trace_state(race_status);
             send_data_wirelessly(race_status);
+            #if LINK_MONITOR
+                link_survey_request();  /* look for a cleaner channel while the track is idle */
+            #endif
         }
 
         #if DEBUG
@@ -215,7 +276,7 @@ inline void parse_data_received()
             Serial.printf("Car Number %d has a lap time of %dms. \n", car_number, car_lap_time[car_number]);
         #endif
 
-        xSemaphoreGive(print_data_semaphore);
+        handoff_give(HANDOFF_PRINT_DATA, print_data_semaphore);
     }
 }
 
@@ -223,10 +284,11 @@ IRAM_ATTR void press_start_button()
 {
     if ( xSemaphoreTake(serial2_access_semaphore,portMAX_DELAY) == pdTRUE )
     {   
-        while (serial_interface_2.available() > 0) { serial_interface_2.read(); }   /* clear serial buffer */
+        feed_cu_parser();                                                           /* responses that are still due */
         serial_interface_2.print(PRESS_START);                                      /* send request to start race */
         DELAY_N_MS(20);                                                             /* wait for response */
         while (serial_interface_2.available() > 0) { serial_interface_2.read(); }
+        cu_parser_reset(&cu_parser);                                                /* bytes were discarded */
         xSemaphoreGive(serial2_access_semaphore);
     }
 }
@@ -256,6 +318,18 @@ IRAM_ATTR void print_car_data()
         #if DISPLAY_OUTPUT_ENABLE
             display_victory_screen();
         #endif
+        #if SERIAL_USERDATA_PRINT && (PRINT_HANDOFF_COUNTERS || PRINT_TASK_MEMORY || (LINK_MONITOR && PRINT_LINK_STATS))
+            console_drain();    /* the diagnostics go below the victory screen instead of being overwritten by it */
+        #endif
+        #if PRINT_HANDOFF_COUNTERS
+            print_handoff_counters();
+        #endif
+        #if PRINT_TASK_MEMORY
+            print_task_memory();
+        #endif
+        #if LINK_MONITOR && PRINT_LINK_STATS
+            print_link_stats();
+        #endif
         return;
     }
     /* A race is currently going and a car recently passed the finish line -> print statistics */
@@ -266,8 +340,10 @@ IRAM_ATTR void print_car_data()
             Serial.println("Position\tCar Number\tLaps\tLap Time\tImprovement");
         #endif
         #if SERIAL_USERDATA_PRINT
-            Serial.print(TEXT_PUSH_DOWN_STRING); /* push old data down */
-            Serial.printf("Position\tAuto\tRunden\tRundenzeit\tvs. Vorher\r\n");
+            console_begin(true);
+            #if CONSOLE_SCREEN
+                console_printf("Position\tAuto\tRunden\tRundenzeit\tvs. Vorher\r\n");
+            #endif
         #endif
         #if DISPLAY_OUTPUT_ENABLE
             display_128x64.setFont(u8g2_font_ncenB08_tr);
@@ -301,24 +377,55 @@ IRAM_ATTR void print_car_data()
                         car_lap_time[ii],
                         car_lap_time_improvement[ii]);
                 #endif
-                #if SERIAL_USERDATA_PRINT
-                    Serial.printf("%d.\t\t#%d\t%d/%d\t%.3fs\t\t%.3fs\r\n",
-                        car_position[ii],
+                #if CONSOLE_SCREEN
+                    if (car_derailed[ii])
+                    {
+                        console_printf("%d.\t\t#%d\t%d/%d\tENTGLEIST\r\n",
+                            car_position[ii],
+                            ii + 1,
+                            car_laps[ii], number_laps_in_race);
+                    }
+                    else
+                    {
+                        console_printf("%d.\t\t#%d\t%d/%d\t%.3fs\t\t%.3fs\r\n",
+                            car_position[ii],
+                            ii + 1,
+                            car_laps[ii], number_laps_in_race,
+                            car_lap_time[ii]/1000.0,
+                            car_lap_time_improvement[ii]/1000.0);
+                    }
+                #elif CONSOLE_COMPACT
+                    console_printf("CAR\t%d\t%d\t%d\t%d\t%u\t%lld\t%d\n",
                         ii + 1,
+                        car_position[ii],
                         car_laps[ii], number_laps_in_race,
-                        car_lap_time[ii]/1000.0,
-                        car_lap_time_improvement[ii]/1000.0);
+                        (unsigned int)car_lap_time[ii],
+                        car_lap_time_improvement[ii],
+                        car_derailed[ii]);
                 #endif                
                 #if DISPLAY_OUTPUT_ENABLE
                     display_128x64.setCursor(0, 12*(ii+2));
-                    display_128x64.printf("%d. #%d %d/%d %dms",
-                        car_position[ii],
-                        ii + 1,
-                        car_laps[ii], number_laps_in_race,
-                        car_lap_time[ii]);
+                    if (car_derailed[ii])
+                    {
+                        display_128x64.printf("%d. #%d %d/%d ENTGL.",
+                            car_position[ii],
+                            ii + 1,
+                            car_laps[ii], number_laps_in_race);
+                    }
+                    else
+                    {
+                        display_128x64.printf("%d. #%d %d/%d %dms",
+                            car_position[ii],
+                            ii + 1,
+                            car_laps[ii], number_laps_in_race,
+                            car_lap_time[ii]);
+                    }
                 #endif
             }
         }
+        #if SERIAL_USERDATA_PRINT
+            console_end();
+        #endif
         #if DISPLAY_OUTPUT_ENABLE
             display_128x64.sendBuffer();
             display_128x64.clearBuffer();
@@ -340,8 +447,9 @@ inline void display_victory_screen()
 
 inline void print_victory_screen()
 {
-    Serial.print(TEXT_PUSH_DOWN_STRING);
-    Serial.printf("\
+    console_begin(true);
+    #if CONSOLE_SCREEN
+    console_printf("\
   ___________________\r\n\
 ||@|@| | |@|@| | |@|@|\r\n\
 ||@|@|_|_|@|@|_|_|@|@|\r\n\
@@ -355,8 +463,12 @@ inline void print_victory_screen()
 || Sieger des Rennens:\r\n\
 ||    Spieler %d\r\n\
 || Mittlere Rundenzeit: %.3lfs\r\n\
-|| Standardabweichung: %.3lfs\r\n", winning_car, winner_lap_time_average/1000.0, winner_lap_time_standard/1000.0);
-
+|| Standardabweichung: %.3lfs\r\n\
+|| Entgleisungen: %d\r\n", winning_car, winner_lap_time_average/1000.0, winner_lap_time_standard/1000.0, car_derailments[winning_car-1]);
+    #else
+    console_printf("WIN\t%d\t%.0f\t%.0f\t%d\n", winning_car, winner_lap_time_average, winner_lap_time_standard, car_derailments[winning_car-1]);
+    #endif
+    console_end();
 }
 
 IRAM_ATTR void process_light_state()
@@ -366,7 +478,7 @@ IRAM_ATTR void process_light_state()
     {
         case '7':   /* countdown state 0 */
             #if SERIAL_USERDATA_PRINT
-                Serial.println("LOS!");
+                console_line("LOS!");
             #endif
             race_status = RACE_GOING;
         break;        
@@ -383,21 +495,26 @@ IRAM_ATTR void process_light_state()
             memset(car_lap_time_improvement,    0, 32);
             memset(car_lap_time_sum,            0, 32); /* double is 8 byte on ESP32 */
             memset(car_lap_time_array,          0, 8192);
+            memset(car_derailed,                0, 4);
+            memset(car_derailments,             0, 4);
+            #if LINK_MONITOR
+                link_race_stats_reset();
+            #endif
             race_status = NO_RACE_GOING;
             #if SERIAL_USERDATA_PRINT
                 print_eva_logo();
-                Serial.println("Der Countdown ist bereit.");
+                console_line("Der Countdown ist bereit.");
             #endif
         break;
         case '2':   /* countdown state 5. A new race will start soon. */
             #if SERIAL_USERDATA_PRINT
-                Serial.println("Das Rennen startet gleich!");
+                console_line("Das Rennen startet gleich!");
             #endif
             race_status = NO_RACE_GOING;
         break;
         case '3':   /* countdown state 4 */
             #if SERIAL_USERDATA_PRINT
-                Serial.println("AUF DIE PLAETZE...");
+                console_line("AUF DIE PLAETZE...");
                 break;
             #endif
             race_status = NO_RACE_GOING;
@@ -406,7 +523,7 @@ IRAM_ATTR void process_light_state()
         break;    
         case '5':   /* countdown state 2 */
             #if SERIAL_USERDATA_PRINT
-                Serial.println("FERTIG...");
+                console_line("FERTIG...");
             #endif
             race_status = NO_RACE_GOING;
         break;            
@@ -414,7 +531,7 @@ IRAM_ATTR void process_light_state()
         break;     
         case '8':   /* early start state 0, fallthrough on purpose */
             #if SERIAL_USERDATA_PRINT
-                Serial.println("Fruehstart!");         
+                console_line("Fruehstart!");         
             #endif
         case '9':   /* early start state 1 */
             race_status = NO_RACE_GOING;
@@ -436,8 +553,17 @@ IRAM_ATTR void process_light_state()
         xSemaphoreGive(dac_access_semaphore);   /* free DAC */
     }
 
+    event_trace_state(race_status);
+    #if CONSOLE_COMPACT
+        console_begin(false);
+        console_printf("LIGHT\t%c\n", light_state);
+        console_end();
+    #endif
     if (light_state != '0')
     {
+        #if LINK_MONITOR
+            link_survey_abort();            /* a race is coming, back to the home channel. The next light states reach the sensorcar there. */
+        #endif
         send_data_wirelessly(race_status);  /* transmit race status, but only when state is not idle state, since that one does not give a good indication of where the state machine inside the CU is. */
     }
 }
\ No newline at end of file
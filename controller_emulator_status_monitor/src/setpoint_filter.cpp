@@ -0,0 +1,16 @@
+#include "setpoint_filter.h"
+
+IRAM_ATTR uint8_t setpoint_filter(setpoint_filter_t* filter, uint16_t session, uint8_t sequence)
+{
+    if (filter->any_applied && (session == filter->session))
+    {
+        int8_t sequence_difference = int8_t(sequence - filter->sequence);
+        if (sequence_difference == 0)                                                           { return SETPOINT_ACK_AGAIN; }
+        if ((sequence_difference < 0) && (sequence_difference >= -SETPOINT_REORDER_WINDOW))    { return SETPOINT_DROP; }
+    }
+    /* first setpoint, first one of a rebooted sensorcar, or newer */
+    filter->any_applied = true;
+    filter->session     = session;
+    filter->sequence    = sequence;
+    return SETPOINT_APPLY;
+}
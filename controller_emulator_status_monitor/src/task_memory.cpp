@@ -0,0 +1,49 @@
+#include "task_memory.h"
+
+typedef struct
+{
+    TaskHandle_t task_handle;
+    const char*  name;
+    uint32_t     stack_size;    /* in bytes */
+} task_memory_entry_t;
+
+DRAM_ATTR task_memory_entry_t task_memory_entries[TASK_MEMORY_MAX_TASKS];
+DRAM_ATTR uint8_t             task_memory_number_tasks = 0;
+
+void create_task(TaskFunction_t task_function, const char* name, uint32_t stack_size, UBaseType_t priority, TaskHandle_t* task_handle, BaseType_t core, StackType_t* stack, StaticTask_t* control_block)
+{
+    TaskHandle_t created_task_handle = NULL;
+    #if STATIC_ALLOCATION
+        created_task_handle = xTaskCreateStaticPinnedToCore(task_function, name, stack_size, NULL, priority, stack, control_block, core);
+    #else
+        xTaskCreatePinnedToCore(task_function, name, stack_size, NULL, priority, &created_task_handle, core);
+    #endif
+    if (task_handle != NULL) { *task_handle = created_task_handle; }
+
+    if (created_task_handle == NULL)
+    {
+        Serial.printf("Task %s could not be created.\n", name);
+        return;
+    }
+    if (task_memory_number_tasks < TASK_MEMORY_MAX_TASKS)
+    {
+        task_memory_entries[task_memory_number_tasks] = { created_task_handle, name, stack_size };
+        task_memory_number_tasks++;
+    }
+}
+
+/* stack size and high-water mark (the least unused stack so far) of every task, then the heap */
+void print_task_memory()
+{
+    Serial.println("Task memory (stack size/unused in bytes):");
+    for (uint8_t ii = 0; ii < task_memory_number_tasks; ii++)
+    {
+        unsigned int unused_stack = uxTaskGetStackHighWaterMark(task_memory_entries[ii].task_handle);   /* in bytes on the ESP32 */
+        Serial.printf("%s\t%u/%u%s\n",
+            task_memory_entries[ii].name,
+            (unsigned int)task_memory_entries[ii].stack_size,
+            unused_stack,
+            (unused_stack < TASK_MEMORY_STACK_WARNING) ? "\tLOW" : "");
+    }
+    Serial.printf("Heap free %u, minimum free %u, largest block %u bytes\n", ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+}
@@ -1,6 +1,31 @@
 #include "wireless_transmission.h"
+#include "handoff_accounting.h"
+#include "event_trace.h"
+#include "setpoint_filter.h"
+#if LINK_MONITOR
+  #include "link_quality.h"
+#endif
+
+/* newest received setpoint, waiting for setpoint_task */
+typedef struct
+{
+  setpoint_packet_t setpoint_packet;
+  uint32_t          receive_timestamp;
+} received_setpoint_t;
+
+DRAM_ATTR QueueHandle_t setpoint_mailbox = NULL;
+#if STATIC_ALLOCATION
+  DRAM_ATTR uint8_t       setpoint_mailbox_storage[sizeof(received_setpoint_t)];
+  DRAM_ATTR StaticQueue_t setpoint_mailbox_buffer;
+#endif
 
 void init_wifi() {
+  /* before anything can fail, setpoint_task waits on it */
+  #if STATIC_ALLOCATION
+    setpoint_mailbox = xQueueCreateStatic(1, sizeof(received_setpoint_t), setpoint_mailbox_storage, &setpoint_mailbox_buffer);
+  #else
+    setpoint_mailbox = xQueueCreate(1, sizeof(received_setpoint_t));
+  #endif
   WiFi.mode(WIFI_STA);
   esp_wifi_set_mac(WIFI_IF_STA, &newMACAddress[0]); /* overwrite board mac address with known value to make it work on any ESP32*/
 
@@ -38,22 +63,118 @@ IRAM_ATTR void send_data_wirelessly(uint8_t data_to_transmit)
   for (uint8_t ii = WIRELESS_TRANSMISSION_TRIES; ii > 0; ii--)
   {
     esp_now_send(broadcastAddress, (uint8_t *) &data_to_transmit, 1);
+    event_trace(EVENT_ESPNOW_SEND, ESPNOW_RACE_STATUS, data_to_transmit);
     #if DEBUG
       Serial.printf("Transmitting data: %d\n", data_to_transmit);
     #endif
   }
 }
 
+inline void send_setpoint_ack(uint8_t sequence)
+{
+  setpoint_ack_packet_t setpoint_ack_packet = { RECEIVED_VALUE_WIRELESSLY, sequence };
+  esp_now_send(broadcastAddress, (uint8_t *) &setpoint_ack_packet, sizeof(setpoint_ack_packet));
+  event_trace(EVENT_ESPNOW_SEND, ESPNOW_SETPOINT_ACK, sequence);
+}
+
+#if MEASURE_LATENCY
+/* answers a traced speed value with the local timestamps, so the sensorcar can align them to its own clock */
+IRAM_ATTR void send_trace_report(uint16_t trace_id, uint32_t receive_timestamp, uint32_t dac_write_timestamp)
+{
+  trace_report_packet_t trace_report_packet;
+  trace_report_packet.trace_id              = trace_id;
+  trace_report_packet.receive_timestamp     = receive_timestamp;
+  trace_report_packet.dac_write_timestamp   = dac_write_timestamp;
+  trace_report_packet.report_send_timestamp = micros();
+  esp_now_send(broadcastAddress, (uint8_t *) &trace_report_packet, sizeof(trace_report_packet));
+  event_trace(EVENT_ESPNOW_SEND, ESPNOW_TRACE_REPORT, trace_id);
+}
+#endif
+
+/* runs in the WiFi task, so it only hands the setpoint over */
 IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data, int len)
 {
-  /* update DAC with new value, if DAC is accessible. If not, discard the value. */
-  if ( xSemaphoreTake(dac_access_semaphore, 0) == pdTRUE )
+  #if LINK_MONITOR
+    /* link packets have a length of their own and a magic byte */
+    if (link_packet_valid(incoming_data, len))
+    {
+      link_packet_received(incoming_data);
+      return;
+    }
+    link_peer_heard();
+  #endif
+  if (len == sizeof(derailment_report_packet_t))
   {
-    #if DEBUG
-      Serial.printf("Updating DAC with new value %d which was received wirelessly.\n", *incoming_data);
+    derailment_report_packet_t derailment_report_packet;
+    memcpy(&derailment_report_packet, incoming_data, sizeof(derailment_report_packet));
+    if (derailment_report_packet.derailed && !car_derailed[0]) { car_derailments[0] += 1; } /* sensorcar is car 0 */
+    car_derailed[0] = derailment_report_packet.derailed;
+    event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_DERAILMENT, (derailment_report_packet.derailed << 8) | derailment_report_packet.track_position_index);
+    handoff_give(HANDOFF_DERAILMENT, print_data_semaphore);   /* show it right away */
+    return;
+  }
+  if (len != sizeof(setpoint_packet_t)) { return; }
+
+  received_setpoint_t received_setpoint;
+  received_setpoint.receive_timestamp = micros();
+  memcpy(&received_setpoint.setpoint_packet, incoming_data, sizeof(setpoint_packet_t)); /* incoming data is not necessarily aligned */
+  event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_SETPOINT, (received_setpoint.setpoint_packet.sequence << 8) | received_setpoint.setpoint_packet.speed_digital);
+  #if LINK_MONITOR
+    link_setpoint_received(received_setpoint.setpoint_packet.session, received_setpoint.setpoint_packet.sequence);
+  #endif
+  if (uxQueueMessagesWaiting(setpoint_mailbox) > 0) { handoff_counters[HANDOFF_SETPOINT_RECEIVE].coalesced += 1; } /* the older one is never processed */
+  xQueueOverwrite(setpoint_mailbox, &received_setpoint);
+}
+
+/* deferred work of on_data_receive: duplicate suppression, DAC write and ack */
+IRAM_ATTR void setpoint_task(void*)
+{
+  setpoint_filter_t   filter = { false, 0, 0 };
+  received_setpoint_t received_setpoint;
+
+  for(;;)
+  {
+    if (xQueueReceive(setpoint_mailbox, &received_setpoint, portMAX_DELAY) != pdTRUE) { continue; }
+    setpoint_packet_t* setpoint_packet = &received_setpoint.setpoint_packet;
+
+    uint8_t verdict = setpoint_filter(&filter, setpoint_packet->session, setpoint_packet->sequence);
+    if (verdict == SETPOINT_ACK_AGAIN)
+    {
+      /* retransmission, the ack got lost */
+      handoff_count_rejected(HANDOFF_SETPOINT_RECEIVE);
+      send_setpoint_ack(setpoint_packet->sequence);
+      continue;
+    }
+    if (verdict == SETPOINT_DROP)
+    {
+      /* overtaken by a newer setpoint, applying it would go back in time */
+      handoff_count_rejected(HANDOFF_SETPOINT_RECEIVE);
+      continue;
+    }
+    handoff_count_delivered(HANDOFF_SETPOINT_RECEIVE);
+
+    /* update DAC with new value, if DAC is accessible. If not, discard the value. */
+    #if MEASURE_LATENCY
+      uint32_t dac_write_timestamp = 0; /* stays 0 if the DAC is locked and the value is discarded */
+    #endif
+    if ( xSemaphoreTake(dac_access_semaphore, 0) == pdTRUE )
+    {
+      #if DEBUG
+        Serial.printf("Updating DAC with new value %d which was received wirelessly.\n", setpoint_packet->speed_digital);
+      #endif
+      dac_output_voltage(DAC_CHANNEL_1, setpoint_packet->speed_digital);
+      event_trace(EVENT_DAC_WRITE, setpoint_packet->speed_digital, setpoint_packet->sequence);
+      #if MEASURE_LATENCY
+        dac_write_timestamp = micros();
+      #endif
+      xSemaphoreGive(dac_access_semaphore);
+      handoff_count_delivered(HANDOFF_DAC_WRITE);
+    }
+    else { handoff_count_rejected(HANDOFF_DAC_WRITE); }
+
+    send_setpoint_ack(setpoint_packet->sequence); /* received is received, even while the DAC is locked */
+    #if MEASURE_LATENCY
+      if ( (setpoint_packet->trace_id != 0) && dac_write_timestamp ) { send_trace_report(setpoint_packet->trace_id, received_setpoint.receive_timestamp, dac_write_timestamp); }
     #endif
-    dac_output_voltage(DAC_CHANNEL_1, *incoming_data);
-    xSemaphoreGive(dac_access_semaphore);
   }
-  send_data_wirelessly(RECEIVED_VALUE_WIRELESSLY);
-}
\ No newline at end of file
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "globals.h"
+#include "lockfree_queue.h"
+#include "sensor_pipeline.h"
+
+/*
+Cross-core access to the car state.
+Tasks on core 1 keep working on the globals, no task on core 0 reads them.
+Every sample that has to be logged is packed into a log_record_t and queued for log_to_sdcard_task, which formats and writes it on core 0.
+A run is ended by a close marker in the same queue, behind the last sample of the run. Any task can ask for it, sample_imu_task queues it, since it is the only producer.
+The columns of the log file are listed once in log_row_format, the header and every row are printed from that list.
+*/
+
+#define LOG_RECORD_QUEUE_LENGTH     32  /* in samples. Must be a power of two. Bridges SD card write stalls of up to (LOG_RECORD_QUEUE_LENGTH-1)*SAMPLING_INTERVAL. */
+#define LOG_ROW_SIZE                320 /* in bytes, longest header or row of the log file including the terminating zero */
+
+#define LOG_IMU_FRONT               0
+#define LOG_IMU_BACK                1
+
+/* kinds of log records */
+#define LOG_RECORD_SAMPLE           0
+#define LOG_RECORD_CLOSE_RUN        1   /* no sample, the logging task closes the run file */
+
+typedef struct
+{
+    uint8_t  sensorcar_state;
+    uint8_t  track_position_index;
+    uint8_t  speed_digital;
+    double_t ir_left_speed;
+    double_t ir_right_speed;
+    double_t ir_left_speed_trackbased;
+    double_t ir_right_speed_trackbased;
+    double_t car_speed;
+    double_t accel_now;
+} car_state_t;
+
+typedef struct
+{
+    uint8_t         kind;
+    unsigned long   imu_timestamp;
+    car_state_t     car_state;
+    signed long     ir_left_right_time_difference;
+    int16_t         front_imu_raw_data_array[6];
+    int16_t         back_imu_raw_data_array[6];
+    #if CALIBRATE_ACCELERATION
+        double_t    front_imu_calibrated_acceleration_array[3];
+        double_t    back_imu_calibrated_acceleration_array[3];
+    #endif
+} log_record_t;
+
+/* columns of the log file. The names are what tools/log-ingestion looks for. */
+struct log_time_column                 { static constexpr const char* NAME = "Time";                          static int    value(const log_record_t& record) { return (int)record.imu_timestamp; } };
+struct log_target_speed_column         { static constexpr const char* NAME = "Target_Speed";                  static int    value(const log_record_t& record) { return (int)record.car_state.speed_digital; } };
+struct log_ir_left_column              { static constexpr const char* NAME = "IR_Speed_Left";                 static double value(const log_record_t& record) { return record.car_state.ir_left_speed; } };
+struct log_ir_right_column             { static constexpr const char* NAME = "IR_Speed_Right";                static double value(const log_record_t& record) { return record.car_state.ir_right_speed; } };
+struct log_ir_left_trackbased_column   { static constexpr const char* NAME = "IR_Speed_Left_Trackbased";      static double value(const log_record_t& record) { return record.car_state.ir_left_speed_trackbased; } };
+struct log_ir_right_trackbased_column  { static constexpr const char* NAME = "IR_Speed_Right_Trackbased";     static double value(const log_record_t& record) { return record.car_state.ir_right_speed_trackbased; } };
+struct log_estimated_speed_column      { static constexpr const char* NAME = "Estimated_Speed";               static double value(const log_record_t& record) { return record.car_state.car_speed; } };
+struct log_ir_time_difference_column   { static constexpr const char* NAME = "IR_Time_Difference_Left_Right"; static long   value(const log_record_t& record) { return record.ir_left_right_time_difference; } };
+
+constexpr const char* LOG_ACCELERATION_NAMES[2][3]  = { { "Accel_Front_x", "Accel_Front_y", "Accel_Front_z" }, { "Accel_Heck_x", "Accel_Heck_y", "Accel_Heck_z" } };
+constexpr const char* LOG_ROTATION_NAMES[2][3]      = { { "Rot_Front_x",   "Rot_Front_y",   "Rot_Front_z" },   { "Rot_Heck_x",   "Rot_Heck_y",   "Rot_Heck_z" } };
+
+/* calibrated acceleration in g with CALIBRATE_ACCELERATION, raw counts otherwise */
+template <uint8_t IMU, uint8_t AXIS>
+struct log_acceleration_column
+{
+    static constexpr const char* NAME = LOG_ACCELERATION_NAMES[IMU][AXIS];
+    #if CALIBRATE_ACCELERATION
+        static double value(const log_record_t& record) { return (IMU == LOG_IMU_FRONT) ? record.front_imu_calibrated_acceleration_array[AXIS] : record.back_imu_calibrated_acceleration_array[AXIS]; }
+    #else
+        static int    value(const log_record_t& record) { return (IMU == LOG_IMU_FRONT) ? record.front_imu_raw_data_array[AXIS+3] : record.back_imu_raw_data_array[AXIS+3]; }
+    #endif
+};
+
+/* raw counts */
+template <uint8_t IMU, uint8_t AXIS>
+struct log_rotation_column
+{
+    static constexpr const char* NAME = LOG_ROTATION_NAMES[IMU][AXIS];
+    static int value(const log_record_t& record) { return (IMU == LOG_IMU_FRONT) ? record.front_imu_raw_data_array[AXIS] : record.back_imu_raw_data_array[AXIS]; }
+};
+
+typedef log_format<
+    log_time_column, log_target_speed_column,
+    log_ir_left_column, log_ir_right_column, log_ir_left_trackbased_column, log_ir_right_trackbased_column,
+    log_estimated_speed_column, log_ir_time_difference_column,
+    log_acceleration_column<LOG_IMU_FRONT, 0>, log_acceleration_column<LOG_IMU_FRONT, 1>, log_acceleration_column<LOG_IMU_FRONT, 2>,
+    log_rotation_column<LOG_IMU_FRONT, 0>,     log_rotation_column<LOG_IMU_FRONT, 1>,     log_rotation_column<LOG_IMU_FRONT, 2>,
+    log_acceleration_column<LOG_IMU_BACK, 0>,  log_acceleration_column<LOG_IMU_BACK, 1>,  log_acceleration_column<LOG_IMU_BACK, 2>,
+    log_rotation_column<LOG_IMU_BACK, 0>,      log_rotation_column<LOG_IMU_BACK, 1>,      log_rotation_column<LOG_IMU_BACK, 2>
+> log_row_format;
+
+extern DRAM_ATTR spsc_queue<log_record_t, LOG_RECORD_QUEUE_LENGTH>      log_record_queue;
+
+IRAM_ATTR bool queue_log_record();
+IRAM_ATTR void request_log_close();
+IRAM_ATTR void queue_log_close();
@@ -3,12 +3,35 @@
 #include <SPI.h>
 #include "globals.h"
 
+/*
+Every run gets its own file, /run_NNNNN.txt. The logging task creates and preallocates it to RUN_FILE_SIZE while it waits for the run, so no clusters have to be allocated and no FAT has to be updated while data is written.
+Rows are collected in a sector buffer and only whole sectors are written, without reopening the file. Data beyond RUN_FILE_SIZE is still written, with the usual allocation cost.
+Each file starts with '#' metadata rows (firmware settings, accelerometer calibration, track layout), followed by the column header and the data.
+The preallocated rest of the file is not cleared, it holds whatever was on the card before. Only the first data_length bytes of the index entry belong to the run.
+The index file holds one fixed-size run_index_entry_t per run, so a run and its data length are found by seeking to run_number * sizeof(run_index_entry_t) instead of scanning the card.
+The entry is rewritten at every flush, so after a reset it covers everything up to the last flush. The last row of such a run may be cut off.
+*/
+
 #define SD_CS                   13   /* ESP32 pin for CS pin of SD card */
-#define LOG_FILE_NAME           "/data.txt"
-#define CLOSE_FILE_SAMPLE_NO    100 /* close and reopen file every CLOSE_FILE_SAMPLE_NO samples to save them to the SD card. This is slow. */
+#define RUN_FILE_NAME           "/run_%05u.txt"
+#define RUN_INDEX_FILE_NAME     "/runs.idx"
+#define RUN_FILE_SIZE           (8UL*1024*1024)   /* in bytes. About 9 minutes of data at 100 Hz. */
+#define SD_SECTOR_SIZE          512
+#define RUN_FLUSH_SECTORS       16      /* written sectors are committed to the card every RUN_FLUSH_SECTORS, so a power loss costs at most this much */
+
+typedef struct
+{
+    uint32_t run_number;
+    uint32_t start_time_ms;     /* millis() at the start of the run */
+    uint32_t data_length;       /* in bytes, including metadata and header. Everything behind it is preallocated space with old card data. */
+    uint32_t preallocated_size; /* in bytes */
+    uint8_t  complete;          /* 1 once the run was closed. A run with 0 was cut off by a reset, its data_length is that of the last flush. */
+    uint8_t  reserved[3];
+    char     file_name[16];
+} run_index_entry_t;   /* 36 bytes */
 
-IRAM_ATTR void appendFile(fs::FS &fs, const char * path, const char * message);
-IRAM_ATTR void writeFile(fs::FS &fs, const char * path, const char * message);
 void init_SD();
 IRAM_ATTR void init_log_file(const char* log_file_header);
-IRAM_ATTR void close_log_file();
\ No newline at end of file
+IRAM_ATTR void prepare_log_file();
+IRAM_ATTR bool append_to_log(const char* message);
+IRAM_ATTR void close_log_file();   /* only the logging task, other tasks use request_log_close() of car_state.h */
@@ -0,0 +1,26 @@
+#pragma once
+#include "globals.h"
+
+/*
+Derailment detection in the IMU sampling path, see the recordings in tools/derailing-data.
+A derailment starts with a rotation transient: normal cornering stays below about 450 dps, a derailing car spins at 550...900 dps within the first 50ms.
+Afterwards, the car lies on its side or back, so gravity leaves the z axis, and no IR marks arrive anymore.
+Any of the three signatures stops the car: speed is cut right away (the controller is woken up early), the controller emulator is told and the laps in progress are discarded.
+With ALGORITHM_LEARNING, the learned speed of the piece and the one before are lowered.
+Once the car stood upright for DERAILMENT_RECOVERY_MS, it drives slowly until the next finish line passing syncs the position again, then racing continues.
+*/
+
+#define DERAILMENT_ROTATION_THRESHOLD   600.0   /* in dps, rotation rate magnitude of either IMU */
+#define DERAILMENT_TILT_THRESHOLD       0.5     /* in g. The car lies on its side if the low pass filtered z acceleration drops below this. */
+#define DERAILMENT_UPRIGHT_THRESHOLD    0.8     /* in g. The car stands on its wheels again above this. */
+#define DERAILMENT_TILT_SAMPLES         20      /* in samples, time constant of the z acceleration low pass */
+#define DERAILMENT_IR_TIMEOUT_MS        2000    /* no IR mark for this long while the car is driven means it left the slot */
+#define DERAILMENT_RECOVERY_MS          1000    /* time the car has to stand upright after it was put back on the track */
+#define DERAILMENT_RESYNC_VDIGI         38      /* speed while the position is unknown */
+
+extern DRAM_ATTR uint8_t derailment_count;
+
+IRAM_ATTR void      derailment_update();
+IRAM_ATTR void      derailment_reset();
+IRAM_ATTR uint8_t   derailment_speed_digital();
+IRAM_ATTR void      derailment_resync();
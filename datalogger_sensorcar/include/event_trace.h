@@ -0,0 +1,59 @@
+#pragma once
+#include "globals.h"
+
+/*
+Crash-surviving event trace.
+Events are written as 8 byte entries into a ring in RTC slow memory. RTC_NOINIT_ATTR memory is neither cleared by ESP.restart(), a panic nor a watchdog reset, only a power cycle loses it (detected by EVENT_TRACE_MAGIC).
+At the next boot, dump_event_trace() outputs the entries written since the last dump together with the reset reason via the serial terminal, so the last moments before a stall or reset can be read without a debugger:
+EVENT <boot> <timestamp in us since that boot> <event> <value8> <value16>
+Entries are written from tasks and the wireless receive callback on both cores, a spinlock keeps them whole. Not to be used from ISRs.
+The event list is the same on both boards up to EVENT_ESPNOW_RECEIVE, so traces of both can be read side by side.
+*/
+
+#define EVENT_TRACE_LENGTH          256         /* entries, must be a power of two. RTC slow memory has 8 kB. */
+#define EVENT_TRACE_MAGIC           0x45564131  /* marks a ring that was written by this firmware since the last power cycle */
+
+/* events and the meaning of value8, value16 */
+#define EVENT_BOOT                  0   /* esp_reset_reason(), boot number */
+#define EVENT_RESTART               1   /* RESTART_ reason below. Written right before ESP.restart(). */
+#define EVENT_STATE                 2   /* new sensorcar_state, previous sensorcar_state */
+#define EVENT_HANDOFF_COALESCED     3   /* hand-off channel, number of events merged into one, see handoff_accounting.h */
+#define EVENT_HANDOFF_REJECTED      4   /* hand-off channel, 0 */
+#define EVENT_ESPNOW_SEND           5   /* ESPNOW_ message below, its content */
+#define EVENT_ESPNOW_RECEIVE        6   /* ESPNOW_ message below, its content */
+#define EVENT_IR_MARK               7   /* track_position_index after the mark, car_speed in mm/s */
+#define EVENT_CONTROLLER            8   /* new vdigi, track_position_index */
+#define EVENT_POWER                 9   /* 1 powered down, 0 woke up. See power_management.h */
+#define EVENT_CHANNEL               10  /* new Wi-Fi channel, channel hops since boot. See channel_hop.h */
+#define EVENT_COUNT                 11
+
+/* messages of EVENT_ESPNOW_SEND and EVENT_ESPNOW_RECEIVE */
+#define ESPNOW_SETPOINT             0   /* sequence << 8 | vdigi */
+#define ESPNOW_SETPOINT_RETRANSMIT  1   /* sequence << 8 | vdigi */
+#define ESPNOW_SETPOINT_ACK         2   /* sequence */
+#define ESPNOW_RACE_STATUS          3   /* race status, see wireless_transmission.h */
+#define ESPNOW_DERAILMENT           4   /* derailed << 8 | track_position_index */
+#define ESPNOW_TRACE_REPORT         5   /* latency trace id */
+#define ESPNOW_LINK                 6   /* link packet type << 8 | channel, see link_monitor.h */
+
+/* reasons of EVENT_RESTART */
+#define RESTART_SD_MOUNT_FAILED     0
+#define RESTART_SD_CARD_MISSING     1
+
+typedef struct
+{
+    uint32_t timestamp;     /* in us since boot */
+    uint8_t  event;
+    uint8_t  value8;
+    uint16_t value16;
+} event_trace_entry_t;
+
+#if EVENT_TRACE
+    void            dump_event_trace();
+    IRAM_ATTR void  event_trace(uint8_t event, uint8_t value8, uint16_t value16);
+    IRAM_ATTR void  event_trace_state(uint8_t state);
+#else
+    inline void     dump_event_trace() {}
+    inline void     event_trace(uint8_t event, uint8_t value8, uint16_t value16) {}
+    inline void     event_trace_state(uint8_t state) {}
+#endif
@@ -4,15 +4,32 @@
 /* settings that affect much of the code functionality */
 #define DEBUG                       0   /* debug output in main loop via serial port, slows down the timer, etc to ease debug. Disable for final code. 0:disabled 1:enabled */
 #define MEASURE_RTT                 0   /* enable tic and toc functions for measuring round trip time and outputting it to the serial terminal */
+#define MEASURE_LATENCY             0   /* trace every speed change caused by an IR mark through controller, ESP-NOW and the DAC write of the controller emulator. Aligned traces are output via the serial terminal. Needs the same setting on the controller emulator. */
 #define CALIBRATE_ACCELERATION      1   /* use correction values measured and calculated externally to align axes of the accelerometers to that of the car. Set to 0 to obtain sensor raw values. */
+#define IMU_BIAS_TRACKING           1   /* estimate gyro and acceleration biases of both IMUs whenever the car stands still and subtract them from every sample. See imu_bias_tracking.h */
 #define CALIBRATE_IR_SPEED          0   /* use correction values measured and calculated externally to better match the speed data derived from passing tape to that of the speed derived from the time between segment passings an TRACK_STRAIGHTs. */
-#define WIRELESS_TRANSMISSION_TRIES 1   /* because it's not certain that the other uC has received the message, we send a couple times. */
+#define TRACK_REFINEMENT            1   /* keep classifying the track pieces during racing laps and correct the mapped layout by majority vote. See track_data.h */
+#define TRACK_SHAPE                 1   /* reconstruct the x-y shape of the mapping lap from the yaw rate and the IR speeds, close the loop and snap it to the track pieces. Replaces the IR classification of the mapping lap if the snapped layout closes. See track_shape.h */
+#define VEHICLE_DYNAMICS            1   /* estimate yaw rate, yaw acceleration and rear slip from both IMUs and back off the speed when the rear slides out. See vehicle_dynamics.h */
+#define DERAILMENT_DETECTION        1   /* stop the car when the IMUs or missing IR marks show a derailment and resume racing once it is back on the track */
+#define PRINT_HANDOFF_COUNTERS      0   /* periodically output how many samples, IR events and log rows were handed between tasks and how many got lost via the serial terminal */
+    #define HANDOFF_COUNTERS_PRINT_INTERVAL_MS  5000
+#define EVENT_TRACE                 1   /* keep the last state transitions, hand-off losses, ESP-NOW messages, IR marks and controller outputs in RTC memory and output them via the serial terminal after a reset. See event_trace.h */
+#define IDLE_POWER_SAVING           1   /* after a minute in SENSORCAR_IDLE_STATE, power down the IMUs, halt the scheduler and let the CPU clock down and light sleep until the next race status message. Only in RACING_MODE. See power_management.h */
+#define LINK_MONITOR                1   /* measure loss, round trip time and RSSI of the ESP-NOW link and follow the controller emulator when it moves both boards to a cleaner Wi-Fi channel between races. Needs the same setting on the controller emulator. See link_quality.h */
+#define PRINT_LINK_STATS            0   /* periodically output the link statistics and the current channel via the serial terminal */
+    #define LINK_STATS_PRINT_INTERVAL_MS        5000
+#define STATIC_ALLOCATION           1   /* stacks and control blocks of all tasks, semaphores and queues are reserved in DRAM at link time instead of being taken from the heap. See task_memory.h */
+#define PRINT_TASK_MEMORY           0   /* periodically output the stack high-water mark of every task and the heap state via the serial terminal */
+    #define TASK_MEMORY_PRINT_INTERVAL_MS       10000
 
 /* states for operational mode */
     #define RACING_MODE                 0   /* car drives a lap to determine track layout, then runs a strategy depending on ALGORITHM_TYPE */
     #define MEASURING_MODE              1   /* car drives according to set program rules according to MEASURE_SYSTEM while recording data */
+    #define IMU_CALIBRATION_MODE        2   /* car stands still. Guided over the serial terminal, it is put into six poses and the accelerometer calibration for ACCELERATION_SCALE is stored in NVS. See imu_calibration.h */
 #define OPERATION_MODE                  RACING_MODE   /* set one of the modes above */
 #define DATA_LOGGING                    (OPERATION_MODE==MEASURING_MODE)   /* if true, log data to SD card */
+#define NVS_NAMESPACE                   "eva"   /* key value storage in the NVS flash partition for everything the car measures about itself */
 
 /* states for MEASURE_SYSTEM */
     #define MEASURE_MODE_SWEEP          1   /* drive a different speed each race with a start, increment and running condition */
@@ -21,6 +38,8 @@
         #define VDIGI_MAX_VALUE             110     /* if a testing value would go over this threshold, it will delete the task instead of testing it. */
         #define TIME_HELD_MS                6000    /* in milliseconds. Time to hold the current speed setting. Will be rounded to the nearest multiple of MEASUREMENT_TIMER_INTERVAL. About 100ms Latency will be added, too. */
         #define TIME_MEASURE_MS             0    /* in milliseconds. Time to measure after setting speed back to 0. Will be rounded to the nearest multiple of MEASUREMENT_TIMER_INTERVAL. About 100ms Latency will be added, too. */
+    #define MEASURE_MODE_CHARACTERIZATION 2 /* drive every vdigi of AVAILABLE_VDIGI until the speed is steady, then store speed, variance and time constant of every step in NVS. Needs a track made of straights only. See speed_characterization.h */
+    #define MEASURE_MODE_IDENTIFICATION 3   /* drive step and PRBS patterns and identify dead time, time constant and gain of the car from the IMU acceleration. Stored in NVS and used by the controller. Needs a track made of straights only. See plant_identification.h */
 #define MEASURE_SYSTEM                  MEASURE_MODE_SWEEP   /* set one of the modes above */
 
 /* states for ALGORITHM_TYPE */
@@ -28,6 +47,7 @@
     #define ALGORITHM_SIMPLE            1   /* drive a set speed based on the next track piece */
     #define ALGORITHM_AVERAGE           2   /* drive a set speed based on the average of the next ALGORITHM_AVERAGE_NEXT_NUMBER track pieces */
         #define ALGORITHM_AVERAGE_NUMBER   5
+    #define ALGORITHM_LEARNING          3   /* drive a learned speed per track position, adapted after every lap to the lateral acceleration and rotation rate measured there. See speed_learning.h */
 #define ALGORITHM_TYPE                  ALGORITHM_AVERAGE   /* set one of the modes above */
 
 /* states for sensorcar */
@@ -35,6 +55,7 @@
 #define SENSORCAR_RACING_STATE          1   /* car drives according to ALGORITHM_TYPE */
 #define SENSORCAR_TRACK_MAPPING_STATE   2   /* car drives a lap to determine track layout, then stops */
 #define SENSORCAR_MEASUREMENT_STATE     3   /* car drives according to set program rules according to MEASURE_SYSTEM while recording data */
+#define SENSORCAR_DERAILED_STATE        4   /* car derailed. Stands still until it is back on the track, then drives slowly until the finish line syncs its position. See derailment_detection.h */
 #define SENSORCAR_INITIAL_STATE         SENSORCAR_IDLE_STATE   /* initialization value for the state variable */
 
 /* FreeRTOS Settings*/
@@ -49,16 +70,31 @@ Note: If a task is run as only active task on a core and its priority is higher
 #define MEASUREMENT_PRIO            IDLE_PRIO+1
 #define IR_SENSOR_PROCESS_PRIO      IDLE_PRIO+1
 #define VELOCITY_CONTROLLER_PRIO    IDLE_PRIO+1
+#define PRINT_TASK_PRIO             IDLE_PRIO+1   /* tasks that only format and print reports */
 
 /* Task Cores
 main loop and setup run on core 1, wireless receive runs on core 0.
-IMPORTANT: Tasks that share data should not be on different cores, since global variables are used instead of the 'proper' way with queues, because it's faster.
+IMPORTANT: Tasks that share global variables directly must be on the same core. Tasks on the other core only get data through the lock-free queue in car_state.h.
+Sampling, IR processing and control stay on core 1. Formatting and writing log records runs on core 0 next to wireless receive, so SD card stalls never delay control.
 */
 #define IMU_SAMPLE_CORE             1
-#define DATA_LOG_CORE               1
+#define DATA_LOG_CORE               0
 #define MEASUREMENT_CORE            1
 #define IR_SENSOR_PROCESS_CORE      1
 #define VELOCITY_CONTROLLER_CORE    1
+#define PRINT_TASK_CORE             0   /* reports stay off the core that runs control */
+
+/* Task stack sizes
+In bytes, the ESP32 port of FreeRTOS counts stack depth in bytes, not in words. Check them with PRINT_TASK_MEMORY after changing a task.
+These are estimates from what each task calls, none of them was measured on the car yet. Build with PRINT_TASK_MEMORY and drive a few laps
+in every mode, then shrink a stack only where the reported high water mark leaves more than 1024 bytes.
+*/
+#define IMU_SAMPLE_STACK            6144    /* the stage pipelines inline into the task, I2C reads and the %lf prints of DEBUG */
+#define DATA_LOG_STACK              8192    /* row formatting buffers and the SD library */
+#define MEASUREMENT_STACK           6144    /* plant identification and NVS writes */
+#define IR_SENSOR_PROCESS_STACK     4096
+#define VELOCITY_CONTROLLER_STACK   4096
+#define PRINT_TASK_STACK            4096    /* tasks that only format and print reports */
 
 #define DELAY_N_MS(n) (vTaskDelay(n/portTICK_PERIOD_MS))    /* puts a task into the blocked state for N microseconds */
 
@@ -73,14 +109,10 @@ extern DRAM_ATTR TaskHandle_t velocity_controller_task_handle;
 extern DRAM_ATTR TaskHandle_t track_mapper_task_handle;
 
 /* Semaphores
-Used to notify tasks or block shared resources.
+Used to block shared resources or to pass flags.
+Periodic jobs and new IR data wake their tasks with direct-to-task notifications instead, see timer_setup.h and handoff_accounting.h.
 */
-extern DRAM_ATTR SemaphoreHandle_t sampling_semaphore;              /* is set by a timer to sample the IMUs at set time intervals */
-extern DRAM_ATTR SemaphoreHandle_t logging_semaphore;               /* is set when there is new IMU data to log to the sd card  */
 extern DRAM_ATTR SemaphoreHandle_t sd_card_access_semaphore;        /* used for access to the shared resource 'sd card' */
-extern DRAM_ATTR SemaphoreHandle_t measurement_timer_semaphore;   /* is set every time the measurement timer overflows */
-extern DRAM_ATTR SemaphoreHandle_t ir_data_semaphore;               /* is set when new IR data has arrived */
-extern DRAM_ATTR SemaphoreHandle_t controller_timer_semaphore;      /* is set every time the controller timer overflows */
 extern DRAM_ATTR SemaphoreHandle_t finish_line_passed_semaphore;    /* is set every time the car passes the finish line and receives the notification for it wirelessly */
 
 extern DRAM_ATTR unsigned long toc_tic_time_difference; /* time difference between calls of the tic() and toc() functions */
@@ -96,6 +128,7 @@ extern DRAM_ATTR double_t ir_right_speed_trackbased;
 extern DRAM_ATTR double_t car_speed;        
 extern DRAM_ATTR double_t accel_now;        
 extern DRAM_ATTR double_t accel_previous;   
+extern DRAM_ATTR uint32_t ir_mark_sequence;
 
 extern DRAM_ATTR uint8_t  sensorcar_state;
 extern DRAM_ATTR bool     track_mapped_out_flag;
@@ -0,0 +1,39 @@
+#pragma once
+#include "globals.h"
+
+/*
+Accounting for every producer/consumer hand-off.
+Producers wake their consumer with a direct-to-task notification, which counts. The consumer takes all pending notifications at once, so everything beyond the first one was coalesced (the consumer only sees the most recent global data).
+Events that could not be handed over at all are rejected, for example a sample for a full log queue. A notification can't fail, so notification channels never reject, a consumer that falls behind shows up as coalesced.
+Each counter has exactly one writer (the consumer for delivered and coalesced, the producer for rejected), so no locking is needed.
+For the same reason the counters are never cleared from another task. handoff_counters_start_run() keeps a copy instead, and sprint_handoff_counters() reports the difference, so every run file gets the counts of its own run.
+*/
+
+/* hand-off channels */
+#define HANDOFF_IMU_SAMPLING        0   /* scheduler -> sample_imu_task */
+#define HANDOFF_CONTROLLER_TIMER    1   /* scheduler -> velocity_controller_task */
+#define HANDOFF_MEASUREMENT_TIMER   2   /* scheduler -> measurement_task */
+#define HANDOFF_IR_DATA             3   /* IR isr -> ir_sensor_process_task */
+#define HANDOFF_LOGGING             4   /* sample_imu_task -> log_to_sdcard_task. Samples are queued, so none are coalesced. A sample is rejected if the queue is full. */
+#define HANDOFF_SD_WRITE            5   /* log_to_sdcard_task -> SD card. A row is rejected if the card is busy. */
+#define HANDOFF_LOGGING_TIMER       6   /* scheduler -> log_to_sdcard_task. Coalesced if writing the queued records took longer than LOGGING_INTERVAL. */
+#define HANDOFF_SETPOINT            7   /* controller -> controller emulator. Delivered when acknowledged, coalesced when replaced by a newer setpoint before its ack, rejected when the latency budget ran out. */
+#define HANDOFF_LINK                8   /* wireless receive and setpoint delivery -> link_task. Rejected when link_mailbox is full. See link_quality.h */
+#define HANDOFF_COUNT               9
+
+typedef struct
+{
+    uint32_t delivered;     /* events the consumer processed */
+    uint32_t coalesced;     /* events that arrived while the consumer was busy and were merged into the next one */
+    uint32_t rejected;      /* events the producer could not hand over at all */
+} handoff_counter_t;
+
+extern DRAM_ATTR handoff_counter_t handoff_counters[HANDOFF_COUNT];
+
+IRAM_ATTR void  handoff_notify_from_isr(TaskHandle_t task_handle, BaseType_t* higher_priority_task_woken);
+IRAM_ATTR bool  handoff_wait(uint8_t channel, TickType_t ticks_to_wait);
+IRAM_ATTR void  handoff_count_delivered(uint8_t channel);
+IRAM_ATTR void  handoff_count_rejected(uint8_t channel);
+void            handoff_counters_start_run();
+int             sprint_handoff_counters(char* buffer, size_t buffer_length);
+void            handoff_counters_print_task(void*);
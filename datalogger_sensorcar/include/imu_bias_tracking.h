@@ -0,0 +1,27 @@
+#pragma once
+#include "globals.h"
+
+/*
+Bias tracking at standstill (zero-velocity detection).
+The car stands still if its last command was below ZERO_VELOCITY_MAX_VDIGI, no IR mark was seen for ZERO_VELOCITY_IR_SILENCE_MS and the raw accelerations of both IMUs barely vary over the last ZERO_VELOCITY_WINDOW samples.
+The command keeps a car that crawls between two marks with a smooth motor from being taken for standing, which would zero its speed mid-drive.
+While it does, every sample updates the bias of each IMU: the gyros must read zero, the calibrated accelerometers must read 0g, 0g, 1g.
+The estimate starts as a plain average and becomes a slow exponential average, so thermal drift is followed for as long as the car runs.
+The biases are subtracted right after every imu_read(), and the integrated IMU speed is set to zero at standstill.
+*/
+
+#define ZERO_VELOCITY_WINDOW            32      /* in samples */
+#define ZERO_VELOCITY_IR_SILENCE_MS     500     /* a driving car passes an IR mark at least this often */
+#define ZERO_VELOCITY_MAX_VDIGI         10      /* the CU does not power the motor below this vdigi, see speed_digital in globals.cpp */
+#define ZERO_VELOCITY_ACCEL_THRESHOLD   0.01    /* in g. Standstill if the standard deviation of every acceleration axis in the window is smaller. */
+#define BIAS_TRACKING_RATE              0.01    /* weight of the newest sample once the average is settled. 1/rate samples is the time constant. */
+#define BIAS_TRACKING_LEVEL_THRESHOLD   0.3     /* in g. No bias is learned while the calibrated z acceleration is further from 1g, the car is not standing level (e.g. derailed). */
+
+#define GYRO_SENSITIVITY                0.070   /* in dps per LSB at SCALE_2000DPS, see datasheet table 3 */
+
+extern DRAM_ATTR bool     imu_standstill;
+extern DRAM_ATTR double_t front_imu_rotation_rate[3];   /* bias corrected, in dps */
+extern DRAM_ATTR double_t back_imu_rotation_rate[3];
+
+IRAM_ATTR void     imu_bias_update();
+IRAM_ATTR double_t imu_rotation_rate_magnitude();  /* in dps, larger one of both IMUs. Bias corrected with IMU_BIAS_TRACKING. */
@@ -0,0 +1,25 @@
+#pragma once
+#include "globals.h"
+
+/*
+On-device version of tools/imu-axes-calibration/accelerometer_calibration_calculations.m, see there and ST application note AN4508.
+Guided over the serial terminal, the car is put into six static poses (+-x, +-y, +-z of the car pointing to the sky). In every pose the raw accelerations of both IMUs are averaged.
+The affine 3x4 calibration is the least squares solution X = (W^T*W)^-1 * W^T * Y, with W the averaged raw values plus a column of ones and Y the applied accelerations in g.
+The sets are stored in NVS per full scale, so changing ACCELERATION_SCALE or remounting a sensor only needs a new calibration run, not a new firmware.
+*/
+
+#define CALIBRATION_POSE_SAMPLES        200     /* raw samples averaged per pose */
+#define CALIBRATION_POSE_INTERVAL_MS    10      /* time between two samples */
+#define CALIBRATION_STILL_THRESHOLD     0.02    /* in g. A pose is repeated if the standard deviation of any axis is larger, since the car was moved. */
+#define CALIBRATION_NUMBER_POSES        6
+
+#define NVS_KEY_IMU_CALIBRATION         "imu_cal_%dg"   /* one key per full scale */
+
+typedef struct
+{
+    double_t front[12];
+    double_t back[12];
+} imu_calibration_t;
+
+void load_imu_calibration(uint8_t scale);
+void run_imu_calibration();
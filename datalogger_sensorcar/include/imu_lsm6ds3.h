@@ -79,6 +79,8 @@ FS_125 Gyroscope full-scale at 125 dps. Default value: 0
 
 #define GRAVITY_FACTOR      9.80665
 
+#define ACCELERATION_SCALE  SCALE_8G    /* full scale of both accelerometers. The calibration set for this scale is used. */
+
 #include <Wire.h>       /* arduino i2c library */
 #include <Arduino.h>
 #include "globals.h"
@@ -87,26 +89,31 @@ extern DRAM_ATTR unsigned long imu_timestamp;
 extern DRAM_ATTR int16_t front_imu_raw_data_array[6];
 extern DRAM_ATTR int16_t back_imu_raw_data_array[6];
 
+extern DRAM_ATTR uint8_t imu_acceleration_scale;   /* FS_XL bits the accelerometers are configured with */
+
 #if CALIBRATE_ACCELERATION
     extern DRAM_ATTR double_t front_imu_calibrated_acceleration_array[3];
     extern DRAM_ATTR double_t back_imu_calibrated_acceleration_array[3];
-    /* calibration values
+    /* calibration values in use, picked by load_imu_calibration() for the configured full scale
     row vector, cal values: xx xy xz xb, yx yy yz yb, zx zy zz zb
     x_car = xx*measured_x + xy*measured_y + xz*measured_z + xb and so on
     this formats them as well so that 1.0 is equal to 1g.
     */
+    extern DRAM_ATTR double_t calibration_values_front[12];
+    extern DRAM_ATTR double_t calibration_values_back[12];
 
+    /* Defaults, used until a calibration for the configured full scale was stored in NVS (see imu_calibration.h). Other scales are derived from the +-8g set. */
     /* calibration values for +-8g */   
-    const double_t calibration_values_front [] = { 5.49391498367321e-07, 0.000242665106478849, 1.48803148659940e-05, 0.00782013884499783, 0.000244729606560598, -1.30868908647501e-07, -4.73889257422259e-06, 0.00967661395696673, -4.27858538728495e-06, 1.52530721834046e-05, -0.000241466842188727, 0.00728956178570483 };
-    const double_t calibration_values_back [] = { -3.19415627158884e-06, 0.000242641634827048, 6.15240127187166e-06, -0.00811203599963953, 0.000241871778667421, 2.86384418200320e-06, 7.98659477621670e-07, 0.00469760197311742, 1.41746531657993e-06, 5.91491608451484e-06, -0.000241812270066516, 0.0210918849264041 };
+    const double_t CALIBRATION_DEFAULT_FRONT_8G [] = { 5.49391498367321e-07, 0.000242665106478849, 1.48803148659940e-05, 0.00782013884499783, 0.000244729606560598, -1.30868908647501e-07, -4.73889257422259e-06, 0.00967661395696673, -4.27858538728495e-06, 1.52530721834046e-05, -0.000241466842188727, 0.00728956178570483 };
+    const double_t CALIBRATION_DEFAULT_BACK_8G [] = { -3.19415627158884e-06, 0.000242641634827048, 6.15240127187166e-06, -0.00811203599963953, 0.000241871778667421, 2.86384418200320e-06, 7.98659477621670e-07, 0.00469760197311742, 1.41746531657993e-06, 5.91491608451484e-06, -0.000241812270066516, 0.0210918849264041 };
 
     /* calibration values for +-16g */
-    /*
-    const double_t calibration_values_front [] = { 1.02116949902745e-06, 0.000485238530816457, 2.56733216508941e-05, 0.000147457224302067, 0.000489123667111545, -8.09922091756310e-07, -1.02146124957591e-05, 0.000774821647134688, -9.76766565330662e-06, 2.64022873581938e-05, -0.000482909689989141, 0.00453797699394315 };
-    const double_t calibration_values_back [] = { -5.68000538606822e-06, 0.000484780366495398, 8.90901572173184e-06, -0.0107063435566905, 0.000482752933776492, 5.33039522900044e-06, 5.24187631733225e-07, 0.00416002876460825, 4.69406030618897e-07, 8.30570600832508e-06, -0.000482848442737067, 0.0183260247200123 };
-    */
+    const double_t CALIBRATION_DEFAULT_FRONT_16G [] = { 1.02116949902745e-06, 0.000485238530816457, 2.56733216508941e-05, 0.000147457224302067, 0.000489123667111545, -8.09922091756310e-07, -1.02146124957591e-05, 0.000774821647134688, -9.76766565330662e-06, 2.64022873581938e-05, -0.000482909689989141, 0.00453797699394315 };
+    const double_t CALIBRATION_DEFAULT_BACK_16G [] = { -5.68000538606822e-06, 0.000484780366495398, 8.90901572173184e-06, -0.0107063435566905, 0.000482752933776492, 5.33039522900044e-06, 5.24187631733225e-07, 0.00416002876460825, 4.69406030618897e-07, 8.30570600832508e-06, -0.000482848442737067, 0.0183260247200123 };
 #endif
 
 void init_imu();
+void imu_power(bool on);
 inline void write_to_i2c_register(uint8_t slave_address, uint8_t register_address, uint8_t value_to_write);
-IRAM_ATTR void imu_read();
\ No newline at end of file
+IRAM_ATTR void imu_read();
+uint8_t acceleration_scale_in_g(uint8_t scale);
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+#include "globals.h"
+
+/*
+Latency tracer for the actuation path.
+Every IR mark opens a trace with a new correlation id. The first speed change the controller makes after that mark is sent together with the id, the controller emulator stamps the receive and DAC write with its own clock and reports back.
+The report is aligned to the clock of the sensorcar (assuming a symmetric wireless link) and output via the serial terminal as one line per trace:
+TRACE <id> <ir mark> <controller> <send> <bridge receive> <dac write> <report received>, all in us of the sensorcar clock.
+tools/latency-estimation/latency_trace_report.m evaluates a capture of those lines.
+*/
+
+#define LATENCY_TRACE_SLOTS         16      /* number of traces that can be in flight at the same time. Must be a power of two. */
+#define LATENCY_TRACE_QUEUE_LENGTH  8       /* completed traces waiting to be printed */
+#define LATENCY_TRACE_PRIO          IDLE_PRIO+1
+#define LATENCY_TRACE_CORE          0   /* only prints, so it stays off the core that runs control */
+
+/* stages of a trace, in the order they happen */
+#define TRACE_STAGE_IR_MARK         0   /* both IR sensors passed a tape */
+#define TRACE_STAGE_CONTROLLER      1   /* controller decided on a new speed */
+#define TRACE_STAGE_SEND            2   /* speed is handed to ESP-NOW */
+#define TRACE_STAGE_BRIDGE_RECEIVE  3   /* controller emulator received the speed */
+#define TRACE_STAGE_DAC_WRITE       4   /* controller emulator wrote the speed to the DAC */
+#define TRACE_STAGE_REPORT_RECEIVE  5   /* sensorcar received the report of the controller emulator */
+#define TRACE_STAGE_COUNT           6
+
+#define TRACE_ID_NONE               0   /* id sent with speed values that were not caused by an IR mark */
+
+typedef struct
+{
+    uint16_t trace_id;
+    uint8_t  stages_done;                       /* bit n is set when stage n was stamped */
+    uint32_t timestamp[TRACE_STAGE_COUNT];      /* in us, clock of the sensorcar */
+} latency_trace_t;
+
+extern DRAM_ATTR QueueHandle_t latency_trace_queue;
+
+void                init_latency_tracing();
+IRAM_ATTR void      latency_trace_open(uint32_t ir_mark_timestamp);
+IRAM_ATTR void      latency_trace_controller_decision();
+IRAM_ATTR uint16_t  latency_trace_send();
+IRAM_ATTR void      latency_trace_report(uint16_t trace_id, uint32_t bridge_receive_timestamp, uint32_t dac_write_timestamp, uint32_t report_send_timestamp);
+IRAM_ATTR void      latency_trace_print_task(void*);
@@ -0,0 +1,34 @@
+#pragma once
+#include "globals.h"
+#include "link_monitor.h"
+#include "channel_hop.h"
+
+/*
+Link quality of the ESP-NOW connection and the channel hops, sensorcar side. See link_monitor.h and channel_hop.h.
+link_stats measures the setpoints: every transmission counts as sent, every ack as answered with the round trip time since the last transmission of its sequence number.
+Every packet of the controller emulator counts as received, with the RSSI of its frame.
+The receive callback of ESP-NOW in this framework version has no RSSI, so the Wi-Fi driver also runs in promiscuous mode, filtered to management frames (ESP-NOW packets are action frames).
+The promiscuous callback sees each frame in the Wi-Fi task before the ESP-NOW callback does and only keeps the RSSI of the last frame of the controller emulator.
+Link packets go from wireless receive to link_task through link_mailbox. link_task runs the follower of channel_hop.h and is the only one that changes the channel.
+After LINK_LOST_SETPOINTS setpoints in a row ran out of their latency budget, the sensorcar looks for the controller emulator on all channels.
+*/
+
+#define LINK_LOST_SETPOINTS             10
+#define LINK_MAILBOX_LENGTH             8
+#define LINK_FRAME_SENDER_OFFSET        10      /* of addr2 in the 802.11 header of a received frame */
+#define LINK_SEND_SLOTS                 16      /* send times of the last setpoint sequence numbers, must be a power of two */
+#define LINK_PRIO                       IDLE_PRIO+3
+#define LINK_CORE                       0       /* next to wireless receive, which feeds it */
+#define LINK_STACK                      3072
+
+extern DRAM_ATTR channel_follower_t link_follower;
+
+void            init_link_quality();
+IRAM_ATTR void  link_setpoint_sent(uint8_t sequence);
+IRAM_ATTR void  link_setpoint_answered(uint8_t sequence);
+IRAM_ATTR void  link_setpoint_failed();
+IRAM_ATTR void  link_packet_received(const uint8_t* data);
+IRAM_ATTR void  link_peer_heard();
+IRAM_ATTR void  link_task(void*);
+          void  print_link_stats();
+          void  link_stats_print_task(void*);
@@ -0,0 +1,59 @@
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+
+/*
+Lock-free queue to hand data between tasks on different cores without blocking either of them.
+It never blocks: a full queue rejects the element, an empty queue returns false. Tasks that need to sleep until there is data use a semaphore or notification as doorbell next to the queue.
+
+Indices that are written by different sides live on their own QUEUE_LINE_SIZE aligned line, so a producer and a consumer never write the same word.
+The internal RAM of the ESP32 is not cached, but both cores contend for the same memory bus, so keeping producer and consumer data apart still avoids needless contention and makes the layout portable.
+*/
+
+#define QUEUE_LINE_SIZE 32  /* in bytes */
+
+/*
+Single producer, single consumer ring buffer. LENGTH must be a power of two.
+One slot is never used to tell a full from an empty queue apart, so LENGTH-1 elements fit.
+*/
+template <typename T, uint32_t LENGTH>
+class spsc_queue
+{
+    static_assert((LENGTH & (LENGTH - 1)) == 0, "LENGTH must be a power of two");
+
+    public:
+        /* producer side. Returns false if the queue is full and the element was not added. */
+        IRAM_ATTR bool push(const T& element)
+        {
+            uint32_t head      = head_index.load(std::memory_order_relaxed);
+            uint32_t next_head = (head + 1) & (LENGTH - 1);
+            if (next_head == tail_index.load(std::memory_order_acquire)) { return false; }
+
+            slots[head].element = element;
+            head_index.store(next_head, std::memory_order_release);    /* publishes the element to the consumer */
+            return true;
+        }
+
+        /* consumer side. Returns false if the queue is empty. */
+        IRAM_ATTR bool pop(T& element)
+        {
+            uint32_t tail = tail_index.load(std::memory_order_relaxed);
+            if (tail == head_index.load(std::memory_order_acquire)) { return false; }
+
+            element = slots[tail].element;
+            tail_index.store((tail + 1) & (LENGTH - 1), std::memory_order_release); /* hands the slot back to the producer */
+            return true;
+        }
+
+        IRAM_ATTR uint32_t size() const
+        {
+            return (head_index.load(std::memory_order_acquire) - tail_index.load(std::memory_order_acquire)) & (LENGTH - 1);
+        }
+
+    private:
+        struct alignas(QUEUE_LINE_SIZE) slot_t { T element; };
+
+        alignas(QUEUE_LINE_SIZE) std::atomic<uint32_t> head_index { 0 };  /* written by the producer only */
+        alignas(QUEUE_LINE_SIZE) std::atomic<uint32_t> tail_index { 0 };  /* written by the consumer only */
+        slot_t slots[LENGTH];
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include "globals.h"
+#include "speed_characterization.h"   /* vdigi to speed table */
+
+/*
+On-device identification of the car as PT1Tt element (dead time, time constant and gain), see system_simulation.m for the model.
+The measurement task drives step and pseudo random binary sequence (PRBS) patterns between two vdigi levels.
+Every IMU sample, the change of the commanded speed is cross-correlated with the calibrated x acceleration of both IMUs. For a PT1Tt element, that correlation is the impulse response of the acceleration:
+h(t) = K/T1 * exp(-(t-Tt)/T1) for t > Tt, 0 before.
+Tt is where h rises to half its peak. A line fitted through ln(h) after the peak gives T1 from its slope and K/T1 from its value at Tt.
+Each pattern segment gives one estimate. The mean over all segments and its 95% confidence bound are stored in NVS and used by the controller.
+Like the characterization, this needs a track made of straights only. Needs CALIBRATE_ACCELERATION.
+*/
+
+#define IDENTIFICATION_VDIGI_LOW                38
+#define IDENTIFICATION_VDIGI_HIGH               62
+#define IDENTIFICATION_STEP_HOLD_TICKS          40      /* in measurement timer ticks. Each level of the step pattern is held this long. */
+#define IDENTIFICATION_STEP_SEGMENTS            2       /* each step segment is low, high, low, high */
+#define IDENTIFICATION_PRBS_BIT_TICKS           3       /* in measurement timer ticks. Duration of one PRBS bit. */
+#define IDENTIFICATION_PRBS_SEGMENTS            4       /* each PRBS segment is one full period of 63 bits */
+#define IDENTIFICATION_SEGMENTS                 (IDENTIFICATION_STEP_SEGMENTS + IDENTIFICATION_PRBS_SEGMENTS)
+#define IDENTIFICATION_NUMBER_LAGS              200     /* in IMU samples. Must cover dead time plus five time constants. */
+#define IDENTIFICATION_DECAY_FIT_END            0.2     /* the exponential decay is fitted until h falls below this fraction of its peak */
+
+#define NVS_KEY_PLANT_MODEL                     "plant_model"
+
+typedef struct
+{
+    bool  valid;
+    float dead_time;                    /* in s */
+    float dead_time_confidence;         /* in s, half width of the 95% confidence interval */
+    float time_constant;                /* in s */
+    float time_constant_confidence;     /* in s */
+    float gain;                         /* in m/s per m/s if gain_from_speed_table, else in m/s per vdigi count */
+    float gain_confidence;
+    bool  gain_from_speed_table;        /* the speed characterization was available during identification, so the command was converted to m/s */
+} plant_model_t;
+
+extern DRAM_ATTR plant_model_t plant_model;
+
+void            load_plant_model();
+IRAM_ATTR bool  plant_identification_step();
+IRAM_ATTR void  plant_identification_sample(uint8_t commanded_vdigi, double_t acceleration);   /* acceleration in m/s^2 */
@@ -0,0 +1,22 @@
+#pragma once
+#include "globals.h"
+
+/*
+Power saving while the car waits for the next race.
+Once the car was idle for IDLE_POWER_DOWN_DELAY_MS, the sampling task powers the IMUs down and halts the scheduler timer, so no periodic job runs anymore.
+It also releases the power management locks that are held while the car is awake: the CPU may then drop to POWER_MIN_CPU_FREQ_MHZ, and the chip may enter automatic light sleep whenever the Wi-Fi driver does not need it.
+The radio keeps listening. Every race status message of the controller emulator wakes the car, the countdown already sends several of them before RACE_GOING.
+Waking takes the locks and restarts the timer right in the wireless receive callback, so the controller runs again within one CONTROLLER_INTERVAL.
+The IMUs are powered up by the next sample and their first IMU_WAKE_SETTLING_SAMPLES samples are skipped.
+The delay leaves the bias tracking time to follow the drift after a race, it continues during the countdown of the next one.
+Without CONFIG_PM_ENABLE in the framework, only the timer and the IMUs are stopped.
+*/
+
+#define IDLE_POWER_DOWN_DELAY_MS        60000   /* idle time until the car powers down */
+#define IMU_WAKE_SETTLING_SAMPLES       8       /* samples skipped after the IMUs were powered up, their first outputs are not settled */
+#define POWER_MAX_CPU_FREQ_MHZ          240     /* while awake */
+#define POWER_MIN_CPU_FREQ_MHZ          80      /* lowest frequency while idle. Not below 80 MHz, so the APB clock of the UART, I2C and the timers never changes. */
+
+void            init_power_management();
+IRAM_ATTR bool  idle_power_sample(uint8_t sensorcar_state);
+IRAM_ATTR void  idle_power_wake_up();
@@ -0,0 +1,266 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if __has_include(<esp_attr.h>)
+    #include <esp_attr.h>
+#else
+    #define IRAM_ATTR               /* host builds, see tools/sensor-pipeline */
+    #define DRAM_ATTR
+#endif
+
+/*
+Sensor processing chains composed from stage types at compile time.
+A stage is a type with process(sample). sensor_pipeline<Stages...>::process() calls them in order, every call is resolved at compile time and inlined, so a chain costs what the same code written out by hand costs.
+A stage that is configured off is pass_stage, see optional_stage. Adding an estimator is adding a stage type and listing it in a chain, the other stages and the tasks stay as they are.
+
+The sample is any type with the members the stages of a chain use. The firmware binds them by reference to its globals (see main.cpp), so all other modules keep working on the globals.
+This file doesn't depend on the framework, tools/sensor-pipeline composes every combination of the stages on the host, checks them against the hand-written chain and benchmarks them.
+
+Members of an IMU sample:
+    front_raw[6], back_raw[6]                   012: xyz rotation, 345: xyz acceleration, in counts
+    front_acceleration[3], back_acceleration[3] car axes, in g
+    accel_previous, accel_now                   mean x acceleration of both IMUs, in g
+    speed                                       in m/s
+    standstill                                  the car stands still
+Members of an IR sample:
+    left_passing_time, right_passing_time       time the sensor saw the tape, in us
+    left_speed, right_speed                     in m/s
+    left_speed_trackbased, right_speed_trackbased   in m/s, from the time between two marks
+    speed                                       in m/s
+*/
+
+#ifndef GRAVITY_FACTOR
+    #define GRAVITY_FACTOR  9.80665     /* same as imu_lsm6ds3.h */
+#endif
+
+template <typename... Stages>
+class sensor_pipeline
+{
+    public:
+        template <typename Sample>
+        IRAM_ATTR void process(Sample& sample)
+        {
+            process_stages(sample, std::index_sequence_for<Stages...>());
+        }
+
+        /* a stage by its type, e.g. to read or reset the state of an estimator */
+        template <typename Stage>
+        Stage& stage() { return std::get<Stage>(stages); }
+
+    private:
+        template <typename Sample, size_t... INDEX>
+        IRAM_ATTR void process_stages(Sample& sample, std::index_sequence<INDEX...>)
+        {
+            (std::get<INDEX>(stages).process(sample), ...);
+        }
+
+        std::tuple<Stages...> stages;
+};
+
+/* stands in for a stage that is configured off */
+struct pass_stage
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample&) {}
+};
+
+template <bool ENABLED, typename Stage>
+using optional_stage = typename std::conditional<ENABLED, Stage, pass_stage>::type;
+
+/* runs a function that works on the globals the sample is bound to, e.g. the bus read or the bias tracking */
+template <void (*FUNCTION)()>
+struct call_stage
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample&) { FUNCTION(); }
+};
+
+/* hands the sample to a sink that may refuse it, e.g. a queue. ON_REJECTED counts the loss. */
+template <bool (*SINK)(), void (*ON_REJECTED)()>
+struct sink_stage
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample&)
+    {
+        if (!SINK()) { ON_REJECTED(); }
+    }
+};
+
+/* ###################################################
+IMU stages
+################################################### */
+
+/*
+Aligns the accelerometer axes to the car. 12 coefficients per IMU: xx xy xz xb, yx yy yz yb, zx zy zz zb.
+x_car = xx*measured_x + xy*measured_y + xz*measured_z + xb and so on, see imu_lsm6ds3.h.
+*/
+template <const double_t* FRONT, const double_t* BACK>
+struct axis_calibration
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        calibrate(FRONT, sample.front_raw, sample.front_acceleration);
+        calibrate(BACK,  sample.back_raw,  sample.back_acceleration);
+    }
+
+    private:
+        template <typename Raw, typename Acceleration>
+        static inline void calibrate(const double_t* coefficients, const Raw& raw, Acceleration& acceleration)
+        {
+            for (uint8_t axis = 0; axis < 3; axis++)
+            {
+                const double_t* row = &coefficients[axis * 4];
+                acceleration[axis] = row[0] * raw[3] + row[1] * raw[4] + row[2] * raw[5] + row[3];
+            }
+        }
+};
+
+/* mean x acceleration of both IMUs. The one of the last sample is kept for the integration. */
+struct longitudinal_acceleration
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.accel_previous = sample.accel_now;
+        sample.accel_now      = (sample.front_acceleration[0] + sample.back_acceleration[0]) * 0.5;
+    }
+};
+
+/* first order low pass of the longitudinal acceleration, for mounts that pick up motor vibration. Place it right after longitudinal_acceleration. */
+template <uint32_t TIME_CONSTANT_US, uint32_t INTERVAL_US>
+struct acceleration_low_pass
+{
+    double_t filtered = 0.0;
+
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        constexpr double_t WEIGHT = double_t(INTERVAL_US) / (TIME_CONSTANT_US + INTERVAL_US);
+        filtered         += WEIGHT * (sample.accel_now - filtered);
+        sample.accel_now  = filtered;
+    }
+};
+
+/* trapezoidal integration of the longitudinal acceleration to the speed */
+template <uint32_t INTERVAL_US>
+struct trapezoid_integration
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.speed += (sample.accel_now + sample.accel_previous) * 0.5 * double_t(INTERVAL_US) / 1e6 * GRAVITY_FACTOR;
+    }
+};
+
+/* at standstill the speed is zero, the integration error does not carry over to the next start */
+struct zero_velocity_update
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        if (sample.standstill) { sample.speed = 0.0; }
+    }
+};
+
+/* ###################################################
+IR stages
+################################################### */
+
+/* v = s / t. t in us, so a correction factor of 10^6 is required. WIDTH in m. */
+template <const double_t& WIDTH>
+struct tape_speed
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.left_speed  = WIDTH * 1.0e6 / sample.left_passing_time;
+        sample.right_speed = WIDTH * 1.0e6 / sample.right_passing_time;
+    }
+};
+
+/* tape_speed with a slope and an offset per sensor, measured externally. Negative speeds, possible due to the offset, are clamped to 0. */
+template <const double_t& WIDTH, const double_t* LEFT, const double_t* RIGHT>
+struct calibrated_tape_speed
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.left_speed  = clamp_negative(LEFT[0]  * WIDTH * 1.0e6 / sample.left_passing_time  + LEFT[1]);
+        sample.right_speed = clamp_negative(RIGHT[0] * WIDTH * 1.0e6 / sample.right_passing_time + RIGHT[1]);
+    }
+
+    private:
+        static inline double_t clamp_negative(double_t speed) { return (speed < 0.0) ? 0.0 : speed; }
+};
+
+/* the IR speeds replace the integrated speed at every mark, so the integration drifts for at most one piece */
+struct ir_speed_fusion
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.speed = (sample.left_speed + sample.right_speed) / 2;
+    }
+};
+
+/* same with the trackbased speeds, which are more accurate on a track of straights */
+struct trackbased_speed_fusion
+{
+    template <typename Sample>
+    IRAM_ATTR void process(Sample& sample)
+    {
+        sample.speed = (sample.left_speed_trackbased + sample.right_speed_trackbased) / 2;
+    }
+};
+
+/* ###################################################
+Log rows
+################################################### */
+
+/* one value of a log row, the type of the value picks the format */
+inline int log_print(char* buffer, size_t size, int value)      { return snprintf(buffer, size, "%d\t", value); }
+inline int log_print(char* buffer, size_t size, long value)     { return snprintf(buffer, size, "%ld\t", value); }
+inline int log_print(char* buffer, size_t size, double value)   { return snprintf(buffer, size, "%lf\t", value); }
+
+/*
+Tab-separated rows of a log file from a list of column types. Every column has a NAME and a static value(record).
+The header and the rows come from the same list, so they can't get out of step. Both return the length, a row that does not fit into size is cut off.
+*/
+template <typename... Columns>
+struct log_format
+{
+    static size_t header(char* buffer, size_t size)
+    {
+        size_t length = 0;
+        (append(size, length, snprintf(&buffer[length], size - length, "%s\t", Columns::NAME)), ...);
+        return terminate(buffer, length);
+    }
+
+    template <typename Record>
+    static size_t row(char* buffer, size_t size, const Record& record)
+    {
+        size_t length = 0;
+        (append(size, length, log_print(&buffer[length], size - length, Columns::value(record))), ...);
+        return terminate(buffer, length);
+    }
+
+    private:
+        static inline void append(size_t size, size_t& length, int printed)
+        {
+            length += (printed > 0) ? size_t(printed) : 0;
+            if (length > size - 1) { length = size - 1; }
+        }
+
+        /* the tab after the last column becomes the line break */
+        static inline size_t terminate(char* buffer, size_t length)
+        {
+            if (length > 0) { buffer[length - 1] = '\n'; }
+            return length;
+        }
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include "globals.h"
+#include "track_data.h"
+
+/*
+Self-characterization of the vdigi to speed relation.
+The car drives every legal vdigi step of AVAILABLE_VDIGI in ascending order on a track made of straights only.
+Each step is held until the trackbased IR speed is steady, then the steady state speed, its variance and the time constant of the step response are stored.
+The finished table is written to NVS and loaded at every boot, so the controller works with the speeds of the actual car, motor and track.
+A step that is interrupted by going back to SENSORCAR_IDLE_STATE is driven again from the start, the steps before it are kept.
+*/
+
+#define CHARACTERIZATION_NUMBER_STEPS           NUMBER_AVAILABLE_VDIGI
+#define CHARACTERIZATION_WINDOW_LENGTH          8       /* number of IR speed samples the steady state is judged on */
+#define CHARACTERIZATION_STEADY_THRESHOLD       0.03    /* steady if the standard deviation in the window is smaller than this fraction of its mean */
+#define CHARACTERIZATION_MINIMUM_STEP_TIME_MS   1500    /* a step is held at least this long, so the window can't be filled with samples of the previous step */
+#define CHARACTERIZATION_MAXIMUM_STEP_TIME_MS   10000   /* a step that does not get steady is ended after this time and marked as unsteady */
+#define CHARACTERIZATION_STEP_SAMPLES           128     /* IR speed samples recorded per step to determine the time constant */
+
+#define NVS_KEY_SPEED_CHARACTERIZATION          "speed_table"
+
+#define VDIGI_NOT_FOUND                         0xFF    /* find_vdigi_for_speed() without a steady step, the caller needs another source for the vdigi */
+
+typedef struct
+{
+    uint8_t  vdigi;
+    bool     steady;            /* false if the step timed out before the speed got steady */
+    float    speed;             /* in m/s, mean of the steady window */
+    float    variance;          /* in (m/s)^2, of the steady window */
+    float    time_constant;     /* in s, time until 63.2% of the speed change was reached. Includes the dead time. */
+} speed_characterization_t;
+
+extern DRAM_ATTR speed_characterization_t speed_characterization[CHARACTERIZATION_NUMBER_STEPS];
+extern DRAM_ATTR bool speed_characterization_valid;
+
+void            load_speed_characterization();
+IRAM_ATTR bool  speed_characterization_step();
+IRAM_ATTR void  speed_characterization_abort_step();
+IRAM_ATTR uint8_t find_vdigi_for_speed(double_t target_speed);
+IRAM_ATTR double_t speed_for_vdigi(uint8_t vdigi);
@@ -0,0 +1,31 @@
+#pragma once
+#include "globals.h"
+#include "track_data.h"     /* number of pieces and the per type target speeds the table starts from */
+
+/*
+Iterative learning control of the speed of every track position, used by ALGORITHM_LEARNING.
+The table has one vdigi per track piece and starts with TARGET_TRACKPIECE_SPEED_DIGITAL of its type, or with the speeds of speed_table.h if they were optimized for the mapped layout. The controller commands the entry of the piece the command takes effect on.
+While racing, the peak stress of every piece is recorded: the largest of lateral acceleration and rotation rate, each relative to its limit, and the slip indicator of VEHICLE_DYNAMICS.
+After every complete lap, each entry moves by LEARNING_GAIN times the distance of its stress to 1 - LEARNING_MARGIN: up where the car stayed below the margin, down where it went over.
+Going down is LEARNING_BRAKE_FACTOR times faster, and a piece that went over the limit also lowers the piece before it, since braking has to start earlier after a fast approach.
+A derailment is the limit being found the hard way, so it lowers both pieces by LEARNING_DERAILMENT_STEP right away.
+The limits are the grip of the car and have to be found empirically, the margin is the safety distance to them. Needs CALIBRATE_ACCELERATION.
+*/
+
+#define LEARNING_LATERAL_LIMIT      1.2     /* in g, calibrated y acceleration of either IMU */
+#define LEARNING_ROTATION_LIMIT     600.0   /* in dps, absolute rotation rate of either IMU */
+#define LEARNING_MARGIN             0.15    /* target stress is 1 - margin */
+#define LEARNING_GAIN               30.0    /* in vdigi per unit of stress error */
+#define LEARNING_BRAKE_FACTOR       2.0     /* lowering is this much faster than raising */
+#define LEARNING_MAX_STEP           6.0     /* in vdigi, largest change per lap, one step of AVAILABLE_VDIGI */
+#define LEARNING_MIN_VDIGI          20.0
+#define LEARNING_MAX_VDIGI          86.0
+#define LEARNING_DERAILMENT_STEP    12.0    /* in vdigi, the piece the car derailed on and the one before are lowered this much */
+
+extern DRAM_ATTR float learned_speed_digital[TRACK_MAX_PIECES];    /* unquantized vdigi of every track position */
+
+IRAM_ATTR void speed_learning_start();
+IRAM_ATTR void speed_learning_sample(uint8_t track_position_index);
+IRAM_ATTR void speed_learning_mark(bool finish_line_passed);
+IRAM_ATTR void speed_learning_discard_lap();
+IRAM_ATTR void speed_learning_derailed(uint8_t track_position_index);
@@ -0,0 +1,13 @@
+#pragma once
+#include "track_data.h"
+
+/*
+Per track piece speeds optimized for one layout by tools/strategy-optimizer, which overwrites this file.
+ALGORITHM_LEARNING starts from them instead of TARGET_TRACKPIECE_SPEED_DIGITAL if the mapped layout is SPEED_TABLE_TRACK_GEOMETRY.
+Without a table for the layout, SPEED_TABLE_NUMBER_PIECES is 0.
+*/
+
+#define SPEED_TABLE_NUMBER_PIECES       0
+
+const uint8_t SPEED_TABLE_TRACK_GEOMETRY[TRACK_MAX_PIECES]  = { 0 };
+const uint8_t SPEED_TABLE_SPEED_DIGITAL[TRACK_MAX_PIECES]   = { 0 };
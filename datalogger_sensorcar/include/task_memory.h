@@ -0,0 +1,32 @@
+#pragma once
+#include "globals.h"
+
+/*
+Memory layout of the tasks.
+With STATIC_ALLOCATION, the stack and control block of every task are arrays in DRAM, reserved at link time instead of being taken from the heap when the task is created.
+They are named <task>_stack and <task>_control_block, so the RAM usage of the build accounts for them and tools/memory-report lists them per task.
+Long sessions can no longer fragment the heap with task memory, and what the tasks don't use stays free for log buffers and FIFOs.
+Without STATIC_ALLOCATION, the same sizes are taken from the heap.
+*/
+
+#define TASK_MEMORY_MAX_TASKS       10
+#define TASK_MEMORY_STACK_WARNING   512     /* in bytes. Tasks with less unused stack are marked in the report. */
+
+#if STATIC_ALLOCATION
+    /* reserves the memory of a task at file scope */
+    #define STATIC_TASK_MEMORY(task_function, stack_size)   DRAM_ATTR StackType_t task_function##_stack[stack_size]; DRAM_ATTR StaticTask_t task_function##_control_block;
+    #define TASK_STACK(task_function)                       (task_function##_stack)
+    #define TASK_CONTROL_BLOCK(task_function)               (&task_function##_control_block)
+#else
+    #define STATIC_TASK_MEMORY(task_function, stack_size)
+    #define TASK_STACK(task_function)                       NULL
+    #define TASK_CONTROL_BLOCK(task_function)               NULL
+#endif
+
+/* creates a task with the memory reserved by STATIC_TASK_MEMORY for it. task_handle may be NULL. */
+#define CREATE_TASK(task_function, stack_size, priority, task_handle, core) \
+    create_task(task_function, #task_function, stack_size, priority, task_handle, core, TASK_STACK(task_function), TASK_CONTROL_BLOCK(task_function))
+
+void create_task(TaskFunction_t task_function, const char* name, uint32_t stack_size, UBaseType_t priority, TaskHandle_t* task_handle, BaseType_t core, StackType_t* stack, StaticTask_t* control_block);
+void print_task_memory();
+void task_memory_print_task(void*);
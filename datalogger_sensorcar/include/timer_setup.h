@@ -1,6 +1,15 @@
 #include <Arduino.h>
 #include "globals.h"
 
+/*
+Time-triggered scheduler.
+A single hardware timer runs freely at 1 MHz. Its alarm is always set to the next release time in the schedule table, so the isr only fires when at least one job is due.
+Due jobs wake their task with a direct-to-task notification. Release times are absolute, so jitter does not accumulate.
+Pausing stops the timer counter itself, so the whole schedule freezes and continues with the same phases on resume.
+*/
+
+#define SCHEDULER_TIMER_NUMBER      3   /* one timer of 4 (counted from zero). The others are free, for example for input capture. */
+
 #if DEBUG
     #define SAMPLING_INTERVAL 1000000 /* sampling period T (1/f) in microseconds (us). Resolution is only one ms, the ESP will change between intervals to get the required interval on average. For consistency, only use ms based periods. */
 #else
@@ -8,13 +17,24 @@
 #endif
 #define CONTROLLER_INTERVAL         75000                  /* 75ms, equal to Carrera CU sampling clock */
 #define MEASUREMENT_TIMER_INTERVAL  CONTROLLER_INTERVAL*1  /* multiple of Carrera CU sampling clock. Even multiples are recommended since logging is done at the sampling interval */
+#define LOGGING_INTERVAL            SAMPLING_INTERVAL*5    /* queued log records are written in batches */
+
+/* Phases in us, relative to the start of the schedule. They spread the jobs so they don't compete for the core at the same time. Must be smaller than the interval of the job. */
+#define SAMPLING_PHASE              0
+#define CONTROLLER_PHASE            SAMPLING_INTERVAL/2    /* between two samples. Controller and measurement never run in the same operation mode. */
+#define MEASUREMENT_PHASE           SAMPLING_INTERVAL/2
+#define LOGGING_PHASE               SAMPLING_INTERVAL/4
+
+typedef struct
+{
+    TaskHandle_t*   task_handle;        /* task to notify. Jobs whose task does not exist in the current operation mode are skipped. */
+    uint32_t        interval;           /* in us */
+    uint32_t        phase;              /* in us */
+} schedule_entry_t;
 
-inline void init_timer_generic();
 void init_timers();
-inline void halt_timer_generic();
 IRAM_ATTR void halt_timers();
 IRAM_ATTR void restart_timers();
+IRAM_ATTR bool timers_halted();
 
-IRAM_ATTR void on_sample_timer();
-IRAM_ATTR void on_controller_timer();
-IRAM_ATTR void on_measurement_timer();
\ No newline at end of file
+IRAM_ATTR void on_scheduler_timer();
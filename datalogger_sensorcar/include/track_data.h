@@ -1,3 +1,4 @@
+#pragma once
 #include "globals.h"
 
 #define TRACK_STRAIGHT                  0
@@ -5,26 +6,42 @@
 #define TRACK_CURVE_LEFT_OUTER_TRACK    2
 #define TRACK_CURVE_RIGHT_INNER_TRACK   3
 #define TRACK_CURVE_RIGHT_OUTER_TRACK   4
+#define TRACK_PIECE_TYPES               5
+#define TRACK_MAX_PIECES                50
 
 /* Absolute time thresholds. Based on the time difference it takes the IR sensors to trigger, determine the track piece. Times in us, set speed of 40. Test track: simplest zero with right curves. Strongly dependent on actual car speed, which actually varies based on the geometry. */
 #define THRESHOLD_STRAIGHT              2500
 #define THRESHOLD_CURVE_INNER           18000   /* typical values: 16000...22000 */
 #define THRESHOLD_CURVE_OUTER           10000   /* typical values: 13000...17000 */
 
-/* array that contains track piece length in meters. The index number corresponds to the track pieces as defined above. For example, TRACKPIECE_LENGTH[0] has the length for the 'TRACK_STRAIGHT' pieces, because it is defined as '#define TRACK_STRAIGHT 0'*/
-const double_t TRACKPIECE_LENGTH[] = { 345e-3, 259.181393921e-3, 362.85395149e-3, 259.181393921e-3, 362.85395149e-3 }; 
-
-/* contains the target speed one can drive on a trackpiece without derailing or losing speed from sliding in a corner. Data obtained empirically. */
-const uint8_t TARGET_TRACKPIECE_SPEED_DIGITAL[] = { 62, 44, 44, 44, 44 }; 
-
-/* All possible individual target vdigis. All other values just result in the same result as one of these values due to quantization by the carrera CU. */
-const uint8_t AVAILABLE_VDIGI[]             = { 0, 20, 26, 32, 38, 44, 50, 56, 62, 68, 74, 80, 86, 92, 98 };
+/* TRACKPIECE_LENGTH, TARGET_TRACKPIECE_SPEED_DIGITAL, AVAILABLE_VDIGI and the lookahead tables, computed from the physical parameters of the track */
+#include "track_tables.h"
 
 /* current track geometry data */
 extern DRAM_ATTR uint8_t number_track_pieces;
 extern DRAM_ATTR uint8_t track_position_index;
-extern DRAM_ATTR uint8_t track_geometry[50];
-extern DRAM_ATTR double_t track_checkpoint_lengths[50];
+extern DRAM_ATTR uint8_t track_geometry[TRACK_MAX_PIECES];
+extern DRAM_ATTR double_t track_checkpoint_lengths[TRACK_MAX_PIECES];
 
 IRAM_ATTR void      calculate_track_checkpoint_lengths(uint8_t number_track_pieces);
-IRAM_ATTR uint8_t   determine_track_piece(signed long sensor_time_difference);
\ No newline at end of file
+IRAM_ATTR uint8_t   determine_track_piece(signed long sensor_time_difference);
+
+#if TRACK_REFINEMENT
+    /*
+    The mapping lap is only the first guess of the layout. During racing laps every piece is classified again and the classifications of a lap are collected between two passes of the finish line.
+    A complete lap (as many pieces as the layout has) adds one vote per piece. The type with the most votes becomes the geometry of the piece and its share of the votes is the confidence.
+    Votes are halved once a piece has TRACK_VOTE_LIMIT of them, so later laps still count against a long history.
+    If TRACK_RECOUNT_LAPS laps in a row agree on a different number of pieces (a mark was missed or doubled during mapping), that lap replaces the layout.
+    The IR time difference shrinks with speed, so it is scaled to the mean speed of the mapping lap the thresholds were made for before classifying.
+    */
+    #define TRACK_VOTE_LIMIT            16
+    #define TRACK_RECOUNT_LAPS          3
+
+    extern DRAM_ATTR uint8_t  track_piece_votes[TRACK_MAX_PIECES][TRACK_PIECE_TYPES];
+    extern DRAM_ATTR float    track_piece_confidence[TRACK_MAX_PIECES];  /* 0...1, share of the votes that agree with track_geometry */
+
+    IRAM_ATTR void  track_refinement_mapping_mark(double_t ir_speed);
+    IRAM_ATTR void  track_refinement_start(uint8_t number_track_pieces);
+    IRAM_ATTR void  track_refinement_racing_mark(bool finish_line_passed, signed long sensor_time_difference, double_t ir_speed);
+    IRAM_ATTR void  track_refinement_discard_lap();
+#endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include "globals.h"
+#include "track_data.h"     /* piece types and their nominal lengths */
+
+/*
+Shape of the track, reconstructed from the mapping lap. Checks and corrects the IR classification of the pieces.
+Every sample of the mapping lap integrates the yaw rate of both gyros to a heading and the direction of travel over the time since the last IR mark.
+At every mark, the mean IR speed of both marks of the piece turns that into the length and the displacement of the piece. The end of piece 0 is the origin, heading 0 points along x.
+The piece that ends at the mark after the finish line is piece 0 again, so the lap has to end where it started, with a heading change of +-360 degrees:
+- The heading error is spread over the pieces by their duration, as a constant gyro bias would have caused it.
+- The remaining gap between start and end is spread over the vertices by their distance along the lap.
+The IR speeds are scaled so the straights have their nominal length, then every piece is snapped to the piece type that is closest in heading change and length.
+The layout of the snapped pieces has to close as well. Only then does it replace the classification of the IR time differences, which is the geometry the planner starts from.
+Only the snapped piece types reach the planner, their nominal radius already is the curvature it plans the corners with. x, y and curvature are diagnostics for print_track_shape()
+and only exist with DEBUG.
+*/
+
+#define TRACK_SHAPE_HEADING_TOLERANCE   45.0    /* in degrees. A lap whose heading change is further from +-360 is discarded, the gyros or the lap were not right. */
+#define TRACK_SHAPE_ANGLE_TOLERANCE     15.0    /* in degrees, weight of the heading change when snapping */
+#define TRACK_SHAPE_LENGTH_TOLERANCE    0.2     /* relative to the nominal length, weight of the length when snapping */
+#define TRACK_SHAPE_CLOSURE_TOLERANCE   0.05    /* in m, largest gap between start and end of the snapped layout. The lanes are 0.099 m apart, one curve snapped to the wrong lane opens a gap about that big. */
+
+typedef struct
+{
+    bool    valid;                              /* the mapping lap closed and its snapped pieces form a closed layout */
+    uint8_t number_pieces;
+    uint8_t corrected_pieces;                   /* IR classifications the shape replaced */
+    float   heading_error;                      /* in degrees, heading change of the lap minus +-360, before the correction */
+    float   closure_error;                      /* in m, gap between start and end after the heading correction */
+    float   snapped_closure_error;              /* in m, gap of the layout of the snapped pieces */
+    float   length_scale;                       /* applied to the IR speeds */
+    float   heading_change[TRACK_MAX_PIECES];   /* in degrees, after loop closure, positive to the left */
+    float   length[TRACK_MAX_PIECES];           /* in m */
+    #if DEBUG
+        float   x[TRACK_MAX_PIECES];            /* in m, end of every piece after loop closure */
+        float   y[TRACK_MAX_PIECES];
+        float   curvature[TRACK_MAX_PIECES];    /* in 1/m, positive to the left */
+    #endif
+} track_shape_t;
+
+extern DRAM_ATTR track_shape_t track_shape;
+
+IRAM_ATTR void  track_shape_sample(double_t yaw_rate);
+IRAM_ATTR void  track_shape_mark(uint8_t piece, double_t ir_speed);
+IRAM_ATTR bool  track_shape_close(uint8_t number_track_pieces, double_t ir_speed);
+#if DEBUG
+          void  print_track_shape();
+#endif
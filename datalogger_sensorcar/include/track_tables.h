@@ -0,0 +1,176 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Track and speed tables, computed by the compiler from the physical parameters below. Included by track_data.h after the track piece types, ALGORITHM_AVERAGE_NUMBER comes from globals.h.
+Change a parameter and every table that depends on it is rebuilt consistently. The tables are constexpr, so they end up in flash and cost no RAM or boot time.
+- piece lengths from the lane radius and the angle of the curves
+- target speed of every piece type from a lateral acceleration budget, curves can't be driven faster than sqrt(budget * radius)
+- speed of every vdigi from a curve fitted to the measured speeds of available_speeds in tools/system-simulation
+- target vdigi of every piece type: the fastest vdigi whose fitted speed does not exceed the target speed
+- target vdigi of ALGORITHM_AVERAGE for every sequence of ALGORITHM_AVERAGE_NUMBER piece types
+*/
+
+/* geometry of the Carrera Digital 132 pieces */
+#define TRACK_STRAIGHT_LENGTH           0.345   /* in m */
+#define TRACK_CURVE_ANGLE               60.0    /* in degrees, standard curve 1/60 */
+#define TRACK_INNER_LANE_RADIUS         0.2475  /* in m */
+#define TRACK_OUTER_LANE_RADIUS         0.3465  /* in m */
+
+/* targets */
+#define LATERAL_ACCELERATION_BUDGET     15.0    /* in m/s^2. The car derails at about 19...22 m/s^2 (maximum_trackpiece_speed of system_simulation.m). */
+#define STRAIGHT_TARGET_SPEED           2.95    /* in m/s. Not a grip limit, the car has to brake down to the curve speed within the dead time of the next piece. */
+
+/* legal vdigis. All other values just result in the same result as one of these values due to quantization by the carrera CU. */
+#define VDIGI_FIRST_STEP                20      /* lowest vdigi the car moves with */
+#define VDIGI_STEP                      6
+#define NUMBER_AVAILABLE_VDIGI          15      /* including 0 */
+
+/* speed in m/s = VDIGI_SPEED_OFFSET + VDIGI_SPEED_LINEAR * vdigi + VDIGI_SPEED_QUADRATIC * vdigi^2 for vdigi > 0. Least squares fit, at most 0.22 m/s off. */
+#define VDIGI_SPEED_OFFSET              -0.530787400
+#define VDIGI_SPEED_LINEAR              0.0562240494
+#define VDIGI_SPEED_QUADRATIC           -1.34938378e-5
+
+#define AVERAGE_TABLE_MAX_SIZE          16384   /* in bytes of flash, TRACK_PIECE_TYPES^ALGORITHM_AVERAGE_NUMBER entries */
+
+/* fixed size array that can be returned from a constexpr function, indexed like a plain array */
+template <typename T, size_t N>
+struct constexpr_table_t
+{
+    T value[N];
+    constexpr const T& operator[](size_t index) const   { return value[index]; }
+    constexpr T&       operator[](size_t index)         { return value[index]; }
+    constexpr size_t   size() const                     { return N; }
+};
+
+/* std::sqrt is not constexpr, Newton iteration converges in a few steps for the magnitudes used here */
+constexpr double constexpr_sqrt(double x)
+{
+    if (x <= 0.0) { return 0.0; }
+    double root = (x > 1.0) ? x : 1.0;
+    for (uint8_t ii = 0; ii < 64; ii++) { root = 0.5 * (root + x / root); }
+    return root;
+}
+
+constexpr double curve_length(double radius)
+{
+    return radius * TRACK_CURVE_ANGLE * 3.14159265358979323846 / 180.0;
+}
+
+constexpr double vdigi_speed(uint8_t vdigi)
+{
+    if (vdigi == 0) { return 0.0; }
+    return VDIGI_SPEED_OFFSET + VDIGI_SPEED_LINEAR * vdigi + VDIGI_SPEED_QUADRATIC * vdigi * vdigi;
+}
+
+constexpr constexpr_table_t<uint8_t, NUMBER_AVAILABLE_VDIGI> make_available_vdigi()
+{
+    constexpr_table_t<uint8_t, NUMBER_AVAILABLE_VDIGI> table = {};
+    for (uint8_t ii = 1; ii < NUMBER_AVAILABLE_VDIGI; ii++) { table[ii] = VDIGI_FIRST_STEP + (ii - 1) * VDIGI_STEP; }
+    return table;
+}
+
+constexpr constexpr_table_t<double, TRACK_PIECE_TYPES> make_trackpiece_length()
+{
+    constexpr_table_t<double, TRACK_PIECE_TYPES> table = {};
+    table[TRACK_STRAIGHT]                   = TRACK_STRAIGHT_LENGTH;
+    table[TRACK_CURVE_LEFT_INNER_TRACK]     = curve_length(TRACK_INNER_LANE_RADIUS);
+    table[TRACK_CURVE_LEFT_OUTER_TRACK]     = curve_length(TRACK_OUTER_LANE_RADIUS);
+    table[TRACK_CURVE_RIGHT_INNER_TRACK]    = curve_length(TRACK_INNER_LANE_RADIUS);
+    table[TRACK_CURVE_RIGHT_OUTER_TRACK]    = curve_length(TRACK_OUTER_LANE_RADIUS);
+    return table;
+}
+
+constexpr constexpr_table_t<double, TRACK_PIECE_TYPES> make_trackpiece_target_speed()
+{
+    constexpr_table_t<double, TRACK_PIECE_TYPES> table = {};
+    table[TRACK_STRAIGHT]                   = STRAIGHT_TARGET_SPEED;
+    table[TRACK_CURVE_LEFT_INNER_TRACK]     = constexpr_sqrt(LATERAL_ACCELERATION_BUDGET * TRACK_INNER_LANE_RADIUS);
+    table[TRACK_CURVE_LEFT_OUTER_TRACK]     = constexpr_sqrt(LATERAL_ACCELERATION_BUDGET * TRACK_OUTER_LANE_RADIUS);
+    table[TRACK_CURVE_RIGHT_INNER_TRACK]    = constexpr_sqrt(LATERAL_ACCELERATION_BUDGET * TRACK_INNER_LANE_RADIUS);
+    table[TRACK_CURVE_RIGHT_OUTER_TRACK]    = constexpr_sqrt(LATERAL_ACCELERATION_BUDGET * TRACK_OUTER_LANE_RADIUS);
+    return table;
+}
+
+/* array that contains track piece length in meters. The index number corresponds to the track pieces as defined in track_data.h. For example, TRACKPIECE_LENGTH[0] has the length for the 'TRACK_STRAIGHT' pieces, because it is defined as '#define TRACK_STRAIGHT 0'*/
+constexpr constexpr_table_t<double, TRACK_PIECE_TYPES>          TRACKPIECE_LENGTH           = make_trackpiece_length();
+constexpr constexpr_table_t<double, TRACK_PIECE_TYPES>          TRACKPIECE_TARGET_SPEED     = make_trackpiece_target_speed();
+constexpr constexpr_table_t<uint8_t, NUMBER_AVAILABLE_VDIGI>    AVAILABLE_VDIGI             = make_available_vdigi();
+
+/* fastest legal vdigi whose fitted speed is at most speed. The fitted speed rises with the vdigi over the whole range. */
+constexpr uint8_t fastest_vdigi_below(double speed)
+{
+    uint8_t vdigi = 0;
+    for (uint8_t ii = 0; ii < NUMBER_AVAILABLE_VDIGI; ii++)
+    {
+        if (vdigi_speed(AVAILABLE_VDIGI[ii]) <= speed) { vdigi = AVAILABLE_VDIGI[ii]; }
+    }
+    return vdigi;
+}
+
+/* legal vdigi whose fitted speed is closest to speed, like find_vdigi_for_speed() does with the measured speeds */
+constexpr uint8_t closest_vdigi_for_speed(double speed)
+{
+    uint8_t  closest_vdigi       = 0;
+    double   smallest_difference = 10e3;
+    for (uint8_t ii = 0; ii < NUMBER_AVAILABLE_VDIGI; ii++)
+    {
+        double difference = vdigi_speed(AVAILABLE_VDIGI[ii]) - speed;
+        if (difference < 0.0) { difference = -difference; }
+        if (difference < smallest_difference)
+        {
+            smallest_difference = difference;
+            closest_vdigi       = AVAILABLE_VDIGI[ii];
+        }
+    }
+    return closest_vdigi;
+}
+
+constexpr constexpr_table_t<uint8_t, TRACK_PIECE_TYPES> make_target_trackpiece_speed_digital()
+{
+    constexpr_table_t<uint8_t, TRACK_PIECE_TYPES> table = {};
+    for (uint8_t type = 0; type < TRACK_PIECE_TYPES; type++) { table[type] = fastest_vdigi_below(TRACKPIECE_TARGET_SPEED[type]); }
+    return table;
+}
+
+/* contains the target speed one can drive on a trackpiece without derailing or losing speed from sliding in a corner */
+constexpr constexpr_table_t<uint8_t, TRACK_PIECE_TYPES> TARGET_TRACKPIECE_SPEED_DIGITAL = make_target_trackpiece_speed_digital();
+
+constexpr size_t average_table_size(uint8_t number_pieces)
+{
+    size_t size = 1;
+    for (uint8_t ii = 0; ii < number_pieces; ii++) { size *= TRACK_PIECE_TYPES; }
+    return size;
+}
+
+#define AVERAGE_TABLE_SIZE              average_table_size(ALGORITHM_AVERAGE_NUMBER)
+static_assert(AVERAGE_TABLE_SIZE <= AVERAGE_TABLE_MAX_SIZE, "ALGORITHM_AVERAGE_NUMBER too large for the table of averaged target speeds");
+
+/*
+The index of a sequence is sum(type of piece ii * TRACK_PIECE_TYPES^ii), the first piece of the sequence is the least significant digit.
+The entry is the vdigi closest to the mean fitted speed of the target vdigis of the pieces, averaging in speed since the vdigi to speed relation is not linear.
+*/
+constexpr constexpr_table_t<uint8_t, AVERAGE_TABLE_SIZE> make_average_target_speed_digital()
+{
+    constexpr_table_t<uint8_t, AVERAGE_TABLE_SIZE> table = {};
+    for (size_t sequence = 0; sequence < AVERAGE_TABLE_SIZE; sequence++)
+    {
+        double speed_sum = 0.0;
+        size_t remainder = sequence;
+        for (uint8_t ii = 0; ii < ALGORITHM_AVERAGE_NUMBER; ii++)
+        {
+            speed_sum += vdigi_speed(TARGET_TRACKPIECE_SPEED_DIGITAL[remainder % TRACK_PIECE_TYPES]);
+            remainder /= TRACK_PIECE_TYPES;
+        }
+        table[sequence] = closest_vdigi_for_speed(speed_sum / ALGORITHM_AVERAGE_NUMBER);
+    }
+    return table;
+}
+
+constexpr constexpr_table_t<uint8_t, AVERAGE_TABLE_SIZE> AVERAGE_TARGET_SPEED_DIGITAL = make_average_target_speed_digital();
+
+/* the tables above must agree with the measured values of the MATLAB tools they replace */
+static_assert((TRACKPIECE_LENGTH[TRACK_CURVE_RIGHT_INNER_TRACK] > 0.2591) && (TRACKPIECE_LENGTH[TRACK_CURVE_RIGHT_INNER_TRACK] < 0.2592), "inner curve length");
+static_assert((TRACKPIECE_LENGTH[TRACK_CURVE_RIGHT_OUTER_TRACK] > 0.3628) && (TRACKPIECE_LENGTH[TRACK_CURVE_RIGHT_OUTER_TRACK] < 0.3629), "outer curve length");
+static_assert(AVAILABLE_VDIGI[NUMBER_AVAILABLE_VDIGI - 1] == 98, "highest vdigi");
@@ -0,0 +1,35 @@
+#pragma once
+#include "globals.h"
+
+/*
+Yaw and slip estimation from the two IMUs, which sit IMU_LEVER_ARM apart on the car x axis.
+yaw rate: both gyros projected onto the car z axis. Gyro and accelerometer share the sensor axes, so the z row of the acceleration calibration is that axis in sensor coordinates.
+yaw acceleration: for a rigid body, the lateral accelerations of two points on the x axis differ by the yaw acceleration times their distance.
+slide ratio: a rear that follows the slot has a lateral acceleration of v * r. If the car turns faster than the lateral acceleration of the rear supports, the rear is sliding out.
+slip_indicator is the larger of slide ratio and yaw acceleration, each relative to its limit. Above 1, the controller backs off.
+tools/derailing-data/slip_indicator.py replays the recordings there: it stays at most 1 in 99.9% of normal driving and goes above 20...30 ms before the yaw rate leaves what the slot allows, right at the entry of the curve the car derails in.
+Needs CALIBRATE_ACCELERATION.
+*/
+
+#define IMU_LEVER_ARM               0.09    /* in m, distance between ADDRESS_IMU_FRONT and ADDRESS_IMU_BACK along the car */
+#define YAW_ACCELERATION_FILTER     4       /* in samples, time constant of the low pass on the yaw acceleration */
+#define YAW_ACCELERATION_LIMIT      120.0   /* in rad/s^2. Normal cornering stays below about 100. */
+#define SLIDE_RATIO_LIMIT           2.5     /* normal cornering stays below about 2 */
+#define SLIDE_MIN_YAW_RATE          1.0     /* in rad/s. On straights, the slide ratio is not meaningful. */
+#define SLIDE_MIN_LATERAL           2.0     /* in m/s^2, floor of the rear lateral acceleration in the slide ratio */
+#define SLIDE_MIN_SPEED             0.3     /* in m/s */
+#define SLIP_BACKOFF_VDIGI          12      /* the controller commands at least this much less than before while slip_indicator is above 1 */
+
+typedef struct
+{
+    float yaw_rate;             /* in rad/s, positive to the left */
+    float yaw_acceleration;     /* in rad/s^2 */
+    float slide_ratio;          /* yaw rate * speed / lateral acceleration of the rear, about 1 without sliding */
+    float slip_indicator;       /* 0...1 within the limits */
+} vehicle_dynamics_t;
+
+extern DRAM_ATTR vehicle_dynamics_t vehicle_dynamics;
+
+IRAM_ATTR double_t car_yaw_rate();     /* in rad/s, positive to the left */
+IRAM_ATTR void     vehicle_dynamics_update(double_t car_speed);
+IRAM_ATTR void     vehicle_dynamics_reset();
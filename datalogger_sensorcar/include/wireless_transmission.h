@@ -9,9 +9,65 @@
 #define CAR_NO_0_PASSED_FINISH_LINE     2
 #define RECEIVED_VALUE_WIRELESSLY       3
 
+/*
+Setpoint delivery.
+Every speed value gets a sequence number and is acknowledged by the controller emulator once it was handed to the DAC.
+Only the newest setpoint matters: a new one replaces the one still waiting for its ack.
+Without an ack after SETPOINT_ACK_TIMEOUT_MS, the setpoint is sent again, until SETPOINT_LATENCY_BUDGET_MS have passed. A setpoint that ran out of budget is sent again at the next speed update even if the speed did not change.
+Sequence numbers start over at every boot. The session number drawn at boot tells the controller emulator that they did, so it doesn't take the first setpoints for retransmissions or late packets.
+Packets are told apart by their length.
+*/
+#define SETPOINT_ACK_TIMEOUT_MS         4       /* ESP-NOW round trip time is about 1-2ms */
+#define SETPOINT_LATENCY_BUDGET_MS      20      /* a retransmitted setpoint older than this is of no use anymore, the next controller cycle follows soon */
+#define SETPOINT_RETRANSMIT_PRIO        IDLE_PRIO+4
+#define SETPOINT_RETRANSMIT_CORE        0       /* next to wireless receive, which handles the acks */
+#define SETPOINT_RETRANSMIT_STACK       3072    /* in bytes */
+
+typedef struct __attribute__((packed))
+{
+    uint16_t session;           /* drawn at every boot, sequence numbers start over with it */
+    uint8_t  sequence;
+    uint8_t  speed_digital;
+    #if MEASURE_LATENCY
+        uint16_t trace_id;      /* correlation id of the latency trace the speed value belongs to */
+    #endif
+} setpoint_packet_t;
+
+/* answer of the controller emulator to a setpoint_packet_t */
+typedef struct __attribute__((packed))
+{
+    uint8_t  message;           /* RECEIVED_VALUE_WIRELESSLY */
+    uint8_t  sequence;
+} setpoint_ack_packet_t;
+
+#if MEASURE_LATENCY
+    /* answer of the controller emulator to a traced setpoint. Timestamps in us of the controller emulator clock. */
+    typedef struct __attribute__((packed))
+    {
+        uint16_t trace_id;
+        uint32_t receive_timestamp;
+        uint32_t dac_write_timestamp;
+        uint32_t report_send_timestamp;
+    } trace_report_packet_t;
+#endif
+
+/* sensorcar -> controller emulator, sent when the car derailed and when it is racing again */
+typedef struct __attribute__((packed))
+{
+    uint8_t  derailed;              /* 1 when derailed, 0 when the position was synced again */
+    uint8_t  track_position_index;
+    uint8_t  derailment_count;      /* derailments since boot of the sensorcar */
+} derailment_report_packet_t;
+
+extern DRAM_ATTR TaskHandle_t setpoint_retransmit_task_handle;
+extern DRAM_ATTR uint32_t     setpoint_retransmissions;
+
 const uint8_t newMACAddress[] = {0x32, 0xAE, 0xA4, 0x07, 0x0D, 0x66};    /* MAC this uC */
 const uint8_t broadcastAddress[] = {0x32, 0xAE, 0xA4, 0x07, 0x0D, 0x65}; /* MAC receiver */
 
 void init_wifi();
 IRAM_ATTR void send_data_wirelessly(uint8_t data_to_transmit);
+IRAM_ATTR bool setpoint_delivery_failed();
+IRAM_ATTR void send_derailment_report(bool derailed, uint8_t track_position_index, uint8_t derailment_count);
+IRAM_ATTR void setpoint_retransmit_task(void*);
 IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data, int len);
\ No newline at end of file
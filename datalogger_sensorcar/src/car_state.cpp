@@ -0,0 +1,51 @@
+#include "car_state.h"
+#include "imu_lsm6ds3.h"
+#include "ir_sensors.h"
+
+DRAM_ATTR spsc_queue<log_record_t, LOG_RECORD_QUEUE_LENGTH> log_record_queue;
+DRAM_ATTR std::atomic<bool> log_close_requested(false);
+
+inline void fill_car_state(car_state_t* car_state)
+{
+    car_state->sensorcar_state              = sensorcar_state;
+    car_state->track_position_index         = track_position_index;
+    car_state->speed_digital                = speed_digital;
+    car_state->ir_left_speed                = ir_left_speed;
+    car_state->ir_right_speed               = ir_right_speed;
+    car_state->ir_left_speed_trackbased     = ir_left_speed_trackbased;
+    car_state->ir_right_speed_trackbased    = ir_right_speed_trackbased;
+    car_state->car_speed                    = car_speed;
+    car_state->accel_now                    = accel_now;
+}
+
+/* packs the current sample for the logging task. Returns false if the queue is full and the sample is lost. Only sample_imu_task may call this. */
+IRAM_ATTR bool queue_log_record()
+{
+    log_record_t log_record;
+    log_record.kind                             = LOG_RECORD_SAMPLE;
+    log_record.imu_timestamp                    = imu_timestamp;
+    fill_car_state(&log_record.car_state);
+    log_record.ir_left_right_time_difference    = ir_left_right_time_difference;
+    memcpy(log_record.front_imu_raw_data_array, front_imu_raw_data_array, sizeof(front_imu_raw_data_array));
+    memcpy(log_record.back_imu_raw_data_array,  back_imu_raw_data_array,  sizeof(back_imu_raw_data_array));
+    #if CALIBRATE_ACCELERATION
+        memcpy(log_record.front_imu_calibrated_acceleration_array, front_imu_calibrated_acceleration_array, sizeof(front_imu_calibrated_acceleration_array));
+        memcpy(log_record.back_imu_calibrated_acceleration_array,  back_imu_calibrated_acceleration_array,  sizeof(back_imu_calibrated_acceleration_array));
+    #endif
+    return log_record_queue.push(log_record);
+}
+
+/* ends the current run once every sample queued so far is written. Any task may call this, it does not wait for the card. */
+IRAM_ATTR void request_log_close()
+{
+    log_close_requested.store(true, std::memory_order_release);
+}
+
+/* queues the close marker behind the samples of the run if a close was requested. Only sample_imu_task may call this, for every sample. A full queue is tried again at the next sample. */
+IRAM_ATTR void queue_log_close()
+{
+    if (!log_close_requested.load(std::memory_order_acquire)) { return; }
+    log_record_t close_marker;
+    close_marker.kind = LOG_RECORD_CLOSE_RUN;
+    if (log_record_queue.push(close_marker)) { log_close_requested.store(false, std::memory_order_relaxed); }
+}
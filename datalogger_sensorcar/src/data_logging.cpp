@@ -1,117 +1,224 @@
 #include "data_logging.h"
-DRAM_ATTR File log_file;
+#include "handoff_accounting.h"
+#include "imu_lsm6ds3.h"    /* calibration values for the run metadata */
+#include "track_data.h"     /* track layout for the run metadata */
+#include "timer_setup.h"    /* intervals for the run metadata */
+#include "event_trace.h"
 
-RTC_DATA_ATTR uint32_t readingID = 0; /* counter. Increments every time a line is appended to the log. Is used to close and reopen the file to save progress. The file can't be opened and closed every line, it takes too much time. */
+DRAM_ATTR File     log_file;
+DRAM_ATTR File     run_index_file;              /* open while a run is open */
+DRAM_ATTR bool     run_prepared         = false;    /* log_file is created and preallocated, but the run has not started */
+DRAM_ATTR bool     run_open             = false;
+DRAM_ATTR uint32_t run_number           = 0;    /* number of the next or current run, equal to the number of entries in the index */
+DRAM_ATTR run_index_entry_t run_index_entry;
+DRAM_ATTR const char* run_file_header   = "";
 
-/* Append data to the SD card */
-IRAM_ATTR void appendFile(fs::FS &fs, const char * path, const char * message)
+DRAM_ATTR uint8_t  sector_buffer[SD_SECTOR_SIZE];
+DRAM_ATTR uint16_t sector_buffer_fill   = 0;
+DRAM_ATTR uint32_t run_written_sectors  = 0;
+
+inline bool open_run_index()
+{
+    run_index_file = SD.open(RUN_INDEX_FILE_NAME, (run_index_entry.run_number == 0) ? FILE_WRITE : "r+");
+    if (!run_index_file) { run_index_file = SD.open(RUN_INDEX_FILE_NAME, FILE_WRITE); }   /* first run on this card */
+    return bool(run_index_file);
+}
+
+/* overwrites the entry of the current run in the index and commits it to the card */
+inline void write_run_index_entry()
+{
+    run_index_file.seek(run_index_entry.run_number * sizeof(run_index_entry_t));
+    run_index_file.write((const uint8_t*)&run_index_entry, sizeof(run_index_entry));
+    run_index_file.flush();
+}
+
+/* writes the full sector buffer. Only called with a full buffer, so every write covers one whole sector. */
+inline void write_sector()
 {
-  if (xSemaphoreTake(sd_card_access_semaphore,0) == pdTRUE)
-  {
-    if (!log_file)
+    log_file.write(sector_buffer, SD_SECTOR_SIZE);
+    sector_buffer_fill = 0;
+    run_written_sectors++;
+    if ((run_written_sectors % RUN_FLUSH_SECTORS) == 0)
     {
-      log_file = fs.open(path, FILE_APPEND);
+        log_file.flush();   /* the file size does not change, so this does not touch the FAT */
+        run_index_entry.data_length = run_written_sectors * SD_SECTOR_SIZE;
+        write_run_index_entry();    /* after the data, so the index never covers data that is not on the card */
     }
-
-    #if DEBUG
-      bool print_success = log_file.print(message);
-      log_file.close();
-      Serial.printf("Appending to file: %s\n", path);
-      if(print_success)
-      {
-        Serial.println("Message appended");
-      } 
-      else
-      {
-        Serial.println("Append failed");
-      }
-    #else
-      log_file.print(message);
-      #if (MEASURE_SYSTEM == MEASURE_MODE_MANUAL) /* free running sampling, there is no event to stop capture, so it is stopped periodically */
-        readingID += 1;
-        if ((readingID % CLOSE_FILE_SAMPLE_NO) == 0)
-        {
-          readingID = 0;
-          log_file.close();
-        }
-      #endif
-    #endif
-    xSemaphoreGive(sd_card_access_semaphore);
-  }
 }
 
-/* Write to the SD card */
-IRAM_ATTR void writeFile(fs::FS &fs, const char * path, const char * message)
+inline void buffer_message(const char* message)
 {
-  if (xSemaphoreTake(sd_card_access_semaphore,0) == pdTRUE)
-  {
-    if (!log_file)
+    size_t length = strlen(message);
+    while (length > 0)
     {
-      log_file = fs.open(path, FILE_WRITE);
+        size_t chunk = min(length, size_t(SD_SECTOR_SIZE - sector_buffer_fill));
+        memcpy(&sector_buffer[sector_buffer_fill], message, chunk);
+        sector_buffer_fill += chunk;
+        message            += chunk;
+        length             -= chunk;
+        if (sector_buffer_fill == SD_SECTOR_SIZE) { write_sector(); }
     }
-    log_file.print(message);
-    log_file.close();
+}
 
-    #if DEBUG
-      Serial.printf("Writing file: %s\n", path);
+inline void buffer_calibration_row(const char* name, const double_t* calibration_values)
+{
+    char row[300];
+    int  length = snprintf(row, sizeof(row), "#%s", name);
+    for (uint8_t ii = 0; ii < 12; ii++) { length += snprintf(&row[length], sizeof(row) - length, "\t%.15g", calibration_values[ii]); }
+    snprintf(&row[length], sizeof(row) - length, "\n");
+    buffer_message(row);
+}
+
+/* settings, calibration and track layout, so a run can be evaluated without knowing which firmware recorded it */
+inline void buffer_run_metadata()
+{
+    char row[200];
+    snprintf(row, sizeof(row), "#Run\t%u\n", run_index_entry.run_number);
+    buffer_message(row);
+    snprintf(row, sizeof(row), "#Firmware\tOPERATION_MODE=%d\tMEASURE_SYSTEM=%d\tALGORITHM_TYPE=%d\tCALIBRATE_ACCELERATION=%d\tIMU_BIAS_TRACKING=%d\tSAMPLING_INTERVAL=%d\tCONTROLLER_INTERVAL=%d\n",
+        OPERATION_MODE, MEASURE_SYSTEM, ALGORITHM_TYPE, CALIBRATE_ACCELERATION, IMU_BIAS_TRACKING, SAMPLING_INTERVAL, CONTROLLER_INTERVAL);
+    buffer_message(row);
+    snprintf(row, sizeof(row), "#Acceleration_Scale_g\t%d\n", acceleration_scale_in_g(imu_acceleration_scale));
+    buffer_message(row);
+    #if CALIBRATE_ACCELERATION
+        buffer_calibration_row("Calibration_Front", calibration_values_front);
+        buffer_calibration_row("Calibration_Heck",  calibration_values_back);
     #endif
-    xSemaphoreGive(sd_card_access_semaphore);
-  }
+
+    /* written by the IR task on the other core. A run starts between laps, so the layout is not changing while it is copied. */
+    int length = snprintf(row, sizeof(row), "#Track\t%d", track_mapped_out_flag ? number_track_pieces : 0);
+    for (uint8_t ii = 0; track_mapped_out_flag && (ii < number_track_pieces) && (length < (int)sizeof(row) - 4); ii++) { length += snprintf(&row[length], sizeof(row) - length, "\t%d", track_geometry[ii]); }
+    snprintf(&row[length], sizeof(row) - length, "\n");
+    buffer_message(row);
 }
 
-void init_SD()
+/*
+Creates and preallocates the file of the next run. Takes as long as allocating RUN_FILE_SIZE, so the logging task does it while it waits for the run.
+Writing the last byte reserves the clusters of the whole size up front, so writing the run does not allocate. FAT does not promise that they are contiguous. The clusters are not cleared.
+*/
+inline bool prepare_run()
 {
-  SD.begin(SD_CS);
-  if(!SD.begin(SD_CS))
-  {
-    Serial.println("Card Mount Failed");
-    ESP.restart();
-  }
-  uint8_t cardType = SD.cardType();
-  if(cardType == CARD_NONE)
-  {
-    Serial.println("No SD card attached");
-    ESP.restart();
-  }
-  Serial.println("Initializing SD card...");
-  if (!SD.begin(SD_CS))
-  {
-    Serial.println("ERROR - SD card initialization failed!");
-    ESP.restart();
-  }
-  xSemaphoreGive(sd_card_access_semaphore);
+    char file_name[sizeof(run_index_entry.file_name)];
+    snprintf(file_name, sizeof(file_name), RUN_FILE_NAME, run_number);
+    log_file = SD.open(file_name, FILE_WRITE);
+    if (!log_file) { return false; }
+
+    log_file.seek(RUN_FILE_SIZE - 1);
+    log_file.write((uint8_t)0);
+    log_file.flush();
+    log_file.seek(0);
+    run_prepared = true;
+    return true;
 }
 
-IRAM_ATTR void init_log_file(const char* log_file_header)
+/* starts the prepared run: adds it to the index and writes its metadata and header */
+inline bool open_run()
+{
+    if (!run_prepared && !prepare_run()) { return false; }  /* the first row came before the logging task could prepare the run */
+
+    run_index_entry = { };
+    run_index_entry.run_number        = run_number;
+    run_index_entry.start_time_ms     = millis();
+    run_index_entry.preallocated_size = RUN_FILE_SIZE;
+    snprintf(run_index_entry.file_name, sizeof(run_index_entry.file_name), RUN_FILE_NAME, run_number);
+    if (!open_run_index()) { return false; }
+
+    write_run_index_entry();
+    handoff_counters_start_run();   /* the counters appended at the end count this run only */
+    run_number++;
+    run_prepared        = false;
+    run_open            = true;
+    sector_buffer_fill  = 0;
+    run_written_sectors = 0;
+
+    buffer_run_metadata();
+    buffer_message(run_file_header);
+    return true;
+}
+
+/* creates and preallocates the file of the next run ahead of its first row. Does nothing if the card is busy or the file is ready. */
+IRAM_ATTR void prepare_log_file()
+{
+    if (xSemaphoreTake(sd_card_access_semaphore,0) == pdTRUE)
+    {
+        if (!run_open && !run_prepared) { prepare_run(); }
+        xSemaphoreGive(sd_card_access_semaphore);
+    }
+}
+
+/* Append data to the current run, which is opened first if needed. Returns false if the card was busy and the message was dropped. */
+IRAM_ATTR bool append_to_log(const char* message)
+{
+    if (xSemaphoreTake(sd_card_access_semaphore,0) == pdTRUE)
+    {
+        bool appended = run_open || open_run();
+        if (appended) { buffer_message(message); }
+        #if DEBUG
+            Serial.printf("Appending to %s: %s\n", run_index_entry.file_name, appended ? "ok" : "failed");
+        #endif
+        xSemaphoreGive(sd_card_access_semaphore);
+        return appended;
+    }
+    return false;
+}
+
+void init_SD()
 {
-  if (xSemaphoreTake(sd_card_access_semaphore,portMAX_DELAY) == pdTRUE)
-  {
-    log_file = SD.open(LOG_FILE_NAME);
-    if (!log_file)
+    Serial.println("Initializing SD card...");
+    if (!SD.begin(SD_CS))
     {
-      log_file.close();
-      xSemaphoreGive(sd_card_access_semaphore);
-      Serial.println("File doesn't exist. Creating it.");
-      writeFile(SD, LOG_FILE_NAME, log_file_header);
+        Serial.println("Card Mount Failed");
+        event_trace(EVENT_RESTART, RESTART_SD_MOUNT_FAILED, 0);
+        ESP.restart();
     }
-    else
+    if (SD.cardType() == CARD_NONE)
     {
-      log_file.close();
-      xSemaphoreGive(sd_card_access_semaphore);
-      Serial.println("File already exists.");
-      appendFile(SD, LOG_FILE_NAME, log_file_header);
+        Serial.println("No SD card attached");
+        event_trace(EVENT_RESTART, RESTART_SD_CARD_MISSING, 0);
+        ESP.restart();
     }
-    Serial.println("Writing header.");
-    log_file.close();
+
+    /* the next run number follows from the size of the index */
+    File index_file = SD.open(RUN_INDEX_FILE_NAME);
+    if (index_file)
+    {
+        run_number = index_file.size() / sizeof(run_index_entry_t);
+        index_file.close();
+    }
+    Serial.printf("%u runs on the card.\n", run_number);
     xSemaphoreGive(sd_card_access_semaphore);
-  }
 }
 
+/* the header is written at the start of every run */
+IRAM_ATTR void init_log_file(const char* log_file_header)
+{
+    run_file_header = log_file_header;
+}
+
+/* closing ends a run, so the hand-off counters are appended to document how much data got lost during it. Called by the logging task at the close marker, after the last row of the run. */
 IRAM_ATTR void close_log_file()
 {
-  if (xSemaphoreTake(sd_card_access_semaphore,portMAX_DELAY) == pdTRUE)
-  {
-    log_file.close();
-    xSemaphoreGive(sd_card_access_semaphore);
-  }
-}
\ No newline at end of file
+    if (xSemaphoreTake(sd_card_access_semaphore,portMAX_DELAY) == pdTRUE)
+    {
+        if (run_open)
+        {
+            char counter_buffer[300];
+            char row[350];
+            sprint_handoff_counters(counter_buffer, sizeof(counter_buffer));
+            snprintf(row, sizeof(row), "#Handoffs_Delivered/Coalesced/Rejected\t%s\n", counter_buffer);
+            buffer_message(row);
+
+            /* the last, partial sector. The rest of the file keeps the old card data, data_length marks the end. */
+            if (sector_buffer_fill > 0) { log_file.write(sector_buffer, sector_buffer_fill); }
+            log_file.close();
+
+            run_index_entry.data_length = run_written_sectors * SD_SECTOR_SIZE + sector_buffer_fill;
+            run_index_entry.complete    = 1;
+            write_run_index_entry();
+            run_index_file.close();
+            sector_buffer_fill = 0;
+            run_open           = false;
+        }
+        xSemaphoreGive(sd_card_access_semaphore);
+    }
+}
@@ -0,0 +1,111 @@
+#include "derailment_detection.h"
+#include "imu_lsm6ds3.h"
+#include "imu_bias_tracking.h"      /* rotation rates */
+#include "track_data.h"
+#include "wireless_transmission.h"  /* derailment reports */
+#if ALGORITHM_TYPE == ALGORITHM_LEARNING
+    #include "speed_learning.h"
+#endif
+
+DRAM_ATTR uint8_t       derailment_count                = 0;    /* derailments since boot */
+
+DRAM_ATTR double_t      derailment_filtered_z           = 1.0;  /* low pass filtered calibrated z acceleration, in g */
+DRAM_ATTR uint32_t      derailment_last_ir_mark         = 0;    /* ir_mark_sequence at the last check */
+DRAM_ATTR unsigned long derailment_last_motion_ms       = 0;    /* last IR mark, or last time the car was not driven */
+DRAM_ATTR unsigned long derailment_upright_since_ms     = 0;
+DRAM_ATTR bool          derailment_upright              = false;
+DRAM_ATTR bool          derailment_resyncing            = false; /* back on the track, driving slowly to the finish line */
+
+/* returns true if any of the signatures is present */
+inline bool derailment_detected(unsigned long timestamp_now)
+{
+    if (imu_rotation_rate_magnitude() > DERAILMENT_ROTATION_THRESHOLD) { return true; }
+    #if CALIBRATE_ACCELERATION
+        if (derailment_filtered_z < DERAILMENT_TILT_THRESHOLD) { return true; }
+    #endif
+    return (timestamp_now - derailment_last_motion_ms) >= DERAILMENT_IR_TIMEOUT_MS;
+}
+
+inline void on_derailment()
+{
+    derailment_count++;
+    sensorcar_state         = SENSORCAR_DERAILED_STATE;
+    derailment_resyncing    = false;
+    derailment_upright      = false;
+    xTaskNotifyGive(velocity_controller_task_handle);           /* the controller stops the car now instead of at its next interval */
+    xSemaphoreTake(finish_line_passed_semaphore, 0);            /* a pass from before the derailment must not sync the position */
+
+    #if TRACK_REFINEMENT
+        track_refinement_discard_lap();
+    #endif
+    #if ALGORITHM_TYPE == ALGORITHM_LEARNING
+        speed_learning_derailed(track_position_index);
+    #endif
+    send_derailment_report(true, track_position_index, derailment_count);
+    #if DEBUG
+        Serial.printf("Derailment %d on track piece %d.\n", derailment_count, track_position_index);
+    #endif
+}
+
+/* call after imu_read() and imu_bias_update() in SENSORCAR_RACING_STATE and SENSORCAR_DERAILED_STATE */
+IRAM_ATTR void derailment_update()
+{
+    unsigned long timestamp_now = millis();
+    uint32_t      ir_mark       = ir_mark_sequence;
+    if ((ir_mark != derailment_last_ir_mark) || (speed_digital_previous == 0) || ((sensorcar_state == SENSORCAR_DERAILED_STATE) && !derailment_resyncing))
+    {
+        derailment_last_ir_mark   = ir_mark;
+        derailment_last_motion_ms = timestamp_now;
+    }
+    #if CALIBRATE_ACCELERATION
+        double_t acceleration_z = (front_imu_calibrated_acceleration_array[2] + back_imu_calibrated_acceleration_array[2]) / 2;
+        derailment_filtered_z  += (acceleration_z - derailment_filtered_z) / DERAILMENT_TILT_SAMPLES;
+    #endif
+
+    if ((sensorcar_state == SENSORCAR_RACING_STATE) || derailment_resyncing)
+    {
+        if (derailment_detected(timestamp_now)) { on_derailment(); }
+        return;
+    }
+
+    /* derailed: wait until the car stands upright on the track for a while */
+    #if CALIBRATE_ACCELERATION
+        bool upright = (derailment_filtered_z > DERAILMENT_UPRIGHT_THRESHOLD) && (imu_rotation_rate_magnitude() < DERAILMENT_ROTATION_THRESHOLD);
+    #else
+        bool upright = (imu_rotation_rate_magnitude() < DERAILMENT_ROTATION_THRESHOLD);
+    #endif
+    #if IMU_BIAS_TRACKING
+        upright = upright && imu_standstill;
+    #endif
+    if (!upright)                   { derailment_upright = false; return; }
+    if (!derailment_upright)        { derailment_upright = true; derailment_upright_since_ms = timestamp_now; }
+    if ((timestamp_now - derailment_upright_since_ms) >= DERAILMENT_RECOVERY_MS)
+    {
+        derailment_resyncing      = true;
+        derailment_last_motion_ms = timestamp_now;
+    }
+}
+
+/* a new race starts with a clean state */
+IRAM_ATTR void derailment_reset()
+{
+    derailment_last_motion_ms = millis();
+    derailment_filtered_z     = 1.0;
+    derailment_resyncing      = false;
+}
+
+/* speed the controller commands in SENSORCAR_DERAILED_STATE */
+IRAM_ATTR uint8_t derailment_speed_digital()
+{
+    return derailment_resyncing ? DERAILMENT_RESYNC_VDIGI : 0;
+}
+
+/* called by the IR task at the first mark after the finish line while derailed. The position is known again. */
+IRAM_ATTR void derailment_resync()
+{
+    if (!derailment_resyncing) { return; }
+    derailment_resyncing = false;
+    track_position_index = 1;
+    sensorcar_state      = SENSORCAR_RACING_STATE;
+    send_derailment_report(false, track_position_index, derailment_count);
+}
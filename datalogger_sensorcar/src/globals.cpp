@@ -1,12 +1,14 @@
 #include "globals.h"
 
-DRAM_ATTR SemaphoreHandle_t sampling_semaphore              = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t logging_semaphore               = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t sd_card_access_semaphore        = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t measurement_timer_semaphore   = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t ir_data_semaphore               = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t controller_timer_semaphore      = xSemaphoreCreateBinary();
-DRAM_ATTR SemaphoreHandle_t finish_line_passed_semaphore    = xSemaphoreCreateBinary();
+#if STATIC_ALLOCATION
+  DRAM_ATTR StaticSemaphore_t sd_card_access_semaphore_buffer;
+  DRAM_ATTR StaticSemaphore_t finish_line_passed_semaphore_buffer;
+  DRAM_ATTR SemaphoreHandle_t sd_card_access_semaphore        = xSemaphoreCreateBinaryStatic(&sd_card_access_semaphore_buffer);
+  DRAM_ATTR SemaphoreHandle_t finish_line_passed_semaphore    = xSemaphoreCreateBinaryStatic(&finish_line_passed_semaphore_buffer);
+#else
+  DRAM_ATTR SemaphoreHandle_t sd_card_access_semaphore        = xSemaphoreCreateBinary();
+  DRAM_ATTR SemaphoreHandle_t finish_line_passed_semaphore    = xSemaphoreCreateBinary();
+#endif
 
 DRAM_ATTR TaskHandle_t measurement_task_handle           = NULL;
 DRAM_ATTR TaskHandle_t log_to_sdcard_task_handle         = NULL;
@@ -30,6 +32,7 @@ DRAM_ATTR double_t ir_right_speed_trackbased = 0.0; /* in m/s, calculated from t
 DRAM_ATTR double_t car_speed                 = 0.0; /* in m/s, calculated from ir speeds and accelerometer x axes integration */
 DRAM_ATTR double_t accel_now                 = 0.0; /* in m/s^2 */
 DRAM_ATTR double_t accel_previous            = 0.0; /* in m/s^2 */
+DRAM_ATTR uint32_t ir_mark_sequence          = 0;   /* counts the IR marks ir_sensor_process_task has processed. Never reset, consumers compare it with the value they saw last. */
 
 DRAM_ATTR uint8_t  sensorcar_state           = SENSORCAR_INITIAL_STATE;
 DRAM_ATTR bool     track_mapped_out_flag     = false;   /* is true when the track geometry has been figured out */
@@ -0,0 +1,71 @@
+#include "handoff_accounting.h"
+#include "event_trace.h"
+
+DRAM_ATTR handoff_counter_t handoff_counters[HANDOFF_COUNT] = { 0 };
+DRAM_ATTR handoff_counter_t handoff_run_start[HANDOFF_COUNT] = { 0 };  /* counters when the current run started */
+
+const char* const HANDOFF_NAMES[HANDOFF_COUNT] = { "imu_sampling", "controller_timer", "measurement_timer", "ir_data", "logging", "sd_write", "logging_timer", "setpoint", "link" };
+
+/* consumers that do not exist in the current operation mode (task handle is NULL) are skipped. Counted by the consumer in handoff_wait(). */
+IRAM_ATTR void handoff_notify_from_isr(TaskHandle_t task_handle, BaseType_t* higher_priority_task_woken)
+{
+    if (task_handle == NULL) { return; }
+    vTaskNotifyGiveFromISR(task_handle, higher_priority_task_woken);
+}
+
+/* blocks the calling task until it is notified, then takes all pending notifications at once. Returns true if there is an event to process. */
+IRAM_ATTR bool handoff_wait(uint8_t channel, TickType_t ticks_to_wait)
+{
+    uint32_t pending_notifications = ulTaskNotifyTake(pdTRUE, ticks_to_wait);
+    if (pending_notifications == 0) { return false; }
+
+    handoff_counters[channel].coalesced += pending_notifications - 1;
+    handoff_counters[channel].delivered += 1;
+    if (pending_notifications > 1) { event_trace(EVENT_HANDOFF_COALESCED, channel, uint16_t(min(pending_notifications - 1, uint32_t(UINT16_MAX)))); }
+    return true;
+}
+
+IRAM_ATTR void handoff_count_delivered(uint8_t channel)
+{
+    handoff_counters[channel].delivered += 1;
+}
+
+IRAM_ATTR void handoff_count_rejected(uint8_t channel)
+{
+    handoff_counters[channel].rejected += 1;
+    event_trace(EVENT_HANDOFF_REJECTED, channel, 0);
+}
+
+/* called when a run opens, the counters are reported relative to this point from now on */
+void handoff_counters_start_run()
+{
+    memcpy(handoff_run_start, handoff_counters, sizeof(handoff_run_start));
+}
+
+/* formats the counters since the start of the run as tab separated name=delivered/coalesced/rejected. Returns the number of characters written, like snprintf. */
+int sprint_handoff_counters(char* buffer, size_t buffer_length)
+{
+    int length = 0;
+    for (uint8_t ii = 0; ii < HANDOFF_COUNT; ii++)
+    {
+        if (length >= int(buffer_length)) { break; }
+        length += snprintf(buffer + length, buffer_length - length, "%s%s=%u/%u/%u",
+            (ii ? "\t" : ""),
+            HANDOFF_NAMES[ii],
+            (unsigned int)(handoff_counters[ii].delivered - handoff_run_start[ii].delivered),
+            (unsigned int)(handoff_counters[ii].coalesced - handoff_run_start[ii].coalesced),
+            (unsigned int)(handoff_counters[ii].rejected  - handoff_run_start[ii].rejected));
+    }
+    return length;
+}
+
+void handoff_counters_print_task(void*)
+{
+    char print_buffer[300];
+    for(;;)
+    {
+        DELAY_N_MS(HANDOFF_COUNTERS_PRINT_INTERVAL_MS);
+        sprint_handoff_counters(print_buffer, sizeof(print_buffer));
+        Serial.printf("Hand-offs since the run started (delivered/coalesced/rejected): %s\n", print_buffer);
+    }
+}
@@ -0,0 +1,125 @@
+#include "imu_bias_tracking.h"
+#include "imu_lsm6ds3.h"
+
+DRAM_ATTR bool     imu_standstill                = false;
+DRAM_ATTR double_t front_imu_rotation_rate[3]    = { 0 };
+DRAM_ATTR double_t back_imu_rotation_rate[3]     = { 0 };
+
+/* biases, gyro in counts, acceleration in g of the calibrated car axes */
+DRAM_ATTR double_t front_gyro_bias[3]            = { 0 };
+DRAM_ATTR double_t back_gyro_bias[3]             = { 0 };
+#if CALIBRATE_ACCELERATION
+    DRAM_ATTR double_t front_acceleration_bias[3] = { 0 };
+    DRAM_ATTR double_t back_acceleration_bias[3]  = { 0 };
+    const double_t STANDSTILL_ACCELERATION[3]     = { 0.0, 0.0, 1.0 };  /* gravity only, on a level track */
+#endif
+DRAM_ATTR uint32_t bias_samples                  = 0;   /* standstill samples averaged so far */
+
+/* ring buffer of the raw accelerations, 012: front xyz, 345: back xyz */
+DRAM_ATTR int16_t  acceleration_window[ZERO_VELOCITY_WINDOW][6] = { { 0 } };
+DRAM_ATTR uint8_t  acceleration_window_index     = 0;
+DRAM_ATTR uint8_t  acceleration_window_fill      = 0;
+
+DRAM_ATTR uint32_t bias_last_ir_mark             = 0;
+DRAM_ATTR unsigned long bias_last_ir_mark_ms     = 0;
+
+inline bool acceleration_window_still()
+{
+    if (acceleration_window_fill < ZERO_VELOCITY_WINDOW) { return false; }
+
+    double_t counts_per_g = 32768.0 / acceleration_scale_in_g(imu_acceleration_scale);
+    double_t threshold    = ZERO_VELOCITY_ACCEL_THRESHOLD * counts_per_g;
+    for (uint8_t axis = 0; axis < 6; axis++)
+    {
+        double_t sum = 0.0, sum_squares = 0.0;
+        for (uint8_t ii = 0; ii < ZERO_VELOCITY_WINDOW; ii++)
+        {
+            sum         += acceleration_window[ii][axis];
+            sum_squares += double_t(acceleration_window[ii][axis]) * acceleration_window[ii][axis];
+        }
+        double_t mean = sum / ZERO_VELOCITY_WINDOW;
+        if ((sum_squares / ZERO_VELOCITY_WINDOW - mean * mean) > threshold * threshold) { return false; }
+    }
+    return true;
+}
+
+/* moves the estimate towards measured - expected */
+inline void track_bias(double_t* bias, double_t measured, double_t expected, double_t rate)
+{
+    *bias += rate * ((measured - expected) - *bias);
+}
+
+/* call right after imu_read(). Detects standstill, updates the biases and subtracts them. */
+IRAM_ATTR void imu_bias_update()
+{
+    unsigned long timestamp_now = millis();
+    if (ir_mark_sequence != bias_last_ir_mark)
+    {
+        bias_last_ir_mark    = ir_mark_sequence;
+        bias_last_ir_mark_ms = timestamp_now;
+    }
+
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        acceleration_window[acceleration_window_index][axis]   = front_imu_raw_data_array[axis+3];
+        acceleration_window[acceleration_window_index][axis+3] = back_imu_raw_data_array[axis+3];
+    }
+    acceleration_window_index = (acceleration_window_index + 1) % ZERO_VELOCITY_WINDOW;
+    if (acceleration_window_fill < ZERO_VELOCITY_WINDOW) { acceleration_window_fill++; }
+
+    imu_standstill = (speed_digital_previous < ZERO_VELOCITY_MAX_VDIGI)                      /* speed_digital_previous is the last command sent */
+                  && ((timestamp_now - bias_last_ir_mark_ms) >= ZERO_VELOCITY_IR_SILENCE_MS)
+                  && acceleration_window_still();
+
+    bool level = true;
+    #if CALIBRATE_ACCELERATION
+        double_t level_z = ((front_imu_calibrated_acceleration_array[2] - front_acceleration_bias[2]) + (back_imu_calibrated_acceleration_array[2] - back_acceleration_bias[2])) / 2;
+        level = (abs(level_z - STANDSTILL_ACCELERATION[2]) < BIAS_TRACKING_LEVEL_THRESHOLD);
+    #endif
+
+    if (imu_standstill && level)
+    {
+        bias_samples++;
+        double_t rate = max(1.0 / bias_samples, BIAS_TRACKING_RATE); /* plain average first, so the first standstill already gives a good estimate */
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            track_bias(&front_gyro_bias[axis], front_imu_raw_data_array[axis], 0.0, rate);
+            track_bias(&back_gyro_bias[axis],  back_imu_raw_data_array[axis],  0.0, rate);
+            #if CALIBRATE_ACCELERATION
+                track_bias(&front_acceleration_bias[axis], front_imu_calibrated_acceleration_array[axis], STANDSTILL_ACCELERATION[axis], rate);
+                track_bias(&back_acceleration_bias[axis],  back_imu_calibrated_acceleration_array[axis],  STANDSTILL_ACCELERATION[axis], rate);
+            #endif
+        }
+    }
+
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        front_imu_rotation_rate[axis] = (front_imu_raw_data_array[axis] - front_gyro_bias[axis]) * GYRO_SENSITIVITY;
+        back_imu_rotation_rate[axis]  = (back_imu_raw_data_array[axis]  - back_gyro_bias[axis])  * GYRO_SENSITIVITY;
+        #if CALIBRATE_ACCELERATION
+            front_imu_calibrated_acceleration_array[axis] -= front_acceleration_bias[axis];
+            back_imu_calibrated_acceleration_array[axis]  -= back_acceleration_bias[axis];
+        #endif
+    }
+}
+
+inline double_t rotation_rate_magnitude(double_t* rotation_rate)
+{
+    return sqrt(rotation_rate[0] * rotation_rate[0] + rotation_rate[1] * rotation_rate[1] + rotation_rate[2] * rotation_rate[2]);
+}
+
+/* gyro axes are not aligned to the car, so only the magnitude of the rotation is meaningful */
+IRAM_ATTR double_t imu_rotation_rate_magnitude()
+{
+    #if IMU_BIAS_TRACKING
+        return max(rotation_rate_magnitude(front_imu_rotation_rate), rotation_rate_magnitude(back_imu_rotation_rate));
+    #else
+        double_t front_rotation_rate[3], back_rotation_rate[3];
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            front_rotation_rate[axis] = front_imu_raw_data_array[axis] * GYRO_SENSITIVITY;
+            back_rotation_rate[axis]  = back_imu_raw_data_array[axis]  * GYRO_SENSITIVITY;
+        }
+        return max(rotation_rate_magnitude(front_rotation_rate), rotation_rate_magnitude(back_rotation_rate));
+    #endif
+}
@@ -0,0 +1,214 @@
+#include "imu_calibration.h"
+#include "imu_lsm6ds3.h"
+#include <Preferences.h>    /* key value storage in the NVS flash partition */
+
+/* poses in the order they are requested, with the acceleration in g the car axes see in them. Equivalent of Y in the application note. */
+const char* const CALIBRATION_POSE_NAMES[CALIBRATION_NUMBER_POSES] = { "+x (nose to the sky)", "-x (nose to the earth)", "+y (left side to the sky)", "-y (left side to the earth)", "+z (wheels on the ground)", "-z (wheels to the sky)" };
+const double_t CALIBRATION_REFERENCE[CALIBRATION_NUMBER_POSES][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+inline void nvs_key_for_scale(char* key, uint8_t scale)
+{
+    sprintf(key, NVS_KEY_IMU_CALIBRATION, acceleration_scale_in_g(scale));
+}
+
+/* the +-8g defaults scaled to another full scale. Coefficients scale with the counts per g, offsets are in g and stay. */
+inline void derive_from_8g_defaults(double_t* calibration_values, const double_t* defaults, uint8_t scale)
+{
+    double_t range_factor = acceleration_scale_in_g(scale) / 8.0;
+    for (uint8_t ii = 0; ii < 12; ii++)
+    {
+        calibration_values[ii] = ((ii % 4) == 3) ? defaults[ii] : defaults[ii] * range_factor;
+    }
+}
+
+/* picks the stored set for the full scale, else the compiled in defaults */
+void load_imu_calibration(uint8_t scale)
+{
+    #if CALIBRATE_ACCELERATION
+        char key[16];
+        nvs_key_for_scale(key, scale);
+
+        imu_calibration_t calibration;
+        Preferences preferences;
+        preferences.begin(NVS_NAMESPACE, true);
+        bool stored = (preferences.getBytesLength(key) == sizeof(calibration));
+        if (stored) { preferences.getBytes(key, &calibration, sizeof(calibration)); }
+        preferences.end();
+
+        if (stored)
+        {
+            memcpy(calibration_values_front, calibration.front, sizeof(calibration_values_front));
+            memcpy(calibration_values_back,  calibration.back,  sizeof(calibration_values_back));
+        }
+        else if (scale == SCALE_16G)
+        {
+            memcpy(calibration_values_front, CALIBRATION_DEFAULT_FRONT_16G, sizeof(calibration_values_front));
+            memcpy(calibration_values_back,  CALIBRATION_DEFAULT_BACK_16G,  sizeof(calibration_values_back));
+        }
+        else
+        {
+            derive_from_8g_defaults(calibration_values_front, CALIBRATION_DEFAULT_FRONT_8G, scale);
+            derive_from_8g_defaults(calibration_values_back,  CALIBRATION_DEFAULT_BACK_8G,  scale);
+        }
+        #if DEBUG
+            Serial.printf("IMU calibration for +-%dg %s.\n", acceleration_scale_in_g(scale), stored ? "loaded from NVS" : "taken from defaults");
+        #endif
+    #endif
+}
+
+/* blocks until anything was sent over the serial terminal, then discards it */
+inline void wait_for_serial_input()
+{
+    while (!Serial.available()) { DELAY_N_MS(50); }
+    while (Serial.available()) { Serial.read(); }
+}
+
+/*
+Averages the raw accelerations of both IMUs over CALIBRATION_POSE_SAMPLES samples.
+means[0..2] are the front, means[3..5] the back xyz values in counts. Returns false if the car was not still.
+*/
+inline bool measure_pose(double_t* means)
+{
+    double_t sum[6]         = { 0 };
+    double_t sum_squares[6] = { 0 };
+    for (uint16_t sample = 0; sample < CALIBRATION_POSE_SAMPLES; sample++)
+    {
+        imu_read();
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            sum[axis]             += front_imu_raw_data_array[axis+3];
+            sum_squares[axis]     += double_t(front_imu_raw_data_array[axis+3]) * front_imu_raw_data_array[axis+3];
+            sum[axis+3]           += back_imu_raw_data_array[axis+3];
+            sum_squares[axis+3]   += double_t(back_imu_raw_data_array[axis+3]) * back_imu_raw_data_array[axis+3];
+        }
+        DELAY_N_MS(CALIBRATION_POSE_INTERVAL_MS);
+    }
+
+    double_t counts_per_g = 32768.0 / acceleration_scale_in_g(imu_acceleration_scale);
+    bool     still        = true;
+    for (uint8_t ii = 0; ii < 6; ii++)
+    {
+        means[ii] = sum[ii] / CALIBRATION_POSE_SAMPLES;
+        double_t variance = sum_squares[ii] / CALIBRATION_POSE_SAMPLES - means[ii] * means[ii];
+        if (sqrt(max(variance, 0.0)) > CALIBRATION_STILL_THRESHOLD * counts_per_g) { still = false; }
+    }
+    return still;
+}
+
+/*
+Solves (W^T*W) * X = W^T*Y for the 4x3 matrix X with Gauss-Jordan elimination and partial pivoting.
+normal_matrix and right_hand_side are overwritten. Returns false if the poses don't span all axes.
+*/
+inline bool solve_normal_equations(double_t normal_matrix[4][4], double_t right_hand_side[4][3])
+{
+    for (uint8_t column = 0; column < 4; column++)
+    {
+        uint8_t pivot = column;
+        for (uint8_t row = column + 1; row < 4; row++)
+        {
+            if (abs(normal_matrix[row][column]) > abs(normal_matrix[pivot][column])) { pivot = row; }
+        }
+        if (abs(normal_matrix[pivot][column]) < 1e-12) { return false; }
+        for (uint8_t ii = 0; ii < 4; ii++) { std::swap(normal_matrix[column][ii], normal_matrix[pivot][ii]); }
+        for (uint8_t ii = 0; ii < 3; ii++) { std::swap(right_hand_side[column][ii], right_hand_side[pivot][ii]); }
+
+        double_t divisor = normal_matrix[column][column];
+        for (uint8_t ii = 0; ii < 4; ii++) { normal_matrix[column][ii]   /= divisor; }
+        for (uint8_t ii = 0; ii < 3; ii++) { right_hand_side[column][ii] /= divisor; }
+
+        for (uint8_t row = 0; row < 4; row++)
+        {
+            if (row == column) { continue; }
+            double_t factor = normal_matrix[row][column];
+            for (uint8_t ii = 0; ii < 4; ii++) { normal_matrix[row][ii]   -= factor * normal_matrix[column][ii]; }
+            for (uint8_t ii = 0; ii < 3; ii++) { right_hand_side[row][ii] -= factor * right_hand_side[column][ii]; }
+        }
+    }
+    return true;
+}
+
+/* least squares fit of one IMU. pose_means holds the xyz counts of every pose. Returns the mean squared error in g^2, negative if the fit failed. */
+inline double_t fit_calibration(double_t pose_means[CALIBRATION_NUMBER_POSES][3], double_t* calibration_values)
+{
+    double_t normal_matrix[4][4]   = { { 0 } };
+    double_t right_hand_side[4][3] = { { 0 } };
+    for (uint8_t pose = 0; pose < CALIBRATION_NUMBER_POSES; pose++)
+    {
+        double_t w[4] = { pose_means[pose][0], pose_means[pose][1], pose_means[pose][2], 1.0 };
+        for (uint8_t row = 0; row < 4; row++)
+        {
+            for (uint8_t column = 0; column < 4; column++) { normal_matrix[row][column] += w[row] * w[column]; }
+            for (uint8_t axis = 0; axis < 3; axis++)       { right_hand_side[row][axis] += w[row] * CALIBRATION_REFERENCE[pose][axis]; }
+        }
+    }
+    if (!solve_normal_equations(normal_matrix, right_hand_side)) { return -1.0; }
+
+    /* same layout as the row vector in imu_lsm6ds3.h: xx xy xz xb, yx yy yz yb, zx zy zz zb */
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        for (uint8_t ii = 0; ii < 4; ii++) { calibration_values[axis*4 + ii] = right_hand_side[ii][axis]; }
+    }
+
+    double_t squared_error = 0.0;
+    for (uint8_t pose = 0; pose < CALIBRATION_NUMBER_POSES; pose++)
+    {
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            double_t calibrated = calibration_values[axis*4] * pose_means[pose][0] + calibration_values[axis*4+1] * pose_means[pose][1] + calibration_values[axis*4+2] * pose_means[pose][2] + calibration_values[axis*4+3];
+            squared_error += (calibrated - CALIBRATION_REFERENCE[pose][axis]) * (calibrated - CALIBRATION_REFERENCE[pose][axis]);
+        }
+    }
+    return squared_error / (CALIBRATION_NUMBER_POSES * 3);
+}
+
+inline void print_calibration_values(const char* name, double_t* calibration_values)
+{
+    Serial.printf("%s = { ", name);
+    for (uint8_t ii = 0; ii < 12; ii++) { Serial.printf("%.15g%s", calibration_values[ii], (ii < 11) ? ", " : " };\n"); }
+}
+
+/* runs the guided calibration for the configured full scale. Needs init_imu() first. */
+void run_imu_calibration()
+{
+    double_t front_means[CALIBRATION_NUMBER_POSES][3];
+    double_t back_means[CALIBRATION_NUMBER_POSES][3];
+
+    Serial.printf("IMU calibration for +-%dg. Put the car into each pose on a level surface, hold it still and send any key.\n", acceleration_scale_in_g(imu_acceleration_scale));
+    for (uint8_t pose = 0; pose < CALIBRATION_NUMBER_POSES; pose++)
+    {
+        double_t means[6];
+        Serial.printf("Pose %d of %d: %s\n", pose + 1, CALIBRATION_NUMBER_POSES, CALIBRATION_POSE_NAMES[pose]);
+        wait_for_serial_input();
+        while (!measure_pose(means))
+        {
+            Serial.println("Car moved during the measurement. Hold it still and send any key to repeat the pose.");
+            wait_for_serial_input();
+        }
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            front_means[pose][axis] = means[axis];
+            back_means[pose][axis]  = means[axis+3];
+        }
+        Serial.printf("front %.1f %.1f %.1f, back %.1f %.1f %.1f counts\n", means[0], means[1], means[2], means[3], means[4], means[5]);
+    }
+
+    imu_calibration_t calibration;
+    double_t error_front = fit_calibration(front_means, calibration.front);
+    double_t error_back  = fit_calibration(back_means,  calibration.back);
+    if ((error_front < 0.0) || (error_back < 0.0))
+    {
+        Serial.println("Calibration failed, the poses don't span all axes. Nothing was stored.");
+        return;
+    }
+    Serial.printf("min_square_error_front = %g, min_square_error_back = %g\n", error_front, error_back);
+    print_calibration_values("calibration_values_front", calibration.front);
+    print_calibration_values("calibration_values_back",  calibration.back);
+
+    char key[16];
+    nvs_key_for_scale(key, imu_acceleration_scale);
+    Preferences preferences;
+    preferences.begin(NVS_NAMESPACE, false);
+    preferences.putBytes(key, &calibration, sizeof(calibration));
+    preferences.end();
+    Serial.printf("Stored as %s. It is used from the next boot on.\n", key);
+}
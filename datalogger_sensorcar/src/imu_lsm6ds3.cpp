@@ -1,12 +1,16 @@
 #include "imu_lsm6ds3.h"
+#include "imu_calibration.h"
 
 DRAM_ATTR unsigned long imu_timestamp           = 0;
 DRAM_ATTR int16_t front_imu_raw_data_array[6]   = { 0 }; /* 012: xyz rotation, 345: xyz acceleration */
 DRAM_ATTR int16_t back_imu_raw_data_array[6]    = { 0 }; /* 012: xyz rotation, 345: xyz acceleration */
+DRAM_ATTR uint8_t imu_acceleration_scale        = ACCELERATION_SCALE;
 
 #if CALIBRATE_ACCELERATION
     DRAM_ATTR double_t front_imu_calibrated_acceleration_array[3] = { 0 }; /* 012: xyz acceleration */
     DRAM_ATTR double_t back_imu_calibrated_acceleration_array[3] = { 0 }; /* 012: xyz acceleration */
+    DRAM_ATTR double_t calibration_values_front[12] = { 0 };
+    DRAM_ATTR double_t calibration_values_back[12]  = { 0 };
 #endif
 
 void init_imu()
@@ -14,17 +18,40 @@ void init_imu()
     Wire.begin();
     Wire.setClock(FAST_MODE_PLUS);
 
-    /* Set up acceleration mode */
-    uint8_t value_to_write = SCALE_8G | ODR_ACCEL_104Hz; /* for choosing values, see definition of the registers in the header file. If calibration is used, use the right sets of calibration parameters in the header file. */
+    imu_acceleration_scale = ACCELERATION_SCALE;
+    imu_power(true);
+
+    #if CALIBRATE_ACCELERATION
+        load_imu_calibration(imu_acceleration_scale);   /* the set that matches the configured full scale */
+    #endif
+}
+
+/* sets the output data rate of both IMUs to 104 Hz, or powers them down. Full scales stay as configured. */
+void imu_power(bool on)
+{
+    /* acceleration mode */
+    uint8_t value_to_write = imu_acceleration_scale | (on ? ODR_ACCEL_104Hz : ODR_ACCEL_0Hz); /* for choosing values, see definition of the registers in the header file */
     write_to_i2c_register(ADDRESS_IMU_FRONT,LINEAR_ACCELERATION_CONTROL_REGISTER,value_to_write);
     write_to_i2c_register(ADDRESS_IMU_BACK,LINEAR_ACCELERATION_CONTROL_REGISTER,value_to_write);
 
-    /* Set up rotation mode */
-    value_to_write = SCALE_2000DPS | ODR_ACCEL_104Hz;
+    /* rotation mode */
+    value_to_write = SCALE_2000DPS | (on ? ODR_GYRO_104Hz : ODR_GYRO_0Hz);
     write_to_i2c_register(ADDRESS_IMU_FRONT,ANGULAR_RATE_CONTROL_REGISTER,value_to_write);
     write_to_i2c_register(ADDRESS_IMU_BACK,ANGULAR_RATE_CONTROL_REGISTER,value_to_write);
 }
 
+/* full scale in g for the FS_XL bits */
+uint8_t acceleration_scale_in_g(uint8_t scale)
+{
+    switch (scale)
+    {
+        case SCALE_2G:  return 2;
+        case SCALE_4G:  return 4;
+        case SCALE_16G: return 16;
+        default:        return 8;
+    }
+}
+
 inline void write_to_i2c_register(uint8_t slave_address, uint8_t register_address, uint8_t value_to_write)
 {
     Wire.beginTransmission(slave_address);
@@ -36,6 +63,7 @@ inline void write_to_i2c_register(uint8_t slave_address, uint8_t register_addres
     #endif
 }
 
+/* raw values of both IMUs. axis_calibration of sensor_pipeline.h aligns the accelerations to the car. */
 IRAM_ATTR void imu_read()
 {
     imu_timestamp = micros();
@@ -80,23 +108,4 @@ IRAM_ATTR void imu_read()
     back_imu_raw_data_array[4] += Wire.read() << 8;
     back_imu_raw_data_array[5]  = Wire.read();
     back_imu_raw_data_array[5] += Wire.read() << 8;
-
-    #if CALIBRATE_ACCELERATION
-        /* done without vector or matrix libraries to keep it lightweight */
-        /* front sensor */
-        /* x axis vehicle */
-        front_imu_calibrated_acceleration_array[0] = calibration_values_front[0] * front_imu_raw_data_array[3] + calibration_values_front[1] * front_imu_raw_data_array[4] + calibration_values_front[2] * front_imu_raw_data_array[5] + calibration_values_front[3];
-        /* y axis vehicle */
-        front_imu_calibrated_acceleration_array[1] = calibration_values_front[4] * front_imu_raw_data_array[3] + calibration_values_front[5] * front_imu_raw_data_array[4] + calibration_values_front[6] * front_imu_raw_data_array[5] + calibration_values_front[7];
-        /* z axis vehicle */
-        front_imu_calibrated_acceleration_array[2] = calibration_values_front[8] * front_imu_raw_data_array[3] + calibration_values_front[9] * front_imu_raw_data_array[4] + calibration_values_front[10] * front_imu_raw_data_array[5] + calibration_values_front[11];
-
-        /* back sensor */
-        /* x axis vehicle */
-        back_imu_calibrated_acceleration_array[0] = calibration_values_back[0] * back_imu_raw_data_array[3] + calibration_values_back[1] * back_imu_raw_data_array[4] + calibration_values_back[2] * back_imu_raw_data_array[5] + calibration_values_back[3];
-        /* y axis vehicle */
-        back_imu_calibrated_acceleration_array[1] = calibration_values_back[4] * back_imu_raw_data_array[3] + calibration_values_back[5] * back_imu_raw_data_array[4] + calibration_values_back[6] * back_imu_raw_data_array[5] + calibration_values_back[7];
-        /* z axis vehicle */
-        back_imu_calibrated_acceleration_array[2] = calibration_values_back[8] * back_imu_raw_data_array[3] + calibration_values_back[9] * back_imu_raw_data_array[4] + calibration_values_back[10] * back_imu_raw_data_array[5] + calibration_values_back[11];
-    #endif
 }
@@ -1,4 +1,8 @@
 #include "ir_sensors.h"
+#include "handoff_accounting.h"
+#if MEASURE_LATENCY
+    #include "latency_tracing.h"
+#endif
 
 /* get ports and masks for faster digital reads so that it will be OK to read in the isr */
 const uint32_t IR_SENSOR_LEFT_PIN_MASK      = digitalPinToBitMask(IR_SENSOR_LEFT_PIN);
@@ -75,7 +79,10 @@ IRAM_ATTR void ir_sensor_left_isr()
                 Serial.printf("Infrared sensor right was high for %ld us.\n", ir_right_passing_time);
                 Serial.printf("Infrared sensor right triggered %ld us after the left one.\n", ir_left_right_time_difference);            
             #endif            
-            xSemaphoreGiveFromISR(ir_data_semaphore,NULL);
+            #if MEASURE_LATENCY
+                latency_trace_open(micros()); /* the edge itself happened DEBOUNCE_TIMEOUT_MS earlier */
+            #endif
+            handoff_notify_from_isr(ir_sensor_process_task_handle, NULL);
             left_done = false;
             right_done = false;
         }
@@ -106,7 +113,10 @@ IRAM_ATTR void ir_sensor_right_isr()
                 Serial.printf("Infrared sensor right was high for %ld us.\n", ir_right_passing_time);
                 Serial.printf("Infrared sensor right triggered %ld us after the left one.\n", ir_left_right_time_difference);
             #endif
-            xSemaphoreGiveFromISR(ir_data_semaphore,NULL);
+            #if MEASURE_LATENCY
+                latency_trace_open(micros()); /* the edge itself happened DEBOUNCE_TIMEOUT_MS earlier */
+            #endif
+            handoff_notify_from_isr(ir_sensor_process_task_handle, NULL);
             left_done = false;
             right_done = false;
         }
@@ -0,0 +1,131 @@
+#include "latency_tracing.h"
+
+DRAM_ATTR QueueHandle_t latency_trace_queue = NULL;
+#if STATIC_ALLOCATION
+    DRAM_ATTR uint8_t       latency_trace_queue_storage[LATENCY_TRACE_QUEUE_LENGTH * sizeof(latency_trace_t)];
+    DRAM_ATTR StaticQueue_t latency_trace_queue_buffer;
+#endif
+
+DRAM_ATTR latency_trace_t latency_trace_slots[LATENCY_TRACE_SLOTS];    /* indexed by trace id modulo LATENCY_TRACE_SLOTS */
+DRAM_ATTR uint16_t  latency_trace_id_counter    = TRACE_ID_NONE;
+DRAM_ATTR uint16_t  latency_trace_pending_id    = TRACE_ID_NONE;          /* trace that was opened by an IR mark and has not been sent yet */
+DRAM_ATTR portMUX_TYPE latency_trace_mutex      = portMUX_INITIALIZER_UNLOCKED; /* slots are written from the IR isr (core 1) and the wireless receive callback (core 0) */
+
+void init_latency_tracing()
+{
+    memset(latency_trace_slots, 0, sizeof(latency_trace_slots));
+    #if STATIC_ALLOCATION
+        latency_trace_queue = xQueueCreateStatic(LATENCY_TRACE_QUEUE_LENGTH, sizeof(latency_trace_t), latency_trace_queue_storage, &latency_trace_queue_buffer);
+    #else
+        latency_trace_queue = xQueueCreate(LATENCY_TRACE_QUEUE_LENGTH, sizeof(latency_trace_t));
+    #endif
+}
+
+inline latency_trace_t* latency_trace_slot(uint16_t trace_id)
+{
+    return &latency_trace_slots[trace_id & (LATENCY_TRACE_SLOTS - 1)];
+}
+
+inline void latency_trace_stamp(latency_trace_t* trace, uint8_t stage, uint32_t timestamp)
+{
+    trace->timestamp[stage] = timestamp;
+    trace->stages_done |= (1 << stage);
+}
+
+/* called from the IR isr. A trace that was not sent until the next mark is overwritten, since the mark did not cause a speed change. */
+IRAM_ATTR void latency_trace_open(uint32_t ir_mark_timestamp)
+{
+    portENTER_CRITICAL_ISR(&latency_trace_mutex);
+    latency_trace_id_counter += 1;
+    if (latency_trace_id_counter == TRACE_ID_NONE) { latency_trace_id_counter += 1; } /* skip the id reserved for untraced speed values on overflow */
+
+    latency_trace_t* trace = latency_trace_slot(latency_trace_id_counter);
+    memset(trace, 0, sizeof(latency_trace_t));
+    trace->trace_id = latency_trace_id_counter;
+    latency_trace_stamp(trace, TRACE_STAGE_IR_MARK, ir_mark_timestamp);
+    latency_trace_pending_id = latency_trace_id_counter;
+    portEXIT_CRITICAL_ISR(&latency_trace_mutex);
+}
+
+/* called by the controller when it changes the speed. Only the first decision after an IR mark belongs to its trace. */
+IRAM_ATTR void latency_trace_controller_decision()
+{
+    uint32_t timestamp = micros();
+    portENTER_CRITICAL(&latency_trace_mutex);
+    if (latency_trace_pending_id != TRACE_ID_NONE)
+    {
+        latency_trace_t* trace = latency_trace_slot(latency_trace_pending_id);
+        if (!(trace->stages_done & (1 << TRACE_STAGE_CONTROLLER))) { latency_trace_stamp(trace, TRACE_STAGE_CONTROLLER, timestamp); }
+    }
+    portEXIT_CRITICAL(&latency_trace_mutex);
+}
+
+/* stamps the send stage and returns the id to transmit with the speed value. Returns TRACE_ID_NONE if the speed change was not caused by an IR mark. */
+IRAM_ATTR uint16_t latency_trace_send()
+{
+    uint16_t trace_id  = TRACE_ID_NONE;
+    uint32_t timestamp = micros();
+    portENTER_CRITICAL(&latency_trace_mutex);
+    if (latency_trace_pending_id != TRACE_ID_NONE)
+    {
+        latency_trace_t* trace = latency_trace_slot(latency_trace_pending_id);
+        if (trace->stages_done & (1 << TRACE_STAGE_CONTROLLER))
+        {
+            latency_trace_stamp(trace, TRACE_STAGE_SEND, timestamp);
+            trace_id = latency_trace_pending_id;
+            latency_trace_pending_id = TRACE_ID_NONE;
+        }
+    }
+    portEXIT_CRITICAL(&latency_trace_mutex);
+    return trace_id;
+}
+
+/*
+called from the wireless receive callback with the timestamps of the controller emulator.
+The clock offset between both boards is estimated like NTP does: the link is assumed to take the same time in both directions.
+offset = ((bridge_receive - send) + (report_send - report_receive)) / 2, bridge time in sensorcar clock = bridge time - offset.
+Signed differences keep the math valid when micros() overflows.
+*/
+IRAM_ATTR void latency_trace_report(uint16_t trace_id, uint32_t bridge_receive_timestamp, uint32_t dac_write_timestamp, uint32_t report_send_timestamp)
+{
+    uint32_t report_receive_timestamp = micros();
+    bool     trace_complete           = false;
+    latency_trace_t trace_copy;
+
+    portENTER_CRITICAL(&latency_trace_mutex);
+    latency_trace_t* trace = latency_trace_slot(trace_id);
+    if ((trace_id != TRACE_ID_NONE) && (trace->trace_id == trace_id) && (trace->stages_done & (1 << TRACE_STAGE_SEND)))
+    {
+        int32_t offset = ( int32_t(bridge_receive_timestamp - trace->timestamp[TRACE_STAGE_SEND]) + int32_t(report_send_timestamp - report_receive_timestamp) ) / 2;
+        latency_trace_stamp(trace, TRACE_STAGE_BRIDGE_RECEIVE, bridge_receive_timestamp - offset);
+        latency_trace_stamp(trace, TRACE_STAGE_DAC_WRITE,      dac_write_timestamp - offset);
+        latency_trace_stamp(trace, TRACE_STAGE_REPORT_RECEIVE, report_receive_timestamp);
+        trace_copy = *trace;
+        trace->trace_id = TRACE_ID_NONE; /* a duplicate report must not complete the trace twice */
+        trace_complete = true;
+    }
+    portEXIT_CRITICAL(&latency_trace_mutex);
+
+    if (trace_complete) { xQueueSend(latency_trace_queue, &trace_copy, 0); } /* if the printing can't keep up, traces are dropped instead of blocking the wireless task */
+}
+
+/* prints completed traces. Runs at low priority so the serial output never delays the traced path. */
+IRAM_ATTR void latency_trace_print_task(void*)
+{
+    latency_trace_t trace;
+    Serial.println("TRACE\tId\tIR_Mark\tController\tSend\tBridge_Receive\tDAC_Write\tReport_Receive");
+    for(;;)
+    {
+        if (xQueueReceive(latency_trace_queue, &trace, portMAX_DELAY) == pdTRUE)
+        {
+            Serial.printf("TRACE\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+                trace.trace_id,
+                trace.timestamp[TRACE_STAGE_IR_MARK],
+                trace.timestamp[TRACE_STAGE_CONTROLLER],
+                trace.timestamp[TRACE_STAGE_SEND],
+                trace.timestamp[TRACE_STAGE_BRIDGE_RECEIVE],
+                trace.timestamp[TRACE_STAGE_DAC_WRITE],
+                trace.timestamp[TRACE_STAGE_REPORT_RECEIVE]);
+        }
+    }
+}
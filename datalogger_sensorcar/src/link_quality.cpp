@@ -0,0 +1,163 @@
+#include <esp_wifi.h>
+#include "link_quality.h"
+#include "wireless_transmission.h"
+#include "handoff_accounting.h"
+#include "event_trace.h"
+
+/* what wireless receive and the setpoint delivery hand to link_task */
+#define LINK_EVENT_PACKET           0   /* link packet of the controller emulator */
+#define LINK_EVENT_LOST             1   /* LINK_LOST_SETPOINTS setpoints in a row failed */
+
+typedef struct
+{
+    uint8_t       kind;
+    link_packet_t packet;
+    uint32_t      receive_us;
+} link_event_t;
+
+DRAM_ATTR QueueHandle_t link_mailbox = NULL;
+#if STATIC_ALLOCATION
+    DRAM_ATTR uint8_t       link_mailbox_storage[LINK_MAILBOX_LENGTH * sizeof(link_event_t)];
+    DRAM_ATTR StaticQueue_t link_mailbox_buffer;
+#endif
+
+DRAM_ATTR channel_follower_t link_follower;                                 /* only used by link_task */
+DRAM_ATTR link_stats_t  link_stats;                                         /* since boot */
+DRAM_ATTR portMUX_TYPE  link_stats_mutex        = portMUX_INITIALIZER_UNLOCKED; /* setpoints are sent from core 1, the acks arrive on core 0 */
+DRAM_ATTR uint32_t      link_send_us[LINK_SEND_SLOTS];                      /* last transmission of a setpoint, indexed by its sequence number */
+DRAM_ATTR int8_t        link_last_rssi          = 0;                        /* of the last frame of the controller emulator, 0 until the first one */
+DRAM_ATTR uint32_t      link_heard_us           = 0;                        /* last packet of the controller emulator that was no link packet */
+DRAM_ATTR uint8_t       link_failed_setpoints   = 0;                        /* in a row, both writers run on core 0 */
+
+inline void link_radio_send(void* context, const link_packet_t* packet)
+{
+    esp_now_send(broadcastAddress, (uint8_t *) packet, sizeof(link_packet_t));
+    event_trace(EVENT_ESPNOW_SEND, ESPNOW_LINK, (packet->type << 8) | packet->channel);
+}
+
+inline void link_radio_set_channel(void* context, uint8_t channel)
+{
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    event_trace(EVENT_CHANNEL, channel, uint16_t(link_follower.hops));
+}
+
+DRAM_ATTR const link_radio_t link_radio = { NULL, link_radio_send, link_radio_set_channel };
+
+/* runs in the Wi-Fi task for every management frame on the channel, before the ESP-NOW callback gets the same frame */
+IRAM_ATTR void link_sniff(void* buffer, wifi_promiscuous_pkt_type_t type)
+{
+    const wifi_promiscuous_pkt_t* frame = (const wifi_promiscuous_pkt_t*)buffer;
+    if (frame->rx_ctrl.sig_len < LINK_FRAME_SENDER_OFFSET + 6) { return; }
+    if (memcmp(&frame->payload[LINK_FRAME_SENDER_OFFSET], broadcastAddress, 6) != 0) { return; }
+    link_last_rssi = frame->rx_ctrl.rssi;
+}
+
+/* after init_wifi(), before any packet can arrive */
+void init_link_quality()
+{
+    #if STATIC_ALLOCATION
+        link_mailbox = xQueueCreateStatic(LINK_MAILBOX_LENGTH, sizeof(link_event_t), link_mailbox_storage, &link_mailbox_buffer);
+    #else
+        link_mailbox = xQueueCreate(LINK_MAILBOX_LENGTH, sizeof(link_event_t));
+    #endif
+    link_stats_reset(&link_stats);
+
+    wifi_promiscuous_filter_t filter = { WIFI_PROMIS_FILTER_MASK_MGMT };
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(link_sniff);
+    esp_wifi_set_promiscuous(true);
+}
+
+/* every transmission of a setpoint, retransmissions included */
+IRAM_ATTR void link_setpoint_sent(uint8_t sequence)
+{
+    uint32_t now_us = micros();
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_sent(&link_stats);
+    link_send_us[sequence & (LINK_SEND_SLOTS - 1)] = now_us;
+    portEXIT_CRITICAL(&link_stats_mutex);
+}
+
+/* every ack, also the ones of replaced setpoints */
+IRAM_ATTR void link_setpoint_answered(uint8_t sequence)
+{
+    uint32_t now_us = micros();
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_answered(&link_stats, now_us - link_send_us[sequence & (LINK_SEND_SLOTS - 1)]);
+    portEXIT_CRITICAL(&link_stats_mutex);
+    link_failed_setpoints = 0;
+}
+
+/* the newest setpoint ran out of its latency budget */
+IRAM_ATTR void link_setpoint_failed()
+{
+    link_failed_setpoints += 1;
+    if (link_failed_setpoints != LINK_LOST_SETPOINTS) { return; } /* once per breakdown */
+    link_event_t event = { LINK_EVENT_LOST, { 0 }, uint32_t(micros()) };
+    if (xQueueSend(link_mailbox, &event, 0) != pdTRUE) { handoff_count_rejected(HANDOFF_LINK); }
+}
+
+/* wireless receive, for packets that passed link_packet_valid() */
+IRAM_ATTR void link_packet_received(const uint8_t* data)
+{
+    link_event_t event;
+    event.kind       = LINK_EVENT_PACKET;
+    event.receive_us = micros();
+    memcpy(&event.packet, data, sizeof(link_packet_t)); /* incoming data is not necessarily aligned */
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_received(&link_stats, link_last_rssi);
+    portEXIT_CRITICAL(&link_stats_mutex);
+    event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_LINK, (event.packet.type << 8) | event.packet.channel);
+    if (xQueueSend(link_mailbox, &event, 0) != pdTRUE) { handoff_count_rejected(HANDOFF_LINK); }
+}
+
+/* wireless receive, for every other packet of the controller emulator */
+IRAM_ATTR void link_peer_heard()
+{
+    portENTER_CRITICAL(&link_stats_mutex);
+    link_stats_received(&link_stats, link_last_rssi);
+    portEXIT_CRITICAL(&link_stats_mutex);
+    link_heard_us = micros();
+}
+
+/* the follower of channel_hop.h. Sleeps until the next link packet or the time the follower asked for. */
+IRAM_ATTR void link_task(void*)
+{
+    channel_follower_init(&link_follower, &link_radio, micros());
+    uint32_t wait_us = 0;
+    for(;;)
+    {
+        TickType_t   wait_ticks = (wait_us == LINK_NO_DEADLINE) ? portMAX_DELAY : ((wait_us + 999) / 1000) / portTICK_PERIOD_MS;
+        link_event_t event;
+        if (xQueueReceive(link_mailbox, &event, wait_ticks) == pdTRUE)
+        {
+            handoff_count_delivered(HANDOFF_LINK);
+            if (event.kind == LINK_EVENT_PACKET) { channel_follower_packet(&link_follower, &event.packet, event.receive_us); }
+            else                                 { channel_follower_lost(&link_follower, event.receive_us); }
+        }
+        uint32_t heard_us = link_heard_us;
+        if (!link_time_reached(link_follower.heard_us, heard_us)) { channel_follower_heard(&link_follower, heard_us); }
+        wait_us = channel_follower_tick(&link_follower, micros());
+    }
+}
+
+void print_link_stats()
+{
+    link_stats_t stats;
+    portENTER_CRITICAL(&link_stats_mutex);
+    stats = link_stats;
+    portEXIT_CRITICAL(&link_stats_mutex);
+    char print_buffer[300];
+    link_stats_format(print_buffer, sizeof(print_buffer), &stats);
+    Serial.printf("Link on channel %u (home %u, %u hops, %u fallbacks, %u rejoins): %s\n", link_follower.channel, link_follower.home_channel,
+        (unsigned int)link_follower.hops, (unsigned int)link_follower.fallbacks, (unsigned int)link_follower.rejoins, print_buffer);
+}
+
+void link_stats_print_task(void*)
+{
+    for(;;)
+    {
+        DELAY_N_MS(LINK_STATS_PRINT_INTERVAL_MS);
+        print_link_stats();
+    }
+}
@@ -15,21 +15,133 @@ running controller emulation.
 #include "imu_lsm6ds3.h"            /* for managing the two lsm6ds3 IMUs */
 #include "ir_sensors.h"             /* for managing the two digital infrared reflectometers */
 #include "track_data.h"             /* includes track parts lengths, etc. */
+#include "handoff_accounting.h"     /* counts events handed between tasks and the ones that got lost */
+#include "car_state.h"              /* lock-free access to the car state and log records from core 0 */
+#include "sensor_pipeline.h"        /* processing chains of the IMU and IR samples, composed from stages */
+#include "speed_characterization.h" /* measured vdigi to speed table */
+#include "plant_identification.h"   /* identified dead time, time constant and gain of the car */
+#include "imu_calibration.h"        /* guided accelerometer calibration stored in NVS */
+#include "imu_bias_tracking.h"      /* gyro and acceleration bias estimation at standstill */
+#include "speed_learning.h"         /* per track position speeds learned lap by lap */
+#include "derailment_detection.h"   /* stops the car after a derailment and resumes racing */
+#include "vehicle_dynamics.h"       /* yaw rate, yaw acceleration and slip from both IMUs */
+#include "track_shape.h"            /* x-y shape of the mapping lap, checks the piece classification */
+#include "task_memory.h"            /* static task stacks and the stack usage report */
+#include "event_trace.h"            /* crash-surviving trace of the last events */
+#include "power_management.h"       /* powers the car down while it waits for the next race */
+#if LINK_MONITOR
+  #include "link_quality.h"         /* ESP-NOW link statistics and channel hops */
+#endif
+#if MEASURE_LATENCY
+  #include "latency_tracing.h"      /* for tracing the latency from IR mark to DAC write */
+#endif
 
 /* ###################################################
 Variables
 ################################################### */
 
+/* task memory, only reserved for the tasks of the current operation mode */
+#if (OPERATION_MODE==MEASURING_MODE)
+  STATIC_TASK_MEMORY(log_to_sdcard_task,       DATA_LOG_STACK)
+  STATIC_TASK_MEMORY(measurement_task,         MEASUREMENT_STACK)
+#else
+  STATIC_TASK_MEMORY(velocity_controller_task, VELOCITY_CONTROLLER_STACK)
+#endif
+STATIC_TASK_MEMORY(sample_imu_task,            IMU_SAMPLE_STACK)
+STATIC_TASK_MEMORY(ir_sensor_process_task,     IR_SENSOR_PROCESS_STACK)
+STATIC_TASK_MEMORY(setpoint_retransmit_task,   SETPOINT_RETRANSMIT_STACK)
+#if LINK_MONITOR
+  STATIC_TASK_MEMORY(link_task,                LINK_STACK)
+#endif
+#if MEASURE_LATENCY
+  STATIC_TASK_MEMORY(latency_trace_print_task, PRINT_TASK_STACK)
+#endif
+#if LINK_MONITOR && PRINT_LINK_STATS
+  STATIC_TASK_MEMORY(link_stats_print_task,    PRINT_TASK_STACK)
+#endif
+#if PRINT_HANDOFF_COUNTERS
+  STATIC_TASK_MEMORY(handoff_counters_print_task, PRINT_TASK_STACK)
+#endif
+#if PRINT_TASK_MEMORY
+  STATIC_TASK_MEMORY(task_memory_print_task,   PRINT_TASK_STACK)
+#endif
+
+/* the globals the chains of sensor_pipeline.h work on */
+typedef struct
+{
+  int16_t   (&front_raw)[6];
+  int16_t   (&back_raw)[6];
+  #if CALIBRATE_ACCELERATION
+    double_t  (&front_acceleration)[3];
+    double_t  (&back_acceleration)[3];
+  #endif
+  double_t& accel_previous;
+  double_t& accel_now;
+  double_t& speed;
+  bool&     standstill;
+} imu_sample_t;
+
+typedef struct
+{
+  unsigned long&  left_passing_time;
+  unsigned long&  right_passing_time;
+  double_t&       left_speed;
+  double_t&       right_speed;
+  double_t&       left_speed_trackbased;
+  double_t&       right_speed_trackbased;
+  double_t&       speed;
+} ir_sample_t;
+
+/* IMU chains */
+#if CALIBRATE_ACCELERATION
+  typedef axis_calibration<calibration_values_front, calibration_values_back> imu_calibration_stage;
+#else
+  typedef pass_stage imu_calibration_stage;
+#endif
+typedef sensor_pipeline<                    /* standing in SENSORCAR_IDLE_STATE: follow the biases */
+  call_stage<imu_read>,
+  imu_calibration_stage,
+  call_stage<imu_bias_update>,
+  optional_stage<CALIBRATE_ACCELERATION, longitudinal_acceleration>
+> imu_idle_pipeline_t;
+typedef sensor_pipeline<                    /* driving: integrate the speed. Only with calibrated axes, the raw x axes are not the car's. */
+  call_stage<imu_read>,                     /* takes about 685us to get all data via I2C */
+  imu_calibration_stage,
+  optional_stage<IMU_BIAS_TRACKING, call_stage<imu_bias_update>>,
+  optional_stage<CALIBRATE_ACCELERATION, longitudinal_acceleration>,
+  optional_stage<CALIBRATE_ACCELERATION, trapezoid_integration<SAMPLING_INTERVAL>>,
+  optional_stage<CALIBRATE_ACCELERATION && IMU_BIAS_TRACKING, zero_velocity_update>
+> imu_driving_pipeline_t;
+
+inline void log_record_lost() { handoff_count_rejected(HANDOFF_LOGGING); }  /* logging task fell LOG_RECORD_QUEUE_LENGTH samples behind */
+typedef sensor_pipeline<                    /* after every driving sample */
+  optional_stage<DATA_LOGGING, sink_stage<queue_log_record, log_record_lost>>
+> imu_sink_pipeline_t;
+
+/* IR chains */
+constexpr double_t IR_TAPE_WIDTH = TAPE_WIDTH;
+#if CALIBRATE_IR_SPEED
+  typedef calibrated_tape_speed<IR_TAPE_WIDTH, CAL_LEFT, CAL_RIGHT> ir_speed_stage;
+#else
+  typedef tape_speed<IR_TAPE_WIDTH> ir_speed_stage;
+#endif
+typedef sensor_pipeline<ir_speed_stage> ir_mapping_pipeline_t;
+typedef sensor_pipeline<                    /* the IR speeds overwrite the integrated speed to avoid drift from accelerometer values */
+  ir_speed_stage,
+  std::conditional<(MEASURE_SYSTEM == MEASURE_MODE_SWEEP) || (MEASURE_SYSTEM == MEASURE_MODE_CHARACTERIZATION), trackbased_speed_fusion, ir_speed_fusion>::type /* TODO: figure out a smarter way to get accurate curve speed */
+> ir_racing_pipeline_t;
+
 /* ####################################################
 Functions
 #################################################### */
 
-/* sends speed value over ESP now if it changed */
+/* sends speed value over ESP now if it changed, or if the last one never arrived */
 inline void update_speed()
 {
-  if (speed_digital != speed_digital_previous)
+  if ((speed_digital != speed_digital_previous) || setpoint_delivery_failed())
   {
     send_data_wirelessly(speed_digital);
+    event_trace(EVENT_CONTROLLER, speed_digital, track_position_index);
     speed_digital_previous = speed_digital;
   }
 }
@@ -47,7 +159,7 @@ IRAM_ATTR void measurement_task(void*)
 
     for(;;)
     {
-      if (xSemaphoreTake(measurement_timer_semaphore, portMAX_DELAY) == pdTRUE)
+      if (handoff_wait(HANDOFF_MEASUREMENT_TIMER, portMAX_DELAY))
       {
         switch (sensorcar_state)
         {
@@ -62,7 +174,7 @@ IRAM_ATTR void measurement_task(void*)
 
             if (timestamp_measure_current >= (timestamp_measure_start + TIME_HELD_MS + TIME_MEASURE_MS) ) /* Measuring time has passed. Wrap up the current measurement. */
             {
-              close_log_file();   /* save the progress */
+              request_log_close();  /* save the progress */
               if ( (speed_digital_test + VDIGI_INCREMENT_VALUE) <= VDIGI_MAX_VALUE ) /* avoids overflow and checks for being smaller than VDIGI_MAX_VALUE*/
               {
                 speed_digital_test += VDIGI_INCREMENT_VALUE; /* set up the speed for the next test */
@@ -93,15 +205,79 @@ IRAM_ATTR void measurement_task(void*)
         }
       }
     }
+  #elif MEASURE_SYSTEM == MEASURE_MODE_CHARACTERIZATION
+    for(;;)
+    {
+      if (handoff_wait(HANDOFF_MEASUREMENT_TIMER, portMAX_DELAY))
+      {
+        switch (sensorcar_state)
+        {
+          case SENSORCAR_IDLE_STATE:
+            reset_all_state_data();
+            update_speed();
+            speed_characterization_abort_step();  /* an interrupted step starts over at the next measurement */
+          break;
+          case SENSORCAR_MEASUREMENT_STATE:
+          {
+            bool characterization_done = speed_characterization_step(); /* sets speed_digital for the current step */
+            update_speed();
+            if (characterization_done)
+            {
+              /* all steps done, the table is stored in NVS and used from now on */
+              #if DATA_LOGGING
+                request_log_close();
+              #endif
+              sensorcar_state = SENSORCAR_IDLE_STATE;
+              vTaskDelete(NULL);  /* task deletes itself */
+            }
+          }
+          break;
+        }
+      }
+    }
+  #elif MEASURE_SYSTEM == MEASURE_MODE_IDENTIFICATION
+    #if !CALIBRATE_ACCELERATION
+      #error "Plant identification needs CALIBRATE_ACCELERATION."
+    #endif
+    for(;;)
+    {
+      if (handoff_wait(HANDOFF_MEASUREMENT_TIMER, portMAX_DELAY))
+      {
+        switch (sensorcar_state)
+        {
+          case SENSORCAR_IDLE_STATE:
+            reset_all_state_data();
+            update_speed();
+          break;
+          case SENSORCAR_MEASUREMENT_STATE:
+          {
+            bool identification_done = plant_identification_step(); /* sets speed_digital for the current pattern */
+            update_speed();
+            if (identification_done)
+            {
+              /* the model is stored in NVS and used by the controller from now on */
+              #if DATA_LOGGING
+                request_log_close();
+              #endif
+              sensorcar_state = SENSORCAR_IDLE_STATE;
+              vTaskDelete(NULL);  /* task deletes itself */
+            }
+          }
+          break;
+        }
+      }
+    }
   #endif
 }
 
 IRAM_ATTR void log_to_sdcard_task(void*)
 {  
   /* SD card */
-  const char LOG_FILE_HEADER[] = "Time\tTarget_Speed\tIR_Speed_Left\tIR_Speed_Right\tIR_Speed_Left_Trackbased\tIR_Speed_Right_Trackbased\tEstimated_Speed\tIR_Time_Difference_Left_Right\tAccel_Front_x\tAccel_Front_y\tAccel_Front_z\tRot_Front_x\tRot_Front_y\tRot_Front_z\tAccel_Heck_x\tAccel_Heck_y\tAccel_Heck_z\tRot_Heck_x\tRot_Heck_y\tRot_Heck_z\n";
+  static DRAM_ATTR char log_file_header[LOG_ROW_SIZE];  /* stays, every run file starts with it */
+  log_row_format::header(log_file_header, sizeof(log_file_header));
   init_SD();
-  init_log_file(LOG_FILE_HEADER);
+  init_log_file(log_file_header);
+  prepare_log_file();   /* the first run is preallocated before any sample arrives */
   
   /* SD card initilized LED */
   pinMode(LED_BUILTIN, OUTPUT);
@@ -109,55 +285,20 @@ IRAM_ATTR void log_to_sdcard_task(void*)
 
   for(;;)
   {
-    if (xSemaphoreTake(logging_semaphore, portMAX_DELAY) == pdTRUE)
+    /* every LOGGING_INTERVAL microseconds, write all queued records */
+    if (!handoff_wait(HANDOFF_LOGGING_TIMER, portMAX_DELAY)) { continue; }
+    if (log_record_queue.size() == 0) { prepare_log_file(); continue; } /* between runs, so the next one is preallocated before its first row */
+
+    log_record_t log_record;
+    while (log_record_queue.pop(log_record))
     {
-      char log_write_buffer [200];
-      #if CALIBRATE_ACCELERATION
-        sprintf(log_write_buffer, "%d\t%d\t%lf\t%lf\t%lf\t%lf\t%lf\t%ld\t%lf\t%lf\t%lf\t%d\t%d\t%d\t%lf\t%lf\t%lf\t%d\t%d\t%d\n", 
-          (int)imu_timestamp,
-          (int)speed_digital,
-          ir_left_speed,
-          ir_right_speed,
-          ir_left_speed_trackbased,
-          ir_right_speed_trackbased,
-          car_speed,
-          ir_left_right_time_difference,
-          front_imu_calibrated_acceleration_array[0],
-          front_imu_calibrated_acceleration_array[1],
-          front_imu_calibrated_acceleration_array[2],
-          (int)front_imu_raw_data_array[0],
-          (int)front_imu_raw_data_array[1],
-          (int)front_imu_raw_data_array[2],    
-          back_imu_calibrated_acceleration_array[0],
-          back_imu_calibrated_acceleration_array[1],
-          back_imu_calibrated_acceleration_array[2],
-          (int)back_imu_raw_data_array[0],
-          (int)back_imu_raw_data_array[1],
-          (int)back_imu_raw_data_array[2]);
-      #else
-        sprintf(log_write_buffer, "%d\t%d\t%lf\t%lf\t%lf\t%lf\t%lf\t%ld\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", 
-          (int)imu_timestamp,
-          (int)speed_digital,
-          ir_left_speed,
-          ir_right_speed,
-          ir_left_speed_trackbased,
-          ir_right_speed_trackbased,
-          car_speed,
-          ir_left_right_time_difference,
-          (int)front_imu_raw_data_array[3],
-          (int)front_imu_raw_data_array[4],
-          (int)front_imu_raw_data_array[5],
-          (int)front_imu_raw_data_array[0],
-          (int)front_imu_raw_data_array[1],
-          (int)front_imu_raw_data_array[2],    
-          (int)back_imu_raw_data_array[3],
-          (int)back_imu_raw_data_array[4],
-          (int)back_imu_raw_data_array[5],
-          (int)back_imu_raw_data_array[0],
-          (int)back_imu_raw_data_array[1],
-          (int)back_imu_raw_data_array[2]);
-      #endif
-      appendFile(SD, LOG_FILE_NAME, log_write_buffer);
+      if (log_record.kind == LOG_RECORD_CLOSE_RUN) { close_log_file(); continue; } /* every row of the run is written */
+      handoff_count_delivered(HANDOFF_LOGGING);
+
+      char log_write_buffer[LOG_ROW_SIZE];
+      log_row_format::row(log_write_buffer, sizeof(log_write_buffer), log_record);
+      if (append_to_log(log_write_buffer))                  { handoff_count_delivered(HANDOFF_SD_WRITE); }
+      else                                                  { handoff_count_rejected(HANDOFF_SD_WRITE); }  /* card is busy, the row is lost */
       #if DEBUG
         Serial.printf("Logged: %s\n", log_write_buffer);
       #endif
@@ -165,69 +306,94 @@ IRAM_ATTR void log_to_sdcard_task(void*)
   }
 }
 
-/* calculate arithmatic mean of two double values */
-inline double_t mean_two_doubles(double_t x, double_t y)
-{
-  return (x + y) * 0.5;
-}
-
 /* gets new acceleration sample and performs integration (only when calibrated, else it makes little sense) to obtain a rough speed estimate */
 IRAM_ATTR void sample_imu_task(void*)
 {
+  imu_sample_t imu_sample = {
+    front_imu_raw_data_array, back_imu_raw_data_array,
+    #if CALIBRATE_ACCELERATION
+      front_imu_calibrated_acceleration_array, back_imu_calibrated_acceleration_array,
+    #endif
+    accel_previous, accel_now, car_speed, imu_standstill };
+  imu_idle_pipeline_t     imu_idle_pipeline;
+  imu_driving_pipeline_t  imu_driving_pipeline;
+  imu_sink_pipeline_t     imu_sink_pipeline;
+
   init_imu();
   for(;;)
   {
-    if (xSemaphoreTake(sampling_semaphore, portMAX_DELAY) == pdTRUE)
+    if (handoff_wait(HANDOFF_IMU_SAMPLING, portMAX_DELAY))
     {
+      /*
+      Traced at the next sample, so a state shorter than SAMPLING_INTERVAL is missed. Sampling halts during idle power saving,
+      but the state only leaves SENSORCAR_IDLE_STATE on a race status message, which restarts the timers first. The entry then comes with the first sample after the wake up.
+      */
+      event_trace_state(sensorcar_state);
+      #if DATA_LOGGING
+        queue_log_close();  /* before the state switch, a run may end right as the car goes idle */
+      #endif
+      #if IDLE_POWER_SAVING && (OPERATION_MODE == RACING_MODE)
+        if (idle_power_sample(sensorcar_state)) { continue; } /* IMUs powered down or still settling */
+      #endif
       switch (sensorcar_state)
       {
+        #if IMU_BIAS_TRACKING
+          case SENSORCAR_IDLE_STATE: /* the car stands still most of the time, which is the best time to follow the biases */
+            imu_idle_pipeline.process(imu_sample);
+            break;
+        #endif
         case SENSORCAR_TRACK_MAPPING_STATE: /* fallthrough on purpose */
         case SENSORCAR_MEASUREMENT_STATE:
         case SENSORCAR_RACING_STATE:
+        case SENSORCAR_DERAILED_STATE:
+          imu_driving_pipeline.process(imu_sample);
           #if CALIBRATE_ACCELERATION
-            accel_previous = mean_two_doubles(front_imu_calibrated_acceleration_array[0],back_imu_calibrated_acceleration_array[0]);
-            imu_read(); /* takes about 685us to get all data via I2C */
-            accel_now = mean_two_doubles(front_imu_calibrated_acceleration_array[0],back_imu_calibrated_acceleration_array[0]);
-            car_speed += mean_two_doubles(accel_now, accel_previous) * SAMPLING_INTERVAL / 1e6 * GRAVITY_FACTOR; /* trapezoidal integration of acceleration value */
+            #if VEHICLE_DYNAMICS
+              vehicle_dynamics_update(car_speed);
+            #endif
             #if DEBUG
               Serial.printf("accel_previous=%lf; accel_now=%lf; car_speed=%lf.\n", accel_previous, accel_now, car_speed);
             #endif
-          #else
-            imu_read();
+            #if (ALGORITHM_TYPE == ALGORITHM_LEARNING) && (OPERATION_MODE == RACING_MODE)
+              if (sensorcar_state == SENSORCAR_RACING_STATE) { speed_learning_sample(track_position_index); }
+            #endif
+            #if (MEASURE_SYSTEM == MEASURE_MODE_IDENTIFICATION) && (OPERATION_MODE == MEASURING_MODE)
+              if (sensorcar_state == SENSORCAR_MEASUREMENT_STATE) { plant_identification_sample(speed_digital_previous, accel_now * GRAVITY_FACTOR); } /* speed_digital_previous is the last command sent */
+            #endif
           #endif
-      
-          #if DATA_LOGGING
-            xSemaphoreGive(logging_semaphore);
+          #if TRACK_SHAPE
+            if (sensorcar_state == SENSORCAR_TRACK_MAPPING_STATE) { track_shape_sample(car_yaw_rate()); }
           #endif
+          #if DERAILMENT_DETECTION && (OPERATION_MODE == RACING_MODE)
+            if ((sensorcar_state == SENSORCAR_RACING_STATE) || (sensorcar_state == SENSORCAR_DERAILED_STATE)) { derailment_update(); }
+          #endif
+
+          imu_sink_pipeline.process(imu_sample);
           break;
       }
     }
   }
 }
 
-inline double_t clamp_value_smaller(double_t value, double_t threshold)
-{
-  if (value < threshold)
-  {
-    return threshold;
-  }
-  else
-  {
-    return value;
-  }
-}
-
 /* obtains time values from most recent IR sensor passing and processes it */
 IRAM_ATTR void ir_sensor_process_task(void*)
 {
+  ir_sample_t ir_sample = {
+    ir_left_passing_time, ir_right_passing_time,
+    ir_left_speed, ir_right_speed,
+    ir_left_speed_trackbased, ir_right_speed_trackbased,
+    car_speed };
+  ir_mapping_pipeline_t ir_mapping_pipeline;
+  ir_racing_pipeline_t  ir_racing_pipeline;
+
   for(;;)
   {
     /* block task until both IR sensors have a new value */
-    if (xSemaphoreTake(ir_data_semaphore, portMAX_DELAY) == pdTRUE)
+    if (handoff_wait(HANDOFF_IR_DATA, portMAX_DELAY))
     {
       switch (sensorcar_state)
       {
-        #if (MEASURE_SYSTEM == MEASURE_MODE_SWEEP) && (OPERATION_MODE == MEASURING_MODE) /* measurement track only contains straights */
+        #if ((MEASURE_SYSTEM == MEASURE_MODE_SWEEP) || (MEASURE_SYSTEM == MEASURE_MODE_CHARACTERIZATION)) && (OPERATION_MODE == MEASURING_MODE) /* measurement track only contains straights */
           case SENSORCAR_MEASUREMENT_STATE: /* fallthrough on purpose */
             if (!(ir_left_history_time && ir_right_history_time)) { break; } /* avoid divide by zero*/
             /* Derive speed from part length, which can be more accurate if only straights are used in the track since the absolute errors cancel each other out */
@@ -237,56 +403,83 @@ IRAM_ATTR void ir_sensor_process_task(void*)
           case SENSORCAR_MEASUREMENT_STATE: /* fallthrough on purpose */
         #endif
         case SENSORCAR_RACING_STATE:
-          /* Derive speed from the passing times */
-          #if CALIBRATE_IR_SPEED
-            ir_left_speed  = CAL_LEFT[0] * TAPE_WIDTH * 1.0e6 / ir_left_passing_time + CAL_LEFT[1]; /* v = s / t. t in us, so a correction factor of 10^6 is required. */
-            ir_right_speed = CAL_RIGHT[0] * TAPE_WIDTH * 1.0e6 / ir_right_passing_time + CAL_RIGHT[1];
-            ir_left_speed  = clamp_value_smaller(ir_left_speed, 0.0);  /* due to the calibration offset, negative values are possible. Those are clamped to 0. */
-            ir_right_speed = clamp_value_smaller(ir_right_speed, 0.0);
-          #else
-            ir_left_speed  = TAPE_WIDTH * 1.0e6 / ir_left_passing_time; /* v = s / t. t in us, so a correction factor of 10^6 is required. */
-            ir_right_speed = TAPE_WIDTH * 1.0e6 / ir_right_passing_time;            
-          #endif
-          /* Overwrite previous speed value to avoid drift from accelerometer values */
-          #if MEASURE_SYSTEM == MEASURE_MODE_SWEEP
-            car_speed = (ir_left_speed_trackbased + ir_right_speed_trackbased) / 2;
-          #else
-            car_speed = (ir_left_speed + ir_right_speed) / 2; /* TODO: figure out a smarter way to get accurate curve speed */
-          #endif
+          ir_racing_pipeline.process(ir_sample);
           if (xSemaphoreTake(finish_line_passed_semaphore, 0) == pdTRUE)
           {
             /* Sync car position if it desynced somewhere on the track. Last segment was zero (because finish line has been passed), so this segment has to be 1. This assumes, however, that the latency from lapping to receiving it wirelessly is low enough that the car does not pass a mark in between. Should this be the case, the car will be out of sync by one. */            
             track_position_index = 1;
+            #if TRACK_REFINEMENT && (OPERATION_MODE == RACING_MODE)
+              track_refinement_racing_mark(true, ir_left_right_time_difference, (ir_left_speed + ir_right_speed) / 2);
+            #endif
+            #if (ALGORITHM_TYPE == ALGORITHM_LEARNING) && (OPERATION_MODE == RACING_MODE)
+              speed_learning_mark(true);
+            #endif
           }
           else
           {
             track_position_index += 1;
             track_position_index %= number_track_pieces;
+            #if TRACK_REFINEMENT && (OPERATION_MODE == RACING_MODE)
+              track_refinement_racing_mark(false, ir_left_right_time_difference, (ir_left_speed + ir_right_speed) / 2);
+            #endif
+            #if (ALGORITHM_TYPE == ALGORITHM_LEARNING) && (OPERATION_MODE == RACING_MODE)
+              speed_learning_mark(false);
+            #endif
           }
           break;
+        #if DERAILMENT_DETECTION
+          case SENSORCAR_DERAILED_STATE:
+            /* the position is unknown until the finish line is passed */
+            if (xSemaphoreTake(finish_line_passed_semaphore, 0) == pdTRUE) { derailment_resync(); }
+            break;
+        #endif
         case SENSORCAR_TRACK_MAPPING_STATE:
+          #if TRACK_REFINEMENT || TRACK_SHAPE
+            ir_mapping_pipeline.process(ir_sample);
+          #endif
           if (xSemaphoreTake(finish_line_passed_semaphore, 0) == pdTRUE)
           {
             /* this part executes one segment after the finish line */
             number_track_pieces = track_position_index;
+            #if TRACK_SHAPE
+              track_shape_close(number_track_pieces, (ir_left_speed + ir_right_speed) / 2); /* before anything starts from track_geometry */
+            #endif
             calculate_track_checkpoint_lengths(number_track_pieces);
+            #if TRACK_REFINEMENT
+              track_refinement_start(number_track_pieces);
+            #endif
+            #if ALGORITHM_TYPE == ALGORITHM_LEARNING
+              speed_learning_start();
+            #endif
             track_mapped_out_flag = true;
             #if DATA_LOGGING
-              close_log_file();
+              request_log_close();
             #endif
             #if DEBUG
               Serial.printf("Estimated track: {");
               for(uint8_t ii=0; ii < number_track_pieces; ii++) { Serial.printf(" %d", track_geometry[ii]); }
               Serial.printf("}\n");
+              #if TRACK_SHAPE
+                print_track_shape();
+              #endif
             #endif
           }
           else
           {
             /* determine what kind of piece the last track piece was, then update the position. */
+            if (track_position_index >= TRACK_MAX_PIECES) { break; } /* finish line message got lost */
             track_geometry[track_position_index] = determine_track_piece(ir_left_right_time_difference);
+            #if TRACK_SHAPE
+              track_shape_mark(track_position_index, (ir_left_speed + ir_right_speed) / 2);
+            #endif
             track_position_index += 1;
+            #if TRACK_REFINEMENT
+              track_refinement_mapping_mark((ir_left_speed + ir_right_speed) / 2); /* reference speed for classifying at racing speed */
+            #endif
           }
       }
+      ir_mark_sequence++;   /* the IR speeds of this mark are ready */
+      event_trace(EVENT_IR_MARK, track_position_index, uint16_t(constrain(car_speed * 1000.0, 0.0, 65535.0)));
     }
   }
 }
@@ -304,7 +497,7 @@ inline uint8_t find_closest_legal_vdigi(float value)
   float   current_difference  = 0.0;
 
   /* step through array and find the smallest absolute difference to the current value */
-  for(uint8_t ii = 0; ii < sizeof(AVAILABLE_VDIGI); ii++)
+  for(uint8_t ii = 0; ii < NUMBER_AVAILABLE_VDIGI; ii++)
   {
     current_difference = abs(float(AVAILABLE_VDIGI[ii]) - value);
     if ( current_difference < smallest_difference)
@@ -317,25 +510,73 @@ inline uint8_t find_closest_legal_vdigi(float value)
   return closest_value;
 }
 
+/*
+Number of track pieces ahead whose target speed is commanded now. A new command only takes full effect after dead time plus time constant of the car, and the car keeps driving meanwhile.
+The distance covered meanwhile is walked off piece by piece with the length of each piece type. Without an identified plant model, the next track piece is used.
+*/
+inline uint8_t controller_lookahead(uint8_t track_position_index, uint8_t number_track_pieces, uint8_t* track_geometry)
+{
+  if (!plant_model.valid || (number_track_pieces < 2)) { return 1; }
+  double_t speed     = speed_characterization_valid ? speed_for_vdigi(speed_digital_previous) : max(car_speed, 0.0);
+  double_t distance  = speed * (plant_model.dead_time + plant_model.time_constant);
+  uint8_t  lookahead = 1;
+  while (lookahead < number_track_pieces - 1)
+  {
+    double_t piece_length = TRACKPIECE_LENGTH[track_geometry[increment_with_boundaries(track_position_index, lookahead, number_track_pieces)]];
+    if (distance < piece_length) { break; }
+    distance -= piece_length;
+    lookahead++;
+  }
+  return lookahead;
+}
+
 inline uint8_t simple_algorithm(uint8_t track_position_index, uint8_t number_track_pieces, uint8_t* track_geometry)
 {           
   /*
-    'increment_with_boundaries(track_position_index, 1, number_track_pieces)' identifies the next track piece index (0...number_track_pieces-1)
+    'increment_with_boundaries(track_position_index, controller_lookahead(...), number_track_pieces)' identifies the track piece index the command takes effect on (0...number_track_pieces-1)
     'track_geometry[index]' is a look up table (LUT) for the type of segment any piece of the track is (for example, a TRACK_STRAIGHT or TRACK_CURVE_LEFT_INNER_TRACK)
     'TARGET_TRACKPIECE_SPEED_DIGITAL[segment_type]' is a LUT for the target vdigi that should be driven on a specific type of track piece.
   */
-  return TARGET_TRACKPIECE_SPEED_DIGITAL[track_geometry[increment_with_boundaries(track_position_index, 1, number_track_pieces)]];
+  return TARGET_TRACKPIECE_SPEED_DIGITAL[track_geometry[increment_with_boundaries(track_position_index, controller_lookahead(track_position_index, number_track_pieces, track_geometry), number_track_pieces)]];
 }
 
 inline uint8_t average_algorithm(uint8_t track_position_index, uint8_t number_track_pieces, uint8_t* track_geometry)
 {
-  uint sum_buffer = 0;
-  for(uint8_t ii = 0; ii < ALGORITHM_AVERAGE_NUMBER; ii++)
+  uint8_t lookahead = controller_lookahead(track_position_index, number_track_pieces, track_geometry);
+
+  /* with a measured speed table, the average is taken over the actual speeds, since the vdigi to speed relation is not linear */
+  if (speed_characterization_valid)
   {
-    sum_buffer += TARGET_TRACKPIECE_SPEED_DIGITAL[track_geometry[increment_with_boundaries(track_position_index, ii+1, number_track_pieces)]];
+    double_t speed_sum = 0.0;
+    for(uint8_t ii = 0; ii < ALGORITHM_AVERAGE_NUMBER; ii++)
+    {
+      speed_sum += speed_for_vdigi(TARGET_TRACKPIECE_SPEED_DIGITAL[track_geometry[increment_with_boundaries(track_position_index, ii+lookahead, number_track_pieces)]]);
+    }
+    uint8_t vdigi = find_vdigi_for_speed(speed_sum / ALGORITHM_AVERAGE_NUMBER);
+    if (vdigi != VDIGI_NOT_FOUND) { return vdigi; }
   }
-  
-  return find_closest_legal_vdigi( float(sum_buffer)/float(ALGORITHM_AVERAGE_NUMBER) );
+
+  /* otherwise, or if no step of the table got steady, the average of the fitted speeds was computed at compile time for every sequence of piece types, see track_tables.h */
+  uint16_t sequence = 0;
+  for(uint8_t ii = ALGORITHM_AVERAGE_NUMBER; ii > 0; ii--)
+  {
+    sequence = sequence * TRACK_PIECE_TYPES + track_geometry[increment_with_boundaries(track_position_index, ii-1+lookahead, number_track_pieces)];
+  }
+  return AVERAGE_TARGET_SPEED_DIGITAL[sequence];
+}
+
+/* while the rear slides out, command at least SLIP_BACKOFF_VDIGI less than before, whatever the strategy wants */
+inline uint8_t slip_limited_vdigi(uint8_t target_vdigi)
+{
+  if (vehicle_dynamics.slip_indicator <= 1.0) { return target_vdigi; }
+  int16_t backoff_vdigi = int16_t(speed_digital_previous) - SLIP_BACKOFF_VDIGI;
+  return min(target_vdigi, find_closest_legal_vdigi(max(backoff_vdigi, int16_t(0))));
+}
+
+/* learned speed of the track piece the command takes effect on, see speed_learning.h */
+inline uint8_t learning_algorithm(uint8_t track_position_index, uint8_t number_track_pieces)
+{
+  return find_closest_legal_vdigi(learned_speed_digital[increment_with_boundaries(track_position_index, controller_lookahead(track_position_index, number_track_pieces, track_geometry), number_track_pieces)]);
 }
 
 IRAM_ATTR void velocity_controller_task(void*)
@@ -343,12 +584,24 @@ IRAM_ATTR void velocity_controller_task(void*)
   for(;;)
   {
     /* execute every CONTROLLER_INTERVAL microseconds */
-    if (xSemaphoreTake(controller_timer_semaphore, portMAX_DELAY) == pdTRUE)
+    if (handoff_wait(HANDOFF_CONTROLLER_TIMER, portMAX_DELAY))
     {
       switch (sensorcar_state)
       {
         case SENSORCAR_IDLE_STATE:
           reset_all_state_data();
+          #if TRACK_REFINEMENT
+            track_refinement_discard_lap();
+          #endif
+          #if ALGORITHM_TYPE == ALGORITHM_LEARNING
+            speed_learning_discard_lap();
+          #endif
+          #if DERAILMENT_DETECTION
+            derailment_reset();
+          #endif
+          #if VEHICLE_DYNAMICS
+            vehicle_dynamics_reset();
+          #endif
           update_speed();
         break;
         case SENSORCAR_RACING_STATE:
@@ -361,9 +614,23 @@ IRAM_ATTR void velocity_controller_task(void*)
             speed_digital = simple_algorithm(track_position_index, number_track_pieces, track_geometry);
           #elif ALGORITHM_TYPE == ALGORITHM_AVERAGE
             speed_digital = average_algorithm(track_position_index, number_track_pieces, track_geometry);
+          #elif ALGORITHM_TYPE == ALGORITHM_LEARNING
+            speed_digital = learning_algorithm(track_position_index, number_track_pieces);
+          #endif
+          #if VEHICLE_DYNAMICS
+            speed_digital = slip_limited_vdigi(speed_digital);
+          #endif
+          #if MEASURE_LATENCY
+            if (speed_digital != speed_digital_previous) { latency_trace_controller_decision(); }
           #endif
           update_speed();
           break;
+        #if DERAILMENT_DETECTION
+          case SENSORCAR_DERAILED_STATE:
+            speed_digital = derailment_speed_digital();
+            update_speed();
+            break;
+        #endif
         case SENSORCAR_TRACK_MAPPING_STATE:
           if (track_mapped_out_flag)
           {
@@ -388,27 +655,69 @@ void setup()
   /* serial interface */
   Serial.begin(115200);
   Serial.setTimeout(10);
+
+  /* what happened before the last reset */
+  dump_event_trace();
+
+  /* calibration needs nothing but the IMUs, the car does not drive */
+  #if (OPERATION_MODE==IMU_CALIBRATION_MODE)
+    init_imu();
+    run_imu_calibration();
+    return;
+  #endif
   
   /* wireless comms */
   init_wifi();
+  #if LINK_MONITOR
+    init_link_quality();
+  #endif
+
+  /* latency tracing, needs to be ready before the first IR mark */
+  #if MEASURE_LATENCY
+    init_latency_tracing();
+  #endif
 
   /* ir sensors */
   init_ir_sensors();
 
+  /* vdigi to speed table and plant model from previous measurement runs */
+  load_speed_characterization();
+  load_plant_model();
+
+  #if IDLE_POWER_SAVING && (OPERATION_MODE == RACING_MODE)
+    init_power_management();
+  #endif
+
   /* timers */
   init_timers();
 
   /* Tasks. Some Tasks do their own initialization to avoid memory bugs with this version of FreeRTOS. */
 
   #if (OPERATION_MODE==MEASURING_MODE)
-    xTaskCreatePinnedToCore(log_to_sdcard_task,       "log_to_sdcard_task",       10000, NULL, DATA_LOG_PRIO      ,       &log_to_sdcard_task_handle,       DATA_LOG_CORE);
-    xTaskCreatePinnedToCore(measurement_task,         "measurement_task",         10000, NULL, MEASUREMENT_PRIO ,         &measurement_task_handle,         MEASUREMENT_CORE);
+    CREATE_TASK(log_to_sdcard_task,       DATA_LOG_STACK,             DATA_LOG_PRIO,              &log_to_sdcard_task_handle,       DATA_LOG_CORE);
+    CREATE_TASK(measurement_task,         MEASUREMENT_STACK,          MEASUREMENT_PRIO,           &measurement_task_handle,         MEASUREMENT_CORE);
   #else
-    xTaskCreatePinnedToCore(velocity_controller_task, "velocity_controller_task", 10000, NULL, VELOCITY_CONTROLLER_PRIO,  &velocity_controller_task_handle, VELOCITY_CONTROLLER_CORE);
+    CREATE_TASK(velocity_controller_task, VELOCITY_CONTROLLER_STACK,  VELOCITY_CONTROLLER_PRIO,   &velocity_controller_task_handle, VELOCITY_CONTROLLER_CORE);
   #endif
 
-  xTaskCreatePinnedToCore(sample_imu_task,          "sample_imu_task",          10000, NULL, IMU_SAMPLE_PRIO,           &sample_imu_task_handle,         IMU_SAMPLE_CORE);
-  xTaskCreatePinnedToCore(ir_sensor_process_task,   "ir_sensor_process_task",   10000, NULL, IR_SENSOR_PROCESS_PRIO,    &ir_sensor_process_task_handle,  IR_SENSOR_PROCESS_CORE);
+  CREATE_TASK(sample_imu_task,            IMU_SAMPLE_STACK,           IMU_SAMPLE_PRIO,            &sample_imu_task_handle,          IMU_SAMPLE_CORE);
+  CREATE_TASK(ir_sensor_process_task,     IR_SENSOR_PROCESS_STACK,    IR_SENSOR_PROCESS_PRIO,     &ir_sensor_process_task_handle,   IR_SENSOR_PROCESS_CORE);
+  CREATE_TASK(setpoint_retransmit_task,   SETPOINT_RETRANSMIT_STACK,  SETPOINT_RETRANSMIT_PRIO,   &setpoint_retransmit_task_handle, SETPOINT_RETRANSMIT_CORE);
+  #if LINK_MONITOR
+    CREATE_TASK(link_task,                LINK_STACK,                 LINK_PRIO,                  NULL,                             LINK_CORE);
+  #endif
+  #if MEASURE_LATENCY
+    CREATE_TASK(latency_trace_print_task, PRINT_TASK_STACK,           LATENCY_TRACE_PRIO,         NULL,                             LATENCY_TRACE_CORE);
+  #endif
+  #if PRINT_HANDOFF_COUNTERS
+    CREATE_TASK(handoff_counters_print_task, PRINT_TASK_STACK,        PRINT_TASK_PRIO,            NULL,                             PRINT_TASK_CORE);
+  #endif
+  #if LINK_MONITOR && PRINT_LINK_STATS
+    CREATE_TASK(link_stats_print_task,    PRINT_TASK_STACK,           PRINT_TASK_PRIO,            NULL,                             PRINT_TASK_CORE);
+  #endif
+  #if PRINT_TASK_MEMORY
+    CREATE_TASK(task_memory_print_task,   PRINT_TASK_STACK,           PRINT_TASK_PRIO,            NULL,                             PRINT_TASK_CORE);
+  #endif
 }
 
 /* #####################################################
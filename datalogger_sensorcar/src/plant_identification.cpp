@@ -0,0 +1,249 @@
+#include "plant_identification.h"
+#include "timer_setup.h"    /* sampling and measurement intervals */
+#include <Preferences.h>    /* key value storage in the NVS flash partition */
+
+#define IDENTIFICATION_SAMPLE_TIME      (SAMPLING_INTERVAL / 1e6)   /* in s, lag resolution of the correlation */
+#define IDENTIFICATION_PRBS_LENGTH      63                          /* period of the 6 bit LFSR */
+#define IDENTIFICATION_STEP_TICKS       (4 * IDENTIFICATION_STEP_HOLD_TICKS)
+#define IDENTIFICATION_PRBS_TICKS       (IDENTIFICATION_PRBS_LENGTH * IDENTIFICATION_PRBS_BIT_TICKS)
+#define IDENTIFICATION_TOTAL_TICKS      (IDENTIFICATION_STEP_HOLD_TICKS + IDENTIFICATION_STEP_SEGMENTS * IDENTIFICATION_STEP_TICKS + IDENTIFICATION_PRBS_SEGMENTS * IDENTIFICATION_PRBS_TICKS)
+
+DRAM_ATTR plant_model_t plant_model = { false, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, false };
+
+/* two-sided 97.5% quantiles of the student t distribution for 1...IDENTIFICATION_SEGMENTS-1 degrees of freedom */
+const float T_QUANTILE_95[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262 };
+
+/*
+Correlation, written by the sample task, read and cleared by the measurement task at the segment boundaries.
+The sample task has the higher priority on the same core, so the measurement task never runs in the middle of an update.
+The other way around it does get preempted, so it takes and clears the correlation in a critical section.
+*/
+#if (IMU_SAMPLE_CORE != MEASUREMENT_CORE) || (IMU_SAMPLE_PRIO <= MEASUREMENT_PRIO)
+  #error "Plant identification needs sample_imu_task above measurement_task on the same core."
+#endif
+DRAM_ATTR portMUX_TYPE  identification_mutex            = portMUX_INITIALIZER_UNLOCKED;
+DRAM_ATTR bool          identification_accumulating     = false;
+DRAM_ATTR float         identification_command_change[IDENTIFICATION_NUMBER_LAGS] = { 0 };  /* ring buffer of the most recent command changes */
+DRAM_ATTR uint8_t       identification_history_index    = 0;
+DRAM_ATTR double_t      identification_previous_command = 0.0;
+DRAM_ATTR double_t      identification_correlation[IDENTIFICATION_NUMBER_LAGS] = { 0 };
+DRAM_ATTR double_t      identification_command_energy   = 0.0;  /* sum of the squared command changes */
+DRAM_ATTR double_t      identification_segment_correlation[IDENTIFICATION_NUMBER_LAGS] = { 0 };  /* copy of the closed segment for the estimation */
+
+/* state of the running identification */
+DRAM_ATTR uint16_t      identification_tick             = 0;
+DRAM_ATTR int8_t        identification_segment          = -1;   /* -1 during the lead-in */
+DRAM_ATTR uint8_t       identification_prbs_register    = 1;
+DRAM_ATTR bool          identification_prbs_bit         = true;
+DRAM_ATTR uint8_t       identification_number_estimates = 0;
+DRAM_ATTR float         identification_dead_time[IDENTIFICATION_SEGMENTS]       = { 0 };
+DRAM_ATTR float         identification_time_constant[IDENTIFICATION_SEGMENTS]   = { 0 };
+DRAM_ATTR float         identification_gain[IDENTIFICATION_SEGMENTS]            = { 0 };
+
+void load_plant_model()
+{
+    Preferences preferences;
+    preferences.begin(NVS_NAMESPACE, true);
+    if (preferences.getBytesLength(NVS_KEY_PLANT_MODEL) == sizeof(plant_model))
+    {
+        preferences.getBytes(NVS_KEY_PLANT_MODEL, &plant_model, sizeof(plant_model));
+    }
+    preferences.end();
+    #if DEBUG
+        Serial.printf("Plant model %s.\n", plant_model.valid ? "loaded from NVS" : "not found in NVS");
+    #endif
+}
+
+inline void save_plant_model()
+{
+    Preferences preferences;
+    preferences.begin(NVS_NAMESPACE, false);
+    preferences.putBytes(NVS_KEY_PLANT_MODEL, &plant_model, sizeof(plant_model));
+    preferences.end();
+}
+
+IRAM_ATTR void plant_identification_sample(uint8_t commanded_vdigi, double_t acceleration)
+{
+    double_t command = speed_characterization_valid ? speed_for_vdigi(commanded_vdigi) : commanded_vdigi;
+
+    identification_history_index = (identification_history_index + 1) % IDENTIFICATION_NUMBER_LAGS;
+    identification_command_change[identification_history_index] = command - identification_previous_command;
+    identification_previous_command = command;
+
+    if (!identification_accumulating) { return; }
+
+    identification_command_energy += identification_command_change[identification_history_index] * identification_command_change[identification_history_index];
+    uint8_t history_index = identification_history_index;
+    for (uint8_t lag = 0; lag < IDENTIFICATION_NUMBER_LAGS; lag++)
+    {
+        identification_correlation[lag] += identification_command_change[history_index] * acceleration;
+        history_index = history_index ? history_index - 1 : IDENTIFICATION_NUMBER_LAGS - 1;
+    }
+}
+
+inline void start_segment()
+{
+    portENTER_CRITICAL(&identification_mutex);
+    memset(identification_correlation, 0, sizeof(identification_correlation));
+    identification_command_energy = 0.0;
+    identification_accumulating   = true;
+    portEXIT_CRITICAL(&identification_mutex);
+}
+
+/* estimates the PT1Tt parameters from the impulse response of the closed segment. Segments without a clear response are dropped. */
+inline void finish_segment()
+{
+    portENTER_CRITICAL(&identification_mutex);
+    identification_accumulating = false;
+    memcpy(identification_segment_correlation, identification_correlation, sizeof(identification_segment_correlation));
+    double_t command_energy     = identification_command_energy;
+    portEXIT_CRITICAL(&identification_mutex);
+    if (command_energy <= 0.0) { return; }
+
+    float   impulse_response[IDENTIFICATION_NUMBER_LAGS];
+    uint8_t peak_index = 0;
+    for (uint8_t lag = 0; lag < IDENTIFICATION_NUMBER_LAGS; lag++)
+    {
+        impulse_response[lag] = identification_segment_correlation[lag] / command_energy;
+        if (impulse_response[lag] > impulse_response[peak_index]) { peak_index = lag; }
+    }
+    float peak = impulse_response[peak_index];
+    if (peak <= 0.0) { return; }
+
+    /* dead time: rising edge at half the peak, interpolated between the two lags around it */
+    uint8_t rise_index = 0;
+    while (impulse_response[rise_index] < peak / 2) { rise_index++; }
+    float dead_time = rise_index * IDENTIFICATION_SAMPLE_TIME;
+    if (rise_index > 0)
+    {
+        float below = impulse_response[rise_index - 1];
+        dead_time  -= IDENTIFICATION_SAMPLE_TIME * (1.0 - (peak / 2 - below) / (impulse_response[rise_index] - below));
+    }
+
+    /* time constant: least squares line through ln(h) from the peak until h has decayed */
+    float   sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+    uint8_t number_points = 0;
+    for (uint8_t lag = peak_index; (lag < IDENTIFICATION_NUMBER_LAGS) && (impulse_response[lag] >= IDENTIFICATION_DECAY_FIT_END * peak); lag++)
+    {
+        float x = lag * IDENTIFICATION_SAMPLE_TIME;
+        float y = log(impulse_response[lag]);
+        sum_x  += x;
+        sum_y  += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+        number_points++;
+    }
+    if (number_points < 3) { return; }
+    float slope = (number_points * sum_xy - sum_x * sum_y) / (number_points * sum_xx - sum_x * sum_x);
+    if (slope >= 0.0) { return; }
+    float intercept     = (sum_y - slope * sum_x) / number_points;
+    float time_constant = -1.0 / slope;
+    float gain          = exp(intercept + slope * dead_time) * time_constant;   /* the fitted h at the dead time is K/T1 */
+
+    identification_dead_time[identification_number_estimates]     = dead_time;
+    identification_time_constant[identification_number_estimates] = time_constant;
+    identification_gain[identification_number_estimates]          = gain;
+
+    #if DEBUG
+        Serial.printf("Identification segment %d: dead time %f s, time constant %f s, gain %f\n", identification_segment, dead_time, time_constant, gain);
+    #endif
+    identification_number_estimates++;
+}
+
+/* mean of the segment estimates and the half width of its 95% confidence interval */
+inline void combine_estimates(float* estimates, float* mean, float* confidence)
+{
+    float sum = 0.0, sum_squares = 0.0;
+    for (uint8_t ii = 0; ii < identification_number_estimates; ii++) { sum += estimates[ii]; }
+    *mean = sum / identification_number_estimates;
+    for (uint8_t ii = 0; ii < identification_number_estimates; ii++) { sum_squares += (estimates[ii] - *mean) * (estimates[ii] - *mean); }
+    float standard_deviation = sqrt(sum_squares / (identification_number_estimates - 1));
+    *confidence = T_QUANTILE_95[identification_number_estimates - 2] * standard_deviation / sqrt(identification_number_estimates);
+}
+
+inline void print_plant_model()
+{
+    Serial.println("Plant model (95% confidence):");
+    Serial.printf("dead time\t%f\t+-%f s\n",     plant_model.dead_time,     plant_model.dead_time_confidence);
+    Serial.printf("time constant\t%f\t+-%f s\n", plant_model.time_constant, plant_model.time_constant_confidence);
+    Serial.printf("gain\t%f\t+-%f %s\n",         plant_model.gain,          plant_model.gain_confidence, plant_model.gain_from_speed_table ? "" : "m/s per vdigi");
+}
+
+/* next bit of the 6 bit maximum length sequence, x^6 + x^5 + 1 */
+inline bool next_prbs_bit()
+{
+    uint8_t feedback = ((identification_prbs_register >> 5) ^ (identification_prbs_register >> 4)) & 1;
+    identification_prbs_register = ((identification_prbs_register << 1) | feedback) & 0x3F;
+    return feedback;
+}
+
+/* vdigi of the excitation pattern at identification_tick. Lead-in at the low level, then the step segments, then the PRBS segments. */
+inline uint8_t excitation_vdigi(int8_t segment, uint16_t segment_tick)
+{
+    if (segment < 0) { return IDENTIFICATION_VDIGI_LOW; }
+    if (segment < IDENTIFICATION_STEP_SEGMENTS)
+    {
+        return ((segment_tick / IDENTIFICATION_STEP_HOLD_TICKS) % 2) ? IDENTIFICATION_VDIGI_LOW : IDENTIFICATION_VDIGI_HIGH;
+    }
+    if ((segment_tick % IDENTIFICATION_PRBS_BIT_TICKS) == 0) { identification_prbs_bit = next_prbs_bit(); }
+    return identification_prbs_bit ? IDENTIFICATION_VDIGI_HIGH : IDENTIFICATION_VDIGI_LOW;
+}
+
+/*
+Called by the measurement task at every measurement timer interval. Sets speed_digital for the current pattern.
+Returns true when all segments are done and the model has been stored. Every call after that returns true right away.
+*/
+IRAM_ATTR bool plant_identification_step()
+{
+    if (identification_tick >= IDENTIFICATION_TOTAL_TICKS) { return true; }
+
+    /* segment and tick within it */
+    int8_t   segment      = -1;
+    uint16_t segment_tick = identification_tick;
+    if (segment_tick >= IDENTIFICATION_STEP_HOLD_TICKS)
+    {
+        segment_tick -= IDENTIFICATION_STEP_HOLD_TICKS;
+        if (segment_tick < IDENTIFICATION_STEP_SEGMENTS * IDENTIFICATION_STEP_TICKS)
+        {
+            segment       = segment_tick / IDENTIFICATION_STEP_TICKS;
+            segment_tick %= IDENTIFICATION_STEP_TICKS;
+        }
+        else
+        {
+            segment_tick -= IDENTIFICATION_STEP_SEGMENTS * IDENTIFICATION_STEP_TICKS;
+            segment       = IDENTIFICATION_STEP_SEGMENTS + segment_tick / IDENTIFICATION_PRBS_TICKS;
+            segment_tick %= IDENTIFICATION_PRBS_TICKS;
+        }
+    }
+
+    if (segment != identification_segment)
+    {
+        if (identification_segment >= 0) { finish_segment(); }
+        identification_segment = segment;
+        start_segment();
+    }
+    speed_digital = excitation_vdigi(segment, segment_tick);
+    identification_tick++;
+
+    if (identification_tick >= IDENTIFICATION_TOTAL_TICKS)
+    {
+        finish_segment();
+        speed_digital = 0;
+        if (identification_number_estimates >= 2)
+        {
+            combine_estimates(identification_dead_time,     &plant_model.dead_time,     &plant_model.dead_time_confidence);
+            combine_estimates(identification_time_constant, &plant_model.time_constant, &plant_model.time_constant_confidence);
+            combine_estimates(identification_gain,          &plant_model.gain,          &plant_model.gain_confidence);
+            plant_model.gain_from_speed_table = speed_characterization_valid;
+            plant_model.valid = true;
+            save_plant_model();
+            print_plant_model();
+        }
+        else
+        {
+            Serial.println("Plant identification failed, too few segments with a clear response.");
+        }
+        return true;
+    }
+    return false;
+}
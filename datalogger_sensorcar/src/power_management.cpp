@@ -0,0 +1,119 @@
+#include "power_management.h"
+#include "timer_setup.h"
+#include "imu_lsm6ds3.h"
+#include "event_trace.h"
+#include <esp_pm.h>
+
+#define IDLE_POWER_DOWN_DELAY_SAMPLES   (uint32_t(IDLE_POWER_DOWN_DELAY_MS) * 1000 / SAMPLING_INTERVAL)
+
+DRAM_ATTR portMUX_TYPE          power_mutex             = portMUX_INITIALIZER_UNLOCKED; /* sampling task on core 1 powers down, wireless receive on core 0 wakes up */
+DRAM_ATTR bool                  power_saving            = false;    /* timer halted and locks released */
+DRAM_ATTR bool                  imu_powered_down        = false;    /* only changed by the sampling task, it owns the I2C bus */
+DRAM_ATTR uint8_t               imu_settling_samples    = 0;
+DRAM_ATTR uint32_t              idle_samples            = 0;
+DRAM_ATTR bool                  power_locks_available   = false;
+DRAM_ATTR esp_pm_lock_handle_t  cpu_frequency_lock      = NULL;
+DRAM_ATTR esp_pm_lock_handle_t  no_light_sleep_lock     = NULL;
+
+/* allows frequency scaling and automatic light sleep, then takes the locks that keep the car at full speed until it is idle */
+void init_power_management()
+{
+    esp_pm_config_esp32_t power_config;
+    power_config.max_freq_mhz       = POWER_MAX_CPU_FREQ_MHZ;
+    power_config.min_freq_mhz       = POWER_MIN_CPU_FREQ_MHZ;
+    power_config.light_sleep_enable = true;
+    if (esp_pm_configure(&power_config) != ESP_OK)
+    {
+        #if DEBUG
+            Serial.println("Power management is not enabled in this framework, only the timers and the IMUs are stopped when idle.");
+        #endif
+        return;
+    }
+    power_locks_available = (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "awake", &cpu_frequency_lock) == ESP_OK) &&
+                            (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "awake", &no_light_sleep_lock) == ESP_OK);
+    if (!power_locks_available) { return; }
+    esp_pm_lock_acquire(cpu_frequency_lock);
+    esp_pm_lock_acquire(no_light_sleep_lock);
+}
+
+/* the locks count, so an acquire and a release that overlap from both cores still leave them in the right state */
+inline void take_power_locks()
+{
+    if (!power_locks_available) { return; }
+    esp_pm_lock_acquire(cpu_frequency_lock);
+    esp_pm_lock_acquire(no_light_sleep_lock);
+}
+
+inline void give_power_locks()
+{
+    if (!power_locks_available) { return; }
+    esp_pm_lock_release(no_light_sleep_lock);
+    esp_pm_lock_release(cpu_frequency_lock);
+}
+
+inline void power_down()
+{
+    imu_power(false);
+    imu_powered_down = true;
+
+    portENTER_CRITICAL(&power_mutex);
+    power_saving = true;
+    halt_timers();  /* under the lock, so a wake up can't restart the timer before it was halted */
+    portEXIT_CRITICAL(&power_mutex);
+
+    give_power_locks();
+    event_trace(EVENT_POWER, 1, 0);
+    #if DEBUG
+        Serial.println("Idle, powering down.");
+    #endif
+}
+
+/*
+Called by the sampling task for every sample. Powers down after IDLE_POWER_DOWN_DELAY_MS in SENSORCAR_IDLE_STATE and powers the IMUs up again after a wake up.
+Returns true if the sample has to be skipped, because the IMUs are off or not settled.
+*/
+IRAM_ATTR bool idle_power_sample(uint8_t sensorcar_state)
+{
+    if (imu_powered_down)
+    {
+        /* the timer only runs again after idle_power_wake_up() */
+        imu_power(true);
+        imu_powered_down     = false;
+        imu_settling_samples = IMU_WAKE_SETTLING_SAMPLES;
+        idle_samples         = 0;
+        return true;
+    }
+    if (imu_settling_samples > 0)
+    {
+        imu_settling_samples--;
+        return true;
+    }
+
+    if (sensorcar_state != SENSORCAR_IDLE_STATE)
+    {
+        idle_samples = 0;
+        return false;
+    }
+    idle_samples++;
+    if (idle_samples < IDLE_POWER_DOWN_DELAY_SAMPLES) { return false; }
+
+    power_down();
+    return true;
+}
+
+/* called by wireless receive for every race status message. Does nothing if the car is awake. */
+IRAM_ATTR void idle_power_wake_up()
+{
+    portENTER_CRITICAL(&power_mutex);
+    bool was_power_saving = power_saving;
+    if (was_power_saving)
+    {
+        power_saving = false;
+        restart_timers();
+    }
+    portEXIT_CRITICAL(&power_mutex);
+
+    if (!was_power_saving) { return; }
+    take_power_locks();
+    event_trace(EVENT_POWER, 0, 0);
+}
@@ -0,0 +1,209 @@
+#include "speed_characterization.h"
+#include <Preferences.h>    /* key value storage in the NVS flash partition */
+
+DRAM_ATTR speed_characterization_t speed_characterization[CHARACTERIZATION_NUMBER_STEPS];
+DRAM_ATTR bool speed_characterization_valid = false;   /* true once a table was loaded from NVS or measured */
+
+/* state of the running characterization */
+DRAM_ATTR uint8_t       characterization_step_index         = 0;
+DRAM_ATTR bool          characterization_step_running       = false;
+DRAM_ATTR unsigned long characterization_step_start_ms      = 0;
+DRAM_ATTR double_t      characterization_initial_speed      = 0.0;
+DRAM_ATTR uint32_t      characterization_last_ir_mark       = 0;
+DRAM_ATTR float         characterization_window[CHARACTERIZATION_WINDOW_LENGTH] = { 0 };   /* ring buffer of the most recent IR speeds */
+DRAM_ATTR uint16_t      characterization_samples_count      = 0;
+DRAM_ATTR float         characterization_sample_speed[CHARACTERIZATION_STEP_SAMPLES]   = { 0 };
+DRAM_ATTR uint16_t      characterization_sample_time_ms[CHARACTERIZATION_STEP_SAMPLES] = { 0 };    /* since the start of the step */
+
+void load_speed_characterization()
+{
+    Preferences preferences;
+    preferences.begin(NVS_NAMESPACE, true);
+    if (preferences.getBytesLength(NVS_KEY_SPEED_CHARACTERIZATION) == sizeof(speed_characterization))
+    {
+        preferences.getBytes(NVS_KEY_SPEED_CHARACTERIZATION, speed_characterization, sizeof(speed_characterization));
+        speed_characterization_valid = true;
+    }
+    preferences.end();
+    #if DEBUG
+        Serial.printf("Speed characterization %s.\n", speed_characterization_valid ? "loaded from NVS" : "not found in NVS");
+    #endif
+}
+
+inline void save_speed_characterization()
+{
+    Preferences preferences;
+    preferences.begin(NVS_NAMESPACE, false);
+    preferences.putBytes(NVS_KEY_SPEED_CHARACTERIZATION, speed_characterization, sizeof(speed_characterization));
+    preferences.end();
+}
+
+/* mean and variance of the filled part of the window */
+inline void window_statistics(float* mean, float* variance)
+{
+    uint8_t number_samples = min(characterization_samples_count, (uint16_t)CHARACTERIZATION_WINDOW_LENGTH);
+    float   sum            = 0.0;
+    float   sum_squares    = 0.0;
+    for (uint8_t ii = 0; ii < number_samples; ii++) { sum += characterization_window[ii]; }
+    *mean = number_samples ? sum / number_samples : 0.0;
+    for (uint8_t ii = 0; ii < number_samples; ii++) { sum_squares += (characterization_window[ii] - *mean) * (characterization_window[ii] - *mean); }
+    *variance = (number_samples > 1) ? sum_squares / (number_samples - 1) : 0.0;
+}
+
+/* time until 63.2% of the speed change was reached, interpolated between the two IR samples around it. 0 if the speed barely changed. */
+inline float step_time_constant(float initial_speed, float final_speed)
+{
+    float target_speed = initial_speed + 0.632 * (final_speed - initial_speed);
+    if (abs(final_speed - initial_speed) < 0.05) { return 0.0; }
+
+    bool  rising        = final_speed > initial_speed;
+    float previous_time = 0.0;
+    float previous_speed = initial_speed;
+    uint16_t number_samples = min(characterization_samples_count, (uint16_t)CHARACTERIZATION_STEP_SAMPLES);
+    for (uint16_t ii = 0; ii < number_samples; ii++)
+    {
+        float speed = characterization_sample_speed[ii];
+        float time  = characterization_sample_time_ms[ii] / 1000.0;
+        if ((rising && (speed >= target_speed)) || (!rising && (speed <= target_speed)))
+        {
+            return previous_time + (time - previous_time) * (target_speed - previous_speed) / (speed - previous_speed);
+        }
+        previous_time  = time;
+        previous_speed = speed;
+    }
+    return previous_time; /* never reached, the step was too short */
+}
+
+inline void finish_step(bool steady)
+{
+    speed_characterization_t* step = &speed_characterization[characterization_step_index];
+    float mean, variance;
+    window_statistics(&mean, &variance);
+    step->vdigi         = AVAILABLE_VDIGI[characterization_step_index];
+    step->steady        = steady;
+    step->speed         = mean;
+    step->variance      = variance;
+    step->time_constant = step_time_constant(characterization_initial_speed, mean);
+
+    #if DEBUG
+        Serial.printf("vdigi %d: %s, speed %f m/s, variance %f, time constant %f s\n", step->vdigi, steady ? "steady" : "NOT steady", step->speed, step->variance, step->time_constant);
+    #endif
+
+    characterization_initial_speed = mean;
+    characterization_step_running  = false;
+    characterization_step_index   += 1;
+}
+
+inline void print_speed_characterization()
+{
+    Serial.println("Speed characterization (vdigi, steady, speed in m/s, variance, time constant in s):");
+    for (uint8_t ii = 0; ii < CHARACTERIZATION_NUMBER_STEPS; ii++)
+    {
+        Serial.printf("%d\t%d\t%f\t%f\t%f\n", speed_characterization[ii].vdigi, speed_characterization[ii].steady, speed_characterization[ii].speed, speed_characterization[ii].variance, speed_characterization[ii].time_constant);
+    }
+}
+
+/*
+Called by the measurement task at every measurement timer interval. Sets speed_digital for the current step.
+Returns true when all steps are done and the table has been stored. Every call after that returns true right away.
+*/
+IRAM_ATTR bool speed_characterization_step()
+{
+    if (characterization_step_index >= CHARACTERIZATION_NUMBER_STEPS) { return true; }
+
+    unsigned long timestamp_now = millis();
+
+    if (!characterization_step_running)
+    {
+        if (AVAILABLE_VDIGI[characterization_step_index] == 0)
+        {
+            /* standing still needs no measurement */
+            speed_characterization[characterization_step_index] = { 0, true, 0.0, 0.0, 0.0 };
+            characterization_initial_speed = 0.0;
+            characterization_step_index += 1;
+            return false;
+        }
+        characterization_step_running   = true;
+        characterization_step_start_ms  = timestamp_now;
+        characterization_samples_count  = 0;
+        characterization_last_ir_mark   = ir_mark_sequence;
+        speed_digital                   = AVAILABLE_VDIGI[characterization_step_index];
+    }
+
+    /* only new marks carry a new speed */
+    if (ir_mark_sequence != characterization_last_ir_mark)
+    {
+        characterization_last_ir_mark = ir_mark_sequence;
+        float speed = (ir_left_speed_trackbased + ir_right_speed_trackbased) / 2;
+        characterization_window[characterization_samples_count % CHARACTERIZATION_WINDOW_LENGTH] = speed;
+        if (characterization_samples_count < CHARACTERIZATION_STEP_SAMPLES)
+        {
+            characterization_sample_speed[characterization_samples_count]   = speed;
+            characterization_sample_time_ms[characterization_samples_count] = timestamp_now - characterization_step_start_ms;
+        }
+        characterization_samples_count += 1;
+    }
+
+    unsigned long step_time = timestamp_now - characterization_step_start_ms;
+    if ((step_time >= CHARACTERIZATION_MINIMUM_STEP_TIME_MS) && (characterization_samples_count >= CHARACTERIZATION_WINDOW_LENGTH))
+    {
+        float mean, variance;
+        window_statistics(&mean, &variance);
+        if (sqrt(variance) < CHARACTERIZATION_STEADY_THRESHOLD * mean) { finish_step(true); }
+    }
+    if (characterization_step_running && (step_time >= CHARACTERIZATION_MAXIMUM_STEP_TIME_MS)) { finish_step(false); }
+
+    if (characterization_step_index >= CHARACTERIZATION_NUMBER_STEPS)
+    {
+        speed_digital = 0;
+        save_speed_characterization();
+        speed_characterization_valid = true;
+        print_speed_characterization();
+        return true;
+    }
+    return false;
+}
+
+/* called by the measurement task in SENSORCAR_IDLE_STATE. The step that was running is restarted from standstill by the next speed_characterization_step(). */
+IRAM_ATTR void speed_characterization_abort_step()
+{
+    characterization_step_running   = false;
+    characterization_samples_count  = 0;
+    characterization_initial_speed  = 0.0;   /* the car is stopped while idle */
+}
+
+/* vdigi of the characterized step whose speed is closest to target_speed. Unsteady steps are not used, VDIGI_NOT_FOUND if no step is steady. */
+IRAM_ATTR uint8_t find_vdigi_for_speed(double_t target_speed)
+{
+    uint8_t  closest_vdigi       = VDIGI_NOT_FOUND;
+    double_t smallest_difference = 10e3; /* init with big value */
+    for (uint8_t ii = 0; ii < CHARACTERIZATION_NUMBER_STEPS; ii++)
+    {
+        if (!speed_characterization[ii].steady) { continue; }
+        double_t difference = abs(speed_characterization[ii].speed - target_speed);
+        if (difference < smallest_difference)
+        {
+            smallest_difference = difference;
+            closest_vdigi       = speed_characterization[ii].vdigi;
+        }
+    }
+    return closest_vdigi;
+}
+
+/* characterized speed of the step closest to vdigi. Unsteady steps are not used, 0 if no step is steady. */
+IRAM_ATTR double_t speed_for_vdigi(uint8_t vdigi)
+{
+    int16_t closest_index       = -1;
+    uint8_t smallest_difference = 255;
+    for (uint8_t ii = 0; ii < CHARACTERIZATION_NUMBER_STEPS; ii++)
+    {
+        if (!speed_characterization[ii].steady) { continue; }
+        uint8_t difference = abs(int(speed_characterization[ii].vdigi) - int(vdigi));
+        if (difference < smallest_difference)
+        {
+            smallest_difference = difference;
+            closest_index       = ii;
+        }
+    }
+    return (closest_index >= 0) ? speed_characterization[closest_index].speed : 0.0;
+}
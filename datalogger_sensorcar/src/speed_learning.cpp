@@ -0,0 +1,119 @@
+#include "speed_learning.h"
+#include "imu_lsm6ds3.h"
+#include "imu_bias_tracking.h"  /* rotation rates */
+#include "vehicle_dynamics.h"   /* rear slip */
+#include "speed_table.h"        /* optimized speeds of a known layout */
+
+#if !CALIBRATE_ACCELERATION && (ALGORITHM_TYPE == ALGORITHM_LEARNING)
+    #error "ALGORITHM_LEARNING needs the lateral acceleration of the car axes, enable CALIBRATE_ACCELERATION."
+#endif
+
+DRAM_ATTR float   learned_speed_digital[TRACK_MAX_PIECES] = { 0 };
+DRAM_ATTR uint8_t learned_number_track_pieces   = 0;    /* layout the table was made for */
+
+/* peak stress of every piece in the lap in progress, written by the sample task */
+DRAM_ATTR float   learning_peak_stress[TRACK_MAX_PIECES] = { 0 };
+DRAM_ATTR uint8_t learning_piece_count          = 0;
+DRAM_ATTR bool    learning_lap_recording        = false;
+
+/* call after imu_read() while racing */
+IRAM_ATTR void speed_learning_sample(uint8_t track_position_index)
+{
+    #if CALIBRATE_ACCELERATION
+        if (!learning_lap_recording || (track_position_index >= TRACK_MAX_PIECES)) { return; }
+
+        double_t lateral  = max(abs(front_imu_calibrated_acceleration_array[1]), abs(back_imu_calibrated_acceleration_array[1]));
+        double_t rotation = imu_rotation_rate_magnitude();
+
+        float stress = max(lateral / LEARNING_LATERAL_LIMIT, rotation / LEARNING_ROTATION_LIMIT);
+        #if VEHICLE_DYNAMICS
+            stress = max(stress, vehicle_dynamics.slip_indicator);
+        #endif
+        if (stress > learning_peak_stress[track_position_index]) { learning_peak_stress[track_position_index] = stress; }
+    #endif
+}
+
+/* the mapped layout is the one the speed table was optimized for */
+inline bool speed_table_matches()
+{
+    if (number_track_pieces != SPEED_TABLE_NUMBER_PIECES) { return false; }
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        if (track_geometry[piece] != SPEED_TABLE_TRACK_GEOMETRY[piece]) { return false; }
+    }
+    return true;
+}
+
+/* table from the optimized speeds if there are any for the mapped layout, else from the per type targets */
+IRAM_ATTR void speed_learning_start()
+{
+    bool optimized = speed_table_matches();
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        learned_speed_digital[piece] = optimized ? SPEED_TABLE_SPEED_DIGITAL[piece] : TARGET_TRACKPIECE_SPEED_DIGITAL[track_geometry[piece]];
+    }
+    learned_number_track_pieces = number_track_pieces;
+    #if DEBUG
+        Serial.printf("Speed learning starts from the %s.\n", optimized ? "optimized speed table" : "per type targets");
+    #endif
+}
+
+inline float clamp_float(float value, float lower, float upper)
+{
+    return min(max(value, lower), upper);
+}
+
+/* one learning iteration over the completed lap */
+inline void learn_from_lap()
+{
+    float step[TRACK_MAX_PIECES];
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        float error = (1.0 - LEARNING_MARGIN) - learning_peak_stress[piece];
+        step[piece] = LEARNING_GAIN * error * ((error < 0.0) ? LEARNING_BRAKE_FACTOR : 1.0);
+    }
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        uint8_t next = (piece + 1) % number_track_pieces;
+        if (learning_peak_stress[next] > 1.0) { step[piece] = min(step[piece], step[next] / 2); } /* brake earlier for the piece that went over */
+        learned_speed_digital[piece] = clamp_float(learned_speed_digital[piece] + clamp_float(step[piece], -LEARNING_MAX_STEP, LEARNING_MAX_STEP), LEARNING_MIN_VDIGI, LEARNING_MAX_VDIGI);
+    }
+
+    #if DEBUG
+        Serial.printf("Learned speeds: {");
+        for (uint8_t ii = 0; ii < number_track_pieces; ii++) { Serial.printf(" %.1f(%.2f)", learned_speed_digital[ii], learning_peak_stress[ii]); }
+        Serial.printf("}\n");
+    #endif
+}
+
+/* called at every IR mark while racing. A lap runs from one pass of the finish line to the next and only counts if every piece was seen once. */
+IRAM_ATTR void speed_learning_mark(bool finish_line_passed)
+{
+    if (learned_number_track_pieces != number_track_pieces) { speed_learning_start(); }  /* the layout was recounted */
+
+    if (finish_line_passed)
+    {
+        if (learning_lap_recording && (learning_piece_count == number_track_pieces)) { learn_from_lap(); }
+        for (uint8_t piece = 0; piece < TRACK_MAX_PIECES; piece++) { learning_peak_stress[piece] = 0.0; }
+        learning_piece_count   = 0;
+        learning_lap_recording = true;
+    }
+    if (learning_lap_recording) { learning_piece_count++; }
+}
+
+/* the car was stopped, the stress of the lap in progress does not belong to a full lap */
+IRAM_ATTR void speed_learning_discard_lap()
+{
+    learning_lap_recording = false;
+}
+
+/* the lap in progress is discarded, since its stress ends with the derailment */
+IRAM_ATTR void speed_learning_derailed(uint8_t track_position_index)
+{
+    learning_lap_recording = false;
+    if ((learned_number_track_pieces != number_track_pieces) || (track_position_index >= number_track_pieces)) { return; }
+
+    uint8_t previous = track_position_index ? track_position_index - 1 : number_track_pieces - 1;
+    learned_speed_digital[track_position_index] = max(learned_speed_digital[track_position_index] - LEARNING_DERAILMENT_STEP, LEARNING_MIN_VDIGI);
+    learned_speed_digital[previous]             = max(learned_speed_digital[previous]             - LEARNING_DERAILMENT_STEP, LEARNING_MIN_VDIGI);
+}
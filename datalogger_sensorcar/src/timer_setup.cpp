@@ -1,58 +1,84 @@
 #include "timer_setup.h"
-hw_timer_t * sample_timer = NULL;
-hw_timer_t * controller_timer = NULL;
-hw_timer_t * measurement_timer = NULL;
+#include "handoff_accounting.h"
 
-inline void init_timer_generic(hw_timer_t * timer_object, uint8_t number_timer, void function_pointer(), int timer_interval_microseconds)
+DRAM_ATTR hw_timer_t* scheduler_timer = NULL;
+DRAM_ATTR bool        scheduler_halted = false;
+
+/* static schedule of all periodic jobs */
+DRAM_ATTR const schedule_entry_t SCHEDULE_TABLE[] = {
+  { &sample_imu_task_handle,          SAMPLING_INTERVAL,          SAMPLING_PHASE    },  /* HANDOFF_IMU_SAMPLING */
+  { &velocity_controller_task_handle, CONTROLLER_INTERVAL,        CONTROLLER_PHASE  },  /* HANDOFF_CONTROLLER_TIMER */
+  { &measurement_task_handle,         MEASUREMENT_TIMER_INTERVAL, MEASUREMENT_PHASE },  /* HANDOFF_MEASUREMENT_TIMER */
+  { &log_to_sdcard_task_handle,       LOGGING_INTERVAL,           LOGGING_PHASE     },  /* HANDOFF_LOGGING_TIMER */
+};
+#define SCHEDULE_TABLE_LENGTH (sizeof(SCHEDULE_TABLE) / sizeof(SCHEDULE_TABLE[0]))
+
+DRAM_ATTR uint64_t next_release_time[SCHEDULE_TABLE_LENGTH] = { 0 };  /* in us of the scheduler timer */
+
+/* searches the earliest release time of all jobs */
+inline uint64_t next_alarm_time()
 {
-  /* 
-  Use one timer of 4 (counted from zero).
-  Set 80 divider for prescaler (see ESP32 Technical Reference Manual for more info).
-  */
-  timer_object = timerBegin(number_timer, 80, true);
-  timerAttachInterrupt(timer_object, function_pointer, true);       /* trigger the referenced function on timer overflow */
-  timerAlarmWrite(timer_object, timer_interval_microseconds, true); /* load the timer and enable autoreload */
-  timerAlarmEnable(timer_object);                                   /* start the timer */
+  uint64_t earliest_release_time = next_release_time[0];
+  for (uint8_t ii = 1; ii < SCHEDULE_TABLE_LENGTH; ii++)
+  {
+    if (next_release_time[ii] < earliest_release_time) { earliest_release_time = next_release_time[ii]; }
+  }
+  return earliest_release_time;
 }
 
 void init_timers()
 {
-  init_timer_generic(sample_timer,        3, &on_sample_timer,         SAMPLING_INTERVAL);
-  init_timer_generic(measurement_timer, 2, &on_measurement_timer,  MEASUREMENT_TIMER_INTERVAL);
-  init_timer_generic(controller_timer,    1, &on_controller_timer,     CONTROLLER_INTERVAL);
-}
+  for (uint8_t ii = 0; ii < SCHEDULE_TABLE_LENGTH; ii++) { next_release_time[ii] = SCHEDULE_TABLE[ii].phase; }
 
-inline void halt_timer_generic(hw_timer_t * timer_object, int timer_interval_microseconds)
-{
-  timerAlarmDisable(timer_object); /* disable reaccuring triggering of interrupt service routine */
-  timerAlarmWrite(timer_object, timer_interval_microseconds, true); /* reload timer */
+  /*
+  Set 80 divider for prescaler (see ESP32 Technical Reference Manual for more info), so the timer counts in us.
+  The alarm does not reload, the isr sets the next alarm time itself.
+  */
+  scheduler_timer = timerBegin(SCHEDULER_TIMER_NUMBER, 80, true);
+  timerAttachInterrupt(scheduler_timer, &on_scheduler_timer, true);
+  timerAlarmWrite(scheduler_timer, next_alarm_time(), false);
+  timerAlarmEnable(scheduler_timer);
 }
 
+/* stops the timer counter. No job is released until restart_timers() is called. */
 IRAM_ATTR void halt_timers()
 {
-  halt_timer_generic(sample_timer,        SAMPLING_INTERVAL);
-  halt_timer_generic(controller_timer,    CONTROLLER_INTERVAL);
-  halt_timer_generic(measurement_timer, MEASUREMENT_TIMER_INTERVAL);
+  timerStop(scheduler_timer);
+  scheduler_halted = true;
 }
 
+/* continues the schedule where it was halted, with all phases intact */
 IRAM_ATTR void restart_timers()
 {
-  timerAlarmEnable(sample_timer);
-  timerAlarmEnable(controller_timer);
-  timerAlarmEnable(measurement_timer);
+  scheduler_halted = false;
+  timerStart(scheduler_timer);
 }
 
-IRAM_ATTR void on_sample_timer()
+IRAM_ATTR bool timers_halted()
 {
-  xSemaphoreGiveFromISR(sampling_semaphore, NULL); /* unblock imu sampling task */
+  return scheduler_halted;
 }
 
-IRAM_ATTR void on_controller_timer()
+IRAM_ATTR void on_scheduler_timer()
 {
-  xSemaphoreGiveFromISR(controller_timer_semaphore, NULL);
-}
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  uint64_t   alarm_time                 = timerRead(scheduler_timer); /* every job released until now is due */
 
-IRAM_ATTR void on_measurement_timer()
-{
-  xSemaphoreGiveFromISR(measurement_timer_semaphore, NULL);
-}
\ No newline at end of file
+  for (uint8_t ii = 0; ii < SCHEDULE_TABLE_LENGTH; ii++)
+  {
+    if (next_release_time[ii] <= alarm_time)
+    {
+      handoff_notify_from_isr(*SCHEDULE_TABLE[ii].task_handle, &higher_priority_task_woken);
+      next_release_time[ii] += SCHEDULE_TABLE[ii].interval;
+    }
+  }
+
+  /* should the isr have been delayed past the next release, that release happens right away instead of never */
+  uint64_t next_alarm = next_alarm_time();
+  uint64_t timer_now  = timerRead(scheduler_timer);
+  if (next_alarm <= timer_now) { next_alarm = timer_now + 1; }
+  timerAlarmWrite(scheduler_timer, next_alarm, false);
+  timerAlarmEnable(scheduler_timer);
+
+  if (higher_priority_task_woken) { portYIELD_FROM_ISR(); } /* switch to the woken task right away instead of at the next tick */
+}
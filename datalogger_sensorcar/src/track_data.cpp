@@ -4,10 +4,10 @@
 DRAM_ATTR uint8_t number_track_pieces = 8;  /* total number of track pieces that the track is made out of */
 
 /* array of integers that holds values representing track pieces. The 0th element is the starting position, so it's usually the straight. Other possible geometries include the inner and outer left and right curves. */
-DRAM_ATTR uint8_t track_geometry[50] = { 0 };
+DRAM_ATTR uint8_t track_geometry[TRACK_MAX_PIECES] = { 0 };
 
 /* holds double values of the total track length at every track piece length. For example: the element at index 0 is always 0, the element at index 1 has the length of the 1st track piece, the element at index 2 has the lentgh of the first two elements, etc. It is used as a reference for position along the track. */
-DRAM_ATTR double_t track_checkpoint_lengths[50] = { 0 };
+DRAM_ATTR double_t track_checkpoint_lengths[TRACK_MAX_PIECES] = { 0 };
 
 /* calculate track length at each checkpoint */
 IRAM_ATTR void calculate_track_checkpoint_lengths(uint8_t number_track_pieces)
@@ -45,4 +45,138 @@ IRAM_ATTR uint8_t determine_track_piece(signed long sensor_time_difference)
     }
     
     return 0;   /* default value if none is applicable */
-}
\ No newline at end of file
+}
+
+#if TRACK_REFINEMENT
+DRAM_ATTR uint8_t  track_piece_votes[TRACK_MAX_PIECES][TRACK_PIECE_TYPES] = { { 0 } };
+DRAM_ATTR float    track_piece_confidence[TRACK_MAX_PIECES] = { 0 };
+
+/* mean IR speed of the mapping lap */
+DRAM_ATTR double_t track_mapping_speed_sum     = 0.0;
+DRAM_ATTR uint8_t  track_mapping_speed_count   = 0;
+DRAM_ATTR double_t track_mapping_speed         = 0.0;
+
+/* classifications of the lap in progress. Index 0 is the piece that ends at the first mark after the finish line. */
+DRAM_ATTR uint8_t  lap_classification[TRACK_MAX_PIECES] = { 0 };
+DRAM_ATTR uint8_t  lap_piece_count             = 0;
+DRAM_ATTR bool     lap_recording               = false;   /* false until the finish line has been passed once */
+
+/* laps in a row that disagree with number_track_pieces on the same count */
+DRAM_ATTR uint8_t  recount_candidate           = 0;
+DRAM_ATTR uint8_t  recount_laps                = 0;
+
+IRAM_ATTR void track_refinement_mapping_mark(double_t ir_speed)
+{
+    if (!isfinite(ir_speed) || (ir_speed <= 0.0)) { return; }
+    track_mapping_speed_sum += ir_speed;
+    track_mapping_speed_count++;
+}
+
+inline void update_confidence(uint8_t piece)
+{
+    uint8_t votes_sum = 0;
+    for (uint8_t type = 0; type < TRACK_PIECE_TYPES; type++) { votes_sum += track_piece_votes[piece][type]; }
+    track_piece_confidence[piece] = votes_sum ? float(track_piece_votes[piece][track_geometry[piece]]) / votes_sum : 0.0;
+}
+
+/* the mapped layout is one vote per piece */
+IRAM_ATTR void track_refinement_start(uint8_t number_track_pieces)
+{
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        memset(track_piece_votes[piece], 0, TRACK_PIECE_TYPES);
+        track_piece_votes[piece][track_geometry[piece]] = 1;
+        update_confidence(piece);
+    }
+    track_mapping_speed = track_mapping_speed_count ? track_mapping_speed_sum / track_mapping_speed_count : 0.0;
+    track_mapping_speed_sum   = 0.0;
+    track_mapping_speed_count = 0;
+    recount_laps  = 0;
+    lap_recording = false;
+}
+
+/* adds the vote and returns true if the piece changed its type */
+inline bool vote_track_piece(uint8_t piece, uint8_t type)
+{
+    track_piece_votes[piece][type]++;
+    if (track_piece_votes[piece][type] >= TRACK_VOTE_LIMIT)
+    {
+        for (uint8_t ii = 0; ii < TRACK_PIECE_TYPES; ii++) { track_piece_votes[piece][ii] /= 2; }
+    }
+
+    uint8_t majority = track_geometry[piece];
+    for (uint8_t ii = 0; ii < TRACK_PIECE_TYPES; ii++)
+    {
+        if (track_piece_votes[piece][ii] > track_piece_votes[piece][majority]) { majority = ii; } /* ties keep the current type */
+    }
+    bool changed = (majority != track_geometry[piece]);
+    track_geometry[piece] = majority;
+    update_confidence(piece);
+    return changed;
+}
+
+/* a lap with a different number of pieces than the layout. Enough of them in a row replace the layout. */
+inline bool recount_track(uint8_t lap_pieces)
+{
+    if (lap_pieces != recount_candidate) { recount_candidate = lap_pieces; recount_laps = 0; }
+    if (++recount_laps < TRACK_RECOUNT_LAPS) { return false; }
+
+    #if DEBUG
+        Serial.printf("Track recounted: %d instead of %d pieces.\n", lap_pieces, number_track_pieces);
+    #endif
+    memcpy(track_geometry, lap_classification, lap_pieces);
+    number_track_pieces = lap_pieces;
+    track_refinement_start(lap_pieces);
+    return true;
+}
+
+/* closes the lap that ends with this pass of the finish line */
+inline void finish_lap()
+{
+    bool changed = false;
+    if (lap_piece_count == number_track_pieces)
+    {
+        recount_laps = 0;
+        for (uint8_t piece = 0; piece < lap_piece_count; piece++) { changed |= vote_track_piece(piece, lap_classification[piece]); }
+    }
+    else if (lap_piece_count >= 2)
+    {
+        changed = recount_track(lap_piece_count);
+    }
+
+    if (changed)
+    {
+        calculate_track_checkpoint_lengths(number_track_pieces);
+        #if DEBUG
+            Serial.printf("Refined track: {");
+            for (uint8_t ii = 0; ii < number_track_pieces; ii++) { Serial.printf(" %d(%.2f)", track_geometry[ii], track_piece_confidence[ii]); }
+            Serial.printf("}\n");
+        #endif
+    }
+}
+
+/* called at every IR mark while racing. finish_line_passed is true for the first mark after the finish line, which ends piece 0. */
+IRAM_ATTR void track_refinement_racing_mark(bool finish_line_passed, signed long sensor_time_difference, double_t ir_speed)
+{
+    if (finish_line_passed)
+    {
+        if (lap_recording) { finish_lap(); }
+        lap_recording   = true;
+        lap_piece_count = 0;
+    }
+    if (!lap_recording) { return; }
+    if (lap_piece_count >= TRACK_MAX_PIECES) { lap_recording = false; return; } /* finish line message got lost, wait for the next one */
+
+    if (isfinite(ir_speed) && (ir_speed > 0.0) && (track_mapping_speed > 0.0))
+    {
+        sensor_time_difference = (signed long)(sensor_time_difference * ir_speed / track_mapping_speed);
+    }
+    lap_classification[lap_piece_count++] = determine_track_piece(sensor_time_difference);
+}
+
+/* the car was stopped, so the lap in progress may not have been driven in one go */
+IRAM_ATTR void track_refinement_discard_lap()
+{
+    lap_recording = false;
+}
+#endif
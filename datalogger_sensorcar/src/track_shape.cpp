@@ -0,0 +1,242 @@
+#include "track_shape.h"
+#include "timer_setup.h"    /* SAMPLING_INTERVAL */
+
+DRAM_ATTR track_shape_t track_shape = { 0 };
+
+/* integrals of the piece in progress, written by the IMU sampling task and taken by the IR task at the next mark */
+typedef struct
+{
+    float heading;          /* in rad since the first mark of the lap */
+    float duration;         /* in s */
+    float direction_x;      /* in s, integral of cos(heading). Times the speed, it is the displacement. */
+    float direction_y;
+} shape_integrals_t;
+
+DRAM_ATTR portMUX_TYPE      shape_mutex             = portMUX_INITIALIZER_UNLOCKED;
+DRAM_ATTR shape_integrals_t shape_integrals         = { 0.0, 0.0, 0.0, 0.0 };
+DRAM_ATTR bool              shape_recording         = false;    /* from the first mark of the mapping lap to the mark after the finish line */
+DRAM_ATTR float             shape_mark_heading      = 0.0;      /* in rad, at the last mark */
+DRAM_ATTR double_t          shape_mark_speed        = 0.0;      /* IR speed at the last mark */
+DRAM_ATTR uint8_t           shape_measured_pieces   = 0;
+
+/* pieces of the mapping lap as measured, indexed by piece */
+DRAM_ATTR float shape_heading_change[TRACK_MAX_PIECES]  = { 0 };    /* in degrees */
+DRAM_ATTR float shape_duration[TRACK_MAX_PIECES]        = { 0 };    /* in s */
+DRAM_ATTR float shape_speed[TRACK_MAX_PIECES]           = { 0 };    /* in m/s, mean of the IR speeds at both ends */
+DRAM_ATTR float shape_direction_x[TRACK_MAX_PIECES]     = { 0 };    /* in s */
+DRAM_ATTR float shape_direction_y[TRACK_MAX_PIECES]     = { 0 };
+
+/* in degrees, positive to the left */
+const float PIECE_HEADING_CHANGE[TRACK_PIECE_TYPES] = { 0.0, TRACK_CURVE_ANGLE, TRACK_CURVE_ANGLE, -TRACK_CURVE_ANGLE, -TRACK_CURVE_ANGLE };
+const float PIECE_RADIUS[TRACK_PIECE_TYPES]         = { 0.0, TRACK_INNER_LANE_RADIUS, TRACK_OUTER_LANE_RADIUS, TRACK_INNER_LANE_RADIUS, TRACK_OUTER_LANE_RADIUS };
+
+/* call after imu_read() and imu_bias_update() during the mapping lap. yaw_rate in rad/s, positive to the left. */
+IRAM_ATTR void track_shape_sample(double_t yaw_rate)
+{
+    if (!shape_recording) { return; }
+    float interval = SAMPLING_INTERVAL / 1.0e6;
+    portENTER_CRITICAL(&shape_mutex);
+    float heading = shape_integrals.heading + yaw_rate * interval / 2;  /* midpoint of the sample interval */
+    shape_integrals.heading     += yaw_rate * interval;
+    shape_integrals.duration    += interval;
+    shape_integrals.direction_x += cosf(heading) * interval;
+    shape_integrals.direction_y += sinf(heading) * interval;
+    portEXIT_CRITICAL(&shape_mutex);
+}
+
+inline bool usable_speed(double_t ir_speed)
+{
+    return isfinite(ir_speed) && (ir_speed > 0.0);
+}
+
+/* closes the piece that ends at this mark */
+inline void take_piece(uint8_t piece, double_t ir_speed)
+{
+    portENTER_CRITICAL(&shape_mutex);
+    shape_integrals_t integrals = shape_integrals;
+    shape_integrals.duration    = 0.0;
+    shape_integrals.direction_x = 0.0;
+    shape_integrals.direction_y = 0.0;
+    portEXIT_CRITICAL(&shape_mutex);
+
+    double_t speed = 0.0;
+    if (usable_speed(ir_speed) && usable_speed(shape_mark_speed))   { speed = (ir_speed + shape_mark_speed) / 2; }
+    else if (usable_speed(ir_speed))                                { speed = ir_speed; }
+    else if (usable_speed(shape_mark_speed))                        { speed = shape_mark_speed; }
+
+    shape_heading_change[piece] = (integrals.heading - shape_mark_heading) * RAD_TO_DEG;
+    shape_duration[piece]       = integrals.duration;
+    shape_speed[piece]          = speed;
+    shape_direction_x[piece]    = integrals.direction_x;
+    shape_direction_y[piece]    = integrals.direction_y;
+    shape_mark_heading          = integrals.heading;
+    shape_mark_speed            = ir_speed;
+    shape_measured_pieces++;
+}
+
+/* at every mark of the mapping lap but the one after the finish line, with the index of the piece that ends there. Piece 0 starts the lap, what came before it was only part of a piece. */
+IRAM_ATTR void track_shape_mark(uint8_t piece, double_t ir_speed)
+{
+    if (piece == 0)
+    {
+        portENTER_CRITICAL(&shape_mutex);
+        shape_integrals = { 0.0, 0.0, 0.0, 0.0 };
+        portEXIT_CRITICAL(&shape_mutex);
+        shape_mark_heading      = 0.0;
+        shape_mark_speed        = ir_speed;
+        shape_measured_pieces   = 0;
+        shape_recording         = true;
+        return;
+    }
+    if (!shape_recording || (piece >= TRACK_MAX_PIECES)) { return; }
+    take_piece(piece, ir_speed);
+}
+
+/* piece type closest to the measured heading change in degrees and length in m */
+inline uint8_t snap_piece(float heading_change, float length)
+{
+    uint8_t best_type = TRACK_STRAIGHT;
+    float   best_cost = INFINITY;
+    for (uint8_t type = 0; type < TRACK_PIECE_TYPES; type++)
+    {
+        float angle_error  = (heading_change - PIECE_HEADING_CHANGE[type]) / TRACK_SHAPE_ANGLE_TOLERANCE;
+        float length_error = (length - TRACKPIECE_LENGTH[type]) / (TRACKPIECE_LENGTH[type] * TRACK_SHAPE_LENGTH_TOLERANCE);
+        float cost = angle_error * angle_error + length_error * length_error;
+        if (cost < best_cost) { best_cost = cost; best_type = type; }
+    }
+    return best_type;
+}
+
+/* gap between start and end of the layout built from the nominal pieces, in m. Sets total_heading_change to the heading change of the layout in degrees. */
+inline float snapped_closure(const uint8_t* types, uint8_t number_pieces, float* total_heading_change)
+{
+    float x = 0.0, y = 0.0, heading = 0.0;
+    for (uint8_t piece = 0; piece < number_pieces; piece++)
+    {
+        uint8_t type = types[piece];
+        if (type == TRACK_STRAIGHT)
+        {
+            x += TRACKPIECE_LENGTH[type] * cosf(heading);
+            y += TRACKPIECE_LENGTH[type] * sinf(heading);
+            continue;
+        }
+        float turn  = PIECE_HEADING_CHANGE[type] * DEG_TO_RAD;
+        float chord = 2 * PIECE_RADIUS[type] * sinf(abs(turn) / 2);
+        x += chord * cosf(heading + turn / 2);
+        y += chord * sinf(heading + turn / 2);
+        heading += turn;
+    }
+    *total_heading_change = heading * RAD_TO_DEG;
+    return sqrtf(x * x + y * y);
+}
+
+/*
+At the mark after the finish line, which ends piece 0 a second time. Closes the loop, snaps the pieces and replaces track_geometry if the snapped layout closes too.
+Returns true if it did.
+*/
+IRAM_ATTR bool track_shape_close(uint8_t number_track_pieces, double_t ir_speed)
+{
+    track_shape.valid           = false;
+    track_shape.number_pieces   = number_track_pieces;
+    if (!shape_recording || (number_track_pieces < 3) || (number_track_pieces > TRACK_MAX_PIECES)) { shape_recording = false; return false; }
+    take_piece(0, ir_speed);
+    shape_recording = false;
+    if (shape_measured_pieces != number_track_pieces) { return false; } /* a mark was missed, the pieces don't line up */
+
+    /* pieces in the order of the lap: 1 ... number_track_pieces-1, then 0 */
+    uint8_t lap_order[TRACK_MAX_PIECES];
+    for (uint8_t ii = 0; ii < number_track_pieces; ii++) { lap_order[ii] = (ii + 1) % number_track_pieces; }
+
+    /* heading: the lap turns once around */
+    float total_heading_change = 0.0, total_duration = 0.0;
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        total_heading_change += shape_heading_change[piece];
+        total_duration       += shape_duration[piece];
+    }
+    float heading_error = total_heading_change - ((total_heading_change > 0.0) ? 360.0 : -360.0);
+    track_shape.heading_error = heading_error;
+    if ((abs(heading_error) > TRACK_SHAPE_HEADING_TOLERANCE) || (total_duration <= 0.0)) { return false; }
+
+    /* IR speeds to the scale of the straights, told apart from curves by their heading change alone */
+    float nominal_straights = 0.0, measured_straights = 0.0;
+    for (uint8_t piece = 0; piece < number_track_pieces; piece++)
+    {
+        float heading_change = shape_heading_change[piece] - heading_error * shape_duration[piece] / total_duration;
+        if (abs(heading_change) > TRACK_CURVE_ANGLE / 2) { continue; }
+        nominal_straights  += TRACKPIECE_LENGTH[TRACK_STRAIGHT];
+        measured_straights += shape_speed[piece] * shape_duration[piece];
+    }
+    float length_scale = (measured_straights > 0.0) ? nominal_straights / measured_straights : 1.0;
+    track_shape.length_scale = length_scale;
+
+    /* polyline with the heading error removed, each piece rotated back by the drift accumulated up to its middle */
+    float x = 0.0, y = 0.0, elapsed = 0.0;
+    for (uint8_t ii = 0; ii < number_track_pieces; ii++)
+    {
+        uint8_t piece = lap_order[ii];
+        float   drift = -heading_error * (elapsed + shape_duration[piece] / 2) / total_duration * DEG_TO_RAD;
+        float   speed = shape_speed[piece] * length_scale;
+        x += speed * (shape_direction_x[piece] * cosf(drift) - shape_direction_y[piece] * sinf(drift));
+        y += speed * (shape_direction_x[piece] * sinf(drift) + shape_direction_y[piece] * cosf(drift));
+        elapsed += shape_duration[piece];
+        track_shape.length[piece]           = speed * shape_duration[piece];
+        track_shape.heading_change[piece]   = shape_heading_change[piece] - heading_error * shape_duration[piece] / total_duration;
+        #if DEBUG
+            track_shape.x[piece]            = x;
+            track_shape.y[piece]            = y;
+            track_shape.curvature[piece]    = (track_shape.length[piece] > 0.0) ? track_shape.heading_change[piece] * DEG_TO_RAD / track_shape.length[piece] : 0.0;
+        #endif
+    }
+    track_shape.closure_error = sqrtf(x * x + y * y);
+
+    #if DEBUG
+        /* the gap between start and end, spread over the vertices by their distance along the lap */
+        float total_length = 0.0;
+        for (uint8_t piece = 0; piece < number_track_pieces; piece++) { total_length += track_shape.length[piece]; }
+        float distance = 0.0, gap_x = x, gap_y = y;
+        for (uint8_t ii = 0; ii < number_track_pieces; ii++)
+        {
+            uint8_t piece = lap_order[ii];
+            distance += track_shape.length[piece];
+            float share = (total_length > 0.0) ? distance / total_length : float(ii + 1) / number_track_pieces;
+            track_shape.x[piece] -= gap_x * share;
+            track_shape.y[piece] -= gap_y * share;
+        }
+    #endif
+
+    /* snapped layout in the order of the lap */
+    uint8_t snapped[TRACK_MAX_PIECES];
+    for (uint8_t ii = 0; ii < number_track_pieces; ii++)
+    {
+        uint8_t piece = lap_order[ii];
+        snapped[ii] = snap_piece(track_shape.heading_change[piece], track_shape.length[piece]);
+    }
+    float snapped_heading_change;
+    track_shape.snapped_closure_error = snapped_closure(snapped, number_track_pieces, &snapped_heading_change);
+    if ((abs(abs(snapped_heading_change) - 360.0) > TRACK_CURVE_ANGLE / 2) || (track_shape.snapped_closure_error > TRACK_SHAPE_CLOSURE_TOLERANCE)) { return false; }
+
+    track_shape.corrected_pieces = 0;
+    for (uint8_t ii = 0; ii < number_track_pieces; ii++)
+    {
+        uint8_t piece = lap_order[ii];
+        if (track_geometry[piece] != snapped[ii]) { track_shape.corrected_pieces++; }
+        track_geometry[piece] = snapped[ii];
+    }
+    track_shape.valid = true;
+    return true;
+}
+
+#if DEBUG
+void print_track_shape()
+{
+    Serial.printf("Track shape of %d pieces %s: heading error %.1f deg, closure error %.3f m, snapped closure error %.3f m, length scale %.3f, %d pieces corrected\n",
+        track_shape.number_pieces, track_shape.valid ? "valid" : "rejected", track_shape.heading_error, track_shape.closure_error,
+        track_shape.snapped_closure_error, track_shape.length_scale, track_shape.corrected_pieces);
+    for (uint8_t piece = 0; piece < track_shape.number_pieces; piece++)
+    {
+        Serial.printf("  piece %2d: type %d, end %6.3f %6.3f m, %6.1f deg over %5.3f m, curvature %6.2f 1/m\n", piece, track_geometry[piece],
+            track_shape.x[piece], track_shape.y[piece], track_shape.heading_change[piece], track_shape.length[piece], track_shape.curvature[piece]);
+    }
+}
+#endif
@@ -0,0 +1,68 @@
+#include "vehicle_dynamics.h"
+#include "imu_lsm6ds3.h"
+#include "imu_bias_tracking.h"  /* bias corrected rotation rates */
+
+#if !CALIBRATE_ACCELERATION && VEHICLE_DYNAMICS
+    #error "VEHICLE_DYNAMICS needs the car axes from the acceleration calibration, enable CALIBRATE_ACCELERATION."
+#endif
+
+DRAM_ATTR vehicle_dynamics_t vehicle_dynamics = { 0.0, 0.0, 0.0, 0.0 };
+
+#if CALIBRATE_ACCELERATION
+/* rotation rate in dps around the car z axis. calibration_values holds the z row in elements 8...10. */
+inline double_t yaw_rate_of_imu(const double_t* rotation_rate, const double_t* calibration_values)
+{
+    double_t norm = sqrt(calibration_values[8] * calibration_values[8] + calibration_values[9] * calibration_values[9] + calibration_values[10] * calibration_values[10]);
+    if (norm <= 0.0) { return 0.0; }
+    return (calibration_values[8] * rotation_rate[0] + calibration_values[9] * rotation_rate[1] + calibration_values[10] * rotation_rate[2]) / norm;
+}
+#endif
+
+/* call after imu_read() and imu_bias_update(). Without CALIBRATE_ACCELERATION, the z axes of the sensors are taken as the car z axis. */
+IRAM_ATTR double_t car_yaw_rate()
+{
+    #if IMU_BIAS_TRACKING
+        double_t* front_rotation_rate = front_imu_rotation_rate;
+        double_t* back_rotation_rate  = back_imu_rotation_rate;
+    #else
+        double_t front_rotation_rate[3], back_rotation_rate[3];
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            front_rotation_rate[axis] = front_imu_raw_data_array[axis] * GYRO_SENSITIVITY;
+            back_rotation_rate[axis]  = back_imu_raw_data_array[axis]  * GYRO_SENSITIVITY;
+        }
+    #endif
+    #if CALIBRATE_ACCELERATION
+        return (yaw_rate_of_imu(front_rotation_rate, calibration_values_front) + yaw_rate_of_imu(back_rotation_rate, calibration_values_back)) / 2 * DEG_TO_RAD;
+    #else
+        return (front_rotation_rate[2] + back_rotation_rate[2]) / 2 * DEG_TO_RAD;
+    #endif
+}
+
+/* call after imu_read() and imu_bias_update(). car_speed in m/s. */
+IRAM_ATTR void vehicle_dynamics_update(double_t car_speed)
+{
+    #if CALIBRATE_ACCELERATION
+        double_t yaw_rate = car_yaw_rate();
+
+        double_t lateral_front      = front_imu_calibrated_acceleration_array[1] * GRAVITY_FACTOR;
+        double_t lateral_back       = back_imu_calibrated_acceleration_array[1]  * GRAVITY_FACTOR;
+        double_t yaw_acceleration   = (lateral_front - lateral_back) / IMU_LEVER_ARM;
+
+        double_t slide_ratio = 0.0;
+        if ((abs(yaw_rate) > SLIDE_MIN_YAW_RATE) && (car_speed > SLIDE_MIN_SPEED)) { slide_ratio = abs(yaw_rate) * car_speed / max(abs(lateral_back), SLIDE_MIN_LATERAL); }
+
+        vehicle_dynamics.yaw_rate           = yaw_rate;
+        vehicle_dynamics.yaw_acceleration  += (yaw_acceleration - vehicle_dynamics.yaw_acceleration) / YAW_ACCELERATION_FILTER;
+        vehicle_dynamics.slide_ratio        = slide_ratio;
+        vehicle_dynamics.slip_indicator     = max(slide_ratio / SLIDE_RATIO_LIMIT, abs(vehicle_dynamics.yaw_acceleration) / YAW_ACCELERATION_LIMIT);
+    #endif
+}
+
+IRAM_ATTR void vehicle_dynamics_reset()
+{
+    vehicle_dynamics.yaw_rate           = 0.0;
+    vehicle_dynamics.yaw_acceleration   = 0.0;
+    vehicle_dynamics.slide_ratio        = 0.0;
+    vehicle_dynamics.slip_indicator     = 0.0;
+}
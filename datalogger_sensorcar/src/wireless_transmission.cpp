@@ -1,8 +1,29 @@
 #include "wireless_transmission.h"
+#include "handoff_accounting.h"
+#include "event_trace.h"
+#include "power_management.h"
+#if LINK_MONITOR
+  #include "link_quality.h"
+#endif
+#if MEASURE_LATENCY
+  #include "latency_tracing.h"
+#endif
 uint8_t race_status           = NO_RACE_GOING; /* For states, look at declaration of initialization value */
 
+/* setpoint waiting for its ack, shared by the sending task, wireless receive and the retransmit task */
+DRAM_ATTR portMUX_TYPE      setpoint_mutex            = portMUX_INITIALIZER_UNLOCKED;
+DRAM_ATTR setpoint_packet_t pending_setpoint;
+DRAM_ATTR bool              setpoint_awaiting_ack     = false;
+DRAM_ATTR bool              setpoint_failed           = false;
+DRAM_ATTR unsigned long     setpoint_first_send_ms    = 0;
+DRAM_ATTR uint16_t          setpoint_session          = 0;
+DRAM_ATTR uint8_t           setpoint_sequence         = 0;
+DRAM_ATTR uint32_t          setpoint_retransmissions  = 0;
+DRAM_ATTR TaskHandle_t      setpoint_retransmit_task_handle = NULL;
+
 void init_wifi() {
   WiFi.mode(WIFI_STA);
+  setpoint_session = uint16_t(esp_random()); /* with the radio on, esp_random() is a true random number */
   esp_wifi_set_mac(WIFI_IF_STA, &newMACAddress[0]);
   Serial.print("ESP32 Board MAC Address: "); Serial.println(WiFi.macAddress());
 
@@ -30,22 +51,149 @@ void init_wifi() {
 
 IRAM_ATTR void send_data_wirelessly(uint8_t data_to_transmit)
 {
-  for (uint8_t ii = WIRELESS_TRANSMISSION_TRIES; ii > 0; ii--)
+  setpoint_packet_t setpoint_packet;
+  setpoint_packet.session       = setpoint_session;
+  setpoint_packet.speed_digital = data_to_transmit;
+  #if MEASURE_LATENCY
+    setpoint_packet.trace_id    = latency_trace_send();
+  #endif
+
+  portENTER_CRITICAL(&setpoint_mutex);
+  if (setpoint_awaiting_ack) { handoff_counters[HANDOFF_SETPOINT].coalesced++; } /* latest value wins, the old one is not retransmitted anymore */
+  setpoint_sequence        += 1;
+  setpoint_packet.sequence  = setpoint_sequence;
+  pending_setpoint          = setpoint_packet;
+  setpoint_awaiting_ack     = true;
+  setpoint_failed           = false;
+  setpoint_first_send_ms    = millis();
+  portEXIT_CRITICAL(&setpoint_mutex);
+
+  esp_now_send(broadcastAddress, (uint8_t *) &setpoint_packet, sizeof(setpoint_packet));
+  event_trace(EVENT_ESPNOW_SEND, ESPNOW_SETPOINT, (setpoint_packet.sequence << 8) | data_to_transmit);
+  #if LINK_MONITOR
+    link_setpoint_sent(setpoint_packet.sequence);
+  #endif
+  #if MEASURE_RTT
+    tic();
+  #endif
+  #if DEBUG
+    Serial.printf("Transmitting data: %d, sequence %d\n", data_to_transmit, setpoint_packet.sequence);
+  #endif
+  if (setpoint_retransmit_task_handle != NULL) { xTaskNotifyGive(setpoint_retransmit_task_handle); } /* starts the ack timeout */
+}
+
+/* true if the newest setpoint never got acknowledged within its latency budget. It has to be sent again. */
+IRAM_ATTR bool setpoint_delivery_failed()
+{
+  return setpoint_failed;
+}
+
+inline void on_setpoint_ack(uint8_t sequence)
+{
+  portENTER_CRITICAL(&setpoint_mutex);
+  bool newest = setpoint_awaiting_ack && (sequence == pending_setpoint.sequence); /* acks of replaced setpoints are late, they don't count */
+  if (newest)
   {
-    esp_now_send(broadcastAddress, (uint8_t *) &data_to_transmit, 1);
-    #if MEASURE_RTT
-      tic();
-    #endif    
-    #if DEBUG
-    Serial.printf("Transmitting data: %d\n", data_to_transmit);
-    #endif
+    setpoint_awaiting_ack = false;
+    handoff_counters[HANDOFF_SETPOINT].delivered++;
   }
+  portEXIT_CRITICAL(&setpoint_mutex);
+  #if LINK_MONITOR
+    link_setpoint_answered(sequence);
+  #endif
+  #if MEASURE_RTT
+    if (newest) { toc(); } /* part of two functions to calculate wireless round trip time (RTT) */
+  #endif
+}
+
+/*
+Started by every new setpoint. Sends the pending setpoint again every SETPOINT_ACK_TIMEOUT_MS until it is acknowledged or its latency budget is used up.
+A newer setpoint restarts the timeout.
+*/
+IRAM_ATTR void setpoint_retransmit_task(void*)
+{
+  for(;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY); /* wait for a setpoint */
+    for(;;)
+    {
+      if (ulTaskNotifyTake(pdTRUE, SETPOINT_ACK_TIMEOUT_MS / portTICK_PERIOD_MS) > 0) { continue; } /* a newer setpoint was sent meanwhile */
+
+      setpoint_packet_t setpoint_packet;
+      bool retransmit = false;
+      portENTER_CRITICAL(&setpoint_mutex);
+      if (setpoint_awaiting_ack)
+      {
+        if ((millis() - setpoint_first_send_ms) < SETPOINT_LATENCY_BUDGET_MS)
+        {
+          setpoint_packet = pending_setpoint;
+          retransmit      = true;
+        }
+        else
+        {
+          setpoint_awaiting_ack = false;
+          setpoint_failed       = true;
+          handoff_counters[HANDOFF_SETPOINT].rejected++;
+        }
+      }
+      portEXIT_CRITICAL(&setpoint_mutex);
+
+      #if LINK_MONITOR
+        if (!retransmit && setpoint_failed) { link_setpoint_failed(); }
+      #endif
+      if (!retransmit) { break; } /* acknowledged or given up, wait for the next setpoint */
+      esp_now_send(broadcastAddress, (uint8_t *) &setpoint_packet, sizeof(setpoint_packet));
+      event_trace(EVENT_ESPNOW_SEND, ESPNOW_SETPOINT_RETRANSMIT, (setpoint_packet.sequence << 8) | setpoint_packet.speed_digital);
+      setpoint_retransmissions++;
+      #if LINK_MONITOR
+        link_setpoint_sent(setpoint_packet.sequence);
+      #endif
+    }
+  }
+}
+
+/* not acknowledged, the controller emulator also clears the derailment when the car passes the finish line */
+IRAM_ATTR void send_derailment_report(bool derailed, uint8_t track_position_index, uint8_t derailment_count)
+{
+  derailment_report_packet_t derailment_report_packet = { derailed, track_position_index, derailment_count };
+  esp_now_send(broadcastAddress, (uint8_t *) &derailment_report_packet, sizeof(derailment_report_packet));
+  event_trace(EVENT_ESPNOW_SEND, ESPNOW_DERAILMENT, (derailed << 8) | track_position_index);
 }
 
 /* this function handles some sensorcar_state switches. */
 IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data, int len)
 {
+  #if LINK_MONITOR
+    /* link packets have a length of their own and a magic byte */
+    if (link_packet_valid(incoming_data, len))
+    {
+      link_packet_received(incoming_data);
+      return;
+    }
+    link_peer_heard();
+  #endif
+  #if MEASURE_LATENCY
+    /* reports are told apart from race status messages by their length */
+    if (len == sizeof(trace_report_packet_t))
+    {
+      trace_report_packet_t trace_report_packet;
+      memcpy(&trace_report_packet, incoming_data, sizeof(trace_report_packet)); /* incoming data is not necessarily aligned */
+      latency_trace_report(trace_report_packet.trace_id, trace_report_packet.receive_timestamp, trace_report_packet.dac_write_timestamp, trace_report_packet.report_send_timestamp);
+      event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_TRACE_REPORT, trace_report_packet.trace_id);
+      return;
+    }
+  #endif
+  if (len == sizeof(setpoint_ack_packet_t))
+  {
+    on_setpoint_ack(incoming_data[1]);
+    event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_SETPOINT_ACK, incoming_data[1]);
+    return;
+  }
   race_status = *incoming_data;
+  event_trace(EVENT_ESPNOW_RECEIVE, ESPNOW_RACE_STATUS, race_status);
+  #if IDLE_POWER_SAVING && (OPERATION_MODE == RACING_MODE)
+    idle_power_wake_up(); /* every race status message is sent by a running countdown or race */
+  #endif
   #if DEBUG
     Serial.printf("New race status received: %d\n", race_status);
   #endif
@@ -74,11 +222,6 @@ IRAM_ATTR void on_data_receive(const uint8_t * mac, const uint8_t *incoming_data
     case CAR_NO_0_PASSED_FINISH_LINE:
       xSemaphoreGive(finish_line_passed_semaphore);
       break;
-    case RECEIVED_VALUE_WIRELESSLY:
-      #if MEASURE_RTT    
-        toc(); /* part of two functions to calculate wireless round trip time (RTT) */
-      #endif
-      break;
   }
 
 }
\ No newline at end of file
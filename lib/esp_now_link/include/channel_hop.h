@@ -0,0 +1,100 @@
+#pragma once
+#include "link_monitor.h"
+
+/* Part of the library shared by both projects, like link_monitor.h. The controller emulator only uses the coordinator, the sensorcar only the follower, the linker drops the other one. */
+
+/*
+Coordinated channel hop, controller emulator side (coordinator).
+Between races, the controller emulator measures every channel from LINK_CHANNEL_MIN to LINK_CHANNEL_MAX together with the sensorcar and moves both to the best one:
+1. LINK_HOP to the channel, sent on the current channel. The sensorcar acks on the current channel, then moves. The controller emulator moves as soon as it has the ack, or after LINK_HOP_TRIES unanswered hops, as the ack may be what got lost.
+2. LINK_SURVEY_PROBES probes, LINK_PROBE_INTERVAL_US apart. Loss, round trip times and RSSI of the echoes and the frames of other stations go into the stats of the channel.
+   Without any echo, the sensorcar is not there. The controller emulator returns to the home channel and waits until the sensorcar did the same after LINK_SURVEY_TIMEOUT_US.
+3. After the last channel, LINK_COMMIT to the channel with the lowest score if it beats the home channel by more than LINK_HOP_HYSTERESIS_PERCENT, else to the home channel.
+   LINK_VERIFY_PROBES probes check that the sensorcar arrived.
+Whenever the sensorcar may be on a channel the controller emulator does not know (commit unanswered, verification failed, boot of the controller emulator), it announces: LINK_COMMIT for the home channel on every channel in turn, starting with LINK_HOP_TRIES of them on the home channel.
+If nobody answers the announce, it is repeated every LINK_REANNOUNCE_INTERVAL_US until any packet of the sensorcar arrives.
+A LINK_HELLO of a sensorcar looking for the controller emulator is answered with LINK_COMMIT for the home channel at any time.
+channel_survey_abort() ends a survey with a commit to the home channel, when a countdown starts.
+The state machine runs in a single task: channel_survey_packet() for every link packet of the sensorcar, channel_survey_tick() once the time it returned has passed.
+*/
+
+#define LINK_ACK_TIMEOUT_US         10000   /* wait for LINK_HOP_ACK before sending the hop again */
+#define LINK_HOP_TRIES              5
+#define LINK_PROBE_INTERVAL_US      10000
+#define LINK_SURVEY_PROBES          30      /* per channel, about 0.4 s per channel with the hop */
+#define LINK_VERIFY_PROBES          5       /* after a commit */
+#define LINK_ANNOUNCE_DWELL_US      20000   /* per channel, long enough for the ack on a busy channel */
+#define LINK_REANNOUNCE_INTERVAL_US 2000000 /* while the sensorcar is lost */
+#define LINK_HOP_HYSTERESIS_PERCENT 20      /* a channel has to score this much better than the home channel to move there */
+
+/* states */
+#define SURVEY_IDLE                 0       /* on the home channel, together with the sensorcar unless follower_lost */
+#define SURVEY_HOPPING              1       /* waiting for LINK_HOP_ACK */
+#define SURVEY_PROBING              2       /* measuring a channel, or verifying a commit */
+#define SURVEY_RETURNING            3       /* back on the home channel, waiting for the sensorcar to time out on the channel it was left on */
+#define SURVEY_ANNOUNCING           4       /* LINK_COMMIT on every channel */
+
+typedef struct
+{
+    const link_radio_t* radio;
+    uint8_t      state;
+    uint8_t      channel;               /* of the controller emulator */
+    uint8_t      home_channel;
+    uint8_t      target_channel;        /* of the hop in progress */
+    bool         target_commit;         /* LINK_COMMIT instead of LINK_HOP */
+    bool         surveying;             /* measuring channels, else a single move */
+    bool         follower_lost;         /* the last announce was not answered */
+    uint8_t      candidate;             /* channel the survey measures */
+    uint8_t      announce_channel;      /* 0 while announcing on the home channel */
+    uint8_t      sequence;
+    uint8_t      tries;
+    uint8_t      probes_planned;
+    uint8_t      probes_sent;
+    uint8_t      probes_answered;
+    uint32_t     next_us;               /* time of the next step */
+    uint32_t     surveys;
+    uint32_t     commits;               /* moves to another home channel */
+    uint32_t     announces;
+    link_stats_t channel_stats[LINK_CHANNEL_MAX + 1];  /* of the last survey, indexed by channel */
+} channel_survey_t;
+
+          void      channel_survey_init(channel_survey_t* survey, const link_radio_t* radio, uint32_t now_us);
+          void      channel_survey_start(channel_survey_t* survey, uint32_t now_us);
+          void      channel_survey_abort(channel_survey_t* survey, uint32_t now_us);
+          void      channel_survey_packet(channel_survey_t* survey, const link_packet_t* packet, int8_t rssi, uint32_t receive_us);
+          void      channel_survey_heard(channel_survey_t* survey);
+          void      channel_survey_foreign(channel_survey_t* survey, uint32_t count);
+          uint32_t  channel_survey_tick(channel_survey_t* survey, uint32_t now_us);
+inline    bool      channel_survey_idle(const channel_survey_t* survey) { return survey->state == SURVEY_IDLE; }
+
+/*
+Coordinated channel hop, sensorcar side (follower).
+- LINK_PROBE is answered with LINK_PROBE_ECHO right away.
+- LINK_HOP and LINK_COMMIT are answered with LINK_HOP_ACK on the current channel, the move follows LINK_HOP_SETTLE_US later. A commit also makes the channel the home channel.
+- On a channel it was only sent to for measuring, the sensorcar returns to the home channel if it hears nothing from the controller emulator for LINK_SURVEY_TIMEOUT_US.
+- After boot, and when the link broke down, it looks for the controller emulator: LINK_HELLO on every channel in turn, LINK_HELLO_DWELL_US each, until a LINK_COMMIT tells it the home channel.
+The state machine runs in a single task: channel_follower_packet() for every link packet, channel_follower_heard() for every other packet of the controller emulator, channel_follower_tick() once the time it returned has passed.
+*/
+
+typedef struct
+{
+    const link_radio_t* radio;
+    uint8_t  channel;
+    uint8_t  home_channel;
+    uint8_t  pending_channel;       /* move after the ack, 0 if none */
+    bool     pending_commit;
+    bool     joined;                /* the controller emulator told the home channel since boot or since the link broke down */
+    uint32_t move_us;               /* time of the pending move */
+    uint32_t heard_us;              /* last packet of the controller emulator */
+    uint32_t hello_us;              /* time of the next hello */
+    uint32_t hellos;                /* sent since the search started */
+    uint32_t hops;
+    uint32_t fallbacks;             /* returns to the home channel after LINK_SURVEY_TIMEOUT_US */
+    uint32_t rejoins;
+} channel_follower_t;
+
+          void      channel_follower_init(channel_follower_t* follower, const link_radio_t* radio, uint32_t now_us);
+          void      channel_follower_packet(channel_follower_t* follower, const link_packet_t* packet, uint32_t now_us);
+          void      channel_follower_heard(channel_follower_t* follower, uint32_t now_us);
+          void      channel_follower_lost(channel_follower_t* follower, uint32_t now_us);
+          uint32_t  channel_follower_tick(channel_follower_t* follower, uint32_t now_us);
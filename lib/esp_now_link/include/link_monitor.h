@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#if __has_include(<esp_attr.h>)
+    #include <esp_attr.h>
+#else
+    #define IRAM_ATTR               /* host builds, see tools/link-simulation */
+    #define DRAM_ATTR
+#endif
+
+/*
+Link quality of the ESP-NOW connection between the sensorcar and the controller emulator, and the packets that move both to another Wi-Fi channel.
+Both projects build this library from lib/esp_now_link (lib_extra_dirs in their platformio.ini). It doesn't depend on the framework, so tools/link-simulation compiles it on the host against a simulated radio.
+
+link_stats_t counts what one side sees of the link:
+- packets it sent that expect an answer (setpoints, probes) and the answers it got, with the round trip time of each answer in a histogram
+- packets of the peer it received, with their RSSI in a histogram, and packets of the peer it missed, as far as sequence numbers show them
+- frames of other stations on the channel, a measure of how much of its airtime is already in use
+Every function is a few additions. The caller serializes access, link_stats_t has no lock of its own.
+
+Channel hops are coordinated by the controller emulator, the sensorcar follows, see channel_hop.h.
+Link packets are told apart from all other packets by their length and LINK_PACKET_MAGIC.
+*/
+
+#define LINK_CHANNEL_MIN            1
+#define LINK_CHANNEL_MAX            13      /* channels 12 and 13 are not allowed in every country, lower it if necessary */
+#define LINK_DEFAULT_CHANNEL        1       /* both boards start here after boot */
+
+/* timing of the channel hop that both sides have to agree on */
+#define LINK_HOP_SETTLE_US          5000    /* the follower changes the channel this long after its LINK_HOP_ACK, so the ack is on air before the radio retunes */
+#define LINK_SURVEY_TIMEOUT_US      200000  /* a follower that hears nothing on a survey channel for this long returns to its home channel */
+#define LINK_HELLO_DWELL_US         20000   /* a follower looking for the coordinator stays this long on every channel */
+#define LINK_NO_DEADLINE            UINT32_MAX  /* returned by the tick functions when nothing is scheduled */
+
+#define LINK_RSSI_BINS              8
+#define LINK_RSSI_FLOOR             -100    /* in dBm, lower edge of the first bin. Everything below counts into it. */
+#define LINK_RSSI_BIN_WIDTH         10      /* in dB, the last bin takes everything above */
+#define LINK_RTT_BINS               10
+#define LINK_RTT_FIRST_BIN_US       256     /* upper edge of the first bin, every further bin doubles it. The last bin takes everything above 64 ms. */
+
+/* channel score, lower is better. One permille of packet loss weighs as much as 20 us of 90th percentile round trip time. */
+#define LINK_SCORE_LOSS_WEIGHT      20      /* per permille of lost packets */
+#define LINK_SCORE_RTT_DIVIDER      1       /* per us of the 90th percentile round trip time */
+#define LINK_SCORE_FOREIGN_WEIGHT   4       /* per foreign frame heard while the channel was measured */
+#define LINK_SCORE_WEAK_RSSI        -75     /* in dBm, mean RSSI below this adds LINK_SCORE_RSSI_WEIGHT per dB */
+#define LINK_SCORE_RSSI_WEIGHT      50
+#define LINK_SCORE_UNUSABLE         UINT32_MAX  /* no answer at all */
+
+/* link packet types */
+#define LINK_PROBE                  0       /* coordinator -> follower, answered with LINK_PROBE_ECHO. timestamp is echoed back for the round trip time. */
+#define LINK_PROBE_ECHO             1       /* follower -> coordinator */
+#define LINK_HOP                    2       /* coordinator -> follower: measure channel. The follower returns to its home channel if it hears nothing there for LINK_SURVEY_TIMEOUT_US. */
+#define LINK_COMMIT                 3       /* coordinator -> follower: move to channel and make it the home channel */
+#define LINK_HOP_ACK                4       /* follower -> coordinator: answer to LINK_HOP and LINK_COMMIT, sent on the old channel right before moving */
+#define LINK_HELLO                  5       /* follower -> coordinator, sent on every channel in turn until the coordinator answers with LINK_COMMIT */
+
+#define LINK_PACKET_MAGIC           0xA5
+
+typedef struct __attribute__((packed))
+{
+    uint8_t  magic;                 /* LINK_PACKET_MAGIC */
+    uint8_t  type;                  /* LINK_ packet type above */
+    uint8_t  channel;               /* target channel of LINK_HOP, LINK_COMMIT and LINK_HOP_ACK, channel of the sender otherwise */
+    uint8_t  sequence;              /* LINK_HOP_ACK and LINK_PROBE_ECHO repeat the one they answer */
+    uint32_t timestamp;             /* in us of the coordinator clock, only used by probes and echoes */
+} link_packet_t;
+
+/* how a coordinator or follower uses the radio. The firmware maps it to ESP-NOW, tools/link-simulation to its simulated radio. */
+typedef struct
+{
+    void*   context;
+    void    (*send)(void* context, const link_packet_t* packet);
+    void    (*set_channel)(void* context, uint8_t channel);
+} link_radio_t;
+
+typedef struct
+{
+    uint32_t sent;                          /* packets that expect an answer */
+    uint32_t answered;
+    uint32_t received;                      /* packets of the peer */
+    uint32_t missed;                        /* packets of the peer that never arrived */
+    uint32_t foreign_frames;                /* frames of other stations */
+    uint32_t rssi_histogram[LINK_RSSI_BINS];
+    int32_t  rssi_sum;                      /* in dBm, of the received packets with an RSSI */
+    uint32_t rssi_count;
+    uint32_t rtt_histogram[LINK_RTT_BINS];
+    uint32_t rtt_max_us;
+} link_stats_t;
+
+/* for timestamps of micros(), which wrap after 71 minutes */
+inline bool link_time_reached(uint32_t now_us, uint32_t deadline_us)
+{
+    return int32_t(now_us - deadline_us) >= 0;
+}
+
+IRAM_ATTR void      link_stats_reset(link_stats_t* stats);
+IRAM_ATTR void      link_stats_sent(link_stats_t* stats);
+IRAM_ATTR void      link_stats_answered(link_stats_t* stats, uint32_t rtt_us);
+IRAM_ATTR void      link_stats_received(link_stats_t* stats, int8_t rssi);
+IRAM_ATTR void      link_stats_missed(link_stats_t* stats, uint32_t count);
+IRAM_ATTR void      link_stats_foreign(link_stats_t* stats, uint32_t count);
+          void      link_stats_add(link_stats_t* sum, const link_stats_t* stats);
+          uint16_t  link_stats_loss_permille(const link_stats_t* stats);
+          uint16_t  link_stats_miss_permille(const link_stats_t* stats);
+          uint32_t  link_stats_rtt_percentile_us(const link_stats_t* stats, uint8_t percent);
+          int8_t    link_stats_rssi_mean(const link_stats_t* stats);
+          uint32_t  link_channel_score(const link_stats_t* stats);
+          int       link_stats_format(char* buffer, size_t size, const link_stats_t* stats);
+          bool      link_packet_valid(const uint8_t* data, int length);
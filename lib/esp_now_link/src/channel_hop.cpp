@@ -0,0 +1,371 @@
+#include "channel_hop.h"
+
+/* coordinator, used by the controller emulator */
+
+inline void send_link_packet(channel_survey_t* survey, uint8_t type, uint8_t channel, uint32_t timestamp)
+{
+    link_packet_t packet = { LINK_PACKET_MAGIC, type, channel, survey->sequence, timestamp };
+    survey->radio->send(survey->radio->context, &packet);
+}
+
+inline void move_to(channel_survey_t* survey, uint8_t channel)
+{
+    survey->channel = channel;
+    survey->radio->set_channel(survey->radio->context, channel);
+}
+
+/* sends LINK_HOP or LINK_COMMIT on the current channel */
+inline void hop(channel_survey_t* survey, uint8_t channel, bool commit, uint32_t now_us)
+{
+    survey->sequence      += 1;
+    survey->target_channel = channel;
+    survey->target_commit  = commit;
+    survey->tries          = 1;
+    survey->state          = SURVEY_HOPPING;
+    survey->next_us        = now_us + LINK_ACK_TIMEOUT_US;
+    send_link_packet(survey, commit ? LINK_COMMIT : LINK_HOP, channel, 0);
+}
+
+inline void start_probing(channel_survey_t* survey, uint8_t probes, uint32_t now_us)
+{
+    survey->probes_planned  = probes;
+    survey->probes_sent     = 0;
+    survey->probes_answered = 0;
+    survey->state           = SURVEY_PROBING;
+    survey->next_us         = now_us + 2 * LINK_HOP_SETTLE_US; /* the sensorcar moves LINK_HOP_SETTLE_US after its ack */
+}
+
+/* moves to the channel of the hop, then measures it or verifies the commit */
+inline void arrive(channel_survey_t* survey, uint32_t now_us)
+{
+    move_to(survey, survey->target_channel);
+    if (survey->target_commit)
+    {
+        if (survey->home_channel != survey->target_channel) { survey->commits += 1; }
+        survey->home_channel = survey->target_channel;
+    }
+    start_probing(survey, survey->surveying ? LINK_SURVEY_PROBES : LINK_VERIFY_PROBES, now_us);
+}
+
+inline void announce(channel_survey_t* survey, uint32_t now_us)
+{
+    survey->surveying        = false;
+    survey->announces       += 1;
+    survey->announce_channel = 0;   /* the home channel first, the sensorcar is most likely there */
+    survey->tries            = 1;
+    survey->sequence        += 1;
+    survey->state            = SURVEY_ANNOUNCING;
+    if (survey->channel != survey->home_channel) { move_to(survey, survey->home_channel); }
+    send_link_packet(survey, LINK_COMMIT, survey->home_channel, 0);
+    survey->next_us          = now_us + LINK_ANNOUNCE_DWELL_US;
+}
+
+/* lowest score, the home channel wins unless another one is more than LINK_HOP_HYSTERESIS_PERCENT better */
+inline uint8_t best_channel(const channel_survey_t* survey)
+{
+    uint64_t home_score = link_channel_score(&survey->channel_stats[survey->home_channel]);
+    uint64_t threshold  = (home_score == LINK_SCORE_UNUSABLE) ? home_score : (home_score * (100 - LINK_HOP_HYSTERESIS_PERCENT)) / 100;
+    uint8_t  best       = survey->home_channel;
+    uint64_t best_score = home_score;
+    for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++)
+    {
+        uint64_t score = link_channel_score(&survey->channel_stats[channel]);
+        if ((score < threshold) && (score < best_score))
+        {
+            best       = channel;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+inline void next_candidate(channel_survey_t* survey, uint32_t now_us)
+{
+    survey->candidate += 1;
+    if (survey->candidate <= LINK_CHANNEL_MAX)
+    {
+        hop(survey, survey->candidate, false, now_us);
+        return;
+    }
+    survey->surveying = false;
+    survey->surveys  += 1;
+    hop(survey, best_channel(survey), true, now_us);
+}
+
+inline void finish_probing(channel_survey_t* survey, uint32_t now_us)
+{
+    if (survey->probes_answered > 0)
+    {
+        if (survey->surveying) { next_candidate(survey, now_us); }
+        else
+        {
+            survey->follower_lost = false;
+            survey->state         = SURVEY_IDLE;
+        }
+        return;
+    }
+    if (!survey->surveying)
+    {
+        announce(survey, now_us); /* lost the sensorcar */
+        return;
+    }
+    /* the sensorcar never arrived or can't be heard here. Either way it returns to the home channel. */
+    if (survey->channel != survey->home_channel) { move_to(survey, survey->home_channel); }
+    survey->state   = SURVEY_RETURNING;
+    survey->next_us = now_us + LINK_SURVEY_TIMEOUT_US + LINK_ACK_TIMEOUT_US;
+}
+
+/* starts on LINK_DEFAULT_CHANNEL and announces it, the sensorcar may still be on the home channel of the previous boot */
+void channel_survey_init(channel_survey_t* survey, const link_radio_t* radio, uint32_t now_us)
+{
+    *survey              = channel_survey_t();
+    survey->radio        = radio;
+    survey->home_channel = LINK_DEFAULT_CHANNEL;
+    announce(survey, now_us);
+}
+
+/* measures all channels and moves to the best one. Does nothing while a survey or a move is in progress, or while the sensorcar is lost. */
+void channel_survey_start(channel_survey_t* survey, uint32_t now_us)
+{
+    if ((survey->state != SURVEY_IDLE) || survey->follower_lost) { return; }
+    for (uint8_t channel = 0; channel <= LINK_CHANNEL_MAX; channel++) { link_stats_reset(&survey->channel_stats[channel]); }
+    survey->surveying = true;
+    survey->candidate = LINK_CHANNEL_MIN;
+    hop(survey, survey->candidate, false, now_us);
+}
+
+/* back to the home channel right away */
+void channel_survey_abort(channel_survey_t* survey, uint32_t now_us)
+{
+    if ((survey->state == SURVEY_IDLE) || (survey->state == SURVEY_ANNOUNCING)) { return; } /* an announce already moves to the home channel */
+    if (!survey->surveying && survey->target_commit && (survey->state == SURVEY_HOPPING)) { return; } /* already committing */
+    survey->surveying = false;
+    if (survey->state == SURVEY_RETURNING)
+    {
+        announce(survey, now_us); /* the sensorcar is on the way back, the announce finds it in any case */
+        return;
+    }
+    hop(survey, survey->home_channel, true, now_us);
+}
+
+void channel_survey_packet(channel_survey_t* survey, const link_packet_t* packet, int8_t rssi, uint32_t receive_us)
+{
+    switch (packet->type)
+    {
+        case LINK_HOP_ACK:
+            if ((survey->state == SURVEY_HOPPING) && (packet->sequence == survey->sequence))
+            {
+                arrive(survey, receive_us);
+            }
+            else if ((survey->state == SURVEY_ANNOUNCING) && (packet->sequence == survey->sequence))
+            {
+                move_to(survey, survey->home_channel);
+                start_probing(survey, LINK_VERIFY_PROBES, receive_us);
+            }
+            break;
+        case LINK_PROBE_ECHO:
+            if ((survey->state != SURVEY_PROBING) || (packet->channel != survey->channel)) { break; } /* late echo from the previous channel */
+            survey->probes_answered += 1;
+            if (survey->surveying)
+            {
+                link_stats_answered(&survey->channel_stats[survey->channel], receive_us - packet->timestamp);
+                link_stats_received(&survey->channel_stats[survey->channel], rssi);
+            }
+            break;
+        case LINK_HELLO:
+            /* the sensorcar booted or lost the link. Whatever was going on, it is told the home channel on the channel it is on right now. */
+            survey->surveying = false;
+            hop(survey, survey->home_channel, true, receive_us);
+            break;
+        default:
+            break;
+    }
+}
+
+/* any other packet of the sensorcar, it is on the home channel */
+void channel_survey_heard(channel_survey_t* survey)
+{
+    survey->follower_lost = false;
+}
+
+/* frames of other stations, counted while a channel is measured */
+void channel_survey_foreign(channel_survey_t* survey, uint32_t count)
+{
+    if (survey->surveying && (survey->state == SURVEY_PROBING)) { link_stats_foreign(&survey->channel_stats[survey->channel], count); }
+}
+
+/* returns the time in us until it has to be called again, LINK_NO_DEADLINE when idle */
+uint32_t channel_survey_tick(channel_survey_t* survey, uint32_t now_us)
+{
+    if ((survey->state == SURVEY_IDLE) && !survey->follower_lost) { return LINK_NO_DEADLINE; }
+    if (!link_time_reached(now_us, survey->next_us)) { return survey->next_us - now_us; }
+
+    switch (survey->state)
+    {
+        case SURVEY_IDLE:
+            announce(survey, now_us); /* still lost */
+            break;
+        case SURVEY_HOPPING:
+            if (survey->tries < LINK_HOP_TRIES)
+            {
+                survey->tries  += 1;
+                survey->next_us = now_us + LINK_ACK_TIMEOUT_US;
+                send_link_packet(survey, survey->target_commit ? LINK_COMMIT : LINK_HOP, survey->target_channel, 0);
+            }
+            else
+            {
+                /* either the hop or its ack got lost. Move anyway, the probes tell which one. */
+                arrive(survey, now_us);
+            }
+            break;
+        case SURVEY_PROBING:
+            if (survey->probes_sent < survey->probes_planned)
+            {
+                survey->sequence    += 1;
+                survey->probes_sent += 1;
+                survey->next_us      = now_us + LINK_PROBE_INTERVAL_US;
+                if (survey->surveying) { link_stats_sent(&survey->channel_stats[survey->channel]); }
+                send_link_packet(survey, LINK_PROBE, survey->channel, now_us);
+            }
+            else { finish_probing(survey, now_us); }
+            break;
+        case SURVEY_RETURNING:
+            next_candidate(survey, now_us);
+            break;
+        case SURVEY_ANNOUNCING:
+            if ((survey->announce_channel == 0) && (survey->tries < LINK_HOP_TRIES))
+            {
+                survey->tries  += 1;
+                survey->next_us = now_us + LINK_ANNOUNCE_DWELL_US;
+                send_link_packet(survey, LINK_COMMIT, survey->home_channel, 0);
+                break;
+            }
+            survey->announce_channel += 1;
+            if (survey->announce_channel == survey->home_channel) { survey->announce_channel += 1; }
+            if (survey->announce_channel <= LINK_CHANNEL_MAX)
+            {
+                move_to(survey, survey->announce_channel);
+                send_link_packet(survey, LINK_COMMIT, survey->home_channel, 0);
+                survey->next_us = now_us + LINK_ANNOUNCE_DWELL_US;
+            }
+            else
+            {
+                /* nobody answered. The sensorcar is off, or it finds the home channel with its hellos. */
+                move_to(survey, survey->home_channel);
+                survey->follower_lost = true;
+                survey->state         = SURVEY_IDLE;
+                survey->next_us       = now_us + LINK_REANNOUNCE_INTERVAL_US;
+            }
+            break;
+    }
+    if ((survey->state == SURVEY_IDLE) && !survey->follower_lost) { return LINK_NO_DEADLINE; }
+    return link_time_reached(now_us, survey->next_us) ? 0 : survey->next_us - now_us;
+}
+
+/* follower, used by the sensorcar */
+
+inline void send_link_packet(channel_follower_t* follower, uint8_t type, uint8_t channel, uint8_t sequence, uint32_t timestamp)
+{
+    link_packet_t packet = { LINK_PACKET_MAGIC, type, channel, sequence, timestamp };
+    follower->radio->send(follower->radio->context, &packet);
+}
+
+inline void move_to(channel_follower_t* follower, uint8_t channel)
+{
+    follower->channel = channel;
+    follower->radio->set_channel(follower->radio->context, channel);
+}
+
+/* starts on LINK_DEFAULT_CHANNEL and looks for the controller emulator there first */
+void channel_follower_init(channel_follower_t* follower, const link_radio_t* radio, uint32_t now_us)
+{
+    *follower              = channel_follower_t();
+    follower->radio        = radio;
+    follower->home_channel = LINK_DEFAULT_CHANNEL;
+    follower->hello_us     = now_us;
+    follower->heard_us     = now_us;
+    move_to(follower, LINK_DEFAULT_CHANNEL);
+}
+
+void channel_follower_packet(channel_follower_t* follower, const link_packet_t* packet, uint32_t now_us)
+{
+    switch (packet->type)
+    {
+        case LINK_PROBE:
+            send_link_packet(follower, LINK_PROBE_ECHO, follower->channel, packet->sequence, packet->timestamp);
+            break;
+        case LINK_HOP:
+            if (!follower->joined) { break; } /* only a commit tells where home is */
+            /* fall through */
+        case LINK_COMMIT:
+            send_link_packet(follower, LINK_HOP_ACK, packet->channel, packet->sequence, 0);
+            follower->pending_channel = packet->channel;
+            follower->pending_commit  = (packet->type == LINK_COMMIT);
+            follower->move_us         = now_us + LINK_HOP_SETTLE_US;
+            if (follower->pending_commit) { follower->joined = true; }
+            break;
+        default:
+            break;
+    }
+    follower->heard_us = now_us;
+}
+
+/* any other packet of the controller emulator, it keeps the sensorcar on a survey channel */
+void channel_follower_heard(channel_follower_t* follower, uint32_t now_us)
+{
+    follower->heard_us = now_us;
+}
+
+/* the link broke down, look for the controller emulator on every channel */
+void channel_follower_lost(channel_follower_t* follower, uint32_t now_us)
+{
+    if (!follower->joined) { return; }
+    follower->joined    = false;
+    follower->rejoins  += 1;
+    follower->hellos    = 0;
+    follower->hello_us  = now_us;
+}
+
+/* returns the time in us until it has to be called again, LINK_NO_DEADLINE if nothing is scheduled */
+uint32_t channel_follower_tick(channel_follower_t* follower, uint32_t now_us)
+{
+    if ((follower->pending_channel != 0) && link_time_reached(now_us, follower->move_us))
+    {
+        move_to(follower, follower->pending_channel);
+        if (follower->pending_commit) { follower->home_channel = follower->pending_channel; }
+        follower->pending_channel = 0;
+        follower->heard_us        = now_us; /* the survey timeout starts on arrival */
+        follower->hops           += 1;
+    }
+
+    uint32_t deadline_us;
+    if (follower->pending_channel != 0)
+    {
+        deadline_us = follower->move_us;
+    }
+    else if (!follower->joined)
+    {
+        if (link_time_reached(now_us, follower->hello_us))
+        {
+            /* the first hello goes out on the current channel, then one channel further every dwell time */
+            if (follower->hellos > 0) { move_to(follower, (follower->channel >= LINK_CHANNEL_MAX) ? LINK_CHANNEL_MIN : follower->channel + 1); }
+            follower->hellos += 1;
+            send_link_packet(follower, LINK_HELLO, follower->channel, uint8_t(follower->hellos), 0);
+            follower->hello_us = now_us + LINK_HELLO_DWELL_US;
+        }
+        deadline_us = follower->hello_us;
+    }
+    else if (follower->channel != follower->home_channel)
+    {
+        if (link_time_reached(now_us, follower->heard_us + LINK_SURVEY_TIMEOUT_US))
+        {
+            move_to(follower, follower->home_channel);
+            follower->fallbacks += 1;
+            return LINK_NO_DEADLINE;
+        }
+        deadline_us = follower->heard_us + LINK_SURVEY_TIMEOUT_US;
+    }
+    else { return LINK_NO_DEADLINE; }
+
+    return link_time_reached(now_us, deadline_us) ? 0 : deadline_us - now_us;
+}
@@ -0,0 +1,153 @@
+#include "link_monitor.h"
+#include <stdio.h>
+#include <string.h>
+
+IRAM_ATTR void link_stats_reset(link_stats_t* stats)
+{
+    memset(stats, 0, sizeof(link_stats_t));
+}
+
+IRAM_ATTR void link_stats_sent(link_stats_t* stats)
+{
+    stats->sent += 1;
+}
+
+IRAM_ATTR void link_stats_answered(link_stats_t* stats, uint32_t rtt_us)
+{
+    uint8_t  bin   = 0;
+    uint32_t upper = LINK_RTT_FIRST_BIN_US;
+    while ((bin < LINK_RTT_BINS - 1) && (rtt_us >= upper))
+    {
+        bin   += 1;
+        upper <<= 1;
+    }
+    stats->answered           += 1;
+    stats->rtt_histogram[bin] += 1;
+    if (rtt_us > stats->rtt_max_us) { stats->rtt_max_us = rtt_us; }
+}
+
+/* rssi 0 means the RSSI of the packet is unknown */
+IRAM_ATTR void link_stats_received(link_stats_t* stats, int8_t rssi)
+{
+    stats->received += 1;
+    if (rssi == 0) { return; }
+    int16_t bin = (int16_t(rssi) - LINK_RSSI_FLOOR) / LINK_RSSI_BIN_WIDTH;
+    if (bin < 0)                  { bin = 0; }
+    if (bin > LINK_RSSI_BINS - 1) { bin = LINK_RSSI_BINS - 1; }
+    stats->rssi_histogram[bin] += 1;
+    stats->rssi_sum            += rssi;
+    stats->rssi_count          += 1;
+}
+
+IRAM_ATTR void link_stats_missed(link_stats_t* stats, uint32_t count)
+{
+    stats->missed += count;
+}
+
+IRAM_ATTR void link_stats_foreign(link_stats_t* stats, uint32_t count)
+{
+    stats->foreign_frames += count;
+}
+
+void link_stats_add(link_stats_t* sum, const link_stats_t* stats)
+{
+    sum->sent           += stats->sent;
+    sum->answered       += stats->answered;
+    sum->received       += stats->received;
+    sum->missed         += stats->missed;
+    sum->foreign_frames += stats->foreign_frames;
+    sum->rssi_sum       += stats->rssi_sum;
+    sum->rssi_count     += stats->rssi_count;
+    for (uint8_t ii = 0; ii < LINK_RSSI_BINS; ii++) { sum->rssi_histogram[ii] += stats->rssi_histogram[ii]; }
+    for (uint8_t ii = 0; ii < LINK_RTT_BINS; ii++)  { sum->rtt_histogram[ii]  += stats->rtt_histogram[ii]; }
+    if (stats->rtt_max_us > sum->rtt_max_us) { sum->rtt_max_us = stats->rtt_max_us; }
+}
+
+/* packets of this side that got no answer. Answers still on their way count as lost, so only read it once the link is quiet. */
+uint16_t link_stats_loss_permille(const link_stats_t* stats)
+{
+    if (stats->sent == 0) { return 0; }
+    uint32_t answered = (stats->answered < stats->sent) ? stats->answered : stats->sent; /* a retransmitted packet may be answered twice */
+    return uint16_t((uint64_t(stats->sent - answered) * 1000) / stats->sent);
+}
+
+/* packets of the peer that never arrived */
+uint16_t link_stats_miss_permille(const link_stats_t* stats)
+{
+    uint32_t total = stats->received + stats->missed;
+    if (total == 0) { return 0; }
+    return uint16_t((uint64_t(stats->missed) * 1000) / total);
+}
+
+/* upper edge of the histogram bin the percentile falls into, so it is at most twice the real value. The maximum for the last bin. */
+uint32_t link_stats_rtt_percentile_us(const link_stats_t* stats, uint8_t percent)
+{
+    uint32_t total = 0;
+    for (uint8_t ii = 0; ii < LINK_RTT_BINS; ii++) { total += stats->rtt_histogram[ii]; }
+    if (total == 0) { return 0; }
+
+    uint32_t rank       = (uint64_t(total) * percent + 99) / 100;
+    uint32_t cumulative = 0;
+    uint32_t upper      = LINK_RTT_FIRST_BIN_US;
+    for (uint8_t ii = 0; ii < LINK_RTT_BINS - 1; ii++)
+    {
+        cumulative += stats->rtt_histogram[ii];
+        if (cumulative >= rank) { return (upper < stats->rtt_max_us) ? upper : stats->rtt_max_us; }
+        upper <<= 1;
+    }
+    return stats->rtt_max_us;
+}
+
+int8_t link_stats_rssi_mean(const link_stats_t* stats)
+{
+    if (stats->rssi_count == 0) { return 0; }
+    return int8_t(stats->rssi_sum / int32_t(stats->rssi_count));
+}
+
+/* lower is better. Only scores of channels measured with the same number of probes can be compared. */
+uint32_t link_channel_score(const link_stats_t* stats)
+{
+    if (stats->answered == 0) { return LINK_SCORE_UNUSABLE; }
+
+    uint32_t score = uint32_t(link_stats_loss_permille(stats)) * LINK_SCORE_LOSS_WEIGHT
+                   + link_stats_rtt_percentile_us(stats, 90) / LINK_SCORE_RTT_DIVIDER
+                   + stats->foreign_frames * LINK_SCORE_FOREIGN_WEIGHT;
+    int8_t rssi_mean = link_stats_rssi_mean(stats);
+    if ((rssi_mean != 0) && (rssi_mean < LINK_SCORE_WEAK_RSSI)) { score += uint32_t(LINK_SCORE_WEAK_RSSI - rssi_mean) * LINK_SCORE_RSSI_WEIGHT; }
+    return score;
+}
+
+/* one line: loss, round trip times, misses, mean RSSI and both histograms. Returns the length like snprintf. */
+int link_stats_format(char* buffer, size_t size, const link_stats_t* stats)
+{
+    uint16_t loss   = link_stats_loss_permille(stats);
+    uint16_t miss   = link_stats_miss_permille(stats);
+    int      length = snprintf(buffer, size, "loss %u.%u%% of %u, rtt p50/p90/max %u/%u/%u us, received %u, missed %u.%u%%, rssi %d dBm, foreign %u, rssi bins [",
+        (unsigned int)(loss / 10), (unsigned int)(loss % 10), (unsigned int)stats->sent,
+        (unsigned int)link_stats_rtt_percentile_us(stats, 50), (unsigned int)link_stats_rtt_percentile_us(stats, 90), (unsigned int)stats->rtt_max_us,
+        (unsigned int)stats->received, (unsigned int)(miss / 10), (unsigned int)(miss % 10),
+        (int)link_stats_rssi_mean(stats), (unsigned int)stats->foreign_frames);
+    for (uint8_t ii = 0; ii < LINK_RSSI_BINS; ii++)
+    {
+        if ((length < 0) || (size_t(length) >= size)) { return length; }
+        length += snprintf(buffer + length, size - length, (ii == 0) ? "%u" : " %u", (unsigned int)stats->rssi_histogram[ii]);
+    }
+    if ((length < 0) || (size_t(length) >= size)) { return length; }
+    length += snprintf(buffer + length, size - length, "], rtt bins [");
+    for (uint8_t ii = 0; ii < LINK_RTT_BINS; ii++)
+    {
+        if ((length < 0) || (size_t(length) >= size)) { return length; }
+        length += snprintf(buffer + length, size - length, (ii == 0) ? "%u" : " %u", (unsigned int)stats->rtt_histogram[ii]);
+    }
+    if ((length < 0) || (size_t(length) >= size)) { return length; }
+    length += snprintf(buffer + length, size - length, "]");
+    return length;
+}
+
+bool link_packet_valid(const uint8_t* data, int length)
+{
+    if (length != int(sizeof(link_packet_t)))   { return false; }
+    if (data[0] != LINK_PACKET_MAGIC)           { return false; }
+    if (data[1] > LINK_HELLO)                   { return false; }
+    return (data[2] >= LINK_CHANNEL_MIN) && (data[2] <= LINK_CHANNEL_MAX);
+}
@@ -0,0 +1,80 @@
+#pragma once
+/*
+Command line and scenario loop shared by the host tests under tools/ (link-simulation, setpoint-delivery, cu-protocol,
+sensor-pipeline). Header only, the Build line of every test adds -I../common.
+
+host_test_parse() reads the options of a table: a number option takes the next argument, a flag stands alone.
+Anything else prints the usage built from the table.
+host_test_run() runs every scenario once per seed from seed to seed + runs - 1 and prints one line per scenario.
+Only the first run of a scenario is verbose, and only the first three failing seeds are printed, so a run can be
+repeated with --seed S --runs 1.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+typedef struct
+{
+    const char* name;           /* "--runs" */
+    const char* argument;       /* "N" for a number option, NULL for a flag */
+    uint32_t*   value;          /* set by a number option */
+    bool*       flag;           /* set by a flag */
+} host_test_option_t;
+
+typedef struct
+{
+    const char* name;
+    bool        (*run)(uint32_t seed, bool verbose);    /* true if the run passed */
+} host_test_scenario_t;
+
+/* false after printing the usage, main() returns 2 then */
+template <size_t N>
+static bool host_test_parse(int argc, char** argv, const host_test_option_t (&options)[N])
+{
+    for (int ii = 1; ii < argc; ii++)
+    {
+        const host_test_option_t* option = NULL;
+        for (const host_test_option_t& candidate : options)
+        {
+            if (!strcmp(argv[ii], candidate.name)) { option = &candidate; }
+        }
+        if (option && !option->argument)    { *option->flag = true; continue; }
+        if (option && (ii + 1 < argc))      { *option->value = uint32_t(strtoul(argv[++ii], NULL, 10)); continue; }
+
+        fprintf(stderr, "usage: %s", argv[0]);
+        for (const host_test_option_t& candidate : options)
+        {
+            if (candidate.argument) { fprintf(stderr, " [%s %s]", candidate.name, candidate.argument); }
+            else                    { fprintf(stderr, " [%s]", candidate.name); }
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+    return true;
+}
+
+/* returns the number of failed runs over all scenarios, name_width aligns the result lines */
+template <size_t N>
+static uint32_t host_test_run(const host_test_scenario_t (&scenarios)[N], uint32_t runs, uint32_t seed, bool verbose, int name_width)
+{
+    uint32_t failures = 0;
+    for (const host_test_scenario_t& scenario : scenarios)
+    {
+        uint32_t scenario_failures = 0;
+        for (uint32_t run = 0; run < runs; run++)
+        {
+            bool print = verbose && (run == 0);
+            if (print) { printf("%s, seed %u:\n", scenario.name, seed + run); }
+            if (!scenario.run(seed + run, print))
+            {
+                scenario_failures++;
+                if (scenario_failures <= 3) { printf("    seed %u failed\n", seed + run); }
+            }
+        }
+        printf("%-*s %u of %u runs failed\n", name_width, scenario.name, scenario_failures, runs);
+        failures += scenario_failures;
+    }
+    return failures;
+}
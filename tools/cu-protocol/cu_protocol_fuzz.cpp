@@ -0,0 +1,452 @@
+/*
+Host side fuzzer and throughput benchmark for the Carrera CU protocol decoder of the controller emulator
+(controller_emulator_status_monitor/src/cu_protocol.cpp), compiled unchanged from the firmware sources.
+
+A CU session is simulated the way the controller emulator polls it: statuses, the laps of the cars as timestamps
+on a CU clock that drifts against the receive time, and the version. The frames are encoded like the CU sends them
+and fed to the parser as one stream, behind the end of a response the parser has to drop. Then the stream is
+corrupted frame by frame with one fault class at a time:
+- nibble:   one payload character replaced by another nibble character (line noise that keeps the framing)
+- delete:   one character lost
+- insert:   one random character added
+- byte:     one character replaced by any byte, including '$'
+- bitflip:  one bit of one character flipped
+- burst:    two to four consecutive characters replaced by random bytes
+Per class it counts the frames that were lost, the intact ones the plausibility checks dropped and the bogus frames:
+decoded frames that differ from the frame whose bytes they end in. A bogus timestamp is a wrong lap time, a bogus
+status a wrong race state. The run fails on a single bogus frame in any class, and if the uncorrupted stream loses
+a frame other than the status changes the parser has to see twice.
+Finally, pure random bytes are fed to check that the parser never runs out of its buffer and that every
+decoded field is in range.
+
+Build (Linux):
+    g++ -std=c++17 -O2 -fsanitize=address,undefined -I../common -I../../controller_emulator_status_monitor/include cu_protocol_fuzz.cpp ../../controller_emulator_status_monitor/src/cu_protocol.cpp -o cu_protocol_fuzz
+Usage:
+    ./cu_protocol_fuzz [--frames N] [--seed S] [--benchmark MB]
+As libFuzzer target (random input only):
+    clang++ -std=c++17 -O1 -g -fsanitize=fuzzer,address -DCU_PROTOCOL_LIBFUZZER -I../common -I../../controller_emulator_status_monitor/include cu_protocol_fuzz.cpp ../../controller_emulator_status_monitor/src/cu_protocol.cpp -o cu_protocol_libfuzzer
+*/
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "cu_protocol.h"
+#include "host_test.h"
+
+struct sent_frame_t
+{
+    std::vector<uint8_t> bytes;
+    cu_frame_t           frame;
+    uint32_t             received_ms;   /* receive time of the bridge */
+    bool                 held;          /* a status the parser has to see twice before it takes it */
+};
+
+static uint8_t nibble_character(uint8_t value) { return 0x30 | (value & 0x0F); }
+
+/* appends checksum and '$' to command and payload */
+static void finish_frame(std::vector<uint8_t>& bytes)
+{
+    uint8_t checksum = 0;
+    for (size_t ii = 1; ii < bytes.size(); ii++) { checksum += bytes[ii]; }
+    bytes.push_back(nibble_character(checksum));
+    bytes.push_back(CU_FRAME_END);
+}
+
+static void encode_timestamp(sent_frame_t& sent)
+{
+    const cu_timestamp_t& timestamp = sent.frame.timestamp;
+    sent.bytes.push_back('?');
+    sent.bytes.push_back(nibble_character(timestamp.car + 1));
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        uint8_t byte = timestamp.timestamp >> shift;
+        sent.bytes.push_back(nibble_character(byte));
+        sent.bytes.push_back(nibble_character(byte >> 4));
+    }
+    sent.bytes.push_back(nibble_character(timestamp.sensor_group));
+    finish_frame(sent.bytes);
+}
+
+static void encode_status(sent_frame_t& sent, bool newer_cu, std::mt19937& rng)
+{
+    const cu_status_t& status = sent.frame.status;
+    sent.bytes.push_back('?');
+    sent.bytes.push_back(':');
+    for (int car = 0; car < CU_NUMBER_CONTROLLERS; car++) { sent.bytes.push_back(nibble_character(status.fuel[car])); }
+    sent.bytes.push_back(nibble_character(status.light_state));
+    sent.bytes.push_back(nibble_character(status.mode));
+    sent.bytes.push_back(nibble_character(status.pit_lane));
+    sent.bytes.push_back(nibble_character(status.pit_lane >> 4));
+    sent.bytes.push_back(nibble_character(status.display));
+    if (newer_cu)
+    {
+        sent.bytes.push_back(nibble_character(rng()));   /* two unknown characters of newer CUs */
+        sent.bytes.push_back(nibble_character(rng()));
+    }
+    finish_frame(sent.bytes);
+}
+
+/*
+What the bridge receives from a CU it polls: a timestamp when a car passed the finish line since the last poll, a status otherwise,
+and now and then its version. The CU clock runs off the clock of the bridge by up to 100 ppm.
+Races go through the light states of the CU: all lights on, the countdown, sometimes an early start, then racing.
+Now and then a fuel level, the pit lane, mode or display changes.
+*/
+struct cu_session_t
+{
+    std::mt19937& rng;
+    double      local_ms;
+    double      cu_offset_ms;
+    double      drift;
+    bool        newer_cu;
+    uint8_t     active_cars;
+    double      next_passing_ms[CU_NUMBER_CONTROLLERS];     /* CU clock */
+    cu_status_t status;
+    cu_version_t version;
+    bool        status_sent   = false;
+    bool        status_frozen = true;       /* the status after a held one stays, it confirms it */
+    uint32_t    polls         = 0;
+    uint32_t    light_polls   = 0;          /* in the current light state */
+    uint32_t    blinks        = 0;          /* of an early start */
+
+    explicit cu_session_t(std::mt19937& random) : rng(random)
+    {
+        local_ms     = rng() % 100000;
+        cu_offset_ms = rng() % 10000000;
+        drift        = (double(rng() % 2001) - 1000.0) * 1e-7;
+        newer_cu     = rng() % 2;
+        active_cars  = 1 + rng() % CU_NUMBER_CONTROLLERS;
+        for (uint8_t car = 0; car < CU_NUMBER_CONTROLLERS; car++) { next_passing_ms[car] = cu_clock() + lap_time(); }
+        memset(&status, 0, sizeof(status));
+        for (uint8_t car = 0; car < CU_NUMBER_CONTROLLERS; car++) { status.fuel[car] = 8 + rng() % 8; }
+        status.light_state = 1;
+        status.mode        = rng() % 16;
+        status.display     = rng() % 16;
+        for (int ii = 0; ii < 4; ii++) { version.version[ii] = '0' + rng() % 10; }
+        version.version[4] = 0;
+    }
+
+    double cu_clock() const { return cu_offset_ms + local_ms * (1.0 + drift); }
+    double lap_time()       { return 2000.0 + rng() % 6000; }
+
+    /* light state after this poll, the CU spends about a second in every countdown step */
+    void step_light_state()
+    {
+        light_polls++;
+        uint8_t light_state = status.light_state;
+        uint8_t next        = light_state;
+        switch (light_state)
+        {
+            case 0:  if (light_polls > 3000 + rng() % 3000) { next = 1; } break;
+            case 1:  if (light_polls > 40 + rng() % 100)    { next = 2; } break;
+            case 8:
+            case 9:  if (light_polls > 10) { next = (++blinks < 6) ? (17 - light_state) : 1; } break;
+            default: if (light_polls > 25 + rng() % 20)     { next = (rng() % 50 == 0) ? 8 : ((light_state == 7) ? 0 : light_state + 1); } break;
+        }
+        if (next == light_state) { return; }
+        if (next == 8) { blinks = 0; }
+        status.light_state = next;
+        light_polls        = 0;
+    }
+
+    /* changes of a status between two polls, returns true if the parser has to see the new status twice: all but a light state step */
+    bool step_status()
+    {
+        if (status_frozen) { status_frozen = false; return false; }
+        step_light_state();
+        if (rng() % 100 != 0) { return false; }
+        uint8_t car = rng() % active_cars;
+        switch (rng() % 8)
+        {
+            case 0:  status.pit_lane ^= 1 << car; break;
+            case 1:  status.mode      = (status.mode + 1 + rng() % 15) % 16; break;
+            case 2:  status.display   = (status.display + 1 + rng() % 15) % 16; break;
+            case 3:  status.fuel[car] = (status.fuel[car] < 8) ? 15 : 0; break;    /* tank refilled at once, or the fuel mode switched */
+            default: status.fuel[car] = (status.fuel[car] > 0) ? status.fuel[car] - 1 : 15; break;
+        }
+        status_frozen = true;
+        return true;
+    }
+
+    sent_frame_t next()
+    {
+        sent_frame_t sent;
+        memset(&sent.frame, 0, sizeof(sent.frame));
+        sent.held = false;
+        local_ms        += 20 + rng() % 30;     /* 20 ms for the response and the rest of the loop */
+        sent.received_ms = uint32_t(local_ms);
+        polls++;
+
+        uint8_t due_car = CU_NUMBER_CONTROLLERS;
+        for (uint8_t car = 0; car < active_cars; car++)
+        {
+            if ((next_passing_ms[car] <= cu_clock()) && ((due_car == CU_NUMBER_CONTROLLERS) || (next_passing_ms[car] < next_passing_ms[due_car]))) { due_car = car; }
+        }
+
+        if (polls % 997 == 0)
+        {
+            sent.frame.kind    = CU_FRAME_VERSION;
+            sent.frame.version = version;
+            sent.bytes.push_back('0');
+            for (int ii = 0; ii < 4; ii++) { sent.bytes.push_back(version.version[ii]); }
+            finish_frame(sent.bytes);
+        }
+        else if (due_car < CU_NUMBER_CONTROLLERS)
+        {
+            sent.frame.kind                   = CU_FRAME_TIMESTAMP;
+            sent.frame.timestamp.car          = due_car;
+            sent.frame.timestamp.timestamp    = uint32_t(next_passing_ms[due_car]);
+            sent.frame.timestamp.sensor_group = CU_SENSOR_GROUP_FINISH_LINE;
+            next_passing_ms[due_car]         += lap_time();
+            encode_timestamp(sent);
+        }
+        else
+        {
+            sent.held         = step_status() || !status_sent;
+            status_sent       = true;
+            sent.frame.kind   = CU_FRAME_STATUS;
+            sent.frame.status = status;
+            encode_status(sent, newer_cu, rng);
+        }
+        return sent;
+    }
+};
+
+/* the end of a response the bridge boots into, the parser has to drop it */
+static const uint8_t BOOT_GARBAGE[] = { '3', '>', '1', '<', CU_FRAME_END };
+
+static bool same_frame(const cu_frame_t& a, const cu_frame_t& b)
+{
+    if (a.kind != b.kind) { return false; }
+    switch (a.kind)
+    {
+        case CU_FRAME_STATUS:
+            return !memcmp(a.status.fuel, b.status.fuel, sizeof(a.status.fuel)) && (a.status.light_state == b.status.light_state) &&
+                   (a.status.mode == b.status.mode) && (a.status.pit_lane == b.status.pit_lane) && (a.status.display == b.status.display);
+        case CU_FRAME_TIMESTAMP:
+            return (a.timestamp.car == b.timestamp.car) && (a.timestamp.timestamp == b.timestamp.timestamp) && (a.timestamp.sensor_group == b.timestamp.sensor_group);
+        case CU_FRAME_VERSION:
+            return !strcmp(a.version.version, b.version.version);
+    }
+    return false;
+}
+
+/* every decoded field within the range of the protocol, whatever the input was */
+static bool frame_in_range(const cu_frame_t& frame)
+{
+    switch (frame.kind)
+    {
+        case CU_FRAME_STATUS:
+            for (int car = 0; car < CU_NUMBER_CONTROLLERS; car++) { if (frame.status.fuel[car] > 15) { return false; } }
+            return (frame.status.light_state <= CU_LIGHT_STATE_MAX) && (frame.status.mode <= 15) && (frame.status.display <= 15);
+        case CU_FRAME_TIMESTAMP:
+            return (frame.timestamp.car < CU_NUMBER_CONTROLLERS) && (frame.timestamp.sensor_group <= 15);
+        case CU_FRAME_VERSION:
+            return strlen(frame.version.version) == 4;
+    }
+    return false;
+}
+
+enum fault_class_t { FAULT_NONE, FAULT_NIBBLE, FAULT_DELETE, FAULT_INSERT, FAULT_BYTE, FAULT_BITFLIP, FAULT_BURST, FAULT_COUNT };
+static const char* const FAULT_NAMES[FAULT_COUNT] = { "none", "nibble", "delete", "insert", "byte", "bitflip", "burst" };
+
+static void corrupt(std::vector<uint8_t>& bytes, fault_class_t fault, std::mt19937& rng)
+{
+    size_t position = rng() % bytes.size();
+    switch (fault)
+    {
+        case FAULT_NIBBLE:
+        {
+            position = 1 + rng() % (bytes.size() - 2);  /* payload or checksum */
+            if (bytes[position] == ':') { position = bytes.size() - 2; }
+            uint8_t replacement;
+            do { replacement = nibble_character(rng()); } while (replacement == bytes[position]);
+            bytes[position] = replacement;
+            break;
+        }
+        case FAULT_DELETE:  bytes.erase(bytes.begin() + position); break;
+        case FAULT_INSERT:  bytes.insert(bytes.begin() + position, uint8_t(rng())); break;
+        case FAULT_BYTE:
+        {
+            uint8_t replacement;
+            do { replacement = rng(); } while (replacement == bytes[position]);
+            bytes[position] = replacement;
+            break;
+        }
+        case FAULT_BITFLIP: bytes[position] ^= 1 << (rng() % 8); break;
+        case FAULT_BURST:
+        {
+            size_t length = 2 + rng() % 3;
+            for (size_t ii = position; (ii < position + length) && (ii < bytes.size()); ii++) { bytes[ii] = rng(); }
+            break;
+        }
+        default: break;
+    }
+}
+
+struct fault_result_t
+{
+    uint32_t frames_sent         = 0;
+    uint32_t frames_corrupted    = 0;
+    uint32_t frames_lost         = 0;   /* clean frames that were not decoded, besides the held ones */
+    uint32_t frames_implausible  = 0;   /* intact frames the plausibility checks dropped */
+    uint32_t frames_bogus        = 0;   /* decoded frames that differ from the frame being sent */
+    uint32_t frames_out_of_range = 0;
+};
+
+/*
+Sends the frames of a CU session, every fourth one corrupted with the fault class, and checks what the parser makes of them.
+A decoded frame is correct if it has the content of the frame whose bytes it ends in. Corrupted bytes outside of what is
+decoded, like a '$' in front of a frame, leave it correct.
+*/
+static fault_result_t run_fault_class(fault_class_t fault, uint32_t number_frames, std::mt19937& rng)
+{
+    fault_result_t       result;
+    std::vector<uint8_t> stream(BOOT_GARBAGE, BOOT_GARBAGE + sizeof(BOOT_GARBAGE));
+    std::vector<size_t>  frame_at(stream.size(), SIZE_MAX);    /* per stream position: index of the frame the byte belongs to */
+    std::vector<sent_frame_t> frames;
+    std::vector<bool>    corrupted;
+
+    cu_session_t session(rng);
+    for (uint32_t ii = 0; ii < number_frames; ii++)
+    {
+        sent_frame_t sent = session.next();
+        bool corrupt_frame = (fault != FAULT_NONE) && (rng() % 4 == 0);
+        if (corrupt_frame)
+        {
+            corrupt(sent.bytes, fault, rng);
+            result.frames_corrupted += 1;
+        }
+        stream.insert(stream.end(), sent.bytes.begin(), sent.bytes.end());
+        frame_at.resize(stream.size(), frames.size());
+        frames.push_back(sent);
+        corrupted.push_back(corrupt_frame);
+        result.frames_sent += 1;
+    }
+
+    cu_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    std::vector<bool> delivered(frames.size(), false);
+    for (size_t position = 0; position < stream.size(); position++)
+    {
+        size_t     index       = frame_at[position];
+        uint32_t   received_ms = (index == SIZE_MAX) ? 0 : frames[index].received_ms;
+        cu_frame_t frame;
+        uint8_t    kind = cu_parser_feed(&parser, stream[position], received_ms, &frame);
+        if ((kind == CU_FRAME_NONE) || (kind == CU_FRAME_INVALID)) { continue; }
+        if (kind == CU_FRAME_IMPLAUSIBLE) { result.frames_implausible += 1; continue; }
+
+        if (!frame_in_range(frame)) { result.frames_out_of_range += 1; }
+        if ((index != SIZE_MAX) && same_frame(frame, frames[index].frame)) { delivered[index] = true; }
+        else                                                                { result.frames_bogus += 1; }
+    }
+    for (size_t ii = 0; ii < frames.size(); ii++)
+    {
+        if (!delivered[ii] && !corrupted[ii] && !frames[ii].held) { result.frames_lost += 1; }
+    }
+    return result;
+}
+
+/* random bytes with a '$' now and then, nothing of it may leave the parser out of range */
+static uint32_t run_random_input(uint32_t number_bytes, std::mt19937& rng, uint32_t* frames_accepted)
+{
+    cu_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    uint32_t out_of_range = 0;
+    *frames_accepted = 0;
+    for (uint32_t ii = 0; ii < number_bytes; ii++)
+    {
+        uint8_t byte = (rng() % 16 == 0) ? CU_FRAME_END : ((rng() % 2) ? nibble_character(rng()) : uint8_t(rng()));
+        cu_frame_t frame;
+        uint8_t kind = cu_parser_feed(&parser, byte, ii / 2, &frame);  /* 19200 baud are about two bytes per ms */
+        if ((kind == CU_FRAME_NONE) || (kind == CU_FRAME_INVALID) || (kind == CU_FRAME_IMPLAUSIBLE)) { continue; }
+        *frames_accepted += 1;
+        if (!frame_in_range(frame)) { out_of_range += 1; }
+    }
+    return out_of_range;
+}
+
+static void run_benchmark(uint32_t megabytes, std::mt19937& rng)
+{
+    std::vector<uint8_t> stream;
+    cu_session_t session(rng);
+    while (stream.size() < (1u << 20))
+    {
+        sent_frame_t sent = session.next();
+        stream.insert(stream.end(), sent.bytes.begin(), sent.bytes.end());
+    }
+
+    cu_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    cu_frame_t frame;
+    uint64_t   checksum = 0;    /* keeps the compiler from dropping the decoding */
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < megabytes; round++)
+    {
+        for (uint8_t byte : stream) { checksum += cu_parser_feed(&parser, byte, 0, &frame); }  /* the same laps again every round, most of them implausible */
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double bytes   = double(stream.size()) * megabytes;
+
+    printf("benchmark: %.1f MB in %.3f s, %.1f MB/s, %.2f ns/byte, %.1f Mframes/s (check %llu)\n",
+        bytes / 1e6, seconds, bytes / 1e6 / seconds, seconds * 1e9 / bytes,
+        (parser.frames_valid + parser.frames_implausible) / 1e6 / seconds, (unsigned long long)checksum);
+    printf("           the CU sends at most 1920 bytes/s at 19200 baud\n");
+}
+
+#ifdef CU_PROTOCOL_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    cu_parser_t parser;
+    memset(&parser, 0, sizeof(parser));
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        cu_frame_t frame;
+        uint8_t kind = cu_parser_feed(&parser, data[ii], ii / 2, &frame);
+        if ((kind != CU_FRAME_NONE) && (kind != CU_FRAME_INVALID) && (kind != CU_FRAME_IMPLAUSIBLE) && !frame_in_range(frame)) { abort(); }
+    }
+    return 0;
+}
+#else
+int main(int argc, char** argv)
+{
+    uint32_t frames    = 200000;
+    uint32_t seed      = 1;
+    uint32_t megabytes = 0;
+    const host_test_option_t options[] =
+    {
+        { "--frames",       "N",    &frames,    NULL },
+        { "--seed",         "S",    &seed,      NULL },
+        { "--benchmark",    "MB",   &megabytes, NULL },
+    };
+    if (!host_test_parse(argc, argv, options)) { return 2; }
+
+    std::mt19937 rng(seed);
+    bool failed = false;
+
+    printf("%-8s %10s %10s %10s %12s %10s\n", "fault", "sent", "corrupted", "lost", "implausible", "bogus");
+    for (int fault = FAULT_NONE; fault < FAULT_COUNT; fault++)
+    {
+        fault_result_t result = run_fault_class(fault_class_t(fault), frames, rng);
+        printf("%-8s %10u %10u %10u %12u %10u\n", FAULT_NAMES[fault], result.frames_sent, result.frames_corrupted, result.frames_lost, result.frames_implausible, result.frames_bogus);
+        if (result.frames_bogus)                                    { failed = true; }
+        if ((fault == FAULT_NONE) && result.frames_lost)            { failed = true; }
+        if (result.frames_out_of_range)                             { failed = true; printf("         %u decoded frames out of range\n", result.frames_out_of_range); }
+    }
+
+    uint32_t frames_accepted;
+    uint32_t out_of_range = run_random_input(frames * 16, rng, &frames_accepted);
+    printf("random   %u bytes, %u frames accepted, %u out of range\n", frames * 16, frames_accepted, out_of_range);
+    if (out_of_range) { failed = true; }
+
+    if (megabytes) { run_benchmark(megabytes, rng); }
+
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
+#endif
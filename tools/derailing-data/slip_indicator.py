@@ -0,0 +1,99 @@
+"""
+Replays the recordings of this folder through the slip indicator of datalogger_sensorcar (vehicle_dynamics.cpp) and
+reports how it behaves in normal driving and before the derailment. The limits are read from vehicle_dynamics.h.
+
+Every recording is a series of runs over seven straights and three left curves, each run with a higher Target_Speed.
+Only the last run derails, the car ends up on its side. Normal driving is every sample of the runs before with a
+Target_Speed. The rotation transient of the derailment is the first sample of the last run whose yaw rate is higher
+than anything the slot allowed in normal driving. The indicator is then compared against 1 like the controller does.
+
+The recordings have no axis calibration, so the sensor z axes are taken as the car z axis. The gyro biases are the
+means at standstill (Target_Speed 0). The speed is the mean IR speed, the firmware has a similar sparse estimate.
+
+Usage:
+    pip install -r requirements.txt
+    python slip_indicator.py [recording.mat ...]
+"""
+
+import os
+import re
+import sys
+
+import numpy as np
+import scipy.io
+
+HERE     = os.path.dirname(os.path.abspath(__file__))
+INCLUDE  = os.path.join(HERE, "..", "..", "datalogger_sensorcar", "include")
+GRAVITY  = 9.81     # in m/s^2 per g, the recordings are in g
+
+
+def read_defines(header):
+    defines = {}
+    with open(os.path.join(INCLUDE, header)) as file:
+        for line in file:
+            match = re.match(r"^\s*#define\s+(\w+)\s+(-?[0-9.eE+-]+)\b", line)
+            if match:
+                defines[match.group(1)] = float(match.group(2))
+    return defines
+
+
+def slip_indicator(recording, limits):
+    target = recording["Target_Speed"].astype(int)
+    standstill = target == 0
+    gyro_front = recording["Rot_Front_z"] - recording["Rot_Front_z"][standstill].mean()
+    gyro_back  = recording["Rot_Heck_z"]  - recording["Rot_Heck_z"][standstill].mean()
+    yaw_rate   = (gyro_front + gyro_back) / 2 * limits["GYRO_SENSITIVITY"] * np.pi / 180
+    lateral_front = recording["Accel_Front_y"] * GRAVITY
+    lateral_back  = recording["Accel_Heck_y"]  * GRAVITY
+    speed = (recording["IR_Speed_Left"] + recording["IR_Speed_Right"]) / 2
+
+    # vehicle_dynamics_update(), sample by sample because of the low pass
+    indicator        = np.zeros(len(yaw_rate))
+    yaw_acceleration = 0.0
+    for ii in range(len(yaw_rate)):
+        yaw_acceleration += ((lateral_front[ii] - lateral_back[ii]) / limits["IMU_LEVER_ARM"] - yaw_acceleration) / limits["YAW_ACCELERATION_FILTER"]
+        slide_ratio = 0.0
+        if (abs(yaw_rate[ii]) > limits["SLIDE_MIN_YAW_RATE"]) and (speed[ii] > limits["SLIDE_MIN_SPEED"]):
+            slide_ratio = abs(yaw_rate[ii]) * speed[ii] / max(abs(lateral_back[ii]), limits["SLIDE_MIN_LATERAL"])
+        indicator[ii] = max(slide_ratio / limits["SLIDE_RATIO_LIMIT"], abs(yaw_acceleration) / limits["YAW_ACCELERATION_LIMIT"])
+    return yaw_rate, indicator
+
+
+def analyze(path, limits):
+    recording = {key: value.ravel() for key, value in scipy.io.loadmat(path).items() if not key.startswith("__")}
+    yaw_rate, indicator = slip_indicator(recording, limits)
+    target   = recording["Target_Speed"].astype(int)
+    interval = np.median(np.diff(recording["Time"])) / 1000.0   # in ms
+
+    last_run  = np.flatnonzero(np.diff(target))[-1] + 1
+    normal    = (np.arange(len(target)) < last_run) & (target > 0)
+    slot_yaw  = np.abs(yaw_rate[normal]).max()
+    transient = last_run + np.argmax(np.abs(yaw_rate[last_run:]) > slot_yaw)
+    crossing  = transient
+    while (crossing > last_run) and (indicator[crossing - 1] > 1.0):
+        crossing -= 1
+
+    below = np.mean(indicator[normal] <= 1.0)
+    print("%s:" % os.path.basename(path))
+    print("  normal driving: %d samples, indicator at most 1 in %.2f%%, highest yaw rate %.2f rad/s" % (normal.sum(), 100.0 * below, slot_yaw))
+    if indicator[transient] > 1.0:
+        print("  derailment: rotation transient at %.2f s, indicator above 1 since %.0f ms before" % (recording["Time"][transient] / 1e6, (transient - crossing) * interval))
+    else:
+        print("  derailment: rotation transient at %.2f s, indicator not above 1" % (recording["Time"][transient] / 1e6))
+    return normal.sum(), below
+
+
+def main():
+    limits = read_defines("vehicle_dynamics.h")
+    limits.update(read_defines("imu_bias_tracking.h"))
+    paths = sys.argv[1:] or sorted(os.path.join(HERE, name) for name in os.listdir(HERE) if name.endswith(".mat"))
+    samples, below = 0, 0.0
+    for path in paths:
+        count, share = analyze(path, limits)
+        samples += count
+        below   += count * share
+    print("all recordings: indicator at most 1 in %.2f%% of %d samples of normal driving" % (100.0 * below / samples, samples))
+
+
+if __name__ == "__main__":
+    main()
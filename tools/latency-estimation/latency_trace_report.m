@@ -0,0 +1,72 @@
+clc;
+clear;
+close all;
+
+%% overview
+% this is a matlab script to evaluate the latency traces the sensorcar
+% outputs via the serial terminal when MEASURE_LATENCY is enabled on both
+% microcontrollers. Save the output of the serial terminal to a text file,
+% then run this script on it. Lines that are not traces are ignored.
+% Every trace line contains the timestamps of one speed change in us,
+% already aligned to the clock of the sensorcar:
+% TRACE Id IR_Mark Controller Send Bridge_Receive DAC_Write Report_Receive
+% The script reports the latency distribution of every hop so the slowest
+% one can be found.
+
+trace_filename = 'latency_trace.txt';
+
+stage_names = ["IR mark -> controller", "controller -> send", "send -> bridge receive", "bridge receive -> DAC write", "IR mark -> DAC write (total)"];
+
+timestamps = read_traces(trace_filename);
+fprintf("%d traces read from %s\n", size(timestamps, 1), trace_filename);
+
+% timestamps are uint32 microseconds that can overflow, so differences are
+% wrapped into the signed range
+stage_latencies = wrap_difference(timestamps(:,2:5), timestamps(:,1:4));
+stage_latencies(:,5) = wrap_difference(timestamps(:,5), timestamps(:,1));
+round_trip_time = wrap_difference(timestamps(:,6), timestamps(:,3));
+
+print_statistics(stage_names, stage_latencies)
+print_statistics("round trip time", round_trip_time)
+
+figure();
+for ii=1:1:length(stage_names)
+    subplot(length(stage_names), 1, ii)
+    histogram(stage_latencies(:,ii) / 1000, 50)
+    title(stage_names(ii))
+    xlabel("Latency in ms")
+    ylabel("Count")
+end
+
+%% functions
+% reads all lines starting with TRACE and returns their six timestamps as
+% one row per trace
+function [timestamps] = read_traces(filename)
+    file_id = fopen(filename, 'r');
+    if file_id < 0
+        error("Can not open %s", filename)
+    end
+    timestamps = zeros(0, 6);
+    line = fgetl(file_id);
+    while ischar(line)
+        values = sscanf(line, 'TRACE\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu');
+        if length(values) == 7 % header line and other output do not match
+            timestamps(end+1,:) = transpose(values(2:7));
+        end
+        line = fgetl(file_id);
+    end
+    fclose(file_id);
+end
+
+function [difference] = wrap_difference(later, earlier)
+    difference = mod(later - earlier + 2^31, 2^32) - 2^31;
+end
+
+function [] = print_statistics(names, latencies)
+    fprintf("%-30s %10s %10s %10s %10s %10s\n", "stage", "min/ms", "median/ms", "mean/ms", "p95/ms", "max/ms");
+    for ii=1:1:length(names)
+        values = sort(latencies(:,ii)) / 1000;
+        p95 = values(max(1, ceil(0.95 * length(values))));
+        fprintf("%-30s %10.3f %10.3f %10.3f %10.3f %10.3f\n", names(ii), min(values), median(values), mean(values), p95, max(values));
+    end
+end
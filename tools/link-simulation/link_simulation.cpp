@@ -0,0 +1,563 @@
+/*
+Host simulation of the ESP-NOW link monitor and the coordinated channel hop of both boards
+(link_monitor.cpp and channel_hop.cpp of lib/esp_now_link), compiled unchanged from the firmware sources.
+
+A simulated radio stands in for ESP-NOW: every channel has its own packet loss, latency, jitter, RSSI and rate of
+frames of other stations. A packet only arrives if the receiver is on the channel it was sent on when it gets there.
+Both state machines are driven like the link tasks of the firmware do it: every received packet is handed over,
+and the tick function is called again when the time it returned has passed, rounded up to the 1 ms FreeRTOS tick.
+The clock starts shortly before micros() wraps.
+
+Scenarios, each one checks that both boards end up idle on the same home channel:
+- stats:          histogram bins, percentiles, loss and score of link_stats_t
+- boot:           both boards boot, the sensorcar finds the controller emulator
+- survey:         one clean channel among busy and lossy ones, the survey has to move both boards there
+- hysteresis:     all channels equal, the survey has to stay on the home channel
+- abort:          a countdown starts at a random time during the survey
+- car reboot:     the sensorcar reboots after a move and finds the new home channel with its hellos
+- bridge reboot:  the controller emulator reboots after a move and brings the sensorcar back to the default channel
+- car off:        the sensorcar is switched off during a survey and switched on again later
+- random:         random channel conditions, reboots, surveys, aborts and blackouts, then a quiet period to converge
+
+Build (Linux):
+    g++ -std=c++17 -O2 -fsanitize=address,undefined -I../common -I../../lib/esp_now_link/include link_simulation.cpp ../../lib/esp_now_link/src/link_monitor.cpp ../../lib/esp_now_link/src/channel_hop.cpp -o link_simulation
+Usage:
+    ./link_simulation [--runs N] [--seed S] [--verbose] [--trace]
+--trace prints every packet and channel change, use it with --runs 1.
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "host_test.h"
+#include "link_monitor.h"
+#include "channel_hop.h"
+
+#define COORDINATOR         0
+#define FOLLOWER            1
+
+#define EVENT_DELIVER       0
+#define EVENT_TICK          1
+#define EVENT_FOREIGN       2
+
+#define CLOCK_START_US      (UINT32_MAX - 3000000u)     /* micros() wraps 3 s into every scenario */
+#define FOREIGN_PERIOD_US   1000
+
+static bool trace = false;
+static const char* const node_names[]   = { "bridge", "car" };
+static const char* const packet_names[] = { "probe", "echo", "hop", "commit", "ack", "hello" };
+
+struct channel_model_t
+{
+    double   loss;              /* probability that a packet gets lost */
+    uint32_t latency_us;        /* air time and the receiving task */
+    uint32_t jitter_us;         /* uniform on top of the latency */
+    double   rssi_mean;         /* in dBm */
+    double   rssi_std;
+    double   foreign_per_ms;    /* frames of other stations */
+};
+
+struct event_t
+{
+    uint64_t      time_us;
+    uint64_t      order;        /* events at the same time keep their order */
+    uint8_t       kind;
+    uint8_t       node;
+    uint8_t       channel;      /* a packet was sent on */
+    int8_t        rssi;
+    uint32_t      generation;   /* of the node when the tick was scheduled */
+    link_packet_t packet;
+    bool operator>(const event_t& other) const { return (time_us != other.time_us) ? (time_us > other.time_us) : (order > other.order); }
+};
+
+struct node_t
+{
+    uint8_t      channel;
+    bool         powered;
+    bool         booted;
+    uint32_t     generation;
+    link_radio_t radio;
+};
+
+struct simulation_t;
+
+struct radio_context_t
+{
+    simulation_t* simulation;
+    uint8_t       node;
+};
+
+struct simulation_t
+{
+    std::mt19937        rng;
+    channel_model_t     channels[LINK_CHANNEL_MAX + 1];
+    uint64_t            now_us = 0;
+    uint64_t            order  = 0;
+    std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> events;
+    node_t              nodes[2];
+    radio_context_t     contexts[2];
+    channel_survey_t    survey;
+    channel_follower_t  follower;
+    double              extra_loss = 0.0;   /* on every channel, for blackouts */
+    uint64_t            packets_sent      = 0;
+    uint64_t            packets_delivered = 0;
+    uint64_t            channel_changes   = 0;
+
+    explicit simulation_t(uint32_t seed) : rng(seed)
+    {
+        for (uint8_t channel = 0; channel <= LINK_CHANNEL_MAX; channel++) { channels[channel] = { 0.02, 900, 600, -55.0, 3.0, 0.2 }; }
+        for (uint8_t node = 0; node < 2; node++)
+        {
+            nodes[node]    = { LINK_DEFAULT_CHANNEL, false, false, 0, { &contexts[node], &radio_send, &radio_set_channel } };
+            contexts[node] = { this, node };
+        }
+        memset(&survey, 0, sizeof(survey));
+        memset(&follower, 0, sizeof(follower));
+        schedule({ 0, 0, EVENT_FOREIGN, COORDINATOR, 0, 0, 0, {} }, FOREIGN_PERIOD_US);
+    }
+
+    uint32_t micros() const { return uint32_t(CLOCK_START_US + now_us); }
+
+    void schedule(event_t event, uint64_t delay_us)
+    {
+        event.time_us = now_us + delay_us;
+        event.order   = order++;
+        events.push(event);
+    }
+
+    static void radio_send(void* context, const link_packet_t* packet)
+    {
+        radio_context_t* radio_context = (radio_context_t*)context;
+        radio_context->simulation->send(radio_context->node, packet);
+    }
+
+    static void radio_set_channel(void* context, uint8_t channel)
+    {
+        radio_context_t* radio_context = (radio_context_t*)context;
+        simulation_t* simulation = radio_context->simulation;
+        if (trace) { printf("%10.3f ms %-6s channel %u\n", simulation->now_us / 1000.0, node_names[radio_context->node], channel); }
+        simulation->nodes[radio_context->node].channel = channel;
+        simulation->channel_changes++;
+    }
+
+    void send(uint8_t from, const link_packet_t* packet)
+    {
+        if (!nodes[from].powered) { return; }
+        packets_sent++;
+        const channel_model_t& model = channels[nodes[from].channel];
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        bool lost = uniform(rng) < model.loss + extra_loss;
+        if (trace)
+        {
+            printf("%10.3f ms %-6s sends %-6s for channel %2u, sequence %3u on channel %2u%s\n", now_us / 1000.0, node_names[from],
+                packet_names[packet->type], packet->channel, packet->sequence, nodes[from].channel, lost ? ", lost" : "");
+        }
+        if (lost) { return; }
+        std::normal_distribution<double> rssi(model.rssi_mean, model.rssi_std);
+        double   rssi_value = std::round(rssi(rng));
+        uint32_t latency    = model.latency_us + uint32_t(uniform(rng) * model.jitter_us);
+        event_t  event      = { 0, 0, EVENT_DELIVER, uint8_t(1 - from), nodes[from].channel, int8_t(std::max(-100.0, std::min(-1.0, rssi_value))), 0, *packet };
+        schedule(event, latency);
+    }
+
+    /* the link task of the firmware: tick right away, then wait for the returned time in whole ms */
+    void run_tick(uint8_t node)
+    {
+        if (!nodes[node].powered || !nodes[node].booted) { return; }
+        uint32_t wait_us = 0;
+        for (uint8_t loops = 0; (wait_us == 0) && (loops < 100); loops++)
+        {
+            wait_us = (node == COORDINATOR) ? channel_survey_tick(&survey, micros()) : channel_follower_tick(&follower, micros());
+        }
+        nodes[node].generation++;
+        if (wait_us == LINK_NO_DEADLINE) { return; }
+        uint64_t wait_ms = (uint64_t(wait_us) + 999) / 1000;
+        schedule({ 0, 0, EVENT_TICK, node, 0, 0, nodes[node].generation, {} }, wait_ms * 1000);
+    }
+
+    void process(const event_t& event)
+    {
+        switch (event.kind)
+        {
+            case EVENT_DELIVER:
+            {
+                node_t& node = nodes[event.node];
+                if (!node.powered || !node.booted || (node.channel != event.channel))
+                {
+                    if (trace) { printf("%10.3f ms %-6s misses %s sent on channel %u\n", now_us / 1000.0, node_names[event.node], packet_names[event.packet.type], event.channel); }
+                    return;
+                }
+                packets_delivered++;
+                if (event.node == COORDINATOR) { channel_survey_packet(&survey, &event.packet, event.rssi, micros()); }
+                else                           { channel_follower_packet(&follower, &event.packet, micros()); }
+                run_tick(event.node);
+                break;
+            }
+            case EVENT_TICK:
+                if (event.generation == nodes[event.node].generation) { run_tick(event.node); }
+                break;
+            case EVENT_FOREIGN:
+            {
+                std::poisson_distribution<uint32_t> foreign(channels[nodes[COORDINATOR].channel].foreign_per_ms * FOREIGN_PERIOD_US / 1000.0);
+                uint32_t count = foreign(rng);
+                if (nodes[COORDINATOR].booted && (count > 0)) { channel_survey_foreign(&survey, count); }
+                schedule(event, FOREIGN_PERIOD_US);
+                break;
+            }
+        }
+    }
+
+    void run_for(uint64_t duration_us)
+    {
+        uint64_t end_us = now_us + duration_us;
+        while (!events.empty() && (events.top().time_us <= end_us))
+        {
+            event_t event = events.top();
+            events.pop();
+            now_us = event.time_us;
+            process(event);
+        }
+        now_us = end_us;
+    }
+
+    /* returns the time it took, or -1 if the condition was not met within limit_us */
+    int64_t run_until(const std::function<bool()>& condition, uint64_t limit_us)
+    {
+        uint64_t start_us = now_us;
+        while (!condition())
+        {
+            if (events.empty() || (events.top().time_us - start_us > limit_us)) { return -1; }
+            event_t event = events.top();
+            events.pop();
+            now_us = event.time_us;
+            process(event);
+        }
+        return int64_t(now_us - start_us);
+    }
+
+    void boot(uint8_t node)
+    {
+        nodes[node].powered = true;
+        nodes[node].booted  = true;
+        nodes[node].generation++;
+        if (node == COORDINATOR) { channel_survey_init(&survey, &nodes[node].radio, micros()); }
+        else                     { channel_follower_init(&follower, &nodes[node].radio, micros()); }
+        run_tick(node);
+    }
+
+    void power_off(uint8_t node)
+    {
+        nodes[node].powered = false;
+        nodes[node].generation++;
+    }
+
+    /* switched on again without a reboot, like after a brownout of the radio */
+    void power_on(uint8_t node)
+    {
+        nodes[node].powered = true;
+        run_tick(node);
+    }
+
+    void start_survey()
+    {
+        channel_survey_start(&survey, micros());
+        run_tick(COORDINATOR);
+    }
+
+    void abort_survey()
+    {
+        channel_survey_abort(&survey, micros());
+        run_tick(COORDINATOR);
+    }
+
+    bool converged() const
+    {
+        return channel_survey_idle(&survey) && !survey.follower_lost
+            && follower.joined && (follower.pending_channel == 0)
+            && (follower.home_channel == survey.home_channel)
+            && (nodes[FOLLOWER].channel == follower.home_channel)
+            && (nodes[COORDINATOR].channel == survey.home_channel);
+    }
+
+    void print_state(const char* label) const
+    {
+        printf("    %s: coordinator state %u channel %u home %u lost %d, follower channel %u home %u joined %d pending %u\n", label,
+            survey.state, nodes[COORDINATOR].channel, survey.home_channel, survey.follower_lost,
+            nodes[FOLLOWER].channel, follower.home_channel, follower.joined, follower.pending_channel);
+    }
+
+    void print_survey() const
+    {
+        char buffer[400];
+        for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++)
+        {
+            link_stats_format(buffer, sizeof(buffer), &survey.channel_stats[channel]);
+            uint32_t score = link_channel_score(&survey.channel_stats[channel]);
+            if (score == LINK_SCORE_UNUSABLE) { printf("    channel %2u: score unusable, %s\n", channel, buffer); }
+            else                              { printf("    channel %2u: score %6u, %s\n", channel, score, buffer); }
+        }
+    }
+};
+
+static bool check(bool condition, const char* scenario, const char* what)
+{
+    if (!condition) { printf("FAIL %s: %s\n", scenario, what); }
+    return condition;
+}
+
+static bool scenario_stats()
+{
+    const char* name = "stats";
+    bool ok = true;
+    link_stats_t stats;
+    link_stats_reset(&stats);
+    for (uint32_t ii = 0; ii < 100; ii++) { link_stats_sent(&stats); }
+    for (uint32_t ii = 0; ii < 80; ii++)  { link_stats_answered(&stats, 1000); }   /* bin 2: 512...1023 us, upper edge 1024 */
+    for (uint32_t ii = 0; ii < 10; ii++)  { link_stats_answered(&stats, 3000); }   /* bin 4: 2048...4095 us */
+    link_stats_answered(&stats, 200000);                                            /* last bin */
+    ok &= check(link_stats_loss_permille(&stats) == 90, name, "loss of 9 out of 100");
+    ok &= check(link_stats_rtt_percentile_us(&stats, 50) == 1024, name, "median in the 1 ms bin");
+    ok &= check(link_stats_rtt_percentile_us(&stats, 90) == 4096, name, "90th percentile in the 4 ms bin");
+    ok &= check(link_stats_rtt_percentile_us(&stats, 100) == 200000, name, "maximum for the last bin");
+    ok &= check(stats.rtt_histogram[LINK_RTT_BINS - 1] == 1, name, "long round trip in the last bin");
+
+    link_stats_received(&stats, -120);
+    link_stats_received(&stats, -55);
+    link_stats_received(&stats, -10);
+    link_stats_received(&stats, 0);
+    ok &= check(stats.received == 4 && stats.rssi_count == 3, name, "packets without RSSI are counted, but not binned");
+    ok &= check(stats.rssi_histogram[0] == 1 && stats.rssi_histogram[4] == 1 && stats.rssi_histogram[LINK_RSSI_BINS - 1] == 1, name, "RSSI bins clamp at both ends");
+    link_stats_missed(&stats, 4);
+    ok &= check(link_stats_miss_permille(&stats) == 500, name, "4 missed out of 8");
+
+    link_stats_t empty;
+    link_stats_reset(&empty);
+    ok &= check(link_channel_score(&empty) == LINK_SCORE_UNUSABLE, name, "no answer is unusable");
+    link_stats_t sum;
+    link_stats_reset(&sum);
+    link_stats_add(&sum, &stats);
+    link_stats_add(&sum, &stats);
+    ok &= check(sum.sent == 200 && sum.rtt_max_us == 200000 && link_stats_loss_permille(&sum) == 90, name, "sums keep ratios");
+
+    uint8_t packet[sizeof(link_packet_t)] = { LINK_PACKET_MAGIC, LINK_HOP, 6, 1, 0, 0, 0, 0 };
+    ok &= check(link_packet_valid(packet, sizeof(packet)), name, "valid link packet");
+    ok &= check(!link_packet_valid(packet, sizeof(packet) - 1), name, "link packets have one length");
+    packet[2] = LINK_CHANNEL_MAX + 1;
+    ok &= check(!link_packet_valid(packet, sizeof(packet)), name, "channel out of range");
+
+    char buffer[16];
+    int  length = link_stats_format(buffer, sizeof(buffer), &stats);
+    ok &= check(length >= int(sizeof(buffer)) && strlen(buffer) == sizeof(buffer) - 1, name, "formatting truncates");
+    return ok;
+}
+
+static bool scenario_boot(uint32_t seed, bool verbose)
+{
+    const char* name = "boot";
+    simulation_t simulation(seed);
+    simulation.boot(COORDINATOR);
+    simulation.run_for(std::uniform_int_distribution<uint32_t>(0, 500000)(simulation.rng));
+    simulation.boot(FOLLOWER);
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 2000000);
+    if (verbose) { printf("    joined after %.1f ms\n", time_us / 1000.0); }
+    bool ok = check(time_us >= 0, name, "sensorcar joined");
+    ok &= check(simulation.survey.home_channel == LINK_DEFAULT_CHANNEL, name, "on the default channel");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+/* both booted and joined on the default channel. On a lossy channel that can take a reannounce. */
+static void boot_both(simulation_t& simulation)
+{
+    simulation.boot(COORDINATOR);
+    simulation.boot(FOLLOWER);
+    simulation.run_until([&]() { return simulation.converged(); }, 10000000);
+}
+
+/* channel 6 is clean, the default channel is loaded, the others are lossy or busy */
+static void congested_band(simulation_t& simulation)
+{
+    for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++)
+    {
+        simulation.channels[channel] = { 0.10 + 0.02 * (channel % 4), 1500, 3000, -62.0, 4.0, 3.0 };
+    }
+    simulation.channels[LINK_DEFAULT_CHANNEL] = { 0.25, 2500, 6000, -60.0, 4.0, 8.0 };
+    simulation.channels[6]                    = { 0.01, 800, 400, -52.0, 2.0, 0.1 };
+}
+
+static bool scenario_survey(uint32_t seed, bool verbose)
+{
+    const char* name = "survey";
+    simulation_t simulation(seed);
+    congested_band(simulation);
+    boot_both(simulation);
+    bool ok = check(simulation.converged(), name, "joined before the survey");
+    simulation.start_survey();
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged() && (simulation.survey.surveys == 1); }, 20000000);
+    if (verbose)
+    {
+        printf("    survey took %.2f s, %llu packets sent, %llu delivered\n", time_us / 1e6, (unsigned long long)simulation.packets_sent, (unsigned long long)simulation.packets_delivered);
+        simulation.print_survey();
+    }
+    ok &= check(time_us >= 0, name, "survey finished");
+    /* all hops to channel 6 can get lost, then it is skipped */
+    ok &= check((simulation.survey.home_channel == 6) || (simulation.survey.channel_stats[6].answered == 0), name, "moved to the clean channel");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+static bool scenario_hysteresis(uint32_t seed, bool verbose)
+{
+    const char* name = "hysteresis";
+    simulation_t simulation(seed);
+    for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++) { simulation.channels[channel] = { 0.0, 900, 200, -55.0, 1.0, 0.0 }; }
+    boot_both(simulation);
+    simulation.start_survey();
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged() && (simulation.survey.surveys == 1); }, 20000000);
+    if (verbose) { printf("    survey took %.2f s\n", time_us / 1e6); }
+    bool ok = check(time_us >= 0, name, "survey finished");
+    ok &= check(simulation.survey.home_channel == LINK_DEFAULT_CHANNEL, name, "stayed on the home channel");
+    ok &= check(simulation.survey.commits == 0, name, "no move");
+    return ok;
+}
+
+static bool scenario_abort(uint32_t seed, bool verbose)
+{
+    const char* name = "abort";
+    simulation_t simulation(seed);
+    congested_band(simulation);
+    boot_both(simulation);
+    simulation.start_survey();
+    simulation.run_for(std::uniform_int_distribution<uint32_t>(1000, 5000000)(simulation.rng));
+    simulation.abort_survey();
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 5000000);
+    if (verbose) { printf("    back on the home channel %.1f ms after the abort\n", time_us / 1000.0); }
+    bool ok = check(time_us >= 0, name, "back on the home channel");
+    ok &= check((simulation.survey.surveys > 0) || (simulation.survey.home_channel == LINK_DEFAULT_CHANNEL), name, "home channel unchanged unless the survey was already complete");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+static bool scenario_car_reboot(uint32_t seed, bool verbose)
+{
+    const char* name = "car reboot";
+    simulation_t simulation(seed);
+    congested_band(simulation);
+    boot_both(simulation);
+    simulation.start_survey();
+    simulation.run_until([&]() { return simulation.converged() && (simulation.survey.surveys == 1); }, 20000000);
+    uint8_t surveyed_channel = simulation.survey.home_channel;
+    simulation.boot(FOLLOWER);
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 5000000);
+    if (verbose) { printf("    rejoined channel %u after %.1f ms\n", simulation.survey.home_channel, time_us / 1000.0); }
+    bool ok = check(time_us >= 0, name, "rejoined");
+    ok &= check(simulation.survey.home_channel == surveyed_channel, name, "kept the surveyed channel");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+static bool scenario_bridge_reboot(uint32_t seed, bool verbose)
+{
+    const char* name = "bridge reboot";
+    simulation_t simulation(seed);
+    congested_band(simulation);
+    boot_both(simulation);
+    simulation.start_survey();
+    simulation.run_until([&]() { return simulation.converged() && (simulation.survey.surveys == 1); }, 20000000);
+    simulation.boot(COORDINATOR);
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 5000000);
+    if (verbose) { printf("    sensorcar back on channel %u after %.1f ms\n", simulation.follower.home_channel, time_us / 1000.0); }
+    bool ok = check(time_us >= 0, name, "sensorcar followed");
+    ok &= check(simulation.survey.home_channel == LINK_DEFAULT_CHANNEL, name, "default channel after boot");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+static bool scenario_car_off(uint32_t seed, bool verbose)
+{
+    const char* name = "car off";
+    simulation_t simulation(seed);
+    congested_band(simulation);
+    boot_both(simulation);
+    simulation.start_survey();
+    simulation.run_for(std::uniform_int_distribution<uint32_t>(1000, 4000000)(simulation.rng));
+    simulation.power_off(FOLLOWER);
+    simulation.run_for(std::uniform_int_distribution<uint32_t>(100000, 8000000)(simulation.rng));
+    simulation.power_on(FOLLOWER);
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 20000000);   /* a few reannounces on a lossy default channel */
+    if (verbose) { printf("    converged on channel %u %.1f ms after switching on, %u announces\n", simulation.survey.home_channel, time_us / 1000.0, simulation.survey.announces); }
+    bool ok = check(time_us >= 0, name, "converged");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+static bool scenario_random(uint32_t seed, bool verbose)
+{
+    const char* name = "random";
+    simulation_t simulation(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (uint8_t channel = LINK_CHANNEL_MIN; channel <= LINK_CHANNEL_MAX; channel++)
+    {
+        simulation.channels[channel] = { 0.4 * uniform(simulation.rng) * uniform(simulation.rng), uint32_t(500 + 3000 * uniform(simulation.rng)), uint32_t(8000 * uniform(simulation.rng)),
+                                         -90.0 + 45.0 * uniform(simulation.rng), 5.0 * uniform(simulation.rng), 10.0 * uniform(simulation.rng) };
+    }
+    boot_both(simulation);
+    for (uint8_t step = 0; step < 20; step++)
+    {
+        double action = uniform(simulation.rng);
+        if      (action < 0.35) { simulation.start_survey(); }
+        else if (action < 0.50) { simulation.abort_survey(); }
+        else if (action < 0.60) { simulation.boot(COORDINATOR); }
+        else if (action < 0.70) { simulation.boot(FOLLOWER); }
+        else if (action < 0.80) { simulation.extra_loss = 0.9; }
+        else if (action < 0.85) { simulation.power_off(FOLLOWER); }
+        else                    { simulation.extra_loss = 0.0; simulation.power_on(FOLLOWER); }
+        simulation.run_for(std::uniform_int_distribution<uint32_t>(0, 3000000)(simulation.rng));
+    }
+    simulation.extra_loss = 0.0;
+    if (!simulation.nodes[FOLLOWER].powered) { simulation.power_on(FOLLOWER); }
+    int64_t time_us = simulation.run_until([&]() { return simulation.converged(); }, 30000000);
+    if (verbose) { printf("    converged on channel %u %.1f ms after the disturbances\n", simulation.survey.home_channel, time_us / 1000.0); }
+    bool ok = check(time_us >= 0, name, "converged after the disturbances");
+    if (!ok) { simulation.print_state("end"); }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t runs    = 200;
+    uint32_t seed    = 1;
+    bool     verbose = false;
+    const host_test_option_t options[] =
+    {
+        { "--runs",     "N",    &runs,  NULL },
+        { "--seed",     "S",    &seed,  NULL },
+        { "--verbose",  NULL,   NULL,   &verbose },
+        { "--trace",    NULL,   NULL,   &trace },
+    };
+    if (!host_test_parse(argc, argv, options)) { return 2; }
+
+    const host_test_scenario_t scenarios[] =
+    {
+        { "boot",           scenario_boot },
+        { "survey",         scenario_survey },
+        { "hysteresis",     scenario_hysteresis },
+        { "abort",          scenario_abort },
+        { "car reboot",     scenario_car_reboot },
+        { "bridge reboot",  scenario_bridge_reboot },
+        { "car off",        scenario_car_off },
+        { "random",         scenario_random },
+    };
+
+    uint32_t failures = scenario_stats() ? 0 : 1;
+    printf("%-14s %s\n", "stats", failures ? "failed" : "passed");
+    failures += host_test_run(scenarios, runs, seed, verbose, 14);
+    return failures ? 1 : 0;
+}
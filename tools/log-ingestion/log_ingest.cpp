@@ -0,0 +1,844 @@
+/*
+Host side evaluation of sensorcar logs, replacing the per-file MATLAB workflow of
+speed_estimation_helper.m, latency_tester.m and accelerometer_calibration_calculations.m.
+
+Every log is memory-mapped and its tab-separated rows are parsed into one array per column.
+The tabs and line breaks are found 64 bytes at a time with SSE2 compares, the numbers are
+converted 8 digits at a time (SWAR). --benchmark compares that with the byte-wise parser.
+Logs are processed in parallel on all cores, the results are merged afterwards.
+Accepted are the per-run files of the sensorcar (run_NNNNN.txt with '#' metadata rows) as well
+as the older single data.txt with one header per boot. A run file ends at the data_length of its
+entry in the runs.idx next to it, the preallocated rest of the file holds old card data.
+Without runs.idx, a run file is read up to the first zero byte, which may include old data.
+
+Per log:
+- step detection: every change of Target_Speed
+- latency: time from a step to the first sample where the mean x acceleration of both IMUs
+  changes by more than --latency-threshold g between two samples (see latency_tester.m)
+- speed statistics: steady state trackbased IR speed at the end of every step, per vdigi
+- IR speed calibration: linear fit of IR speed to trackbased IR speed (see speed_estimation_helper.m)
+- accelerometer calibration (--calibration, raw logs only): the first six static poses in the
+  order +x, -x, +y, -y, +z, -z and the same least squares fit as the firmware
+
+Build (Linux):
+    g++ -std=c++17 -O2 -pthread log_ingest.cpp -o log_ingest
+Usage:
+    ./log_ingest [--threads N] [--calibration] [--latency-threshold G] [--steps] run_*.txt
+    ./log_ingest --benchmark run_*.txt
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* settings */
+struct settings_t
+{
+    unsigned number_threads     = std::max(1u, std::thread::hardware_concurrency());
+    bool     calibration        = false;
+    bool     print_steps        = false;
+    double   latency_threshold  = 0.1;      /* in g per sample */
+    double   latency_window     = 1.0;      /* in s. Steps without a response within this time are not counted. */
+    double   steady_fraction    = 0.5;      /* the last half of a step counts as steady state */
+    double   static_threshold   = 0.02;     /* in g, standard deviation of a static pose */
+    size_t   static_window      = 100;      /* in samples */
+};
+
+/* ###################################################
+Memory-mapped file
+################################################### */
+struct mapped_file_t
+{
+    const char* data   = nullptr;
+    size_t      length = 0;
+
+    explicit mapped_file_t(const char* path)
+    {
+        int descriptor = open(path, O_RDONLY);
+        if (descriptor < 0) { return; }
+        struct stat file_status;
+        if ((fstat(descriptor, &file_status) == 0) && (file_status.st_size > 0))
+        {
+            void* mapping = mmap(nullptr, file_status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapping != MAP_FAILED)
+            {
+                data   = static_cast<const char*>(mapping);
+                length = file_status.st_size;
+                madvise(mapping, length, MADV_SEQUENTIAL);
+            }
+        }
+        close(descriptor);
+    }
+    ~mapped_file_t() { if (data) { munmap(const_cast<char*>(data), length); } }
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+};
+
+/* ###################################################
+Numbers and delimiters
+################################################### */
+/* mantissa * 10^exponent. Exact powers of ten up to 10^22, so small exponents are rounded once. */
+static inline double scale_by_power_of_ten(uint64_t mantissa, int exponent)
+{
+    static const double POWERS_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    if (exponent == 0)                      { return double(mantissa); }
+    if ((exponent > 0) && (exponent <= 22)) { return double(mantissa) * POWERS_OF_TEN[exponent]; }
+    if ((exponent < 0) && (exponent >= -22)) { return double(mantissa) / POWERS_OF_TEN[-exponent]; }
+    return double(mantissa) * std::pow(10.0, exponent);
+}
+
+/* parses a decimal number without locale or errno handling, one byte at a time. Returns the position behind it. */
+static inline const char* parse_number(const char* position, const char* end, double* value)
+{
+    bool negative = false;
+    if ((position < end) && ((*position == '-') || (*position == '+'))) { negative = (*position == '-'); position++; }
+
+    uint64_t mantissa = 0;
+    int      exponent = 0;
+    int      digits   = 0;
+    while ((position < end) && ((unsigned)(*position - '0') < 10))
+    {
+        if (digits < 18) { mantissa = mantissa * 10 + (*position - '0'); digits++; } else { exponent++; }
+        position++;
+    }
+    if ((position < end) && (*position == '.'))
+    {
+        position++;
+        while ((position < end) && ((unsigned)(*position - '0') < 10))
+        {
+            if (digits < 18) { mantissa = mantissa * 10 + (*position - '0'); digits++; exponent--; }
+            position++;
+        }
+    }
+    if ((position < end) && ((*position == 'e') || (*position == 'E')))
+    {
+        position++;
+        bool exponent_negative = false;
+        if ((position < end) && ((*position == '-') || (*position == '+'))) { exponent_negative = (*position == '-'); position++; }
+        int explicit_exponent = 0;
+        while ((position < end) && ((unsigned)(*position - '0') < 10)) { explicit_exponent = explicit_exponent * 10 + (*position - '0'); position++; }
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
+    double result = scale_by_power_of_ten(mantissa, exponent);
+    *value = negative ? -result : result;
+    return position;
+}
+
+/*
+Up to 8 leading digits at position, converted in one 64 bit register (little endian hosts).
+Returns the number of digits, their value goes to value. Reads 8 bytes, whatever the number of digits.
+*/
+static inline int parse_eight_digits(const char* position, uint64_t* value)
+{
+    uint64_t digits;
+    memcpy(&digits, position, sizeof(digits));
+    digits ^= 0x3030303030303030ULL;    /* '0'...'9' become 0...9, everything else 10 or more */
+    uint64_t non_digits = (((digits & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | digits) & 0x8080808080808080ULL;
+    int      count      = non_digits ? __builtin_ctzll(non_digits) / 8 : 8;
+    if (count == 0) { *value = 0; return 0; }
+
+    digits <<= 8 * (8 - count);         /* the missing digits become leading zeros */
+    digits   = digits * 10 + (digits >> 8);
+    *value   = (((digits & 0x000000FF000000FFULL) * 0x000F424000000064ULL) + (((digits >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    return count;
+}
+
+/*
+Same result as parse_number(), 8 digits at a time. limit is the end of the readable memory, at least 8 bytes behind every digit read.
+Numbers with more than 18 digits or an exponent are left to parse_number(), the logs have neither.
+*/
+static inline const char* parse_number_eight_digits(const char* position, const char* end, const char* limit, double* value)
+{
+    static const uint64_t POWERS_OF_TEN[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+    const char* start    = position;
+    bool        negative = false;
+    if ((position < end) && ((*position == '-') || (*position == '+'))) { negative = (*position == '-'); position++; }
+
+    uint64_t mantissa = 0;
+    int      exponent = 0;
+    int      digits   = 0;
+    for (int count = 8; count == 8; )
+    {
+        if (position + 8 > limit) { return parse_number(start, end, value); }
+        uint64_t chunk;
+        count     = parse_eight_digits(position, &chunk);
+        mantissa  = mantissa * POWERS_OF_TEN[count] + chunk;
+        digits   += count;
+        position += count;
+    }
+    if ((position < end) && (*position == '.'))
+    {
+        position++;
+        for (int count = 8; count == 8; )
+        {
+            if (position + 8 > limit) { return parse_number(start, end, value); }
+            uint64_t chunk;
+            count     = parse_eight_digits(position, &chunk);
+            mantissa  = mantissa * POWERS_OF_TEN[count] + chunk;
+            digits   += count;
+            exponent -= count;
+            position += count;
+        }
+    }
+    if ((digits > 18) || (position > end) || ((position < end) && ((*position == 'e') || (*position == 'E')))) { return parse_number(start, end, value); }
+
+    double result = scale_by_power_of_ten(mantissa, exponent);
+    *value = negative ? -result : result;
+    return position;
+}
+
+/* bit ii is set if block[ii] is a tab or a line break */
+static inline uint64_t delimiter_mask(const char* block)
+{
+    uint64_t mask = 0;
+    #if defined(__SSE2__)
+        const __m128i tab      = _mm_set1_epi8('\t');
+        const __m128i new_line = _mm_set1_epi8('\n');
+        for (int ii = 0; ii < 4; ii++)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * ii));
+            uint32_t bits = uint32_t(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, tab), _mm_cmpeq_epi8(bytes, new_line))));
+            mask |= uint64_t(bits) << (16 * ii);
+        }
+    #else
+        for (int ii = 0; ii < 64; ii++) { mask |= uint64_t((block[ii] == '\t') || (block[ii] == '\n')) << ii; }
+    #endif
+    return mask;
+}
+
+/* walks the tabs and line breaks of [begin, end), 64 bytes per compare */
+class vector_delimiter_scanner
+{
+    public:
+        vector_delimiter_scanner(const char* begin, const char* end) : block(begin), end(end) { load(); }
+
+        /* next tab or line break, end if there is none */
+        const char* next()
+        {
+            while (mask == 0)
+            {
+                if (end - block <= 64) { return end; }
+                block += 64;
+                load();
+            }
+            const char* delimiter = block + __builtin_ctzll(mask);
+            mask &= mask - 1;
+            return delimiter;
+        }
+
+    private:
+        void load()
+        {
+            if (end - block >= 64) { mask = delimiter_mask(block); return; }
+            char tail[64] = { 0 };  /* the last block, zeros are no delimiters */
+            memcpy(tail, block, end - block);
+            mask = delimiter_mask(tail);
+        }
+
+        const char* block;
+        const char* end;
+        uint64_t    mask = 0;
+};
+
+/* the same one byte at a time, for --benchmark */
+class scalar_delimiter_scanner
+{
+    public:
+        scalar_delimiter_scanner(const char* begin, const char* end) : position(begin), end(end) {}
+
+        const char* next()
+        {
+            while ((position < end) && (*position != '\t') && (*position != '\n')) { position++; }
+            return (position < end) ? position++ : end;
+        }
+
+    private:
+        const char* position;
+        const char* end;
+};
+
+/* ###################################################
+Run index
+################################################### */
+
+/* same layout as run_index_entry_t in datalogger_sensorcar/include/data_logging.h */
+struct run_index_entry_t
+{
+    uint32_t run_number;
+    uint32_t start_time_ms;
+    uint32_t data_length;
+    uint32_t preallocated_size;
+    uint8_t  complete;
+    uint8_t  reserved[3];
+    char     file_name[16];
+};
+static_assert(sizeof(run_index_entry_t) == 36, "layout of the sensorcar's runs.idx");
+
+/* data length of run_NNNNN.txt from the runs.idx in the same directory. false for other files and runs without an entry. */
+static bool indexed_data_length(const char* path, size_t* data_length)
+{
+    std::string log_path(path);
+    size_t      slash     = log_path.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? std::string() : log_path.substr(0, slash + 1);
+    std::string name      = (slash == std::string::npos) ? log_path : log_path.substr(slash + 1);
+    unsigned    run_number;
+    char        extension[5] = { 0 };
+    if ((sscanf(name.c_str(), "run_%u.%4s", &run_number, extension) != 2) || strcmp(extension, "txt")) { return false; }
+
+    FILE* index_file = fopen((directory + "runs.idx").c_str(), "rb");
+    if (!index_file) { return false; }
+    run_index_entry_t entry;
+    bool found = (fseek(index_file, long(run_number) * long(sizeof(entry)), SEEK_SET) == 0) && (fread(&entry, sizeof(entry), 1, index_file) == 1) && (entry.run_number == run_number);
+    fclose(index_file);
+    if (found) { *data_length = entry.data_length; }
+    return found;
+}
+
+/* ###################################################
+Columnar parser
+################################################### */
+struct log_t
+{
+    std::vector<std::string>          column_names;
+    std::vector<std::vector<double>>  columns;
+    std::map<std::string, std::string> metadata;   /* '#Name' rows, value is the rest of the row */
+
+    const std::vector<double>* column(const char* name) const
+    {
+        for (size_t ii = 0; ii < column_names.size(); ii++)
+        {
+            if (column_names[ii] == name) { return &columns[ii]; }
+        }
+        return nullptr;
+    }
+    size_t rows() const { return columns.empty() ? 0 : columns[0].size(); }
+};
+
+static void parse_header(const char* position, const char* const* field_ends, size_t number_fields, log_t* log)
+{
+    std::vector<std::string> names;
+    for (size_t ii = 0; ii < number_fields; ii++)
+    {
+        names.emplace_back(position, field_ends[ii] - position);
+        position = field_ends[ii] + 1;
+    }
+    if (!names.empty() && !names.back().empty() && (names.back().back() == '\r')) { names.back().pop_back(); }
+
+    /* old logs repeat the header after every boot. The columns stay, a different header starts new ones. */
+    if (names == log->column_names) { return; }
+    log->column_names = names;
+    log->columns.assign(names.size(), std::vector<double>());
+}
+
+#define MAX_FIELDS  64
+
+/* parses [data, end) into log. Scanner finds the delimiters, VECTORIZED picks the number parser. limit is the end of the readable memory. */
+template <typename Scanner, bool VECTORIZED>
+static void parse_rows(const char* data, const char* end, const char* limit, log_t* log)
+{
+    /* rough row count, so the columns are allocated once */
+    size_t expected_rows = (end - data) / 120 + 1;
+
+    Scanner     delimiters(data, end);
+    const char* position = data;
+    const char* field_ends[MAX_FIELDS];
+    while (position < end)
+    {
+        /* every field of the line */
+        size_t      number_fields = 0;
+        const char* delimiter;
+        do
+        {
+            delimiter = delimiters.next();
+            if (number_fields < MAX_FIELDS) { field_ends[number_fields++] = delimiter; }
+        } while ((delimiter < end) && (*delimiter != '\n'));
+        const char* line_end = delimiter;
+        if (line_end == end) { break; }     /* every row ends with a line break. Without one, it was cut off by a reset. */
+
+        if (*position == '#')
+        {
+            const char* name_end = field_ends[0];
+            log->metadata[std::string(position + 1, name_end - position - 1)] = (name_end < line_end) ? std::string(name_end + 1, line_end - name_end - 1) : std::string();
+        }
+        else if ((unsigned)(*position - '0') < 10 || *position == '-')
+        {
+            if (!log->columns.empty() && (number_fields == log->columns.size()))
+            {
+                if (log->columns[0].capacity() < expected_rows) { for (auto& column : log->columns) { column.reserve(expected_rows); } }
+                const char* field = position;
+                for (size_t ii = 0; ii < number_fields; ii++)
+                {
+                    double value;
+                    if (VECTORIZED) { parse_number_eight_digits(field, field_ends[ii], limit, &value); }
+                    else            { parse_number(field, field_ends[ii], &value); }
+                    log->columns[ii].push_back(value);
+                    field = field_ends[ii] + 1;
+                }
+            }
+        }
+        else if (line_end > position)
+        {
+            parse_header(position, field_ends, number_fields, log);
+        }
+        position = line_end + 1;
+    }
+}
+
+/* end of the data of a mapped log, see the top of this file */
+static const char* data_end(const char* path, const mapped_file_t& file, bool* indexed)
+{
+    size_t data_length = file.length;
+    *indexed = indexed_data_length(path, &data_length);
+    if (*indexed) { return file.data + std::min(data_length, file.length); }
+    const char* zero = static_cast<const char*>(memchr(file.data, '\0', file.length));
+    return zero ? zero : file.data + file.length;
+}
+
+static bool parse_log(const char* path, log_t* log, bool* indexed)
+{
+    mapped_file_t file(path);
+    if (!file.data) { return false; }
+    parse_rows<vector_delimiter_scanner, true>(file.data, data_end(path, file, indexed), file.data + file.length, log);
+    return true;
+}
+
+/* ###################################################
+Analysis
+################################################### */
+struct step_t
+{
+    size_t index;
+    double time;            /* in s since the start of the log */
+    int    vdigi_before;
+    int    vdigi_after;
+    double latency;         /* in s, negative if no response was found */
+    double steady_speed;    /* in m/s, mean trackbased IR speed at the end of the step, negative if there was none */
+};
+
+struct result_t
+{
+    std::string             path;
+    bool                    parsed = false;
+    size_t                  rows   = 0;
+    std::vector<step_t>     steps;
+    std::vector<double>     ir_speed;               /* pairs of IR speed and trackbased IR speed for the IR calibration fit */
+    std::vector<double>     ir_speed_trackbased;
+    bool                    calibrated_front = false;
+    bool                    calibrated_back  = false;
+    double                  calibration_front[12];
+    double                  calibration_back[12];
+    double                  calibration_error_front = 0.0;
+    double                  calibration_error_back  = 0.0;
+    std::string             message;
+};
+
+/* Time is the uint32 micros() of the car, logged as int. Differences are wrapped like in latency_trace_report.m. */
+static std::vector<double> relative_time(const std::vector<double>& time_column)
+{
+    std::vector<double> seconds(time_column.size());
+    double accumulated = 0.0;
+    for (size_t ii = 0; ii < time_column.size(); ii++)
+    {
+        if (ii > 0)
+        {
+            uint32_t difference = uint32_t(int64_t(time_column[ii])) - uint32_t(int64_t(time_column[ii-1]));
+            accumulated += int32_t(difference) / 1e6;
+        }
+        seconds[ii] = accumulated;
+    }
+    return seconds;
+}
+
+static void detect_steps(const log_t& log, const settings_t& settings, result_t* result)
+{
+    const std::vector<double>* time_column   = log.column("Time");
+    const std::vector<double>* target_speed  = log.column("Target_Speed");
+    const std::vector<double>* accel_front   = log.column("Accel_Front_x");
+    const std::vector<double>* accel_back    = log.column("Accel_Heck_x");
+    const std::vector<double>* ir_left       = log.column("IR_Speed_Left_Trackbased");
+    const std::vector<double>* ir_right      = log.column("IR_Speed_Right_Trackbased");
+    if (!time_column || !target_speed) { result->message = "no Time or Target_Speed column"; return; }
+
+    std::vector<double> time = relative_time(*time_column);
+    size_t rows = log.rows();
+
+    std::vector<size_t> step_indices;
+    for (size_t ii = 1; ii < rows; ii++)
+    {
+        if ((*target_speed)[ii] != (*target_speed)[ii-1]) { step_indices.push_back(ii); }
+    }
+
+    for (size_t step_number = 0; step_number < step_indices.size(); step_number++)
+    {
+        size_t begin = step_indices[step_number];
+        size_t end   = (step_number + 1 < step_indices.size()) ? step_indices[step_number + 1] : rows;
+        step_t step  = { begin, time[begin], int((*target_speed)[begin-1]), int((*target_speed)[begin]), -1.0, -1.0 };
+
+        /* first sample after the step whose acceleration jumps */
+        if (accel_front && accel_back)
+        {
+            double previous = ((*accel_front)[begin-1] + (*accel_back)[begin-1]) / 2;
+            for (size_t ii = begin; (ii < end) && (time[ii] - step.time <= settings.latency_window); ii++)
+            {
+                double acceleration = ((*accel_front)[ii] + (*accel_back)[ii]) / 2;
+                if (std::fabs(acceleration - previous) > settings.latency_threshold) { step.latency = time[ii] - step.time; break; }
+                previous = acceleration;
+            }
+        }
+
+        /* trackbased speed only changes at IR marks, so the steady part is averaged over samples */
+        if (ir_left && ir_right && (step.vdigi_after > 0))
+        {
+            size_t steady_begin = begin + size_t((end - begin) * (1.0 - settings.steady_fraction));
+            double sum = 0.0;
+            size_t number_samples = 0;
+            for (size_t ii = steady_begin; ii < end; ii++)
+            {
+                double speed = ((*ir_left)[ii] + (*ir_right)[ii]) / 2;
+                if (speed > 0.0) { sum += speed; number_samples++; }
+            }
+            if (number_samples > 0) { step.steady_speed = sum / number_samples; }
+        }
+        result->steps.push_back(step);
+    }
+}
+
+/* pairs for the IR speed calibration, only where the trackbased speed is valid */
+static void collect_ir_pairs(const log_t& log, result_t* result)
+{
+    const std::vector<double>* left             = log.column("IR_Speed_Left");
+    const std::vector<double>* right            = log.column("IR_Speed_Right");
+    const std::vector<double>* left_trackbased  = log.column("IR_Speed_Left_Trackbased");
+    const std::vector<double>* right_trackbased = log.column("IR_Speed_Right_Trackbased");
+    if (!left || !right || !left_trackbased || !right_trackbased) { return; }
+    for (size_t ii = 1; ii < log.rows(); ii++)
+    {
+        /* only the samples where a new mark came in */
+        if (((*left)[ii] != (*left)[ii-1]) && ((*left_trackbased)[ii] > 0.0)) { result->ir_speed.push_back((*left)[ii]);  result->ir_speed_trackbased.push_back((*left_trackbased)[ii]); }
+        if (((*right)[ii] != (*right)[ii-1]) && ((*right_trackbased)[ii] > 0.0)) { result->ir_speed.push_back((*right)[ii]); result->ir_speed_trackbased.push_back((*right_trackbased)[ii]); }
+    }
+}
+
+/* Solves (W^T*W) * X = W^T*Y for the 4x3 matrix X, same as imu_calibration.cpp on the car */
+static bool solve_normal_equations(double normal_matrix[4][4], double right_hand_side[4][3])
+{
+    for (int column = 0; column < 4; column++)
+    {
+        int pivot = column;
+        for (int row = column + 1; row < 4; row++) { if (std::fabs(normal_matrix[row][column]) > std::fabs(normal_matrix[pivot][column])) { pivot = row; } }
+        if (std::fabs(normal_matrix[pivot][column]) < 1e-12) { return false; }
+        for (int ii = 0; ii < 4; ii++) { std::swap(normal_matrix[column][ii], normal_matrix[pivot][ii]); }
+        for (int ii = 0; ii < 3; ii++) { std::swap(right_hand_side[column][ii], right_hand_side[pivot][ii]); }
+        double divisor = normal_matrix[column][column];
+        for (int ii = 0; ii < 4; ii++) { normal_matrix[column][ii]   /= divisor; }
+        for (int ii = 0; ii < 3; ii++) { right_hand_side[column][ii] /= divisor; }
+        for (int row = 0; row < 4; row++)
+        {
+            if (row == column) { continue; }
+            double factor = normal_matrix[row][column];
+            for (int ii = 0; ii < 4; ii++) { normal_matrix[row][ii]   -= factor * normal_matrix[column][ii]; }
+            for (int ii = 0; ii < 3; ii++) { right_hand_side[row][ii] -= factor * right_hand_side[column][ii]; }
+        }
+    }
+    return true;
+}
+
+static const double POSE_REFERENCE[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+static bool fit_pose_calibration(const std::vector<std::vector<double>>& pose_means, double* calibration_values, double* mean_squared_error)
+{
+    double normal_matrix[4][4]   = { { 0 } };
+    double right_hand_side[4][3] = { { 0 } };
+    for (int pose = 0; pose < 6; pose++)
+    {
+        double w[4] = { pose_means[pose][0], pose_means[pose][1], pose_means[pose][2], 1.0 };
+        for (int row = 0; row < 4; row++)
+        {
+            for (int column = 0; column < 4; column++) { normal_matrix[row][column] += w[row] * w[column]; }
+            for (int axis = 0; axis < 3; axis++)       { right_hand_side[row][axis] += w[row] * POSE_REFERENCE[pose][axis]; }
+        }
+    }
+    if (!solve_normal_equations(normal_matrix, right_hand_side)) { return false; }
+    for (int axis = 0; axis < 3; axis++) { for (int ii = 0; ii < 4; ii++) { calibration_values[axis*4 + ii] = right_hand_side[ii][axis]; } }
+
+    double squared_error = 0.0;
+    for (int pose = 0; pose < 6; pose++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            double calibrated = calibration_values[axis*4] * pose_means[pose][0] + calibration_values[axis*4+1] * pose_means[pose][1] + calibration_values[axis*4+2] * pose_means[pose][2] + calibration_values[axis*4+3];
+            squared_error += (calibrated - POSE_REFERENCE[pose][axis]) * (calibrated - POSE_REFERENCE[pose][axis]);
+        }
+    }
+    *mean_squared_error = squared_error / 18;
+    return true;
+}
+
+/* means of the first six static poses of one IMU. Consecutive static stretches with the same mean are one pose. */
+static std::vector<std::vector<double>> find_static_poses(const std::vector<double>& x, const std::vector<double>& y, const std::vector<double>& z, double counts_per_g, const settings_t& settings)
+{
+    std::vector<std::vector<double>> poses;
+    size_t rows      = x.size();
+    size_t window    = settings.static_window;
+    double threshold = settings.static_threshold * counts_per_g;
+    const std::vector<double>* axes[3] = { &x, &y, &z };
+
+    size_t ii = 0;
+    while ((ii + window <= rows) && (poses.size() <= 6))
+    {
+        bool still = true;
+        for (int axis = 0; axis < 3 && still; axis++)
+        {
+            double sum = 0.0, sum_squares = 0.0;
+            for (size_t jj = ii; jj < ii + window; jj++) { sum += (*axes[axis])[jj]; sum_squares += (*axes[axis])[jj] * (*axes[axis])[jj]; }
+            double mean = sum / window;
+            still = (sum_squares / window - mean * mean) <= threshold * threshold;
+        }
+        if (!still) { ii += window / 4; continue; }
+
+        std::vector<double> mean(3, 0.0);
+        for (int axis = 0; axis < 3; axis++) { for (size_t jj = ii; jj < ii + window; jj++) { mean[axis] += (*axes[axis])[jj]; } mean[axis] /= window; }
+
+        bool same_pose = false;
+        if (!poses.empty())
+        {
+            double distance = 0.0;
+            for (int axis = 0; axis < 3; axis++) { distance += (mean[axis] - poses.back()[axis]) * (mean[axis] - poses.back()[axis]); }
+            same_pose = std::sqrt(distance) < 0.1 * counts_per_g;
+        }
+        if (!same_pose) { poses.push_back(mean); }
+        ii += window;
+    }
+    if (poses.size() > 6) { poses.resize(6); }
+    return poses;
+}
+
+static void fit_accelerometer_calibration(const log_t& log, const settings_t& settings, result_t* result)
+{
+    auto calibrate = log.metadata.find("Firmware");
+    if ((calibrate != log.metadata.end()) && (calibrate->second.find("CALIBRATE_ACCELERATION=1") != std::string::npos))
+    {
+        result->message = "log contains calibrated values, no accelerometer calibration";
+        return;
+    }
+    double scale_g = 8.0;
+    auto scale = log.metadata.find("Acceleration_Scale_g");
+    if (scale != log.metadata.end()) { scale_g = std::atof(scale->second.c_str()); }
+    double counts_per_g = 32768.0 / scale_g;
+
+    const char* names[2][3] = { { "Accel_Front_x", "Accel_Front_y", "Accel_Front_z" }, { "Accel_Heck_x", "Accel_Heck_y", "Accel_Heck_z" } };
+    for (int imu = 0; imu < 2; imu++)
+    {
+        const std::vector<double>* x = log.column(names[imu][0]);
+        const std::vector<double>* y = log.column(names[imu][1]);
+        const std::vector<double>* z = log.column(names[imu][2]);
+        if (!x || !y || !z) { continue; }
+        std::vector<std::vector<double>> poses = find_static_poses(*x, *y, *z, counts_per_g, settings);
+        if (poses.size() < 6) { result->message = "fewer than six static poses found"; continue; }
+        if (imu == 0) { result->calibrated_front = fit_pose_calibration(poses, result->calibration_front, &result->calibration_error_front); }
+        else          { result->calibrated_back  = fit_pose_calibration(poses, result->calibration_back,  &result->calibration_error_back); }
+    }
+}
+
+static void process_log(const settings_t& settings, result_t* result)
+{
+    log_t log;
+    bool  indexed = false;
+    result->parsed = parse_log(result->path.c_str(), &log, &indexed);
+    if (!result->parsed) { result->message = "can not be read"; return; }
+    if (!indexed && (result->path.find("run_") != std::string::npos)) { result->message = "no entry in runs.idx, read up to the first zero byte"; }
+    result->rows = log.rows();
+    detect_steps(log, settings, result);
+    collect_ir_pairs(log, result);
+    if (settings.calibration) { fit_accelerometer_calibration(log, settings, result); }
+}
+
+/* ###################################################
+Report
+################################################### */
+struct statistics_t { size_t count; double min, median, mean, p95, max, standard_deviation; };
+
+static statistics_t statistics(std::vector<double> values)
+{
+    statistics_t result = { values.size(), 0, 0, 0, 0, 0, 0 };
+    if (values.empty()) { return result; }
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (double value : values) { sum += value; }
+    result.mean   = sum / values.size();
+    double sum_squares = 0.0;
+    for (double value : values) { sum_squares += (value - result.mean) * (value - result.mean); }
+    result.standard_deviation = (values.size() > 1) ? std::sqrt(sum_squares / (values.size() - 1)) : 0.0;
+    result.min    = values.front();
+    result.max    = values.back();
+    result.median = (values.size() % 2) ? values[values.size() / 2] : (values[values.size() / 2 - 1] + values[values.size() / 2]) / 2;
+    result.p95    = values[std::max<size_t>(1, size_t(std::ceil(0.95 * values.size()))) - 1];
+    return result;
+}
+
+static void print_calibration(const char* name, const double* calibration_values, double error)
+{
+    printf("%s = { ", name);
+    for (int ii = 0; ii < 12; ii++) { printf("%.15g%s", calibration_values[ii], (ii < 11) ? ", " : " };"); }
+    printf("   mean squared error %g\n", error);
+}
+
+static void print_report(const std::vector<result_t>& results, const settings_t& settings)
+{
+    std::vector<double> latencies;
+    std::map<int, std::vector<double>> speeds_per_vdigi;
+    std::vector<double> ir_speed, ir_speed_trackbased;
+    size_t total_rows = 0, total_steps = 0;
+
+    for (const result_t& result : results)
+    {
+        if (!result.parsed || !result.message.empty()) { fprintf(stderr, "%s: %s\n", result.path.c_str(), result.parsed ? result.message.c_str() : "can not be read"); }
+        total_rows  += result.rows;
+        total_steps += result.steps.size();
+        for (const step_t& step : result.steps)
+        {
+            if (step.latency >= 0.0)      { latencies.push_back(step.latency * 1000); }
+            if (step.steady_speed >= 0.0) { speeds_per_vdigi[step.vdigi_after].push_back(step.steady_speed); }
+            if (settings.print_steps)
+            {
+                printf("STEP\t%s\t%zu\t%.3f\t%d\t%d\t%.1f\t%.4f\n", result.path.c_str(), step.index, step.time, step.vdigi_before, step.vdigi_after, step.latency * 1000, step.steady_speed);
+            }
+        }
+        ir_speed.insert(ir_speed.end(), result.ir_speed.begin(), result.ir_speed.end());
+        ir_speed_trackbased.insert(ir_speed_trackbased.end(), result.ir_speed_trackbased.begin(), result.ir_speed_trackbased.end());
+    }
+    printf("%zu logs, %zu rows, %zu steps\n\n", results.size(), total_rows, total_steps);
+
+    statistics_t latency = statistics(latencies);
+    printf("%-20s %8s %10s %10s %10s %10s %10s\n", "latency", "count", "min/ms", "median/ms", "mean/ms", "p95/ms", "max/ms");
+    printf("%-20s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n\n", "step -> acceleration", latency.count, latency.min, latency.median, latency.mean, latency.p95, latency.max);
+
+    printf("%-8s %8s %12s %12s %12s\n", "vdigi", "steps", "median m/s", "mean m/s", "std m/s");
+    for (const auto& entry : speeds_per_vdigi)
+    {
+        statistics_t speed = statistics(entry.second);
+        printf("%-8d %8zu %12.4f %12.4f %12.4f\n", entry.first, speed.count, speed.median, speed.mean, speed.standard_deviation);
+    }
+
+    /* y = m*x + b with x the IR speed and y the trackbased speed */
+    if (ir_speed.size() >= 2)
+    {
+        double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+        size_t n = ir_speed.size();
+        for (size_t ii = 0; ii < n; ii++) { sum_x += ir_speed[ii]; sum_y += ir_speed_trackbased[ii]; sum_xx += ir_speed[ii] * ir_speed[ii]; sum_xy += ir_speed[ii] * ir_speed_trackbased[ii]; }
+        double m = (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+        double b = (sum_y - m * sum_x) / n;
+        double squared_error = 0.0;
+        for (size_t ii = 0; ii < n; ii++) { squared_error += (m * ir_speed[ii] + b - ir_speed_trackbased[ii]) * (m * ir_speed[ii] + b - ir_speed_trackbased[ii]); }
+        printf("\nIR speed calibration over %zu marks: m = %.6f, b = %.6f, MSE = %g\n", n, m, b, squared_error / n);
+    }
+
+    if (settings.calibration)
+    {
+        printf("\n");
+        for (const result_t& result : results)
+        {
+            if (!result.calibrated_front && !result.calibrated_back) { continue; }
+            printf("%s\n", result.path.c_str());
+            if (result.calibrated_front) { print_calibration("calibration_values_front", result.calibration_front, result.calibration_error_front); }
+            if (result.calibrated_back)  { print_calibration("calibration_values_back",  result.calibration_back,  result.calibration_error_back); }
+        }
+    }
+}
+
+/* ###################################################
+Benchmark
+################################################### */
+
+/* parses every log with the byte-wise and the vectorized parser, single threaded. Returns 1 if they disagree. */
+static int run_benchmark(const std::vector<result_t>& results)
+{
+    size_t bytes          = 0;
+    double scalar_seconds = 0.0;
+    double vector_seconds = 0.0;
+    bool   identical      = true;
+    for (const result_t& result : results)
+    {
+        mapped_file_t file(result.path.c_str());
+        if (!file.data) { fprintf(stderr, "%s: can not be read\n", result.path.c_str()); continue; }
+        bool        indexed;
+        const char* end   = data_end(result.path.c_str(), file, &indexed);
+        const char* limit = file.data + file.length;
+
+        log_t warm_up, scalar_log, vector_log;
+        parse_rows<scalar_delimiter_scanner, false>(file.data, end, limit, &warm_up);   /* pages in the file */
+        auto start  = std::chrono::steady_clock::now();
+        parse_rows<scalar_delimiter_scanner, false>(file.data, end, limit, &scalar_log);
+        auto middle = std::chrono::steady_clock::now();
+        parse_rows<vector_delimiter_scanner, true>(file.data, end, limit, &vector_log);
+        auto stop   = std::chrono::steady_clock::now();
+
+        bytes          += end - file.data;
+        scalar_seconds += std::chrono::duration<double>(middle - start).count();
+        vector_seconds += std::chrono::duration<double>(stop - middle).count();
+        if ((scalar_log.column_names != vector_log.column_names) || (scalar_log.columns != vector_log.columns) || (scalar_log.metadata != vector_log.metadata))
+        {
+            fprintf(stderr, "%s: the parsers disagree\n", result.path.c_str());
+            identical = false;
+        }
+    }
+    printf("%zu logs, %.1f MB\n", results.size(), bytes / 1e6);
+    printf("%-12s %10.1f MB/s\n", "byte-wise",  bytes / 1e6 / scalar_seconds);
+    printf("%-12s %10.1f MB/s\n", "vectorized", bytes / 1e6 / vector_seconds);
+    printf("%s\n", identical ? "identical columns" : "columns differ");
+    return identical ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    bool benchmark = false;
+    settings_t settings;
+    std::vector<result_t> results;
+    for (int ii = 1; ii < argc; ii++)
+    {
+        if      (!strcmp(argv[ii], "--threads") && (ii + 1 < argc))           { settings.number_threads = std::max(1, atoi(argv[++ii])); }
+        else if (!strcmp(argv[ii], "--calibration"))                         { settings.calibration = true; }
+        else if (!strcmp(argv[ii], "--steps"))                               { settings.print_steps = true; }
+        else if (!strcmp(argv[ii], "--benchmark"))                           { benchmark = true; }
+        else if (!strcmp(argv[ii], "--latency-threshold") && (ii + 1 < argc)) { settings.latency_threshold = atof(argv[++ii]); }
+        else { results.emplace_back(); results.back().path = argv[ii]; }
+    }
+    if (results.empty())
+    {
+        fprintf(stderr, "usage: %s [--threads N] [--calibration] [--latency-threshold G] [--steps] logs...\n       %s --benchmark logs...\n", argv[0], argv[0]);
+        return 1;
+    }
+    if (benchmark) { return run_benchmark(results); }
+
+    /* every thread takes the next unprocessed log, so long and short logs even out */
+    std::atomic<size_t> next_log(0);
+    std::vector<std::thread> workers;
+    for (unsigned ii = 0; ii < std::min<size_t>(settings.number_threads, results.size()); ii++)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t index = next_log++; index < results.size(); index = next_log++) { process_log(settings, &results[index]); }
+        });
+    }
+    for (std::thread& worker : workers) { worker.join(); }
+
+    print_report(results, settings);
+    return 0;
+}
@@ -0,0 +1,87 @@
+"""
+Build-time memory report of the firmware, run by PlatformIO after linking (extra_scripts in platformio.ini).
+
+With STATIC_ALLOCATION, every task has its stack and control block in DRAM as <task>_stack and
+<task>_control_block, semaphores and queues as <name>_buffer and <name>_storage. This lists them
+per task from the symbol table of the firmware, together with the size of the statically
+allocated DRAM sections, so the RAM that is left for the heap is known before flashing.
+
+Standalone use on an existing build:
+    python memory_report.py .pio/build/firebeetle32/firmware.elf [xtensa-esp32-elf-nm]
+"""
+
+import re
+import subprocess
+import sys
+
+TASK_SUFFIXES   = ("_stack", "_control_block")
+OBJECT_SUFFIXES = ("_semaphore_buffer", "_queue_buffer", "_queue_storage", "_mailbox_buffer", "_mailbox_storage")
+DRAM_SECTIONS   = (".dram0.data", ".dram0.bss", ".noinit")
+
+
+def read_symbols(elf, nm):
+    output = subprocess.run([nm, "--print-size", "--demangle", elf], capture_output=True, text=True, check=True).stdout
+    symbols = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 4:
+            symbols[fields[3]] = int(fields[1], 16)
+    return symbols
+
+
+def read_sections(elf, size_tool):
+    output = subprocess.run([size_tool, "-A", elf], capture_output=True, text=True, check=True).stdout
+    sections = {}
+    for line in output.splitlines():
+        match = re.match(r"^(\S+)\s+(\d+)\s+\d+$", line)
+        if match:
+            sections[match.group(1)] = int(match.group(2))
+    return sections
+
+
+def print_report(elf, nm, size_tool):
+    symbols = read_symbols(elf, nm)
+
+    tasks = {}
+    for name, size in symbols.items():
+        for suffix in TASK_SUFFIXES:
+            if name.endswith(suffix):
+                task = name[:-len(suffix)]
+                tasks.setdefault(task, {})[suffix] = size
+    tasks = {task: sizes for task, sizes in tasks.items() if "_stack" in sizes and "_control_block" in sizes}
+
+    print("Task memory (bytes):")
+    print("  %-46s %8s %8s" % ("task", "stack", "tcb"))
+    total = 0
+    for task in sorted(tasks):
+        stack, control_block = tasks[task]["_stack"], tasks[task]["_control_block"]
+        total += stack + control_block
+        print("  %-46s %8d %8d" % (task, stack, control_block))
+    if not tasks:
+        print("  no static task memory, STATIC_ALLOCATION is off. Stacks are taken from the heap at runtime.")
+
+    objects = sorted((name, size) for name, size in symbols.items() if name.endswith(OBJECT_SUFFIXES))
+    for name, size in objects:
+        total += size
+        print("  %-46s %8d" % (name, size))
+    print("  %-46s %8d" % ("total", total))
+
+    sections = read_sections(elf, size_tool)
+    static_dram = sum(sections.get(section, 0) for section in DRAM_SECTIONS)
+    print("Static DRAM (%s): %d bytes" % (", ".join(DRAM_SECTIONS), static_dram))
+
+
+try:
+    Import("env")  # noqa: F821, only defined inside PlatformIO
+
+    def memory_report(source, target, env):
+        elf = str(target[0])
+        print_report(elf, env.subst("$CC").replace("gcc", "nm"), env.subst("$CC").replace("gcc", "size"))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", memory_report)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        if len(sys.argv) < 2:
+            sys.exit(__doc__)
+        nm = sys.argv[2] if len(sys.argv) > 2 else "xtensa-esp32-elf-nm"
+        print_report(sys.argv[1], nm, nm.replace("nm", "size"))
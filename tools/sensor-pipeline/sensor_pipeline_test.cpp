@@ -0,0 +1,484 @@
+/*
+Host tests and benchmark of the sensor processing chains of the sensorcar
+(datalogger_sensorcar/include/sensor_pipeline.h), compiled unchanged from the firmware sources.
+
+The IMU chain is composed for every combination of its optional stages: axis calibration, bias tracking,
+integration (longitudinal acceleration and trapezoidal integration), low pass and zero velocity update.
+The bus read and the bias tracking are firmware functions on globals, here they are stand-ins on host globals
+that are bound to the sample by reference like main.cpp does it.
+Every composition runs over a synthetic drive (standstill, acceleration, cruise, braking, standstill, with noise)
+next to the chain written out by hand the way sample_imu_task did it before, and every output has to be bit
+for bit the same after every sample.
+- physics:  an ideal calibration, the integrated speed has to follow the synthetic drive
+- ir:       tape speed with and without calibration and both fusions against update_ir_speeds() of before
+- log:      header and rows of log_format against sprintf, rows that don't fit are cut off with a line break
+--benchmark times every composition against its hand-written counterpart in ns per sample.
+
+Build (Linux):
+    g++ -std=c++17 -O2 -I../common -I../../datalogger_sensorcar/include sensor_pipeline_test.cpp -o sensor_pipeline_test
+Usage:
+    ./sensor_pipeline_test [--samples N] [--seed S] [--benchmark ROUNDS]
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "host_test.h"
+#include "sensor_pipeline.h"
+
+#define SAMPLING_INTERVAL       10000   /* in us, same as timer_setup.h */
+#define COUNTS_PER_G            4096.0  /* at SCALE_8G */
+#define LOW_PASS_TIME_CONSTANT  30000   /* in us */
+
+/* optional stages of the IMU chain */
+#define STAGE_CALIBRATION       (1 << 0)
+#define STAGE_BIAS              (1 << 1)
+#define STAGE_INTEGRATION       (1 << 2)
+#define STAGE_LOW_PASS          (1 << 3)
+#define STAGE_ZERO_VELOCITY     (1 << 4)
+#define STAGE_COMBINATIONS      (1 << 5)
+#define STAGE_FIRMWARE          (STAGE_CALIBRATION | STAGE_BIAS | STAGE_INTEGRATION | STAGE_ZERO_VELOCITY)
+
+/* ###################################################
+Host globals, bound to the samples like in main.cpp
+################################################### */
+
+int16_t  front_raw[6], back_raw[6];
+double_t front_acceleration[3], back_acceleration[3];
+double_t accel_previous, accel_now, speed;
+bool     standstill;
+double_t front_bias[3], back_bias[3];
+
+typedef struct
+{
+    int16_t   (&front_raw)[6];
+    int16_t   (&back_raw)[6];
+    double_t  (&front_acceleration)[3];
+    double_t  (&back_acceleration)[3];
+    double_t& accel_previous;
+    double_t& accel_now;
+    double_t& speed;
+    bool&     standstill;
+} imu_sample_t;
+
+imu_sample_t imu_sample = { front_raw, back_raw, front_acceleration, back_acceleration, accel_previous, accel_now, speed, standstill };
+
+/* default +-8g calibration of imu_lsm6ds3.h, for the comparisons */
+double_t calibration_front[12] = { 5.49391498367321e-07, 0.000242665106478849, 1.48803148659940e-05, 0.00782013884499783, 0.000244729606560598, -1.30868908647501e-07, -4.73889257422259e-06, 0.00967661395696673, -4.27858538728495e-06, 1.52530721834046e-05, -0.000241466842188727, 0.00728956178570483 };
+double_t calibration_back[12]  = { -3.19415627158884e-06, 0.000242641634827048, 6.15240127187166e-06, -0.00811203599963953, 0.000241871778667421, 2.86384418200320e-06, 7.98659477621670e-07, 0.00469760197311742, 1.41746531657993e-06, 5.91491608451484e-06, -0.000241812270066516, 0.0210918849264041 };
+/* sensor axes are the car axes, for the physics */
+double_t calibration_ideal[12] = { 1 / COUNTS_PER_G, 0, 0, 0, 0, 1 / COUNTS_PER_G, 0, 0, 0, 0, 1 / COUNTS_PER_G, 0 };
+
+/* ###################################################
+Synthetic drive
+################################################### */
+
+struct drive_sample_t
+{
+    int16_t  front_raw[6];
+    int16_t  back_raw[6];
+    bool     standstill;
+    double_t true_speed;    /* in m/s */
+};
+
+std::vector<drive_sample_t> drive;
+size_t                      drive_index = 0;
+
+static int16_t counts(double_t value)
+{
+    return int16_t(std::lround(std::fmax(-32768.0, std::fmin(32767.0, value))));
+}
+
+/*
+Races of DRIVE_RACE_SAMPLES, repeated: standstill, accelerate, cruise, brake, standstill.
+Accelerations in g along the car x axis plus gravity on z, with sensor noise and an offset.
+*/
+#define DRIVE_RACE_SAMPLES      2000    /* 20 s */
+static void make_drive(size_t samples, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::normal_distribution<double_t> noise(0.0, 6.0);    /* in counts */
+    drive.resize(samples);
+    double_t true_speed = 0.0;
+    for (size_t ii = 0; ii < samples; ii++)
+    {
+        size_t   race_sample  = ii % DRIVE_RACE_SAMPLES;
+        double_t acceleration = 0.0;                                        /* in g */
+        if      ((race_sample >= 800)  && (race_sample < 900))  { acceleration =  0.3; }
+        else if ((race_sample >= 1700) && (race_sample < 1800)) { acceleration = -0.3; }
+        bool still = (race_sample < 800) || (race_sample >= 1800);
+        true_speed = still ? 0.0 : true_speed + acceleration * GRAVITY_FACTOR * SAMPLING_INTERVAL / 1e6;
+
+        drive_sample_t& sample = drive[ii];
+        for (uint8_t axis = 0; axis < 3; axis++)
+        {
+            double_t gravity = (axis == 2) ? 1.0 : 0.0;
+            double_t along   = (axis == 0) ? acceleration : 0.0;
+            sample.front_raw[axis]     = counts(noise(rng) * 10 + 20);        /* gyro with an offset */
+            sample.back_raw[axis]      = counts(noise(rng) * 10 - 15);
+            sample.front_raw[axis + 3] = counts((along + gravity) * COUNTS_PER_G + noise(rng) + 30);
+            sample.back_raw[axis + 3]  = counts((along + gravity) * COUNTS_PER_G + noise(rng) - 25);
+        }
+        sample.standstill = still;
+        sample.true_speed = true_speed;
+    }
+}
+
+/* stand-in for imu_read() */
+static void synthetic_imu_read()
+{
+    const drive_sample_t& sample = drive[drive_index];
+    memcpy(front_raw, sample.front_raw, sizeof(front_raw));
+    memcpy(back_raw,  sample.back_raw,  sizeof(back_raw));
+}
+
+/* stand-in for imu_bias_update(): learns the acceleration bias at standstill and subtracts it */
+static void synthetic_bias_update()
+{
+    const double_t EXPECTED[3] = { 0.0, 0.0, 1.0 };
+    standstill = drive[drive_index].standstill;
+    for (uint8_t axis = 0; axis < 3; axis++)
+    {
+        if (standstill)
+        {
+            front_bias[axis] += 0.01 * ((front_acceleration[axis] - EXPECTED[axis]) - front_bias[axis]);
+            back_bias[axis]  += 0.01 * ((back_acceleration[axis]  - EXPECTED[axis]) - back_bias[axis]);
+        }
+        front_acceleration[axis] -= front_bias[axis];
+        back_acceleration[axis]  -= back_bias[axis];
+    }
+}
+
+static void reset_globals()
+{
+    memset(front_raw, 0, sizeof(front_raw));
+    memset(back_raw,  0, sizeof(back_raw));
+    memset(front_acceleration, 0, sizeof(front_acceleration));
+    memset(back_acceleration,  0, sizeof(back_acceleration));
+    memset(front_bias, 0, sizeof(front_bias));
+    memset(back_bias,  0, sizeof(back_bias));
+    accel_previous = accel_now = speed = 0.0;
+    standstill = false;
+}
+
+/* ###################################################
+IMU chains
+################################################### */
+
+template <uint32_t MASK, const double_t* FRONT = calibration_front, const double_t* BACK = calibration_back>
+using imu_chain = sensor_pipeline<
+    call_stage<synthetic_imu_read>,
+    optional_stage<(MASK & STAGE_CALIBRATION) != 0,   axis_calibration<FRONT, BACK>>,
+    optional_stage<(MASK & STAGE_BIAS) != 0,          call_stage<synthetic_bias_update>>,
+    optional_stage<(MASK & STAGE_INTEGRATION) != 0,   longitudinal_acceleration>,
+    optional_stage<(MASK & STAGE_LOW_PASS) != 0,      acceleration_low_pass<LOW_PASS_TIME_CONSTANT, SAMPLING_INTERVAL>>,
+    optional_stage<(MASK & STAGE_INTEGRATION) != 0,   trapezoid_integration<SAMPLING_INTERVAL>>,
+    optional_stage<(MASK & STAGE_ZERO_VELOCITY) != 0, zero_velocity_update>
+>;
+
+static double_t mean_two_doubles(double_t x, double_t y)
+{
+    return (x + y) * 0.5;
+}
+
+/* the same chain written out by hand, like imu_read() and sample_imu_task did it before the pipeline */
+template <uint32_t MASK>
+struct imu_reference
+{
+    double_t filtered = 0.0;
+
+    void process()
+    {
+        if ((MASK & STAGE_INTEGRATION) && !(MASK & STAGE_LOW_PASS)) { accel_previous = mean_two_doubles(front_acceleration[0], back_acceleration[0]); }
+        else if (MASK & STAGE_INTEGRATION)                          { accel_previous = accel_now; } /* the filtered one */
+
+        synthetic_imu_read();
+        if (MASK & STAGE_CALIBRATION)
+        {
+            front_acceleration[0] = calibration_front[0] * front_raw[3] + calibration_front[1] * front_raw[4] + calibration_front[2] * front_raw[5] + calibration_front[3];
+            front_acceleration[1] = calibration_front[4] * front_raw[3] + calibration_front[5] * front_raw[4] + calibration_front[6] * front_raw[5] + calibration_front[7];
+            front_acceleration[2] = calibration_front[8] * front_raw[3] + calibration_front[9] * front_raw[4] + calibration_front[10] * front_raw[5] + calibration_front[11];
+            back_acceleration[0]  = calibration_back[0] * back_raw[3] + calibration_back[1] * back_raw[4] + calibration_back[2] * back_raw[5] + calibration_back[3];
+            back_acceleration[1]  = calibration_back[4] * back_raw[3] + calibration_back[5] * back_raw[4] + calibration_back[6] * back_raw[5] + calibration_back[7];
+            back_acceleration[2]  = calibration_back[8] * back_raw[3] + calibration_back[9] * back_raw[4] + calibration_back[10] * back_raw[5] + calibration_back[11];
+        }
+        if (MASK & STAGE_BIAS) { synthetic_bias_update(); }
+        if (MASK & STAGE_INTEGRATION)
+        {
+            accel_now = mean_two_doubles(front_acceleration[0], back_acceleration[0]);
+            if (MASK & STAGE_LOW_PASS)
+            {
+                filtered += double_t(SAMPLING_INTERVAL) / (LOW_PASS_TIME_CONSTANT + SAMPLING_INTERVAL) * (accel_now - filtered);
+                accel_now = filtered;
+            }
+            speed += mean_two_doubles(accel_now, accel_previous) * SAMPLING_INTERVAL / 1e6 * GRAVITY_FACTOR;
+        }
+        if ((MASK & STAGE_ZERO_VELOCITY) && standstill) { speed = 0.0; }
+    }
+};
+
+struct imu_outputs_t
+{
+    double_t front_acceleration[3], back_acceleration[3];
+    double_t accel_previous, accel_now, speed;
+    bool     standstill;
+};
+
+static imu_outputs_t imu_outputs()
+{
+    imu_outputs_t outputs;
+    memset(&outputs, 0, sizeof(outputs));
+    memcpy(outputs.front_acceleration, front_acceleration, sizeof(front_acceleration));
+    memcpy(outputs.back_acceleration,  back_acceleration,  sizeof(back_acceleration));
+    outputs.accel_previous = accel_previous;
+    outputs.accel_now      = accel_now;
+    outputs.speed          = speed;
+    outputs.standstill     = standstill;
+    return outputs;
+}
+
+static std::string stage_names(uint32_t mask)
+{
+    const char* NAMES[] = { "calibration", "bias", "integration", "low_pass", "zero_velocity" };
+    std::string names;
+    for (uint8_t ii = 0; ii < 5; ii++) { if (mask & (1 << ii)) { names += names.empty() ? "" : "+"; names += NAMES[ii]; } }
+    return names.empty() ? "read only" : names;
+}
+
+/* runs the composition and its hand-written counterpart over the drive. Returns the first sample that differs, or the drive length. */
+template <uint32_t MASK>
+static size_t compare_imu_chain()
+{
+    std::vector<imu_outputs_t> expected(drive.size());
+    imu_reference<MASK> reference;
+    reset_globals();
+    for (drive_index = 0; drive_index < drive.size(); drive_index++)
+    {
+        reference.process();
+        expected[drive_index] = imu_outputs();
+    }
+
+    imu_chain<MASK> chain;
+    reset_globals();
+    for (drive_index = 0; drive_index < drive.size(); drive_index++)
+    {
+        chain.process(imu_sample);
+        imu_outputs_t outputs = imu_outputs();
+        if (memcmp(&outputs, &expected[drive_index], sizeof(outputs))) { return drive_index; }
+    }
+    return drive.size();
+}
+
+/* in ns per sample, composition and hand-written */
+template <uint32_t MASK>
+static void benchmark_imu_chain(uint32_t rounds, double_t* composed_ns, double_t* written_ns)
+{
+    imu_chain<MASK> chain;
+    reset_globals();
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++)
+    {
+        for (drive_index = 0; drive_index < drive.size(); drive_index++) { chain.process(imu_sample); }
+    }
+    *composed_ns = std::chrono::duration<double_t>(std::chrono::steady_clock::now() - start).count() * 1e9 / (double_t(rounds) * drive.size());
+
+    imu_reference<MASK> reference;
+    reset_globals();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++)
+    {
+        for (drive_index = 0; drive_index < drive.size(); drive_index++) { reference.process(); }
+    }
+    *written_ns = std::chrono::duration<double_t>(std::chrono::steady_clock::now() - start).count() * 1e9 / (double_t(rounds) * drive.size());
+}
+
+template <uint32_t MASK>
+static bool run_imu_combinations(uint32_t rounds)
+{
+    bool failed = false;
+    if constexpr (MASK < STAGE_COMBINATIONS)
+    {
+        size_t differs = compare_imu_chain<MASK>();
+        printf("imu %-56s %s", stage_names(MASK).c_str(), (differs == drive.size()) ? "same" : "DIFFERS");
+        if (differs != drive.size()) { printf(" at sample %zu", differs); failed = true; }
+        if (rounds)
+        {
+            double_t composed_ns, written_ns;
+            benchmark_imu_chain<MASK>(rounds, &composed_ns, &written_ns);
+            printf("  %6.2f ns composed, %6.2f ns by hand", composed_ns, written_ns);
+        }
+        printf("\n");
+        failed |= run_imu_combinations<MASK + 1>(rounds);
+    }
+    return failed;
+}
+
+/* the firmware chain with an ideal calibration has to follow the true speed of the drive */
+static bool run_physics()
+{
+    static const double_t TOLERANCE = 0.05;    /* in m/s, the learned bias does not cancel the noise exactly */
+    imu_chain<STAGE_FIRMWARE, calibration_ideal, calibration_ideal> chain;
+    reset_globals();
+    double_t largest_error = 0.0, top_speed = 0.0;
+    for (drive_index = 0; drive_index < drive.size(); drive_index++)
+    {
+        chain.process(imu_sample);
+        largest_error = std::fmax(largest_error, std::fabs(speed - drive[drive_index].true_speed));
+        top_speed     = std::fmax(top_speed, drive[drive_index].true_speed);
+    }
+    bool passed = (largest_error < TOLERANCE) && (speed == 0.0);
+    printf("physics: top speed %.3f m/s, largest error %.4f m/s, end speed %.3f m/s, %s\n", top_speed, largest_error, speed, passed ? "passed" : "FAILED");
+    return !passed;
+}
+
+/* ###################################################
+IR chains
+################################################### */
+
+#define TAPE_WIDTH 20e-3   /* same as ir_sensors.h */
+constexpr double_t IR_TAPE_WIDTH = TAPE_WIDTH;
+const double_t CAL_LEFT[]  = { 2.47510363770948, -1.03939098433124 };
+const double_t CAL_RIGHT[] = { 2.27465000160550, -0.928610854146550 };
+
+struct ir_sample_t
+{
+    unsigned long left_passing_time, right_passing_time;
+    double_t      left_speed, right_speed, left_speed_trackbased, right_speed_trackbased, speed;
+};
+
+static double_t clamp_value_smaller(double_t value, double_t threshold)
+{
+    return (value < threshold) ? threshold : value;
+}
+
+/* update_ir_speeds() and the speed overwrite of ir_sensor_process_task before the pipeline */
+static void ir_reference(ir_sample_t& sample, bool calibrated, bool trackbased)
+{
+    if (calibrated)
+    {
+        sample.left_speed  = CAL_LEFT[0] * TAPE_WIDTH * 1.0e6 / sample.left_passing_time + CAL_LEFT[1];
+        sample.right_speed = CAL_RIGHT[0] * TAPE_WIDTH * 1.0e6 / sample.right_passing_time + CAL_RIGHT[1];
+        sample.left_speed  = clamp_value_smaller(sample.left_speed, 0.0);
+        sample.right_speed = clamp_value_smaller(sample.right_speed, 0.0);
+    }
+    else
+    {
+        sample.left_speed  = TAPE_WIDTH * 1.0e6 / sample.left_passing_time;
+        sample.right_speed = TAPE_WIDTH * 1.0e6 / sample.right_passing_time;
+    }
+    if (trackbased) { sample.speed = (sample.left_speed_trackbased + sample.right_speed_trackbased) / 2; }
+    else            { sample.speed = (sample.left_speed + sample.right_speed) / 2; }
+}
+
+template <typename Chain>
+static uint32_t compare_ir_chain(bool calibrated, bool trackbased, uint32_t samples, std::mt19937& rng)
+{
+    Chain    chain;
+    uint32_t differences = 0;
+    for (uint32_t ii = 0; ii < samples; ii++)
+    {
+        ir_sample_t sample;
+        sample.left_passing_time      = 500 + rng() % 200000;   /* up to the speeds the calibration offset makes negative */
+        sample.right_passing_time     = 500 + rng() % 200000;
+        sample.left_speed_trackbased  = (rng() % 4000) / 1000.0;
+        sample.right_speed_trackbased = (rng() % 4000) / 1000.0;
+        sample.left_speed = sample.right_speed = sample.speed = -1.0;
+        ir_sample_t expected = sample;
+        ir_reference(expected, calibrated, trackbased);
+        chain.process(sample);
+        if (memcmp(&sample, &expected, sizeof(sample))) { differences++; }
+    }
+    return differences;
+}
+
+static bool run_ir(uint32_t samples, std::mt19937& rng)
+{
+    uint32_t differences[4] = {
+        compare_ir_chain<sensor_pipeline<tape_speed<IR_TAPE_WIDTH>, ir_speed_fusion>>(false, false, samples, rng),
+        compare_ir_chain<sensor_pipeline<tape_speed<IR_TAPE_WIDTH>, trackbased_speed_fusion>>(false, true, samples, rng),
+        compare_ir_chain<sensor_pipeline<calibrated_tape_speed<IR_TAPE_WIDTH, CAL_LEFT, CAL_RIGHT>, ir_speed_fusion>>(true, false, samples, rng),
+        compare_ir_chain<sensor_pipeline<calibrated_tape_speed<IR_TAPE_WIDTH, CAL_LEFT, CAL_RIGHT>, trackbased_speed_fusion>>(true, true, samples, rng) };
+    printf("ir: %u marks per chain, differences: tape %u, tape+trackbased %u, calibrated %u, calibrated+trackbased %u\n",
+        samples, differences[0], differences[1], differences[2], differences[3]);
+    return differences[0] || differences[1] || differences[2] || differences[3];
+}
+
+/* ###################################################
+Log rows
+################################################### */
+
+struct test_record_t
+{
+    unsigned long timestamp;
+    long          difference;
+    double_t      value;
+    int16_t       raw;
+};
+
+struct test_time_column       { static constexpr const char* NAME = "Time";       static int    value(const test_record_t& record) { return (int)record.timestamp; } };
+struct test_difference_column { static constexpr const char* NAME = "Difference"; static long   value(const test_record_t& record) { return record.difference; } };
+struct test_value_column      { static constexpr const char* NAME = "Value";      static double value(const test_record_t& record) { return record.value; } };
+struct test_raw_column        { static constexpr const char* NAME = "Raw";        static int    value(const test_record_t& record) { return record.raw; } };
+typedef log_format<test_time_column, test_difference_column, test_value_column, test_raw_column> test_format;
+
+static bool run_log(uint32_t samples, std::mt19937& rng)
+{
+    bool failed = false;
+    char row[128], expected[128];
+
+    size_t length = test_format::header(row, sizeof(row));
+    if (strcmp(row, "Time\tDifference\tValue\tRaw\n") || (length != strlen(row))) { failed = true; }
+
+    std::uniform_real_distribution<double_t> values(-1e6, 1e6);
+    uint32_t differences = 0;
+    for (uint32_t ii = 0; ii < samples; ii++)
+    {
+        test_record_t record = { (unsigned long)rng(), long(int32_t(rng())), values(rng), int16_t(rng()) };
+        snprintf(expected, sizeof(expected), "%d\t%ld\t%lf\t%d\n", (int)record.timestamp, record.difference, record.value, (int)record.raw);
+        length = test_format::row(row, sizeof(row), record);
+        if (strcmp(row, expected) || (length != strlen(expected))) { differences++; }
+    }
+
+    /* cut off, still a line */
+    test_record_t record = { 123456789, -987654321, 3.5, -7 };
+    std::vector<char> short_row(16);
+    length = test_format::row(short_row.data(), short_row.size(), record);
+    bool cut_ok = (length == short_row.size() - 1) && (strlen(short_row.data()) == length) && (short_row[length - 1] == '\n');
+
+    printf("log: %u rows, %u differences, header %s, cut off row %s\n", samples, differences, failed ? "DIFFERS" : "same", cut_ok ? "ok" : "BROKEN");
+    return failed || differences || !cut_ok;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t samples = 20000;
+    uint32_t seed    = 1;
+    uint32_t rounds  = 0;
+    const host_test_option_t options[] =
+    {
+        { "--samples",      "N",        &samples,   NULL },
+        { "--seed",         "S",        &seed,      NULL },
+        { "--benchmark",    "ROUNDS",   &rounds,    NULL },
+    };
+    if (!host_test_parse(argc, argv, options)) { return 2; }
+    if (samples < DRIVE_RACE_SAMPLES) { samples = DRIVE_RACE_SAMPLES; }
+
+    std::mt19937 rng(seed);
+    make_drive(samples, seed);
+    bool failed = false;
+
+    failed |= run_imu_combinations<0>(rounds);
+    failed |= run_physics();
+    failed |= run_ir(samples, rng);
+    failed |= run_log(samples, rng);
+
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,323 @@
+/*
+Host test of the setpoint delivery between the sensorcar and the controller emulator, with the duplicate suppression
+of the controller emulator (setpoint_filter.cpp) compiled unchanged from the firmware sources.
+
+The sensorcar is modelled like wireless_transmission.cpp of the sensorcar does it: a new setpoint every controller
+cycle with the next sequence number, the pending one sent again every SETPOINT_ACK_TIMEOUT_MS until it is acknowledged
+or its latency budget is used up, and a new random session number with sequence numbers starting over at every boot.
+The controller emulator runs every received setpoint through setpoint_filter, writes the DAC and acknowledges like
+setpoint_task. The radio loses, delays, reorders and duplicates packets.
+
+Every run checks:
+- an ack only ever answers a setpoint that was written to the DAC
+- within a boot of the sensorcar, the DAC never goes back to an older setpoint
+- the first setpoint the controller emulator gets after a reboot of the sensorcar is written to the DAC, whatever its sequence number
+- after a quiet period the DAC holds the last setpoint of the sensorcar
+Scenarios:
+- reboot:   the sensorcar reboots after 1 to 40 setpoints, so its new sequence numbers fall on the last one,
+            into the reorder window behind it and ahead of it. Without the session number these were acked unapplied or dropped.
+- random:   lossy radio with jitter, duplicates and reboots at random times
+One in 65536 reboots draws the session number of the boot before, in the firmware as well as here. Those are counted and
+not checked for the first setpoint.
+
+Build (Linux):
+    g++ -std=c++17 -O2 -fsanitize=address,undefined -I../common -I../../controller_emulator_status_monitor/include setpoint_delivery.cpp ../../controller_emulator_status_monitor/src/setpoint_filter.cpp -o setpoint_delivery
+Usage:
+    ./setpoint_delivery [--runs N] [--seed S] [--verbose]
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "host_test.h"
+#include "setpoint_filter.h"
+
+/* as in wireless_transmission.h of the sensorcar */
+#define SETPOINT_ACK_TIMEOUT_MS     4
+#define SETPOINT_LATENCY_BUDGET_MS  20
+
+#define CONTROLLER_PERIOD_US        10000   /* a new setpoint every controller cycle */
+#define QUIET_PERIOD_US             100000  /* no loss and no reboot at the end of a run */
+
+#define EVENT_SETPOINT              0       /* car -> bridge */
+#define EVENT_ACK                   1       /* bridge -> car */
+#define EVENT_CONTROLLER            2       /* car: next setpoint */
+#define EVENT_RETRANSMIT            3       /* car: ack timeout */
+#define EVENT_REBOOT                4       /* car: off now, boots after the delay in the event */
+
+struct packet_t
+{
+    uint16_t session;
+    uint8_t  sequence;
+    uint8_t  speed_digital;
+    uint64_t id;                /* not sent by the firmware: unique number of the setpoint, for the checks */
+    uint32_t boot;              /* not sent by the firmware: boot of the sensorcar that sent it */
+};
+
+struct event_t
+{
+    uint64_t time_us;
+    uint64_t order;
+    uint8_t  kind;
+    uint32_t generation;        /* of the car when a timer was started, timers of an older boot or setpoint are void */
+    packet_t packet;
+    bool operator>(const event_t& other) const { return (time_us != other.time_us) ? (time_us > other.time_us) : (order > other.order); }
+};
+
+struct radio_t
+{
+    double   loss;
+    double   duplicate;         /* probability that a delivered packet arrives twice */
+    uint32_t latency_us;
+    uint32_t jitter_us;         /* uniform on top, more than SETPOINT_ACK_TIMEOUT_MS reorders retransmissions */
+};
+
+struct car_t
+{
+    bool     powered      = true;
+    uint32_t boot         = 0;
+    uint32_t generation   = 0;
+    uint16_t session      = 0;
+    uint8_t  sequence     = 0;
+    uint64_t next_id      = 1;
+    bool     awaiting_ack = false;
+    uint64_t first_send_us = 0;
+    packet_t pending      = {};
+};
+
+struct bridge_t
+{
+    setpoint_filter_t filter          = { false, 0, 0 };
+    uint8_t           dac             = 0;
+    uint64_t          dac_id          = 0;      /* setpoint in the DAC */
+    uint32_t          dac_boot        = 0;
+    std::set<uint64_t> applied;
+    uint32_t          last_boot_heard    = 0;
+    uint16_t          last_session_heard = 0;
+    bool              any_heard          = false;
+};
+
+struct simulation_t
+{
+    std::mt19937    rng;
+    radio_t         radio        = { 0.0, 0.0, 900, 600 };
+    uint64_t        now_us       = 0;
+    uint64_t        order        = 0;
+    std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> events;
+    car_t           car;
+    bridge_t        bridge;
+    uint8_t         last_speed   = 0;   /* last setpoint of the car */
+    bool            controller   = true;
+    uint32_t        failures     = 0;
+    uint32_t        collisions   = 0;   /* reboots that drew the session of the boot before */
+    bool            verbose      = false;
+
+    explicit simulation_t(uint32_t seed) : rng(seed)
+    {
+        car.session = uint16_t(rng());
+    }
+
+    void schedule(event_t event, uint64_t delay_us)
+    {
+        event.time_us = now_us + delay_us;
+        event.order   = order++;
+        events.push(event);
+    }
+
+    bool chance(double probability) { return std::uniform_real_distribution<double>(0.0, 1.0)(rng) < probability; }
+
+    void fail(const char* what)
+    {
+        failures++;
+        if (verbose) { printf("    %10.3f ms: %s\n", now_us / 1000.0, what); }
+    }
+
+    void transmit(uint8_t kind, const packet_t& packet)
+    {
+        if (chance(radio.loss)) { return; }
+        uint8_t copies = chance(radio.duplicate) ? 2 : 1;
+        for (uint8_t copy = 0; copy < copies; copy++)
+        {
+            uint32_t latency = radio.latency_us + uint32_t(std::uniform_real_distribution<double>(0.0, 1.0)(rng) * radio.jitter_us);
+            schedule({ 0, 0, kind, 0, packet }, latency);
+        }
+    }
+
+    /* send_data_wirelessly of the sensorcar */
+    void car_send(uint8_t speed_digital)
+    {
+        car.sequence     += 1;
+        car.pending       = { car.session, car.sequence, speed_digital, car.next_id++, car.boot };
+        car.awaiting_ack  = true;
+        car.first_send_us = now_us;
+        car.generation++;
+        last_speed = speed_digital;
+        transmit(EVENT_SETPOINT, car.pending);
+        schedule({ 0, 0, EVENT_RETRANSMIT, car.generation, {} }, SETPOINT_ACK_TIMEOUT_MS * 1000);
+    }
+
+    void car_reboot(uint64_t off_us)
+    {
+        car.powered = false;
+        car.generation++;
+        schedule({ 0, 0, EVENT_REBOOT, car.generation, {} }, off_us);
+    }
+
+    /* setpoint_task of the controller emulator */
+    void bridge_receive(const packet_t& packet)
+    {
+        bool first_of_boot = !bridge.any_heard || (packet.boot != bridge.last_boot_heard);
+        bool collision     = bridge.any_heard && (packet.session == bridge.last_session_heard);
+        bridge.any_heard          = true;
+        bridge.last_boot_heard    = packet.boot;
+        bridge.last_session_heard = packet.session;
+
+        uint8_t verdict = setpoint_filter(&bridge.filter, packet.session, packet.sequence);
+        if (first_of_boot && !collision && (verdict != SETPOINT_APPLY)) { fail("first setpoint after a reboot not applied"); }
+        if (verdict == SETPOINT_DROP) { return; }
+        if (verdict == SETPOINT_APPLY)
+        {
+            if ((packet.boot == bridge.dac_boot) && (packet.id < bridge.dac_id)) { fail("DAC went back to an older setpoint"); }
+            bridge.dac      = packet.speed_digital;
+            bridge.dac_id   = packet.id;
+            bridge.dac_boot = packet.boot;
+            bridge.applied.insert(packet.id);
+        }
+        transmit(EVENT_ACK, packet);
+    }
+
+    /* on_setpoint_ack of the sensorcar, the ack only carries the sequence number */
+    void car_receive_ack(const packet_t& packet)
+    {
+        if (!car.powered || !car.awaiting_ack || (packet.sequence != car.pending.sequence)) { return; }
+        if (!bridge.applied.count(car.pending.id)) { fail("ack for a setpoint that never reached the DAC"); }
+        car.awaiting_ack = false;
+    }
+
+    void process(const event_t& event)
+    {
+        switch (event.kind)
+        {
+            case EVENT_SETPOINT:
+                bridge_receive(event.packet);
+                break;
+            case EVENT_ACK:
+                car_receive_ack(event.packet);
+                break;
+            case EVENT_CONTROLLER:
+                if (!controller) { break; }
+                if (car.powered) { car_send(uint8_t(rng() % 256)); }
+                schedule({ 0, 0, EVENT_CONTROLLER, 0, {} }, CONTROLLER_PERIOD_US);
+                break;
+            case EVENT_RETRANSMIT:
+                if (!car.powered || (event.generation != car.generation) || !car.awaiting_ack) { break; }
+                if ((now_us - car.first_send_us) >= SETPOINT_LATENCY_BUDGET_MS * 1000) { car.awaiting_ack = false; break; }
+                transmit(EVENT_SETPOINT, car.pending);
+                schedule({ 0, 0, EVENT_RETRANSMIT, car.generation, {} }, SETPOINT_ACK_TIMEOUT_MS * 1000);
+                break;
+            case EVENT_REBOOT:
+            {
+                if (event.generation != car.generation) { break; }
+                uint16_t old_session = car.session;
+                car.powered      = true;
+                car.boot        += 1;
+                car.session      = uint16_t(rng());     /* esp_random() */
+                car.sequence     = 0;
+                car.awaiting_ack = false;
+                if (car.session == old_session) { collisions++; }
+                break;
+            }
+        }
+    }
+
+    void run_until(uint64_t end_us)
+    {
+        while (!events.empty() && (events.top().time_us <= end_us))
+        {
+            event_t event = events.top();
+            events.pop();
+            now_us = event.time_us;
+            process(event);
+        }
+        now_us = end_us;
+    }
+
+    /* no loss and no reboot, then the controller stops and its last setpoint has to end up in the DAC */
+    void settle()
+    {
+        radio = { 0.0, 0.0, 900, 600 };
+        run_until(now_us + QUIET_PERIOD_US);
+        controller = false;
+        run_until(now_us + QUIET_PERIOD_US);
+        if (bridge.dac != last_speed) { fail("the DAC doesn't hold the last setpoint"); }
+    }
+};
+
+/* the sensorcar reboots after a number of setpoints and starts over with sequence number 1 */
+static bool scenario_reboot(uint32_t seed, bool verbose)
+{
+    simulation_t simulation(seed);
+    simulation.verbose = verbose;
+    uint32_t setpoints_before = 1 + seed % 40;
+    for (uint32_t setpoint = 0; setpoint < setpoints_before; setpoint++)
+    {
+        simulation.car_send(uint8_t(simulation.rng() % 256));
+        simulation.run_until(simulation.now_us + CONTROLLER_PERIOD_US);
+    }
+    simulation.car_reboot(200000);
+    simulation.run_until(simulation.now_us + 300000);
+    for (uint32_t setpoint = 0; setpoint < 20; setpoint++)
+    {
+        simulation.car_send(uint8_t(simulation.rng() % 256));
+        simulation.run_until(simulation.now_us + CONTROLLER_PERIOD_US);
+    }
+    simulation.settle();
+    if (verbose) { printf("    %u setpoints before the reboot, %u failures\n", setpoints_before, simulation.failures); }
+    return simulation.failures == 0;
+}
+
+/* lossy radio with jitter and duplicates, reboots at random times */
+static bool scenario_random(uint32_t seed, bool verbose)
+{
+    simulation_t simulation(seed);
+    simulation.verbose = verbose;
+    simulation.radio   = { 0.2, 0.05, 900, 8000 };
+    simulation.schedule({ 0, 0, EVENT_CONTROLLER, 0, {} }, 0);
+    for (uint32_t phase = 0; phase < 20; phase++)
+    {
+        uint64_t length_us = 50000 + simulation.rng() % 2000000;
+        simulation.run_until(simulation.now_us + length_us);
+        if (simulation.car.powered && simulation.chance(0.5)) { simulation.car_reboot(100000 + simulation.rng() % 300000); }  /* the ESP32 takes longer than that to boot */
+    }
+    simulation.run_until(simulation.now_us + 500000);     /* the last reboot is over */
+    simulation.settle();
+    if (verbose) { printf("    %u reboots, %u session collisions, %u failures\n", simulation.car.boot, simulation.collisions, simulation.failures); }
+    return simulation.failures == 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t runs    = 300;
+    uint32_t seed    = 1;
+    bool     verbose = false;
+    const host_test_option_t options[] =
+    {
+        { "--runs",     "N",    &runs,  NULL },
+        { "--seed",     "S",    &seed,  NULL },
+        { "--verbose",  NULL,   NULL,   &verbose },
+    };
+    if (!host_test_parse(argc, argv, options)) { return 2; }
+
+    const host_test_scenario_t scenarios[] =
+    {
+        { "reboot",     scenario_reboot },
+        { "random",     scenario_random },
+    };
+    return host_test_run(scenarios, runs, seed, verbose, 10) ? 1 : 0;
+}
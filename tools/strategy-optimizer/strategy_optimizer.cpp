@@ -0,0 +1,653 @@
+/*
+Host side search for the speed strategy of the sensorcar on a given track layout, replacing the grid search of
+system_simulation.m (tools/system-simulation). Same plant and the same constants:
+- PT1Tt element from commanded speed to car speed, dead time, time constant and gain (see plant_identification.h)
+- the car speed reached with each vdigi of AVAILABLE_VDIGI, vdigi_speed() fitted to available_speeds
+- maximum_trackpiece_speed: per piece type speed limit, the car derails above it times the tolerance factor
+- a new command every 75 ms (CONTROLLER_INTERVAL) at a random phase to the track position
+
+Each candidate strategy is driven for a number of laps in every scenario of a fixed Monte Carlo set.
+A scenario draws dead time, time constant and gain within --spread around the model and the phase of the controller clock.
+All candidates see the same scenarios, so differences in cost come from the strategy and not from the draw.
+The cost is the mean lap time without the standing start lap, plus a penalty for every scenario that derailed.
+Candidates are evaluated in parallel on all cores.
+
+Two searches:
+- type:  TARGET_TRACKPIECE_SPEED_DIGITAL and ALGORITHM_AVERAGE_NUMBER for ALGORITHM_AVERAGE, averaged in speed like the
+         firmware does with a speed characterization. Exhaustive if there are few piece types in the layout, genetic otherwise.
+- piece: one vdigi per track piece like ALGORITHM_LEARNING commands them. Genetic algorithm (tournament selection,
+         uniform crossover, mutation by one vdigi step, elitism) seeded with the type result, then coordinate descent.
+Both use the lookahead of controller_lookahead() in main.cpp with the model as identified plant.
+
+Piece lengths, legal vdigis and their speeds come from datalogger_sensorcar/include/track_tables.h, so both searches
+drive the tables the firmware is built with.
+
+The type search prints ALGORITHM_AVERAGE_NUMBER for globals.h and STRAIGHT_TARGET_SPEED and LATERAL_ACCELERATION_BUDGET
+for track_tables.h, which derives the vdigi per piece type from them. The piece search is also seeded with the table that
+commands exactly what the type result commands, so it can't end up slower than ALGORITHM_AVERAGE. It writes a header for
+datalogger_sensorcar/include/speed_table.h, ALGORITHM_LEARNING starts from it when the mapped layout is the same.
+A piece table that is still not better than the type result is not written.
+
+Build (Linux):
+    g++ -std=c++17 -O2 -pthread -I../../datalogger_sensorcar/include strategy_optimizer.cpp -o strategy_optimizer
+Usage:
+    ./strategy_optimizer [--track titan|chrome|vanadium|zero|"0 0 3 3 3 ..."] [--laps N] [--scenarios N] [--threads N]
+                         [--dead-time S] [--time-constant S] [--gain K] [--spread F] [--generations N] [--population N]
+                         [--seed S] [--output speed_table.h]
+Track pieces are the codes of track_data.h: 0 straight, 1 left inner, 2 left outer, 3 right inner, 4 right outer.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* piece codes of track_data.h, which needs the framework. track_tables.h is included by it after these. */
+#define TRACK_STRAIGHT                  0
+#define TRACK_CURVE_LEFT_INNER_TRACK    1
+#define TRACK_CURVE_LEFT_OUTER_TRACK    2
+#define TRACK_CURVE_RIGHT_INNER_TRACK   3
+#define TRACK_CURVE_RIGHT_OUTER_TRACK   4
+#define TRACK_PIECE_TYPES               5
+#define TRACK_MAX_PIECES                50
+#define ALGORITHM_AVERAGE_NUMBER        1       /* only the per type tables are used here */
+#include "track_tables.h"
+
+static const char*  const TRACK_PIECE_NAMES[]       = { "straight", "left inner", "left outer", "right inner", "right outer" };
+static const double MAXIMUM_TRACKPIECE_SPEED[]      = { 4.6, 2.32954, 2.58, 2.32954, 2.58 };   /* maximum_trackpiece_speed of system_simulation.m */
+static const int    NUMBER_LEVELS                   = NUMBER_AVAILABLE_VDIGI;
+static const int    LOWEST_LEVEL                    = 1;    /* LEARNING_MIN_VDIGI */
+static const int    HIGHEST_LEVEL                   = 12;   /* LEARNING_MAX_VDIGI */
+
+static const double SIMULATION_SAMPLING_TIME        = 1e-3;     /* in s */
+static const double CONTROLLER_PERIOD               = 75e-3;    /* in s */
+static const double SPEED_VIOLATION_TOLERANCE       = 1.02;
+static const double DERAILMENT_PENALTY              = 100.0;    /* in s of cost per derailed scenario share */
+static const int    AVERAGE_NUMBER_MAX              = 6;        /* AVERAGE_TABLE_MAX_SIZE of track_tables.h */
+
+struct track_t
+{
+    std::vector<int>    geometry;
+    std::vector<double> piece_end;  /* distance from the finish line to the end of every piece */
+    double              length;
+};
+
+struct scenario_t
+{
+    int    dead_time_samples;
+    double feedback_factor;         /* T1/(T1+dt) */
+    double input_factor;            /* K*dt/(T1+dt) */
+    double clock_phase;             /* in s, time to the first controller tick */
+};
+
+struct model_t
+{
+    double dead_time     = 0.1;     /* dead_time_maximum of system_simulation.m */
+    double time_constant = 0.4;
+    double gain          = 1.0;
+};
+
+/* vdigi level to command when the car is on a piece, given the level commanded last */
+typedef std::function<int(int piece, int previous_level)> strategy_t;
+
+struct evaluation_t
+{
+    double cost;
+    double lap_time_mean;
+    double lap_time_standard;
+    double derailment_share;
+};
+
+/* car speed of a level, what track_tables.h assumes for its vdigi */
+static double level_speed(int level)
+{
+    return vdigi_speed(AVAILABLE_VDIGI[level]);
+}
+
+static double lane_radius(int type)
+{
+    if (type == TRACK_STRAIGHT) { return 0.0; }
+    return ((type == TRACK_CURVE_LEFT_INNER_TRACK) || (type == TRACK_CURVE_RIGHT_INNER_TRACK)) ? TRACK_INNER_LANE_RADIUS : TRACK_OUTER_LANE_RADIUS;
+}
+
+static track_t make_track(const std::vector<int>& geometry)
+{
+    track_t track;
+    track.geometry = geometry;
+    track.length   = 0.0;
+    for (int type : geometry)
+    {
+        track.length += TRACKPIECE_LENGTH[type];
+        track.piece_end.push_back(track.length);
+    }
+    return track;
+}
+
+static bool parse_track(const std::string& text, std::vector<int>& geometry)
+{
+    /* layouts of system_simulation.m, curve_right_inner is 3 here */
+    if (text == "titan")    { geometry = { 0, 0, 3, 3, 3, 0, 0, 0, 3, 3, 3, 0 }; return true; }
+    if (text == "zero")     { geometry = { 0, 3, 3, 3, 0, 3, 3, 3 }; return true; }
+    if (text == "vanadium") { geometry = { 0, 0, 3, 0, 3, 3, 0, 0, 3, 0, 3, 3 }; return true; }
+    if (text == "chrome")   { geometry = { 0, 3, 0, 3, 0, 3, 0, 3, 0, 3, 0, 3 }; return true; }
+
+    std::istringstream stream(text);
+    int type;
+    geometry.clear();
+    while (stream >> type)
+    {
+        if ((type < 0) || (type >= TRACK_PIECE_TYPES)) { return false; }
+        geometry.push_back(type);
+    }
+    return (geometry.size() >= 2) && (geometry.size() <= TRACK_MAX_PIECES);
+}
+
+static std::vector<scenario_t> make_scenarios(const model_t& model, double spread, int number_scenarios, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<scenario_t> scenarios;
+    for (int ii = 0; ii < number_scenarios; ii++)
+    {
+        double dead_time     = model.dead_time     * (1.0 + spread * (2.0 * unit(rng) - 1.0));
+        double time_constant = model.time_constant * (1.0 + spread * (2.0 * unit(rng) - 1.0));
+        double gain          = model.gain          * (1.0 + spread * (2.0 * unit(rng) - 1.0));
+        scenario_t scenario;
+        scenario.dead_time_samples = std::max(0, int(std::ceil(dead_time / SIMULATION_SAMPLING_TIME)));
+        scenario.feedback_factor   = time_constant / (time_constant + SIMULATION_SAMPLING_TIME);
+        scenario.input_factor      = gain * SIMULATION_SAMPLING_TIME / (time_constant + SIMULATION_SAMPLING_TIME);
+        scenario.clock_phase       = CONTROLLER_PERIOD * unit(rng);
+        scenarios.push_back(scenario);
+    }
+    return scenarios;
+}
+
+/*
+Drives the laps of one scenario, see simulate_system() in system_simulation.m.
+Returns false if the car derailed or got stuck. Lap times of all laps after the standing start are appended.
+*/
+static bool simulate(const track_t& track, const scenario_t& scenario, const strategy_t& strategy, int laps, std::vector<double>& lap_times)
+{
+    const int number_pieces = track.geometry.size();
+    std::vector<double> delay_line(scenario.dead_time_samples + 1, 0.0);    /* commanded speeds, oldest first out */
+    size_t delay_index = 0;
+
+    double speed         = 0.0;
+    double distance      = TRACKPIECE_LENGTH[track.geometry[0]] / 2;    /* start in the middle of the first piece */
+    int    piece         = 0;
+    int    level         = 0;
+    double clock         = CONTROLLER_PERIOD - scenario.clock_phase;
+    int    lap           = 0;
+    long   step          = 0;
+    long   lap_start     = 0;
+    const long step_limit = long(laps * 60.0 / SIMULATION_SAMPLING_TIME);
+
+    while (lap < laps)
+    {
+        if (++step > step_limit) { return false; }
+
+        clock += SIMULATION_SAMPLING_TIME;
+        if (clock >= CONTROLLER_PERIOD)
+        {
+            clock -= CONTROLLER_PERIOD;
+            level  = strategy(piece, level);
+        }
+
+        delay_line[delay_index] = level_speed(level);
+        delay_index = (delay_index + 1) % delay_line.size();
+        double delayed_command = delay_line[delay_index];
+
+        double previous_speed = speed;
+        speed     = scenario.feedback_factor * speed + scenario.input_factor * delayed_command;
+        distance += (speed + previous_speed) / 2 * SIMULATION_SAMPLING_TIME;
+
+        if (distance >= track.length)
+        {
+            distance -= track.length;
+            piece     = 0;
+            if (lap > 0) { lap_times.push_back((step - lap_start) * SIMULATION_SAMPLING_TIME); }
+            lap_start = step;
+            lap++;
+        }
+        while ((piece < number_pieces - 1) && (distance >= track.piece_end[piece])) { piece++; }
+
+        if (speed > MAXIMUM_TRACKPIECE_SPEED[track.geometry[piece]] * SPEED_VIOLATION_TOLERANCE) { return false; }
+    }
+    return true;
+}
+
+static evaluation_t evaluate(const track_t& track, const std::vector<scenario_t>& scenarios, const strategy_t& strategy, int laps)
+{
+    std::vector<double> lap_times;
+    int derailments = 0;
+    for (const scenario_t& scenario : scenarios)
+    {
+        if (!simulate(track, scenario, strategy, laps, lap_times)) { derailments++; }
+    }
+
+    evaluation_t evaluation;
+    evaluation.derailment_share  = double(derailments) / scenarios.size();
+    evaluation.lap_time_mean     = 0.0;
+    evaluation.lap_time_standard = 0.0;
+    if (!lap_times.empty())
+    {
+        for (double lap_time : lap_times) { evaluation.lap_time_mean += lap_time; }
+        evaluation.lap_time_mean /= lap_times.size();
+        for (double lap_time : lap_times) { evaluation.lap_time_standard += (lap_time - evaluation.lap_time_mean) * (lap_time - evaluation.lap_time_mean); }
+        evaluation.lap_time_standard = std::sqrt(evaluation.lap_time_standard / lap_times.size());
+    }
+    evaluation.cost = (lap_times.empty() ? DERAILMENT_PENALTY : evaluation.lap_time_mean) + DERAILMENT_PENALTY * evaluation.derailment_share;
+    return evaluation;
+}
+
+/* evaluates all candidates on all cores */
+static std::vector<evaluation_t> evaluate_all(const std::vector<strategy_t>& strategies, const track_t& track, const std::vector<scenario_t>& scenarios, int laps, int number_threads)
+{
+    std::vector<evaluation_t> evaluations(strategies.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int thread = 0; thread < number_threads; thread++)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t ii = next++; ii < strategies.size(); ii = next++) { evaluations[ii] = evaluate(track, scenarios, strategies[ii], laps); }
+        });
+    }
+    for (std::thread& worker : workers) { worker.join(); }
+    return evaluations;
+}
+
+/* level whose speed is closest to a speed, like closest_vdigi_for_speed() */
+static int level_for_speed(double speed)
+{
+    int closest = 0;
+    for (int level = 1; level < NUMBER_LEVELS; level++)
+    {
+        if (std::abs(level_speed(level) - speed) < std::abs(level_speed(closest) - speed)) { closest = level; }
+    }
+    return closest;
+}
+
+/* controller_lookahead() of main.cpp with the model as identified plant */
+static int lookahead(const model_t& model, int previous_level, int number_pieces)
+{
+    double distance = level_speed(previous_level) * (model.dead_time + model.time_constant);
+    return std::min(1 + int(distance / TRACKPIECE_LENGTH[0]), number_pieces - 1);
+}
+
+/* level ALGORITHM_AVERAGE commands for the pieces starting at first, genome of the type search */
+static int average_level(const std::vector<int>& genome, const track_t& track, int first)
+{
+    const int number_pieces  = track.geometry.size();
+    const int average_number = genome[TRACK_PIECE_TYPES];
+    double speed_sum = 0.0;
+    for (int ii = 0; ii < average_number; ii++) { speed_sum += level_speed(genome[track.geometry[(first + ii) % number_pieces]]); }
+    return level_for_speed(speed_sum / average_number);
+}
+
+/* genome of the type search: a level per piece type, then ALGORITHM_AVERAGE_NUMBER */
+static strategy_t type_strategy(const std::vector<int>& genome, const track_t& track, const model_t& model)
+{
+    return [genome, &track, model](int piece, int previous_level)
+    {
+        const int number_pieces = track.geometry.size();
+        return average_level(genome, track, (piece + lookahead(model, previous_level, number_pieces)) % number_pieces);
+    };
+}
+
+/* genome of the piece search: a level per track piece, like learning_algorithm() */
+static strategy_t piece_strategy(const std::vector<int>& genome, const track_t& track, const model_t& model)
+{
+    return [genome, &track, model](int piece, int previous_level)
+    {
+        const int number_pieces = track.geometry.size();
+        return genome[(piece + lookahead(model, previous_level, number_pieces)) % number_pieces];
+    };
+}
+
+struct search_t
+{
+    const track_t*                  track;
+    const std::vector<scenario_t>*  scenarios;
+    const model_t*                  model;
+    int                             laps;
+    int                             threads;
+    std::function<strategy_t(const std::vector<int>&)> make_strategy;
+};
+
+static std::vector<evaluation_t> evaluate_genomes(const search_t& search, const std::vector<std::vector<int>>& genomes)
+{
+    std::vector<strategy_t> strategies;
+    for (const std::vector<int>& genome : genomes) { strategies.push_back(search.make_strategy(genome)); }
+    return evaluate_all(strategies, *search.track, *search.scenarios, search.laps, search.threads);
+}
+
+/*
+Genetic algorithm over integer genes within [lower, upper] per gene.
+The seeds are part of the first generation, the rest of it are mutations of them.
+*/
+static std::vector<int> genetic_search(const search_t& search, const std::vector<std::vector<int>>& seeds, const std::vector<int>& lower, const std::vector<int>& upper,
+                                       int population_size, int generations, std::mt19937& rng, evaluation_t* best_evaluation)
+{
+    const int number_genes = lower.size();
+    const int elite        = std::max(2, population_size / 16);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    auto mutate = [&](std::vector<int>& genome, double rate)
+    {
+        for (int gene = 0; gene < number_genes; gene++)
+        {
+            if (unit(rng) >= rate) { continue; }
+            genome[gene] = std::clamp(genome[gene] + ((unit(rng) < 0.5) ? -1 : 1), lower[gene], upper[gene]);
+        }
+    };
+
+    std::vector<std::vector<int>> population = seeds;
+    while ((int)population.size() < population_size)
+    {
+        std::vector<int> genome = seeds[rng() % seeds.size()];
+        mutate(genome, 3.0 / number_genes);
+        population.push_back(genome);
+    }
+
+    std::vector<evaluation_t> evaluations = evaluate_genomes(search, population);
+    for (int generation = 0; generation < generations; generation++)
+    {
+        std::vector<int> order(population.size());
+        for (size_t ii = 0; ii < order.size(); ii++) { order[ii] = ii; }
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return evaluations[a].cost < evaluations[b].cost; });
+
+        auto tournament = [&]() -> const std::vector<int>&
+        {
+            int winner = rng() % population.size();
+            for (int round = 0; round < 2; round++)
+            {
+                int challenger = rng() % population.size();
+                if (evaluations[challenger].cost < evaluations[winner].cost) { winner = challenger; }
+            }
+            return population[winner];
+        };
+
+        std::vector<std::vector<int>> next_population;
+        std::vector<evaluation_t>     next_evaluations;
+        for (int ii = 0; ii < elite; ii++)
+        {
+            next_population.push_back(population[order[ii]]);
+            next_evaluations.push_back(evaluations[order[ii]]);
+        }
+        std::vector<std::vector<int>> children;
+        while ((int)(next_population.size() + children.size()) < population_size)
+        {
+            const std::vector<int>& mother = tournament();
+            const std::vector<int>& father = tournament();
+            std::vector<int> child(number_genes);
+            for (int gene = 0; gene < number_genes; gene++) { child[gene] = (unit(rng) < 0.5) ? mother[gene] : father[gene]; }
+            mutate(child, 1.5 / number_genes);
+            children.push_back(child);
+        }
+        std::vector<evaluation_t> child_evaluations = evaluate_genomes(search, children);
+        next_population.insert(next_population.end(), children.begin(), children.end());
+        next_evaluations.insert(next_evaluations.end(), child_evaluations.begin(), child_evaluations.end());
+        population  = next_population;
+        evaluations = next_evaluations;
+
+        if ((generation % 10 == 0) || (generation == generations - 1))
+        {
+            auto best = std::min_element(evaluations.begin(), evaluations.end(), [](const evaluation_t& a, const evaluation_t& b) { return a.cost < b.cost; });
+            fprintf(stderr, "  generation %3d: best cost %.4f\n", generation, best->cost);
+        }
+    }
+
+    size_t best = std::min_element(evaluations.begin(), evaluations.end(), [](const evaluation_t& a, const evaluation_t& b) { return a.cost < b.cost; }) - evaluations.begin();
+    *best_evaluation = evaluations[best];
+    return population[best];
+}
+
+/* raises or lowers one gene at a time by one step while that lowers the cost */
+static std::vector<int> coordinate_descent(const search_t& search, std::vector<int> genome, const std::vector<int>& lower, const std::vector<int>& upper, evaluation_t* evaluation)
+{
+    bool improved = true;
+    while (improved)
+    {
+        improved = false;
+        std::vector<std::vector<int>> neighbours;
+        for (size_t gene = 0; gene < genome.size(); gene++)
+        {
+            for (int direction : { -1, 1 })
+            {
+                std::vector<int> neighbour = genome;
+                neighbour[gene] += direction;
+                if ((neighbour[gene] >= lower[gene]) && (neighbour[gene] <= upper[gene])) { neighbours.push_back(neighbour); }
+            }
+        }
+        std::vector<evaluation_t> evaluations = evaluate_genomes(search, neighbours);
+        for (size_t ii = 0; ii < neighbours.size(); ii++)
+        {
+            if (evaluations[ii].cost < evaluation->cost - 1e-9)
+            {
+                *evaluation = evaluations[ii];
+                genome      = neighbours[ii];
+                improved    = true;
+            }
+        }
+    }
+    return genome;
+}
+
+/* all combinations of the levels of the piece types in the layout and the average number */
+static std::vector<int> exhaustive_type_search(const search_t& search, const std::vector<int>& types_present, evaluation_t* best_evaluation)
+{
+    std::vector<std::vector<int>> genomes;
+    std::vector<int> genome(TRACK_PIECE_TYPES + 1, LOWEST_LEVEL);
+    std::function<void(size_t)> enumerate = [&](size_t index)
+    {
+        if (index == types_present.size())
+        {
+            for (int average_number = 1; average_number <= AVERAGE_NUMBER_MAX; average_number++)
+            {
+                genome[TRACK_PIECE_TYPES] = average_number;
+                genomes.push_back(genome);
+            }
+            return;
+        }
+        for (int level = LOWEST_LEVEL; level <= HIGHEST_LEVEL; level++)
+        {
+            genome[types_present[index]] = level;
+            enumerate(index + 1);
+        }
+    };
+    enumerate(0);
+
+    std::vector<evaluation_t> evaluations = evaluate_genomes(search, genomes);
+    size_t best = std::min_element(evaluations.begin(), evaluations.end(), [](const evaluation_t& a, const evaluation_t& b) { return a.cost < b.cost; }) - evaluations.begin();
+    *best_evaluation = evaluations[best];
+    fprintf(stderr, "  %zu combinations\n", genomes.size());
+    return genomes[best];
+}
+
+static void print_evaluation(const char* name, const evaluation_t& evaluation)
+{
+    printf("%s: lap time %.4f s +- %.4f s, derailed in %.1f%% of the scenarios\n", name, evaluation.lap_time_mean, evaluation.lap_time_standard, 100.0 * evaluation.derailment_share);
+}
+
+/*
+Prints the type result in the parameters of track_tables.h. It takes the fastest vdigi whose speed is at most the target speed,
+so a level is reproduced by any target from its speed up to the speed of the next level. For the curves that is a range of
+LATERAL_ACCELERATION_BUDGET per lane radius, the ranges of all curves in the layout have to overlap for one budget.
+*/
+static void print_track_tables(const std::vector<int>& genome, const std::vector<int>& types_present)
+{
+    double budget_lower = 0.0;
+    double budget_upper = INFINITY;
+    bool   any_curve    = false;
+    for (int type : types_present)
+    {
+        int    level       = genome[type];
+        double speed       = level_speed(level);
+        double speed_next  = (level + 1 < NUMBER_LEVELS) ? level_speed(level + 1) : INFINITY;
+        printf("  %-12s vdigi %d (%.3f m/s, limit %.3f m/s", TRACK_PIECE_NAMES[type], AVAILABLE_VDIGI[level], speed, MAXIMUM_TRACKPIECE_SPEED[type]);
+        if (type == TRACK_STRAIGHT)
+        {
+            printf(")\n");
+            continue;
+        }
+        double radius = lane_radius(type);
+        printf(", lateral acceleration %.1f m/s^2)\n", speed * speed / radius);
+        budget_lower = std::max(budget_lower, speed * speed / radius);
+        budget_upper = std::min(budget_upper, speed_next * speed_next / radius);
+        any_curve    = true;
+    }
+
+    if (std::find(types_present.begin(), types_present.end(), TRACK_STRAIGHT) != types_present.end())
+    {
+        printf("  track_tables.h: #define STRAIGHT_TARGET_SPEED           %.3f\n", std::ceil(level_speed(genome[TRACK_STRAIGHT]) * 1000.0) / 1000.0);
+    }
+    if (!any_curve) { return; }
+    double budget = std::ceil(budget_lower * 10.0) / 10.0;
+    if (budget >= budget_upper) { budget = std::ceil(budget_lower * 1000.0) / 1000.0; }
+    if (budget < budget_upper)
+    {
+        printf("  track_tables.h: #define LATERAL_ACCELERATION_BUDGET     %g\n", budget);
+    }
+    else
+    {
+        printf("  track_tables.h: no single LATERAL_ACCELERATION_BUDGET gives these vdigis on all curves of the layout\n");
+    }
+}
+
+static bool write_speed_table(const char* path, const track_t& track, const std::vector<int>& genome, const evaluation_t& evaluation, const model_t& model, int number_scenarios)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) { return false; }
+    fprintf(file, "#pragma once\n#include \"track_data.h\"\n\n");
+    fprintf(file, "/*\nPer track piece speeds optimized for one layout by tools/strategy-optimizer, which overwrites this file.\n");
+    fprintf(file, "ALGORITHM_LEARNING starts from them instead of TARGET_TRACKPIECE_SPEED_DIGITAL if the mapped layout is SPEED_TABLE_TRACK_GEOMETRY.\n");
+    fprintf(file, "Without a table for the layout, SPEED_TABLE_NUMBER_PIECES is 0.\n\n");
+    fprintf(file, "Model: dead time %.3f s, time constant %.3f s, gain %.3f, %d scenarios.\n", model.dead_time, model.time_constant, model.gain, number_scenarios);
+    fprintf(file, "Predicted lap time %.4f s +- %.4f s, derailed in %.1f%% of the scenarios.\n*/\n\n", evaluation.lap_time_mean, evaluation.lap_time_standard, 100.0 * evaluation.derailment_share);
+    fprintf(file, "#define SPEED_TABLE_NUMBER_PIECES       %zu\n\n", track.geometry.size());
+    fprintf(file, "const uint8_t SPEED_TABLE_TRACK_GEOMETRY[TRACK_MAX_PIECES]  = {");
+    for (size_t piece = 0; piece < track.geometry.size(); piece++) { fprintf(file, "%s %d", piece ? "," : "", track.geometry[piece]); }
+    fprintf(file, " };\nconst uint8_t SPEED_TABLE_SPEED_DIGITAL[TRACK_MAX_PIECES]   = {");
+    for (size_t piece = 0; piece < genome.size(); piece++) { fprintf(file, "%s %d", piece ? "," : "", AVAILABLE_VDIGI[genome[piece]]); }
+    fprintf(file, " };\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::string track_text   = "titan";
+    std::string output_path  = "speed_table.h";
+    model_t     model;
+    double      spread       = 0.1;
+    int         laps         = 5;
+    int         scenarios    = 200;
+    int         population   = 64;
+    int         generations  = 60;
+    int         threads      = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t    seed         = 1;
+
+    for (int ii = 1; ii < argc; ii++)
+    {
+        std::string argument = argv[ii];
+        bool has_value = (ii + 1 < argc);
+        if      ((argument == "--track")         && has_value) { track_text          = argv[++ii]; }
+        else if ((argument == "--output")        && has_value) { output_path         = argv[++ii]; }
+        else if ((argument == "--dead-time")     && has_value) { model.dead_time     = atof(argv[++ii]); }
+        else if ((argument == "--time-constant") && has_value) { model.time_constant = atof(argv[++ii]); }
+        else if ((argument == "--gain")          && has_value) { model.gain          = atof(argv[++ii]); }
+        else if ((argument == "--spread")        && has_value) { spread              = atof(argv[++ii]); }
+        else if ((argument == "--laps")          && has_value) { laps                = std::max(2, atoi(argv[++ii])); }
+        else if ((argument == "--scenarios")     && has_value) { scenarios           = std::max(1, atoi(argv[++ii])); }
+        else if ((argument == "--population")    && has_value) { population          = std::max(8, atoi(argv[++ii])); }
+        else if ((argument == "--generations")   && has_value) { generations         = std::max(1, atoi(argv[++ii])); }
+        else if ((argument == "--threads")       && has_value) { threads             = std::max(1, atoi(argv[++ii])); }
+        else if ((argument == "--seed")          && has_value) { seed                = strtoul(argv[++ii], NULL, 10); }
+        else
+        {
+            fprintf(stderr, "unknown argument %s, see the comment at the top of strategy_optimizer.cpp\n", argument.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<int> geometry;
+    if (!parse_track(track_text, geometry))
+    {
+        fprintf(stderr, "invalid track \"%s\"\n", track_text.c_str());
+        return 2;
+    }
+    track_t track = make_track(geometry);
+    std::vector<scenario_t> scenario_set = make_scenarios(model, spread, scenarios, seed);
+    std::mt19937 rng(seed);
+
+    printf("track: %zu pieces, %.3f m, %d laps in %d scenarios per candidate on %d threads\n", geometry.size(), track.length, laps, scenarios, threads);
+
+    /* type search */
+    std::vector<int> types_present;
+    for (int type = 0; type < TRACK_PIECE_TYPES; type++)
+    {
+        if (std::find(geometry.begin(), geometry.end(), type) != geometry.end()) { types_present.push_back(type); }
+    }
+    search_t search = { &track, &scenario_set, &model, laps, threads, nullptr };
+    search.make_strategy = [&](const std::vector<int>& genome) { return type_strategy(genome, track, model); };
+
+    fprintf(stderr, "type search\n");
+    evaluation_t     type_evaluation;
+    std::vector<int> type_genome;
+    if (types_present.size() <= 3)
+    {
+        type_genome = exhaustive_type_search(search, types_present, &type_evaluation);
+    }
+    else
+    {
+        std::vector<int> lower(TRACK_PIECE_TYPES + 1, LOWEST_LEVEL), upper(TRACK_PIECE_TYPES + 1, HIGHEST_LEVEL);
+        lower[TRACK_PIECE_TYPES] = 1;
+        upper[TRACK_PIECE_TYPES] = AVERAGE_NUMBER_MAX;
+        std::vector<int> seed_genome = { 8, 5, 6, 5, 6, 5 };    /* the firmware defaults */
+        type_genome = genetic_search(search, { seed_genome }, lower, upper, population, generations, rng, &type_evaluation);
+    }
+    print_evaluation("type", type_evaluation);
+    printf("  globals.h:      #define ALGORITHM_AVERAGE_NUMBER   %d\n", type_genome[TRACK_PIECE_TYPES]);
+    print_track_tables(type_genome, types_present);
+
+    /*
+    piece search, seeded with the slowest safe table and with what the type result commands. Both strategies command the entry
+    at the same lookahead, so a table with the average of the pieces from every piece on drives exactly like the type result.
+    */
+    search.make_strategy = [&](const std::vector<int>& genome) { return piece_strategy(genome, track, model); };
+    std::vector<int> seed_from_types(geometry.size());
+    for (size_t piece = 0; piece < geometry.size(); piece++) { seed_from_types[piece] = std::clamp(average_level(type_genome, track, piece), LOWEST_LEVEL, HIGHEST_LEVEL); }
+    std::vector<int> seed_slow(geometry.size(), level_for_speed(*std::min_element(MAXIMUM_TRACKPIECE_SPEED, MAXIMUM_TRACKPIECE_SPEED + TRACK_PIECE_TYPES) * 0.7));
+    std::vector<int> lower(geometry.size(), LOWEST_LEVEL), upper(geometry.size(), HIGHEST_LEVEL);
+
+    fprintf(stderr, "piece search\n");
+    evaluation_t     piece_evaluation;
+    std::vector<int> piece_genome = genetic_search(search, { seed_from_types, seed_slow }, lower, upper, population, generations, rng, &piece_evaluation);
+    piece_genome = coordinate_descent(search, piece_genome, lower, upper, &piece_evaluation);
+    print_evaluation("piece", piece_evaluation);
+    printf("  vdigi per piece:");
+    for (int level : piece_genome) { printf(" %d", AVAILABLE_VDIGI[level]); }
+    printf("\n");
+
+    if (piece_evaluation.cost >= type_evaluation.cost)
+    {
+        printf("the piece table is not faster than the type result, %s not written. Use ALGORITHM_AVERAGE with the values above.\n", output_path.c_str());
+        return 1;
+    }
+    if (!write_speed_table(output_path.c_str(), track, piece_genome, piece_evaluation, model, scenarios))
+    {
+        fprintf(stderr, "could not write %s\n", output_path.c_str());
+        return 1;
+    }
+    printf("written to %s, copy it to datalogger_sensorcar/include/speed_table.h\n", output_path.c_str());
+    return 0;
+}